@@ -13,6 +13,9 @@ typedef enum {
     InputFileIOError,
     MissingDumpCfgArg,
     MissingDumpIrArg,
+    MissingDumpOccupancyArg,
+    MissingDumpShdbArg,
+    MissingCacheArg,
     IncorrectLogLevel = 16,
     InvalidTarget,
     ClangInvocationFailed,
@@ -23,6 +26,7 @@ typedef enum {
     SrcSlim,
     SrcSPIRV,
     SrcLLVM,
+    SrcShadyBinary,
 } SourceLanguage;
 
 SourceLanguage guess_source_language(const char* filename);
@@ -57,6 +61,10 @@ typedef struct {
     const char* shd_output_filename;
     const char* cfg_output_filename;
     const char* loop_tree_output_filename;
+    const char* occupancy_output_filename;
+    const char* shdb_output_filename;
+    /// SPIR-V compilations go through the cache when its path is set
+    CompilationCacheConfig cache;
 } DriverConfig;
 
 DriverConfig default_driver_config();
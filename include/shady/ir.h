@@ -253,6 +253,15 @@ const Node* bind_last_instruction_and_wrap_in_block(BodyBuilder*, const Node*);
 
 //////////////////////////////// Compilation ////////////////////////////////
 
+typedef enum {
+    /// Keeps switches whose keys are dense enough, and otherwise builds decision trees around dense clusters of keys
+    SwitchLoweringDensity,
+    /// Always keeps switches as-is
+    SwitchLoweringNative,
+    /// Always turns switches into decision trees
+    SwitchLoweringBTree,
+} SwitchLoweringPolicy;
+
 struct CompilerConfig_ {
     bool dynamic_scheduling;
     uint32_t per_thread_stack_size;
@@ -265,9 +274,19 @@ struct CompilerConfig_ {
     struct {
         bool emulate_subgroup_ops;
         bool emulate_subgroup_ops_extended_types;
+        /// Targets without shuffles exchange values through a table in subgroup memory
+        bool emulate_subgroup_shuffles;
+        /// Targets without OpGroupNonUniformPartitionNV build partitions out of one ballot per bit of the partitioned value
+        bool emulate_subgroup_partition;
         bool simt_to_explicit_simd;
+        /// C only: compute entry points run a single workgroup, whose ID they take as arguments, and private variables
+        /// are thread-local, so the host can dispatch workgroups on as many threads as it likes
+        bool host_dispatched_workgroups;
         bool int64;
         bool decay_ptrs;
+        /// Width of the words backing emulated private memory, suitably aligned accesses use whole words at once
+        IntSizes emulated_private_memory_word_size;
+        SwitchLoweringPolicy switch_lowering;
     } lower;
 
     struct {
@@ -281,6 +300,24 @@ struct CompilerConfig_ {
             bool after_every_pass;
             bool delete_unused_instructions;
         } cleanup;
+        /// Gives each entry point its own dispatcher, only containing the functions it can reach
+        bool per_entry_point_dispatchers;
+        /// Splits diverging threads in the scheduler with a single subgroup_partition, instead of one destination at a time
+        bool partitioned_forks;
+        struct {
+            /// Loops with a constant trip count are fully unrolled if that costs at most this many instructions
+            size_t full_unroll_budget;
+            /// Other loops get unrolled by this factor, as long as that fits in the budget too (1 disables it)
+            size_t partial_unroll_factor;
+        } unroll;
+        struct {
+            /// Strips unused types, constants and decorations from the emitted module and renumbers its IDs without gaps
+            bool compact;
+            /// Also drops the debug names, implies compact
+            bool strip_names;
+            /// Emits the function bodies on that many threads, the module is the same no matter how many (0 or 1 stays on the calling thread)
+            size_t emission_threads;
+        } spirv;
     } optimisations;
 
     struct {
@@ -320,7 +357,12 @@ CompilationResult run_compiler_passes(CompilerConfig* config, Module** mod);
 
 //////////////////////////////// Emission ////////////////////////////////
 
+/// Receives emitted code one piece at a time, in order. The data is only valid for the duration of the call.
+typedef void (*EmitterSink)(void* uptr, size_t size, const char* data);
+
 void emit_spirv(CompilerConfig* config, Module*, size_t* output_size, char** output, Module** new_mod);
+/// Like emit_spirv, but the sections of the module are streamed into the sink as they are, without being merged first
+void emit_spirv_into(CompilerConfig* config, Module*, EmitterSink sink, void* uptr, Module** new_mod);
 
 typedef enum {
     C,
@@ -336,10 +378,58 @@ typedef struct {
 
 void emit_c(CompilerConfig compiler_config, CEmitterConfig emitter_config, Module*, size_t* output_size, char** output, Module** new_mod);
 
+//////////////////////////////// Compilation cache ////////////////////////////////
+
+/// On-disk cache of SPIR-V compilation results, addressed by the contents of the input module and the configuration
+typedef struct CompilationCache_ CompilationCache;
+
+typedef struct {
+    /// Directory holding the entries, it is created if it does not exist yet
+    String path;
+    /// The least recently used entries are evicted when there are more than this many of them, 0 means no limit
+    size_t max_entries;
+    /// Same, for the total size of the entries in bytes
+    size_t max_size;
+} CompilationCacheConfig;
+
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t stores;
+    size_t evictions;
+} CompilationCacheStats;
+
+typedef struct {
+    uint32_t words[4];
+} CompilationCacheKey;
+
+CompilationCacheConfig default_compilation_cache_config();
+CompilationCache* open_compilation_cache(CompilationCacheConfig);
+void close_compilation_cache(CompilationCache*);
+CompilationCacheStats get_compilation_cache_stats(const CompilationCache*);
+
+/// Hashes the module, along with the arena and compiler settings that can change what it compiles to. Compiler hooks
+/// are not part of the key, and do not run on a hit.
+CompilationCacheKey compute_compilation_cache_key(const CompilerConfig*, Module*);
+/// Same as compute_compilation_cache_key, for a module already serialized with serialize_module from an arena with these settings
+CompilationCacheKey compute_compilation_cache_key_from_data(const CompilerConfig*, ArenaConfig, size_t module_size, const char* module_data);
+/// On a hit, returns the SPIR-V and, if final_mod is not NULL, the module it was emitted from (in a new arena).
+/// An entry that was stored without its module is a miss when the module is asked for.
+bool lookup_compilation_cache(CompilationCache*, CompilationCacheKey, size_t* spirv_size, char** spirv, Module** final_mod);
+/// final_mod is optional
+void store_in_compilation_cache(CompilationCache*, CompilationCacheKey, size_t spirv_size, const char* spirv, Module* final_mod);
+
 void dump_cfg(FILE* file, Module*);
 void dump_loop_trees(FILE* output, Module* mod);
+/// Writes a JSON estimate of the register pressure of every function and of the memory footprint of the module
+void dump_occupancy_report(FILE* output, Module* mod);
 void dump_module(Module*);
 void print_module_into_str(Module*, char** str_ptr, size_t*);
+/// Writes the module in the binary .shdb format, which can be read back without parsing
+void serialize_module(Module*, size_t* size, char** output);
+/// Reads a .shdb module into an existing one. The arena needs the same name_bound and check_types settings as the
+/// one the module was written from. Returns false if the data is not a valid .shdb module.
+bool deserialize_module(Module*, size_t size, const char* data);
 void dump_node(const Node* node);
 
 #endif
@@ -9,6 +9,10 @@ typedef struct {
     bool use_validation;
     bool dump_spv;
     bool allow_no_devices;
+    /// Specialized programs are compiled through an on-disk cache in that directory, if set
+    const char* compilation_cache_dir;
+    /// The CPU backend dispatches workgroups on that many host threads, one per core if 0
+    size_t cpu_threads;
 } RuntimeConfig;
 
 typedef struct Runtime_  Runtime;
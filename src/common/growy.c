@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <assert.h>
 
 static size_t init_size = 4096;
 
@@ -31,6 +32,19 @@ void growy_append_bytes(Growy* g, size_t s, const char* bytes) {
     memcpy(g->buffer + old_used, bytes, s);
 }
 
+char* growy_reserve(Growy* g, size_t s) {
+    while (g->used + s >= g->size) {
+        g->size *= 2;
+        g->buffer = realloc(g->buffer, g->size);
+    }
+    return g->buffer + g->used;
+}
+
+void growy_commit(Growy* g, size_t s) {
+    assert(g->used + s < g->size);
+    g->used += s;
+}
+
 void growy_append_string(Growy* g, const char* str) {
     size_t len = strlen(str);
     growy_append_bytes(g, len, str);
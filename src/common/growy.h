@@ -13,6 +13,10 @@ void growy_append_string(Growy*, const char*);
 void growy_append_formatted(Growy* g, const char* str, ...);
 #define growy_append_string_literal(a, v) growy_append_bytes(a, sizeof(v) - 1, (char*) &v)
 #define growy_append_object(a, v) growy_append_bytes(a, sizeof(v), (char*) &v)
+/// Makes room for at least that many more bytes and returns where they go, without counting them as used yet.
+char* growy_reserve(Growy*, size_t);
+/// Counts that many bytes written past the end (after growy_reserve) as used.
+void growy_commit(Growy*, size_t);
 size_t growy_size(const Growy*);
 char* growy_data(const Growy*);
 void destroy_growy(Growy*g);
@@ -21,6 +21,8 @@ struct Printer_ {
         Growy* growy;
     };
     int indent;
+    /// set after a newline, the indentation is written once there's something else to print
+    bool pending_indent;
 };
 
 Printer* open_file_as_printer(void* f) {
@@ -42,13 +44,43 @@ void destroy_printer(Printer* p) {
 }
 
 static void print_bare(Printer* p, size_t len, const char* str) {
-    assert(strlen(str) >= len);
     switch(p->output) {
         case PoFile: fwrite(str, sizeof(char), len, p->file); break;
         case PoGrowy: growy_append_bytes(p->growy, len, str);
     }
 }
 
+static const char spaces[] = "                                                                ";
+
+static void print_pending_indent(Printer* p) {
+    if (!p->pending_indent)
+        return;
+    p->pending_indent = false;
+    size_t len = p->indent * 4;
+    while (len > 0) {
+        size_t chunk = len < sizeof(spaces) - 1 ? len : sizeof(spaces) - 1;
+        print_bare(p, chunk, spaces);
+        len -= chunk;
+    }
+}
+
+/// Prints text that may contain newlines, indenting whatever comes after each one.
+static void print_text(Printer* p, size_t len, const char* str) {
+    while (len > 0) {
+        const char* nl = memchr(str, '\n', len);
+        size_t line = nl ? (size_t) (nl - str) : len;
+        if (line > 0) {
+            print_pending_indent(p);
+            print_bare(p, line, str);
+        }
+        if (!nl)
+            return;
+        newline(p);
+        str += line + 1;
+        len -= line + 1;
+    }
+}
+
 void flush(Printer* p) {
     switch(p->output) {
         case PoFile: fflush(p->file); break;
@@ -65,68 +97,120 @@ void deindent(Printer* p) {
 }
 
 void newline(Printer* p) {
+    // the indentation is only written once something actually goes on the line, so empty lines stay empty
     print_bare(p, 1, "\n");
-    for (int i = 0; i < p->indent; i++)
-        print_bare(p, 4, "    ");
+    p->pending_indent = true;
 }
 
-#define LOCAL_BUFFER_SIZE 32
-
-Printer* print(Printer* p, const char* f, ...) {
-    size_t len = strlen(f) + 1;
-    if (len == 1)
-        return p;
-
-    // allocate a bit more to have space for formatting
-    size_t bufsize = (len + 1) + len / 2;
+static void print_unsigned(Printer* p, unsigned long long value, bool negative) {
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* digits = end;
+    do {
+        *--digits = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+    if (negative)
+        *--digits = '-';
+    print_pending_indent(p);
+    print_bare(p, end - digits, digits);
+}
 
-    char buf[LOCAL_BUFFER_SIZE];
-    char* alloc = NULL;
-
-    // points to either the contents of buf, or alloc, depending on bufsize
-    char* tmp;
-    size_t written;
-
-    while(true) {
-        if (bufsize <= LOCAL_BUFFER_SIZE) {
-            bufsize = LOCAL_BUFFER_SIZE;
-            tmp = buf;
-        } else {
-            if (!alloc)
-                tmp = alloc = malloc(bufsize);
-            else
-                tmp = alloc = realloc(alloc, bufsize);
+/// Formats that only use these conversions (by far the most common ones) are handled without going through vsnprintf
+static bool is_simple_format(const char* f) {
+    while ((f = strchr(f, '%'))) {
+        switch (f[1]) {
+            case 's': case 'd': case 'u': case '%': f += 2; break;
+            case 'z': if (f[2] == 'u') { f += 3; break; } return false;
+            default: return false;
         }
+    }
+    return true;
+}
 
-        tmp[bufsize - 1] = '?';
-
-        va_list l;
-        va_start(l, f);
-        written = vsnprintf(tmp, bufsize, f, l);
-        va_end(l);
+static void print_simple(Printer* p, const char* f, va_list l) {
+    while (*f) {
+        const char* spec = strchr(f, '%');
+        size_t literal = spec ? (size_t) (spec - f) : strlen(f);
+        print_text(p, literal, f);
+        if (!spec)
+            return;
+        switch (spec[1]) {
+            case 's': {
+                const char* str = va_arg(l, const char*);
+                print_text(p, strlen(str), str);
+                break;
+            }
+            case 'd': {
+                int i = va_arg(l, int);
+                print_unsigned(p, i < 0 ? -(unsigned long long) i : (unsigned long long) i, i < 0);
+                break;
+            }
+            case 'u': print_unsigned(p, va_arg(l, unsigned), false); break;
+            case 'z': print_unsigned(p, va_arg(l, size_t), false); spec++; break;
+            case '%': print_text(p, 1, "%"); break;
+            default: assert(false);
+        }
+        f = spec + 2;
+    }
+}
 
-        if (written < bufsize)
-            break;
+#define LOCAL_BUFFER_SIZE 256
 
-        // increase buffer size and try again
-        bufsize *= 2;
+/// Anything fancier goes through vsnprintf, straight into the end of the growy when possible
+static void print_formatted(Printer* p, const char* f, va_list l) {
+    char buf[LOCAL_BUFFER_SIZE];
+    char* tmp = buf;
+    size_t bufsize = LOCAL_BUFFER_SIZE;
+    if (p->output == PoGrowy)
+        tmp = growy_reserve(p->growy, bufsize);
+
+    va_list copy;
+    va_copy(copy, l);
+    size_t written = vsnprintf(tmp, bufsize, f, l);
+    if (written >= bufsize) {
+        bufsize = written + 1;
+        tmp = p->output == PoGrowy ? growy_reserve(p->growy, bufsize) : malloc(bufsize);
+        vsnprintf(tmp, bufsize, f, copy);
     }
-
-    size_t start = 0;
-    size_t i = 0;
-    while(i < written) {
-        if (tmp[i] == '\n') {
-            print_bare(p, i - start, &tmp[start]);
-            newline(p);
-            start = i + 1;
+    va_end(copy);
+
+    if (p->output == PoGrowy) {
+        if (!memchr(tmp, '\n', written)) {
+            if (p->pending_indent && p->indent > 0 && written > 0) {
+                // shift what we just wrote over to make room for the indentation
+                size_t indentation = p->indent * 4;
+                tmp = growy_reserve(p->growy, written + indentation);
+                memmove(tmp + indentation, tmp, written);
+                memset(tmp, ' ', indentation);
+                written += indentation;
+            }
+            if (written > 0)
+                p->pending_indent = false;
+            growy_commit(p->growy, written);
+            return;
         }
-        i++;
+        // the text needs indenting after each newline, take it out of the growy first
+        char* copy_out = malloc(written);
+        memcpy(copy_out, tmp, written);
+        print_text(p, written, copy_out);
+        free(copy_out);
+        return;
     }
 
-    if (start < i)
-        print_bare(p, i - start, &tmp[start]);
+    print_text(p, written, tmp);
+    if (tmp != buf)
+        free(tmp);
+}
 
-    free(alloc);
+Printer* print(Printer* p, const char* f, ...) {
+    va_list l;
+    va_start(l, f);
+    if (is_simple_format(f))
+        print_simple(p, f, l);
+    else
+        print_formatted(p, f, l);
+    va_end(l);
     return p;
 }
 
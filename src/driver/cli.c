@@ -90,6 +90,18 @@ void cli_parse_compiler_config_args(CompilerConfig* config, int* pargc, char** a
             continue;
         if (strcmp(argv[i], "--no-dynamic-scheduling") == 0) {
             config->dynamic_scheduling = false;
+        } else if (strcmp(argv[i], "--per-entry-point-dispatchers") == 0) {
+            config->optimisations.per_entry_point_dispatchers = true;
+        } else if (strcmp(argv[i], "--emulate-subgroup-ops") == 0) {
+            config->lower.emulate_subgroup_ops = true;
+        } else if (strcmp(argv[i], "--emulate-subgroup-shuffles") == 0) {
+            config->lower.emulate_subgroup_shuffles = true;
+        } else if (strcmp(argv[i], "--emulate-int64") == 0) {
+            config->lower.int64 = true;
+        } else if (strcmp(argv[i], "--native-subgroup-partition") == 0) {
+            config->lower.emulate_subgroup_partition = false;
+        } else if (strcmp(argv[i], "--partitioned-forks") == 0) {
+            config->optimisations.partitioned_forks = true;
         } else if (strcmp(argv[i], "--lift-join-points") == 0) {
             config->hacks.force_join_point_lifting = true;
         } else if (strcmp(argv[i], "--entry-point") == 0) {
@@ -116,6 +128,53 @@ void cli_parse_compiler_config_args(CompilerConfig* config, int* pargc, char** a
             if (em == EmNone)
                 error("Unknown execution model: %s", argv[i]);
             config->specialization.execution_model = em;
+        } else if (strcmp(argv[i], "--private-memory-word-size") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc)
+                error("Missing word size");
+            switch (atoi(argv[i])) {
+                case 8: config->lower.emulated_private_memory_word_size = IntTy8; break;
+                case 16: config->lower.emulated_private_memory_word_size = IntTy16; break;
+                case 32: config->lower.emulated_private_memory_word_size = IntTy32; break;
+                case 64: config->lower.emulated_private_memory_word_size = IntTy64; break;
+                default: error("Word size must be one of 8, 16, 32 or 64, got: %s", argv[i]);
+            }
+        } else if (strcmp(argv[i], "--switch-lowering") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc)
+                error("Missing switch lowering policy");
+            if (strcmp(argv[i], "density") == 0)
+                config->lower.switch_lowering = SwitchLoweringDensity;
+            else if (strcmp(argv[i], "native") == 0)
+                config->lower.switch_lowering = SwitchLoweringNative;
+            else if (strcmp(argv[i], "btree") == 0)
+                config->lower.switch_lowering = SwitchLoweringBTree;
+            else
+                error("Switch lowering policy must be one of density, native or btree, got: %s", argv[i]);
+        } else if (strcmp(argv[i], "--unroll-budget") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc)
+                error("Missing unroll budget");
+            config->optimisations.unroll.full_unroll_budget = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--unroll-factor") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc)
+                error("Missing unroll factor");
+            config->optimisations.unroll.partial_unroll_factor = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--compact-spirv") == 0) {
+            config->optimisations.spirv.compact = true;
+        } else if (strcmp(argv[i], "--strip-spirv-names") == 0) {
+            config->optimisations.spirv.strip_names = true;
+        } else if (strcmp(argv[i], "--spirv-emission-threads") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc)
+                error("Missing thread count");
+            config->optimisations.spirv.emission_threads = atoi(argv[i]);
         } else if (strcmp(argv[i], "--simt2d") == 0) {
             config->lower.simt_to_explicit_simd = true;
         } else if (strcmp(argv[i], "--print-internal") == 0) {
@@ -137,13 +196,26 @@ void cli_parse_compiler_config_args(CompilerConfig* config, int* pargc, char** a
         error_print("  --print-internal                          Includes internal functions in the debug output\n");
         error_print("  --print-generated                         Includes generated functions in the debug output\n");
         error_print("  --no-dynamic-scheduling                   Disable the built-in dynamic scheduler, restricts code to only leaf functions\n");
-        error_print("  --simt2d                                  Emits SIMD code instead of SIMT, only effective with the C backend.\n");
+        error_print("  --per-entry-point-dispatchers             Generates a dispatcher for each entry point, containing only the functions it can reach\n");
+        error_print("  --simt2d                                  Emits explicit SIMD code running whole subgroups at once, only effective with the C backend.\n");
         error_print("  --entry-point <foo>                       Selects an entry point for the program to be specialized on.\n");
 #define EM(name, _) #name", "
         error_print("  --execution-model <em>                   Selects an entry point for the program to be specialized on.\nPossible values: " EXECUTION_MODELS(EM));
 #undef EM
         error_print("  --subgroup-size N                         Sets the subgroup size the program will be specialized for.\n");
+        error_print("  --emulate-subgroup-ops                    Builds subgroup reductions and ballots out of shuffles.\n");
+        error_print("  --emulate-subgroup-shuffles               Exchanges values between lanes through subgroup memory instead of shuffles.\n");
+        error_print("  --emulate-int64                           Splits 64-bit integers into 32-bit halves, for targets without Int64.\n");
+        error_print("  --native-subgroup-partition               Uses OpGroupNonUniformPartitionNV instead of building partitions out of ballots.\n");
+        error_print("  --partitioned-forks                       Splits diverging threads in the scheduler in one step, instead of one destination at a time.\n");
         error_print("  --lift-join-points                        Forcefully lambda-lifts all join points. Can help with reconvergence issues.\n");
+        error_print("  --private-memory-word-size <8|16|32|64>   Sets the width of the words backing emulated private memory (defaults to 32).\n");
+        error_print("  --switch-lowering <density|native|btree>  Sets how switches are lowered (defaults to density, which is btree on C-like targets).\n");
+        error_print("  --unroll-budget N                         Fully unrolls loops with a constant trip count if that costs at most N instructions (defaults to 128).\n");
+        error_print("  --unroll-factor N                         Unrolls the other loops N times, within the same budget (defaults to 1, which disables it).\n");
+        error_print("  --compact-spirv                           Strips unused types, constants and decorations from the SPIR-V output and renumbers its IDs.\n");
+        error_print("  --strip-spirv-names                       Same as --compact-spirv, and also strips debug names.\n");
+        error_print("  --spirv-emission-threads N                Emits the SPIR-V function bodies on N threads, the output stays the same (defaults to 1).\n");
     }
 
     cli_pack_remaining_args(pargc, argv);
@@ -171,6 +243,7 @@ DriverConfig default_driver_config() {
         .output_filename = NULL,
         .cfg_output_filename = NULL,
         .shd_output_filename = NULL,
+        .cache = default_compilation_cache_config(),
     };
 }
 
@@ -207,6 +280,14 @@ void cli_parse_driver_arguments(DriverConfig* args, int* pargc, char** argv) {
                 exit(MissingDumpCfgArg);
             }
             args->loop_tree_output_filename = argv[i];
+        } else if (strcmp(argv[i], "--dump-occupancy") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc) {
+                error_print("--dump-occupancy must be followed with a filename");
+                exit(MissingDumpOccupancyArg);
+            }
+            args->occupancy_output_filename = argv[i];
         } else if (strcmp(argv[i], "--dump-ir") == 0) {
             argv[i] = NULL;
             i++;
@@ -215,6 +296,38 @@ void cli_parse_driver_arguments(DriverConfig* args, int* pargc, char** argv) {
                 exit(MissingDumpIrArg);
             }
             args->shd_output_filename = argv[i];
+        } else if (strcmp(argv[i], "--dump-shdb") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc) {
+                error_print("--dump-shdb must be followed with a filename");
+                exit(MissingDumpShdbArg);
+            }
+            args->shdb_output_filename = argv[i];
+        } else if (strcmp(argv[i], "--cache-dir") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc) {
+                error_print("--cache-dir must be followed with a directory");
+                exit(MissingCacheArg);
+            }
+            args->cache.path = argv[i];
+        } else if (strcmp(argv[i], "--cache-max-entries") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc) {
+                error_print("--cache-max-entries must be followed with a number");
+                exit(MissingCacheArg);
+            }
+            args->cache.max_entries = strtoull(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--cache-max-size") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc) {
+                error_print("--cache-max-size must be followed with a number of bytes");
+                exit(MissingCacheArg);
+            }
+            args->cache.max_size = strtoull(argv[i], NULL, 10);
         } else if (strcmp(argv[i], "--target") == 0) {
             argv[i] = NULL;
             i++;
@@ -252,6 +365,11 @@ void cli_parse_driver_arguments(DriverConfig* args, int* pargc, char** argv) {
         error_print("  --dump-cfg <filename>                     Dumps the control flow graph of the final IR\n");
         error_print("  --dump-loop-tree <filename>\n");
         error_print("  --dump-ir <filename>                      Dumps the final IR\n");
+        error_print("  --dump-shdb <filename>                    Dumps the input module, before any pass runs, in the binary .shdb format\n");
+        error_print("  --cache-dir <directory>                   Reuses SPIR-V compiled earlier from the same module and options, and stores new results there\n");
+        error_print("  --cache-max-entries <n>                   Evicts the least recently used cache entries past that many (0 for no limit)\n");
+        error_print("  --cache-max-size <bytes>                  Same, for the total size of the cache\n");
+        error_print("  --dump-occupancy <filename>               Dumps estimated register pressure and memory footprint of the final IR, as JSON\n");
     }
 
     cli_pack_remaining_args(pargc, argv);
@@ -31,6 +31,8 @@ SourceLanguage guess_source_language(const char* filename) {
         return SrcSlim;
     else if (string_ends_with(filename, ".slim"))
         return SrcShadyIR;
+    else if (string_ends_with(filename, ".shdb"))
+        return SrcShadyBinary;
 
     warn_print("unknown filename extension '%s', interpreting as Slim sourcecode by default.");
     return SrcSlim;
@@ -61,6 +63,12 @@ ShadyErrorCodes driver_load_source_file(SourceLanguage lang, size_t len, const c
             };
             debugv_print("Parsing: \n%s\n", file_contents);
             parse_shady_ir(pconfig, (const char*) file_contents, mod);
+            break;
+        }
+        case SrcShadyBinary: {
+            if (!deserialize_module(mod, len, file_contents))
+                return InputFileIOError;
+            break;
         }
     }
     return NoError;
@@ -70,7 +78,7 @@ ShadyErrorCodes driver_load_source_file_from_filename(const char* filename, Modu
     ShadyErrorCodes err;
     SourceLanguage lang = guess_source_language(filename);
     size_t len;
-    char* contents;
+    char* contents = NULL;
     assert(filename);
     bool ok = read_file(filename, &len, &contents);
     if (!ok) {
@@ -105,10 +113,51 @@ ShadyErrorCodes driver_load_source_files(DriverConfig* args, Module* mod) {
     return NoError;
 }
 
+static void write_to_file(FILE* f, size_t size, const char* data) {
+    fwrite(data, size, 1, f);
+}
+
 ShadyErrorCodes driver_compile(DriverConfig* args, Module* mod) {
     debugv_print("Parsed program successfully: \n");
     log_module(DEBUGV, &args->config, mod);
 
+    if (args->shdb_output_filename) {
+        FILE* f = fopen(args->shdb_output_filename, "wb");
+        assert(f);
+        size_t output_size;
+        char* output_buffer;
+        serialize_module(mod, &output_size, &output_buffer);
+        fwrite(output_buffer, output_size, 1, f);
+        free((void*) output_buffer);
+        fclose(f);
+        debug_print("Binary IR dumped\n");
+    }
+
+    if (args->output_filename && args->target == TgtAuto)
+        args->target = guess_target(args->output_filename);
+    // C-like targets emit matches as chains of ifs, they never have jump tables to keep
+    if (args->target != TgtAuto && args->target != TgtSPV && args->config.lower.switch_lowering == SwitchLoweringDensity)
+        args->config.lower.switch_lowering = SwitchLoweringBTree;
+
+    // the cache only holds SPIR-V, so it can't be used when anything else is wanted out of the final IR
+    CompilationCache* cache = NULL;
+    CompilationCacheKey cache_key;
+    bool cacheable = args->output_filename && args->target == TgtSPV && !args->cfg_output_filename && !args->loop_tree_output_filename && !args->occupancy_output_filename && !args->shd_output_filename;
+    if (args->cache.path && cacheable)
+        cache = open_compilation_cache(args->cache);
+    if (cache) {
+        cache_key = compute_compilation_cache_key(&args->config, mod);
+        size_t output_size;
+        char* output_buffer;
+        if (lookup_compilation_cache(cache, cache_key, &output_size, &output_buffer, NULL)) {
+            write_file(args->output_filename, output_size, output_buffer);
+            free(output_buffer);
+            debug_print("Wrote cached result to %s\n", args->output_filename);
+            close_compilation_cache(cache);
+            return NoError;
+        }
+    }
+
     CompilationResult result = run_compiler_passes(&args->config, &mod);
     if (result != CompilationNoError) {
         error_print("Compilation pipeline failed, errcode=%d\n", (int) result);
@@ -133,6 +182,14 @@ ShadyErrorCodes driver_compile(DriverConfig* args, Module* mod) {
         debug_print("Loop tree dumped\n");
     }
 
+    if (args->occupancy_output_filename) {
+        FILE* f = fopen(args->occupancy_output_filename, "wb");
+        assert(f);
+        dump_occupancy_report(f, mod);
+        fclose(f);
+        debug_print("Occupancy report dumped\n");
+    }
+
     if (args->shd_output_filename) {
         FILE* f = fopen(args->shd_output_filename, "wb");
         assert(f);
@@ -146,14 +203,19 @@ ShadyErrorCodes driver_compile(DriverConfig* args, Module* mod) {
     }
 
     if (args->output_filename) {
-        if (args->target == TgtAuto)
-            args->target = guess_target(args->output_filename);
         FILE* f = fopen(args->output_filename, "wb");
-        size_t output_size;
-        char* output_buffer;
+        size_t output_size = 0;
+        char* output_buffer = NULL;
         switch (args->target) {
             case TgtAuto: SHADY_UNREACHABLE;
-            case TgtSPV: emit_spirv(&args->config, mod, &output_size, &output_buffer, NULL); break;
+            // SPIR-V is written section by section, unless it needs to be assembled in memory for the cache
+            case TgtSPV:
+                if (cache) {
+                    emit_spirv(&args->config, mod, &output_size, &output_buffer, NULL);
+                    store_in_compilation_cache(cache, cache_key, output_size, output_buffer, NULL);
+                } else
+                    emit_spirv_into(&args->config, mod, (EmitterSink) write_to_file, f, NULL);
+                break;
             case TgtC:
                 args->c_emitter_config.dialect = C;
                 emit_c(args->config, args->c_emitter_config, mod, &output_size, &output_buffer, NULL);
@@ -168,10 +230,13 @@ ShadyErrorCodes driver_compile(DriverConfig* args, Module* mod) {
                 break;
         }
         debug_print("Wrote result to %s\n", args->output_filename);
-        fwrite(output_buffer, output_size, 1, f);
+        if (output_buffer)
+            fwrite(output_buffer, output_size, 1, f);
         free((void*) output_buffer);
         fclose(f);
     }
+    if (cache)
+        close_compilation_cache(cache);
     destroy_ir_arena(get_module_arena(mod));
     return NoError;
 }
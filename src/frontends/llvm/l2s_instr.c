@@ -113,6 +113,9 @@ EmittedInstr convert_instruction(Parser* p, Node* fn_or_bb, BodyBuilder* b, LLVM
             LARRAY(const Node*, targets, n_successors);
             for (size_t i = 0; i < n_successors; i++)
                 targets[i] = convert_basic_block(p, fn, LLVMGetSuccessor(instr, i));
+            LLVMValueRef loop = LLVMGetMetadata(instr, LLVMGetMDKindIDInContext(p->ctx, "llvm.loop", strlen("llvm.loop")));
+            if (loop)
+                convert_loop_metadata(p, fn, loop);
             if (LLVMIsConditional(instr)) {
                 assert(n_successors == 2);
                 const Node* condition = convert_value(p, LLVMGetCondition(instr));
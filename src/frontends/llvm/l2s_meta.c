@@ -161,3 +161,35 @@ LLVM_DI_METADATA_NODES(N)
             error_die();
     }
 }
+
+/// Turns the unrolling hints of a `llvm.loop` metadata node (what `#pragma unroll` becomes) into an @Unroll annotation.
+/// Our annotations live on declarations, so this applies to every loop in the function.
+void convert_loop_metadata(Parser* p, Node* fn, LLVMValueRef loop) {
+    IrArena* a = get_module_arena(p->dst);
+    unsigned count = LLVMGetMDNodeNumOperands(loop);
+    LARRAY(LLVMValueRef, ops, count);
+    LLVMGetMDNodeOperands(loop, ops);
+
+    // the first operand is the loop id itself, and not a hint
+    for (size_t i = 1; i < count; i++) {
+        if (!ops[i] || !LLVMIsAMDNode(ops[i]) || LLVMGetMDNodeNumOperands(ops[i]) == 0)
+            continue;
+        unsigned hint_count = LLVMGetMDNodeNumOperands(ops[i]);
+        LARRAY(LLVMValueRef, hint, hint_count);
+        LLVMGetMDNodeOperands(ops[i], hint);
+        if (!hint[0] || !LLVMIsAMDString(hint[0]))
+            continue;
+        unsigned l;
+        String name = LLVMGetMDString(hint[0], &l);
+        const Node* unroll = NULL;
+        // a bare `#pragma unroll` only enables unrolling, how much is still up to opt_unroll's budget
+        if (strcmp(name, "llvm.loop.unroll.full") == 0)
+            unroll = annotation(a, (Annotation) { .name = "Unroll" });
+        else if (strcmp(name, "llvm.loop.unroll.disable") == 0)
+            unroll = annotation_value(a, (AnnotationValue) { .name = "Unroll", .value = uint32_literal(a, 1) });
+        else if (strcmp(name, "llvm.loop.unroll.count") == 0 && hint_count == 2 && LLVMIsAConstantInt(hint[1]))
+            unroll = annotation_value(a, (AnnotationValue) { .name = "Unroll", .value = uint32_literal(a, LLVMConstIntGetZExtValue(hint[1])) });
+        if (unroll)
+            add_annotation(p, fn, (ParsedAnnotation) { .payload = unroll });
+    }
+}
@@ -42,6 +42,7 @@ const Node* convert_value(Parser* p, LLVMValueRef v);
 const Node* convert_function(Parser* p, LLVMValueRef fn);
 const Type* convert_type(Parser* p, LLVMTypeRef t);
 const Node* convert_metadata(Parser* p, LLVMMetadataRef meta);
+void convert_loop_metadata(Parser* p, Node* fn, LLVMValueRef loop);
 const Node* convert_global(Parser* p, LLVMValueRef global);
 const Node* convert_function(Parser* p, LLVMValueRef fn);
 const Node* convert_basic_block(Parser* p, Node* fn, LLVMBasicBlockRef bb);
@@ -0,0 +1,71 @@
+#include "cpu_runtime_private.h"
+
+#include "log.h"
+#include "list.h"
+#include "dict.h"
+#include "portability.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+static KeyHash hash_spec_program_key(CpuSpecProgramKey* ptr) {
+    return hash_murmur(ptr, sizeof(CpuSpecProgramKey));
+}
+
+static bool cmp_spec_program_keys(CpuSpecProgramKey* a, CpuSpecProgramKey* b) {
+    return memcmp(a, b, sizeof(CpuSpecProgramKey)) == 0;
+}
+
+static String get_cpu_device_name(SHADY_UNUSED CpuDevice* device) { return "CPU"; }
+
+static bool cpu_can_import_host_memory(SHADY_UNUSED CpuDevice* device) { return true; }
+
+void cpu_destroy_device(CpuDevice* device) {
+    cpu_stop_workers(device);
+    size_t i = 0;
+    CpuSpecProgramKey k;
+    CpuSpecProgram* sp;
+    while (dict_iter(device->specialized_programs, &i, &k, &sp))
+        cpu_destroy_specialized_program(sp);
+    destroy_dict(device->specialized_programs);
+    free(device);
+}
+
+CpuDevice* cpu_create_device(CpuBackend* backend) {
+    CpuDevice* device = calloc(1, sizeof(CpuDevice));
+    device->base = (Device) {
+        .cleanup = (void(*)(Device*)) cpu_destroy_device,
+        .get_name = (String(*)(Device*)) get_cpu_device_name,
+        .launch_kernel = (Command*(*)(Device*, Program*, String, int, int, int, int, void**)) cpu_launch_kernel,
+        .allocate_buffer = (Buffer*(*)(Device*, size_t)) cpu_allocate_buffer_device,
+        .import_host_memory_as_buffer = (Buffer*(*)(Device*, void*, size_t)) cpu_import_buffer_host,
+        .can_import_host_memory = (bool(*)(Device*)) cpu_can_import_host_memory,
+    };
+    device->backend = backend;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    device->threads_count = cores > 0 ? (size_t) cores : 1;
+    if (backend->base.runtime->config.cpu_threads > 0)
+        device->threads_count = backend->base.runtime->config.cpu_threads;
+    cpu_start_workers(device);
+    device->specialized_programs = new_dict(CpuSpecProgramKey, CpuSpecProgram*, (HashFn) hash_spec_program_key, (CmpFn) cmp_spec_program_keys);
+    return device;
+}
+
+static void shutdown_cpu_runtime(CpuBackend* backend) {
+    free(backend);
+}
+
+Backend* initialize_cpu_backend(Runtime* base) {
+    CpuBackend* backend = calloc(1, sizeof(CpuBackend));
+    backend->base = (Backend) {
+        .runtime = base,
+        .cleanup = (void(*)()) shutdown_cpu_runtime,
+    };
+
+    CpuDevice* device = cpu_create_device(backend);
+    append_list(Device*, base->devices, device);
+    info_print("Shady CPU backend successfully initialized, dispatching on %zu threads !\n", device->threads_count);
+    return &backend->base;
+}
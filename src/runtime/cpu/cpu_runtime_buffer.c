@@ -0,0 +1,63 @@
+#include "cpu_runtime_private.h"
+
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+static void cpu_destroy_buffer(CpuBuffer* buffer) {
+    if (!buffer->imported)
+        free(buffer->host_ptr);
+    free(buffer);
+}
+
+static void* cpu_get_buffer_host_ptr(CpuBuffer* buffer) {
+    return buffer->host_ptr;
+}
+
+static uint64_t cpu_get_buffer_device_ptr(CpuBuffer* buffer) {
+    return (uint64_t) (size_t) buffer->host_ptr;
+}
+
+static bool cpu_copy_to_buffer(CpuBuffer* dst, size_t buffer_offset, void* src, size_t size) {
+    if (buffer_offset + size > dst->size)
+        return false;
+    memcpy(dst->host_ptr + buffer_offset, src, size);
+    return true;
+}
+
+static bool cpu_copy_from_buffer(CpuBuffer* src, size_t buffer_offset, void* dst, size_t size) {
+    if (buffer_offset + size > src->size)
+        return false;
+    memcpy(dst, src->host_ptr + buffer_offset, size);
+    return true;
+}
+
+static CpuBuffer* make_buffer(CpuDevice* device, char* host_ptr, size_t size, bool imported) {
+    CpuBuffer* buffer = calloc(1, sizeof(CpuBuffer));
+    buffer->base = (Buffer) {
+        .destroy = (void(*)(Buffer*)) cpu_destroy_buffer,
+        .get_host_ptr = (void*(*)(Buffer*)) cpu_get_buffer_host_ptr,
+        .get_device_ptr = (uint64_t(*)(Buffer*)) cpu_get_buffer_device_ptr,
+        .copy_into = (bool(*)(Buffer*, size_t, void*, size_t)) cpu_copy_to_buffer,
+        .copy_from = (bool(*)(Buffer*, size_t, void*, size_t)) cpu_copy_from_buffer,
+    };
+    buffer->device = device;
+    buffer->host_ptr = host_ptr;
+    buffer->size = size;
+    buffer->imported = imported;
+    return buffer;
+}
+
+CpuBuffer* cpu_allocate_buffer_device(CpuDevice* device, size_t size) {
+    char* host_ptr = calloc(1, size);
+    if (!host_ptr) {
+        error_print("failed to allocate a %zu bytes buffer\n", size);
+        return NULL;
+    }
+    return make_buffer(device, host_ptr, size, false);
+}
+
+CpuBuffer* cpu_import_buffer_host(CpuDevice* device, void* ptr, size_t size) {
+    return make_buffer(device, ptr, size, true);
+}
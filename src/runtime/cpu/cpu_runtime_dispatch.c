@@ -0,0 +1,139 @@
+#include "cpu_runtime_private.h"
+
+#include "log.h"
+#include "portability.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct CpuDispatch_ {
+    CpuSpecProgram* prog;
+    uint32_t dims[3];
+    /// Index of the next workgroup to run, shared by all the threads of the dispatch
+    atomic_size_t next;
+};
+
+static void* run_workgroups(CpuDispatch* dispatch) {
+    size_t count = (size_t) dispatch->dims[0] * dispatch->dims[1] * dispatch->dims[2];
+    while (true) {
+        size_t i = atomic_fetch_add(&dispatch->next, 1);
+        if (i >= count)
+            break;
+        uint32_t gx = i % dispatch->dims[0];
+        uint32_t gy = (i / dispatch->dims[0]) % dispatch->dims[1];
+        uint32_t gz = i / ((size_t) dispatch->dims[0] * dispatch->dims[1]);
+        dispatch->prog->entry_point(gx, gy, gz);
+    }
+    return NULL;
+}
+
+static void* run_worker(CpuDevice* device) {
+    size_t seen = 0;
+    pthread_mutex_lock(&device->lock);
+    while (true) {
+        while (!device->stopping && device->dispatches_count == seen)
+            pthread_cond_wait(&device->work_posted, &device->lock);
+        if (device->stopping)
+            break;
+        seen = device->dispatches_count;
+        // we may wake up after the dispatch is already over
+        CpuDispatch* dispatch = device->dispatch;
+        if (!dispatch)
+            continue;
+        device->busy_workers++;
+        pthread_mutex_unlock(&device->lock);
+        run_workgroups(dispatch);
+        pthread_mutex_lock(&device->lock);
+        if (--device->busy_workers == 0)
+            pthread_cond_broadcast(&device->work_done);
+    }
+    pthread_mutex_unlock(&device->lock);
+    return NULL;
+}
+
+void cpu_start_workers(CpuDevice* device) {
+    pthread_mutex_init(&device->lock, NULL);
+    pthread_cond_init(&device->work_posted, NULL);
+    pthread_cond_init(&device->work_done, NULL);
+    device->workers = calloc(device->threads_count, sizeof(pthread_t));
+    for (size_t i = 1; i < device->threads_count; i++) {
+        if (pthread_create(&device->workers[device->workers_count], NULL, (void*(*)(void*)) run_worker, device) != 0)
+            break;
+        device->workers_count++;
+    }
+    device->threads_count = device->workers_count + 1;
+}
+
+void cpu_stop_workers(CpuDevice* device) {
+    pthread_mutex_lock(&device->lock);
+    device->stopping = true;
+    pthread_cond_broadcast(&device->work_posted);
+    pthread_mutex_unlock(&device->lock);
+    for (size_t i = 0; i < device->workers_count; i++)
+        pthread_join(device->workers[i], NULL);
+    free(device->workers);
+    pthread_cond_destroy(&device->work_done);
+    pthread_cond_destroy(&device->work_posted);
+    pthread_mutex_destroy(&device->lock);
+}
+
+static bool cpu_wait_completion(CpuCommand* cmd) {
+    free(cmd);
+    return true;
+}
+
+CpuCommand* cpu_launch_kernel(CpuDevice* device, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args) {
+    assert(program && device);
+
+    CpuSpecProgram* prog = cpu_get_specialized_program(program, entry_point, device);
+    CHECK(prog, return NULL);
+
+    debug_print("Dispatching kernel on the CPU\n");
+
+    assert(args_count == prog->num_args && "number of arguments must match number of entrypoint arguments");
+    for (size_t i = 0; i < prog->num_args; i++)
+        memcpy(prog->args + prog->arg_offset[i], args[i], prog->arg_size[i]);
+    prog->num_workgroups[0] = dimx;
+    prog->num_workgroups[1] = dimy;
+    prog->num_workgroups[2] = dimz;
+
+    CpuDispatch dispatch = {
+        .prog = prog,
+        .dims = { dimx, dimy, dimz },
+    };
+    atomic_init(&dispatch.next, 0);
+
+    // the calling thread pitches in too, the workers only get woken up when there is more than one workgroup
+    size_t count = (size_t) dimx * dimy * dimz;
+    if (count <= 1 || device->workers_count == 0) {
+        run_workgroups(&dispatch);
+    } else {
+        pthread_mutex_lock(&device->lock);
+        while (device->dispatch)
+            pthread_cond_wait(&device->work_done, &device->lock);
+        device->dispatch = &dispatch;
+        device->dispatches_count++;
+        pthread_cond_broadcast(&device->work_posted);
+        pthread_mutex_unlock(&device->lock);
+
+        run_workgroups(&dispatch);
+
+        pthread_mutex_lock(&device->lock);
+        while (device->busy_workers > 0)
+            pthread_cond_wait(&device->work_done, &device->lock);
+        device->dispatch = NULL;
+        // lets in the next dispatch, if another thread is waiting to post one
+        pthread_cond_broadcast(&device->work_done);
+        pthread_mutex_unlock(&device->lock);
+    }
+
+    // the dispatch is over by the time we return
+    CpuCommand* cmd = calloc(1, sizeof(CpuCommand));
+    cmd->base = (Command) {
+        .wait_for_completion = (bool(*)(Command*)) cpu_wait_completion,
+    };
+    return cmd;
+}
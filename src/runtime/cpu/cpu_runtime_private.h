@@ -0,0 +1,94 @@
+#ifndef SHADY_CPU_RUNTIME_PRIVATE_H
+#define SHADY_CPU_RUNTIME_PRIVATE_H
+
+#include "../runtime_private.h"
+#include "shady/ir.h"
+#include "shady/builtins.h"
+
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef struct CpuBackend_ CpuBackend;
+typedef struct CpuDevice_ CpuDevice;
+typedef struct CpuSpecProgram_ CpuSpecProgram;
+
+struct CpuBackend_ {
+    Backend base;
+};
+
+typedef struct CpuDispatch_ CpuDispatch;
+
+struct CpuDevice_ {
+    Device base;
+    CpuBackend* backend;
+    /// Workgroups of a dispatch get spread over that many host threads: the calling one and the workers
+    size_t threads_count;
+    struct Dict* specialized_programs;
+
+    /// The workers live as long as the device, and sleep on work_posted between dispatches
+    pthread_t* workers;
+    size_t workers_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work_posted;
+    /// Signalled when the last worker leaves a dispatch, and when a dispatch is over
+    pthread_cond_t work_done;
+    /// The dispatch in flight, if any, and how many of them were posted so far
+    CpuDispatch* dispatch;
+    size_t dispatches_count;
+    size_t busy_workers;
+    bool stopping;
+};
+
+void cpu_destroy_device(CpuDevice*);
+CpuDevice* cpu_create_device(CpuBackend*);
+
+void cpu_start_workers(CpuDevice*);
+void cpu_stop_workers(CpuDevice*);
+
+typedef struct {
+    Buffer base;
+    CpuDevice* device;
+    /// Device pointers are plain host addresses
+    char* host_ptr;
+    size_t size;
+    bool imported;
+} CpuBuffer;
+
+CpuBuffer* cpu_allocate_buffer_device(CpuDevice*, size_t);
+CpuBuffer* cpu_import_buffer_host(CpuDevice*, void*, size_t);
+
+typedef struct {
+    Command base;
+} CpuCommand;
+
+CpuCommand* cpu_launch_kernel(CpuDevice*, Program*, String, int, int, int, int, void**);
+
+typedef struct {
+    Program* base;
+    String entry_point;
+} CpuSpecProgramKey;
+
+typedef void (*CpuEntryPoint)(uint32_t gx, uint32_t gy, uint32_t gz);
+
+struct CpuSpecProgram_ {
+    CpuSpecProgramKey key;
+    CpuDevice* device;
+
+    /// owns the final module
+    IrArena* arena;
+    Module* specialized_module;
+
+    void* library;
+    CpuEntryPoint entry_point;
+    /// The kernel reads its arguments from there, may be NULL if it has none
+    char* args;
+    size_t num_args;
+    size_t* arg_offset;
+    size_t* arg_size;
+    uint32_t* num_workgroups;
+};
+
+CpuSpecProgram* cpu_get_specialized_program(Program*, String ep, CpuDevice*);
+void cpu_destroy_specialized_program(CpuSpecProgram*);
+
+#endif
@@ -0,0 +1,175 @@
+#include "cpu_runtime_private.h"
+
+#include "log.h"
+#include "portability.h"
+#include "dict.h"
+#include "util.h"
+
+#include "../../shady/transform/memory_layout.h"
+
+#include <dlfcn.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static bool extract_parameters_info(CpuSpecProgram* program) {
+    Nodes decls = get_module_declarations(program->specialized_module);
+
+    const Node* args_struct = NULL;
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* node = decls.nodes[i];
+        if (node->tag == GlobalVariable_TAG && lookup_annotation(node, "EntryPointArgs")) {
+            if (args_struct) {
+                error_print("there cannot be more than one EntryPointArgs\n");
+                return false;
+            }
+            args_struct = node;
+        }
+    }
+
+    if (!args_struct)
+        return true;
+
+    const Type* args_struct_type = args_struct->payload.global_variable.type;
+    if (args_struct_type->tag != RecordType_TAG) {
+        error_print("EntryPointArgs must be a struct\n");
+        return false;
+    }
+
+    size_t num_args = args_struct_type->payload.record_type.members.count;
+    LARRAY(FieldLayout, fields, num_args);
+    get_record_layout(get_module_arena(program->specialized_module), args_struct_type, fields);
+
+    program->num_args = num_args;
+    program->arg_offset = calloc(1, 2 * num_args * sizeof(size_t));
+    program->arg_size = program->arg_offset + num_args;
+    for (size_t i = 0; i < num_args; i++) {
+        program->arg_offset[i] = fields[i].offset_in_bytes;
+        program->arg_size[i] = fields[i].mem_layout.size_in_bytes;
+    }
+
+    program->args = dlsym(program->library, get_decl_name(args_struct));
+    CHECK(program->args, return false);
+    return true;
+}
+
+static CompilerConfig get_compiler_config_for_device(SHADY_UNUSED CpuDevice* device, const CompilerConfig* base_config) {
+    CompilerConfig config = *base_config;
+
+    // invocations run one after another, so there is nothing to gain from wider subgroups, unless they are vectorized
+    if (!config.lower.simt_to_explicit_simd)
+        config.specialization.subgroup_size = 1;
+    config.lower.host_dispatched_workgroups = true;
+
+    return config;
+}
+
+static bool emit_specialized_program(CpuSpecProgram* spec, size_t* output_size, char** output) {
+    CompilerConfig config = get_compiler_config_for_device(spec->device, spec->key.base->base_config);
+    config.specialization.entry_point = spec->key.entry_point;
+
+    Module* mod = copy_program_module(spec->key.base);
+    Module* lowered = mod;
+    CHECK(run_compiler_passes(&config, &lowered) == CompilationNoError, destroy_compilation_arenas(mod, lowered, NULL); return false);
+
+    CEmitterConfig emitter_config = {
+        .dialect = C,
+        .explicitly_sized_types = true,
+        .allow_compound_literals = true,
+    };
+    emit_c(config, emitter_config, lowered, output_size, output, &spec->specialized_module);
+
+    destroy_compilation_arenas(mod, lowered, spec->specialized_module);
+    spec->arena = get_module_arena(spec->specialized_module);
+    return true;
+}
+
+/// Builds the C code into a shared library with the host compiler ($CC, or cc) and loads it
+static bool load_specialized_program(CpuSpecProgram* spec, size_t src_size, const char* src) {
+    const char* tmp = getenv("TMPDIR");
+    char* dir = format_string_new("%s/shady_XXXXXX", tmp ? tmp : "/tmp");
+    CHECK(mkdtemp(dir), free(dir); return false);
+
+    char* src_path = format_string_new("%s/%s.c", dir, spec->key.entry_point);
+    char* lib_path = format_string_new("%s/%s.so", dir, spec->key.entry_point);
+    bool ok = write_file(src_path, src_size, src);
+    if (ok) {
+        const char* cc = getenv("CC");
+        // explicit SIMD kernels pass vectors around, GCC notes the ABI of that depends on the target features
+        char* command = format_string_new("%s -O2 -Wno-psabi -shared -fPIC -o %s %s -lm", cc ? cc : "cc", lib_path, src_path);
+        debug_print("Compiling kernel: %s\n", command);
+        ok = system(command) == 0;
+        if (!ok)
+            error_print("Failed to compile the kernel for the CPU: %s\n", command);
+        free(command);
+    }
+    if (ok) {
+        spec->library = dlopen(lib_path, RTLD_NOW | RTLD_LOCAL);
+        if (!spec->library)
+            error_print("Failed to load the kernel: %s\n", dlerror());
+        ok = spec->library != NULL;
+    }
+
+    // the loaded library stays mapped, the files themselves are not needed anymore
+    unlink(lib_path);
+    unlink(src_path);
+    rmdir(dir);
+    free(lib_path);
+    free(src_path);
+    free(dir);
+    return ok;
+}
+
+static bool find_entry_point(CpuSpecProgram* spec) {
+    spec->entry_point = (CpuEntryPoint) dlsym(spec->library, spec->key.entry_point);
+    CHECK(spec->entry_point, return false);
+    spec->num_workgroups = dlsym(spec->library, get_builtin_name(BuiltinNumWorkgroups));
+    CHECK(spec->num_workgroups, return false);
+    return true;
+}
+
+static CpuSpecProgram* create_specialized_program(CpuSpecProgramKey key, CpuDevice* device) {
+    CpuSpecProgram* spec_program = calloc(1, sizeof(CpuSpecProgram));
+    if (!spec_program)
+        return NULL;
+
+    spec_program->key = key;
+    spec_program->device = device;
+
+    size_t src_size;
+    char* src;
+    CHECK(emit_specialized_program(spec_program, &src_size, &src), cpu_destroy_specialized_program(spec_program); return NULL);
+    if (key.base->runtime->config.dump_spv) {
+        String file_name = format_string_new("%s.c", get_module_name(spec_program->specialized_module));
+        write_file(file_name, src_size, src);
+        free((void*) file_name);
+    }
+    bool loaded = load_specialized_program(spec_program, src_size, src);
+    free(src);
+    CHECK(loaded,                                cpu_destroy_specialized_program(spec_program); return NULL);
+    CHECK(find_entry_point(spec_program),        cpu_destroy_specialized_program(spec_program); return NULL);
+    CHECK(extract_parameters_info(spec_program), cpu_destroy_specialized_program(spec_program); return NULL);
+    return spec_program;
+}
+
+CpuSpecProgram* cpu_get_specialized_program(Program* program, String entry_point, CpuDevice* device) {
+    CpuSpecProgramKey key = { .base = program, .entry_point = entry_point };
+    CpuSpecProgram** found = find_value_dict(CpuSpecProgramKey, CpuSpecProgram*, device->specialized_programs, key);
+    if (found)
+        return *found;
+    CpuSpecProgram* spec = create_specialized_program(key, device);
+    CHECK(spec, return NULL);
+    insert_dict(CpuSpecProgramKey, CpuSpecProgram*, device->specialized_programs, key, spec);
+    return spec;
+}
+
+void cpu_destroy_specialized_program(CpuSpecProgram* spec) {
+    if (spec->library)
+        dlclose(spec->library);
+    free(spec->arg_offset);
+    if (spec->arena)
+        destroy_ir_arena(spec->arena);
+    free(spec);
+}
@@ -2,10 +2,14 @@
 
 #include "log.h"
 #include "list.h"
+#include "dict.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+KeyHash hash_compilation_cache_key(CompilationCacheKey*);
+bool compare_compilation_cache_keys(CompilationCacheKey*, CompilationCacheKey*);
+
 Runtime* initialize_runtime(RuntimeConfig config) {
     Runtime* runtime = malloc(sizeof(Runtime));
     memset(runtime, 0, sizeof(Runtime));
@@ -13,11 +17,24 @@ Runtime* initialize_runtime(RuntimeConfig config) {
     runtime->backends = new_list(Backend*);
     runtime->devices = new_list(Device*);
     runtime->programs = new_list(Program*);
+    runtime->compiled_programs = new_dict(CompilationCacheKey, CompiledProgram*, (HashFn) hash_compilation_cache_key, (CmpFn) compare_compilation_cache_keys);
+
+    if (config.compilation_cache_dir) {
+        CompilationCacheConfig cache_config = default_compilation_cache_config();
+        cache_config.path = config.compilation_cache_dir;
+        runtime->compilation_cache = open_compilation_cache(cache_config);
+    }
 
 #if VK_BACKEND_PRESENT
     Backend* vk_backend = initialize_vk_backend(runtime);
     CHECK(vk_backend, goto init_fail_free);
     append_list(Backend*, runtime->backends, vk_backend);
+#endif
+#if CPU_BACKEND_PRESENT
+    // comes last, so the GPUs keep their device numbers
+    Backend* cpu_backend = initialize_cpu_backend(runtime);
+    CHECK(cpu_backend, goto init_fail_free);
+    append_list(Backend*, runtime->backends, cpu_backend);
 #endif
     info_print("Shady runtime successfully initialized !\n");
     return runtime;
@@ -47,6 +64,18 @@ void shutdown_runtime(Runtime* runtime) {
         Backend* bk = read_list(Backend*, runtime->backends)[i];
         bk->cleanup(bk);
     }
+
+    size_t i = 0;
+    CompiledProgram* compiled;
+    while (dict_iter(runtime->compiled_programs, &i, NULL, &compiled))
+        destroy_compiled_program(compiled);
+    destroy_dict(runtime->compiled_programs);
+
+    if (runtime->compilation_cache) {
+        CompilationCacheStats stats = get_compilation_cache_stats(runtime->compilation_cache);
+        info_print("Compilation cache: %zu hits, %zu misses\n", stats.hits, stats.misses);
+        close_compilation_cache(runtime->compilation_cache);
+    }
     free(runtime);
 }
 
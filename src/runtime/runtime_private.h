@@ -9,6 +9,9 @@
 
 struct Runtime_ {
     RuntimeConfig config;
+    CompilationCache* compilation_cache;
+    /// Maps CompilationCacheKey to CompiledProgram*, so a given module and configuration only get compiled once
+    struct Dict* compiled_programs;
 
     struct List* backends;
     struct List* devices;
@@ -37,6 +40,13 @@ struct Program_ {
     /// owns the module, may be NULL if module is owned by someone else
     IrArena* arena;
     Module* module;
+
+    /// The module as it was when the program was created, in the .shdb format. The compiler passes add to the module
+    /// they start from, so every compilation starts from a fresh copy of this instead of the module itself.
+    ArenaConfig module_arena_config;
+    String module_name;
+    size_t module_size;
+    char* module_data;
 };
 
 struct Command_ {
@@ -53,6 +63,26 @@ struct Buffer_ {
 };
 
 void unload_program(Program*);
+/// Returns a copy of the program's module, in a new arena, for a compilation to start from
+Module* copy_program_module(Program*);
+/// Destroys the arenas a compilation went through, except the one the final module lives in (if any)
+void destroy_compilation_arenas(Module* copy, Module* lowered, Module* final_mod);
+
+/// The result of compiling a module with a given configuration, shared by all the programs and devices that need it.
+/// It belongs to the runtime and lives until it shuts down.
+typedef struct {
+    CompilationCacheKey key;
+    size_t spirv_size;
+    char* spirv;
+    /// The module the SPIR-V was emitted from
+    Module* module;
+    /// owns the module
+    IrArena* arena;
+} CompiledProgram;
+
+const CompiledProgram* get_compiled_program(Program*, CompilerConfig*);
+void destroy_compiled_program(CompiledProgram*);
 
 Backend* initialize_vk_backend(Runtime*);
+Backend* initialize_cpu_backend(Runtime*);
 #endif
@@ -3,7 +3,9 @@
 
 #include "log.h"
 #include "list.h"
+#include "dict.h"
 #include "util.h"
+#include "portability.h"
 
 #include <stdlib.h>
 #include <assert.h>
@@ -16,6 +18,10 @@ Program* new_program_from_module(Runtime* runtime, const CompilerConfig* base_co
     program->arena = NULL;
     program->module = mod;
 
+    program->module_arena_config = get_arena_config(get_module_arena(mod));
+    program->module_name = format_string_new("%s", get_module_name(mod));
+    serialize_module(mod, &program->module_size, &program->module_data);
+
     // TODO split the compilation pipeline into generic and non-generic parts
     append_list(Program*, runtime->programs, program);
     return program;
@@ -53,5 +59,71 @@ void unload_program(Program* program) {
     // TODO iterate over the specialized stuff
     if (program->arena) // if the program owns an arena
         destroy_ir_arena(program->arena);
+    free((void*) program->module_name);
+    free(program->module_data);
     free(program);
 }
+
+Module* copy_program_module(Program* program) {
+    IrArena* arena = new_ir_arena(program->module_arena_config);
+    Module* mod = new_module(arena, program->module_name);
+    SHADY_UNUSED bool ok = deserialize_module(mod, program->module_size, program->module_data);
+    assert(ok);
+    return mod;
+}
+
+void destroy_compilation_arenas(Module* copy, Module* lowered, Module* final_mod) {
+    IrArena* kept = final_mod ? get_module_arena(final_mod) : NULL;
+    // the modules live in their arenas, so look those up before destroying any of them
+    IrArena* copy_arena = get_module_arena(copy);
+    IrArena* lowered_arena = get_module_arena(lowered);
+    // the passes and the backends leave the arena they started from alone
+    if (lowered_arena != kept)
+        destroy_ir_arena(lowered_arena);
+    if (copy_arena != kept && copy_arena != lowered_arena)
+        destroy_ir_arena(copy_arena);
+}
+
+KeyHash hash_compilation_cache_key(CompilationCacheKey* key) {
+    // the key already is a hash
+    return key->words[0];
+}
+
+bool compare_compilation_cache_keys(CompilationCacheKey* a, CompilationCacheKey* b) {
+    return memcmp(a, b, sizeof(CompilationCacheKey)) == 0;
+}
+
+const CompiledProgram* get_compiled_program(Program* program, CompilerConfig* config) {
+    Runtime* runtime = program->runtime;
+    CompilationCacheKey key = compute_compilation_cache_key_from_data(config, program->module_arena_config, program->module_size, program->module_data);
+    CompiledProgram** found = find_value_dict(CompilationCacheKey, CompiledProgram*, runtime->compiled_programs, key);
+    if (found)
+        return *found;
+
+    CompiledProgram* compiled = calloc(1, sizeof(CompiledProgram));
+    compiled->key = key;
+    CompilationCache* cache = runtime->compilation_cache;
+    if (!cache || !lookup_compilation_cache(cache, key, &compiled->spirv_size, &compiled->spirv, &compiled->module)) {
+        Module* mod = copy_program_module(program);
+        Module* lowered = mod;
+        if (run_compiler_passes(config, &lowered) != CompilationNoError) {
+            destroy_compilation_arenas(mod, lowered, NULL);
+            free(compiled);
+            return NULL;
+        }
+        emit_spirv(config, lowered, &compiled->spirv_size, &compiled->spirv, &compiled->module);
+        destroy_compilation_arenas(mod, lowered, compiled->module);
+        if (cache)
+            store_in_compilation_cache(cache, key, compiled->spirv_size, compiled->spirv, compiled->module);
+    }
+    compiled->arena = get_module_arena(compiled->module);
+
+    insert_dict(CompilationCacheKey, CompiledProgram*, runtime->compiled_programs, key, compiled);
+    return compiled;
+}
+
+void destroy_compiled_program(CompiledProgram* compiled) {
+    free(compiled->spirv);
+    destroy_ir_arena(compiled->arena);
+    free(compiled);
+}
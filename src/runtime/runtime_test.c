@@ -23,6 +23,14 @@ typedef struct {
     DriverConfig driver_config;
     RuntimeConfig runtime_config;
     size_t device;
+    /// Picks the device by name instead, if set
+    String device_name;
+    /// How many programs get made out of the module
+    size_t instances;
+    /// Prints what the kernel left in the buffer
+    bool print_buffer;
+    /// How many workgroups get dispatched, along x
+    size_t workgroups;
 } Args;
 
 static void parse_runtime_arguments(int* pargc, char** argv, Args* args) {
@@ -38,7 +46,28 @@ static void parse_runtime_arguments(int* pargc, char** argv, Args* args) {
         } else if (strcmp(argv[i], "--device") == 0 || strcmp(argv[i], "-d") == 0) {
             argv[i] = NULL;
             i++;
-            args->device = strtol(argv[i], NULL, 10);
+            char* end;
+            args->device = strtol(argv[i], &end, 10);
+            if (*end != '\0')
+                args->device_name = argv[i];
+        } else if (strcmp(argv[i], "--instances") == 0) {
+            argv[i] = NULL;
+            i++;
+            args->instances = strtol(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--workgroups") == 0) {
+            argv[i] = NULL;
+            i++;
+            args->workgroups = strtol(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--print-buffer") == 0) {
+            args->print_buffer = true;
+        } else if (strcmp(argv[i], "--cache-dir") == 0) {
+            argv[i] = NULL;
+            i++;
+            args->runtime_config.compilation_cache_dir = argv[i];
+        } else if (strcmp(argv[i], "--cpu-threads") == 0) {
+            argv[i] = NULL;
+            i++;
+            args->runtime_config.cpu_threads = strtol(argv[i], NULL, 10);
         } else {
             continue;
         }
@@ -51,15 +80,34 @@ static void parse_runtime_arguments(int* pargc, char** argv, Args* args) {
         error_print("  --log-level debug[v[v]], info, warn, error]\n");
         error_print("  --print-builtin\n");
         error_print("  --print-generated\n");
-        error_print("  --device n\n");
+        error_print("  --device n|name\n");
+        error_print("  --instances n                             Runs n programs made from the same module\n");
+        error_print("  --print-buffer                            Prints the contents of the buffer passed to the kernel\n");
+        error_print("  --workgroups n                            Dispatches n workgroups instead of one\n");
+        error_print("  --cache-dir <directory>\n");
+        error_print("  --cpu-threads n                           Dispatches on n host threads with the CPU backend\n");
         exit(0);
     }
 }
 
+static Device* find_device(Runtime* runtime, Args* args) {
+    if (!args->device_name)
+        return get_device(runtime, args->device);
+    for (size_t i = 0; i < device_count(runtime); i++) {
+        Device* device = get_device(runtime, i);
+        if (strcmp(get_device_name(device), args->device_name) == 0)
+            return device;
+    }
+    error_print("No device named '%s'\n", args->device_name);
+    return NULL;
+}
+
 int main(int argc, char* argv[]) {
     set_log_level(INFO);
     Args args = {
         .driver_config = default_driver_config(),
+        .instances = 1,
+        .workgroups = 1,
     };
     args.runtime_config = (RuntimeConfig) {
         .use_validation = true,
@@ -73,37 +121,49 @@ int main(int argc, char* argv[]) {
     info_print("Shady runtime test starting...\n");
 
     Runtime* runtime = initialize_runtime(args.runtime_config);
-    Device* device = get_device(runtime, args.device);
-    assert(device);
-
-    Program* program;
-    IrArena* arena = NULL;
-    if (entries_count_list(args.driver_config.input_filenames) == 0) {
-        program = load_program(runtime, &args.driver_config.config, default_shader);
-    } else {
-        arena = new_ir_arena(default_arena_config());
-        Module* module = new_module(arena, "my_module");
-
-        int err = driver_load_source_files(&args.driver_config, module);
-        if (err)
-            return err;
-        program = new_program_from_module(runtime, &args.driver_config.config, module);
-    }
-
-    int32_t stuff[] = { 42, 42, 42, 42 };
+    Device* device = find_device(runtime, &args);
+    if (!device)
+        return 1;
+
+    IrArena* arena = new_ir_arena(default_arena_config());
+    Module* module = new_module(arena, "my_module");
+    int err;
+    if (entries_count_list(args.driver_config.input_filenames) == 0)
+        err = driver_load_source_file(SrcShadyIR, strlen(default_shader), default_shader, module);
+    else
+        err = driver_load_source_files(&args.driver_config, module);
+    if (err)
+        return err;
+
+    int32_t stuff[64];
+    for (size_t i = 0; i < sizeof(stuff) / sizeof(stuff[0]); i++)
+        stuff[i] = 42;
     Buffer* buffer = allocate_buffer_device(device, sizeof(stuff));
     copy_to_buffer(buffer, 0, stuff, sizeof(stuff));
-    copy_from_buffer(buffer, 0, stuff, sizeof(stuff));
 
-    int32_t a0 = 42;
-    uint64_t a1 = get_buffer_device_pointer(buffer);
-    wait_completion(launch_kernel(program, device, "main", 1, 1, 1, 2, (void*[]) { &a0, &a1 }));
+    // the programs share the module, compiling one of them must leave it as it was for the others
+    for (size_t i = 0; i < args.instances; i++) {
+        Program* program = new_program_from_module(runtime, &args.driver_config.config, module);
+        int32_t a0 = 42;
+        uint64_t a1 = get_buffer_device_pointer(buffer);
+        Command* command = launch_kernel(program, device, "main", args.workgroups, 1, 1, 2, (void*[]) { &a0, &a1 });
+        if (!command || !wait_completion(command)) {
+            error_print("Failed to run the kernel\n");
+            return 1;
+        }
+    }
 
+    copy_from_buffer(buffer, 0, stuff, sizeof(stuff));
+    if (args.print_buffer) {
+        printf("buffer:");
+        for (size_t i = 0; i < sizeof(stuff) / sizeof(stuff[0]); i++)
+            printf(" %d", stuff[i]);
+        printf("\n");
+    }
     destroy_buffer(buffer);
 
     shutdown_runtime(runtime);
-    if (arena)
-        destroy_ir_arena(arena);
+    destroy_ir_arena(arena);
     destroy_driver_config(&args.driver_config);
     return 0;
 }
@@ -216,6 +216,14 @@ bool cmp_spec_program_keys(SpecProgramKey* a, SpecProgramKey* b) {
     return memcmp(a, b, sizeof(SpecProgramKey)) == 0;
 }
 
+static KeyHash hash_compiled_program(const CompiledProgram** ptr) {
+    return hash_murmur(ptr, sizeof(const CompiledProgram*));
+}
+
+static bool cmp_compiled_programs(const CompiledProgram** a, const CompiledProgram** b) {
+    return *a == *b;
+}
+
 static void obtain_device_pointers(VkrDevice* device) {
 #define Y(fn_name) ext->fn_name = (PFN_##fn_name) vkGetDeviceProcAddr(device->device, #fn_name);
 #define X(_, name, fns) \
@@ -268,6 +276,7 @@ static VkrDevice* create_vkr_device(SHADY_UNUSED VkrBackend* runtime, VkPhysical
     }, NULL, &device->cmd_pool), goto delete_device);
 
     device->specialized_programs = new_dict(SpecProgramKey, VkrSpecProgram*, (HashFn) hash_spec_program_key, (CmpFn) cmp_spec_program_keys);
+    device->shader_modules = new_dict(const CompiledProgram*, VkShaderModule, (HashFn) hash_compiled_program, (CmpFn) cmp_compiled_programs);
 
     vkGetDeviceQueue(device->device, device->caps.compute_queue_family, 0, &device->compute_queue);
 
@@ -290,6 +299,12 @@ static void shutdown_vkr_device(VkrDevice* device) {
         destroy_specialized_program(sp);
     }
     destroy_dict(device->specialized_programs);
+    i = 0;
+    const CompiledProgram* compiled;
+    VkShaderModule shader_module;
+    while (dict_iter(device->shader_modules, &i, &compiled, &shader_module))
+        vkDestroyShaderModule(device->device, shader_module, NULL);
+    destroy_dict(device->shader_modules);
     vkDestroyCommandPool(device->device, device->cmd_pool, NULL);
     vkDestroyDevice(device->device, NULL);
     free(device);
@@ -40,6 +40,7 @@ X(0, KHR_shader_float16_int8,            empty_fns) \
 X(0, KHR_8bit_storage,                   empty_fns) \
 X(0, KHR_16bit_storage,                  empty_fns) \
 X(0, KHR_driver_properties,              empty_fns) \
+X(0, NV_shader_subgroup_partitioned,     empty_fns) \
 
 #define E(is_required, name, _) ShadySupports##name,
 typedef enum {
@@ -154,6 +155,8 @@ struct VkrDevice_ {
     } extensions;
 
     struct Dict* specialized_programs;
+    /// Maps const CompiledProgram* to VkShaderModule
+    struct Dict* shader_modules;
 };
 
 bool probe_vkr_devices(VkrBackend*);
@@ -231,16 +234,16 @@ struct VkrSpecProgram_ {
     VkrDevice* device;
     Arena* arena;
 
+    const CompiledProgram* compiled;
+    /// The final module, owned by compiled
     Module* specialized_module;
 
-    size_t spirv_size;
-    char* spirv_bytes;
-
     ProgramParamsInfo parameters;
     ProgramResourcesInfo resources;
 
     VkPipeline pipeline;
     VkPipelineLayout layout;
+    /// Shared by all the programs of the device compiled to the same SPIR-V, owned by the device
     VkShaderModule shader_module;
 
     VkDescriptorSetLayout set_layouts[MAX_DESCRIPTOR_SETS];
@@ -256,13 +256,19 @@ static bool extract_layout(VkrSpecProgram* program) {
 }
 
 static bool create_vk_pipeline(VkrSpecProgram* program) {
-    CHECK_VK(vkCreateShaderModule(program->device->device, &(VkShaderModuleCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .codeSize = program->spirv_size,
-        .pCode = (uint32_t*) program->spirv_bytes
-    }, NULL, &program->shader_module), return false);
+    VkShaderModule* found = find_value_dict(const CompiledProgram*, VkShaderModule, program->device->shader_modules, program->compiled);
+    if (found)
+        program->shader_module = *found;
+    else {
+        CHECK_VK(vkCreateShaderModule(program->device->device, &(VkShaderModuleCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .codeSize = program->compiled->spirv_size,
+            .pCode = (uint32_t*) program->compiled->spirv
+        }, NULL, &program->shader_module), return false);
+        insert_dict(const CompiledProgram*, VkShaderModule, program->device->shader_modules, program->compiled, program->shader_module);
+    }
 
     VkPipelineShaderStageCreateInfo stage_create_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -310,6 +316,7 @@ static CompilerConfig get_compiler_config_for_device(VkrDevice* device, const Co
         config.lower.emulate_subgroup_ops_extended_types = true;
 
     config.lower.int64 = !device->caps.features.base.features.shaderInt64;
+    config.lower.emulate_subgroup_partition = !device->caps.supported_extensions[ShadySupportsNV_shader_subgroup_partitioned];
 
     if (device->caps.implementation.is_moltenvk) {
         warn_print("Hack: MoltenVK says they supported subgroup extended types, but it's a lie. 64-bit types are unaccounted for !\n");
@@ -329,16 +336,15 @@ static bool compile_specialized_program(VkrSpecProgram* spec) {
     CompilerConfig config = get_compiler_config_for_device(spec->device, spec->key.base->base_config);
     config.specialization.entry_point = spec->key.entry_point;
 
-    CHECK(run_compiler_passes(&config, &spec->specialized_module) == CompilationNoError, return false);
-
-    Module* new_mod;
-    emit_spirv(&config, spec->specialized_module, &spec->spirv_size, &spec->spirv_bytes, &new_mod);
-    spec->specialized_module = new_mod;
+    // devices with the same capabilities, and programs loaded from the same module, end up sharing this
+    spec->compiled = get_compiled_program(spec->key.base, &config);
+    CHECK(spec->compiled, return false);
+    spec->specialized_module = spec->compiled->module;
 
     if (spec->key.base->runtime->config.dump_spv) {
         String module_name = get_module_name(spec->specialized_module);
         String file_name = format_string_new("%s.spv", module_name);
-        write_file(file_name, spec->spirv_size, (const char*) spec->spirv_bytes);
+        write_file(file_name, spec->compiled->spirv_size, spec->compiled->spirv);
         free((void*) file_name);
     }
 
@@ -420,7 +426,6 @@ static VkrSpecProgram* create_specialized_program(SpecProgramKey key, VkrDevice*
 
     spec_program->key = key;
     spec_program->device = device;
-    spec_program->specialized_module = key.base->module;
     spec_program->arena = new_arena();
 
     CHECK(compile_specialized_program(spec_program), return NULL);
@@ -447,11 +452,7 @@ void destroy_specialized_program(VkrSpecProgram* spec) {
     for (size_t set = 0; set < MAX_DESCRIPTOR_SETS; set++)
         vkDestroyDescriptorSetLayout(spec->device->device, spec->set_layouts[set], NULL);
     vkDestroyPipelineLayout(spec->device->device, spec->layout, NULL);
-    vkDestroyShaderModule(spec->device->device, spec->shader_module, NULL);
     free(spec->parameters.arg_offset);
-    free(spec->spirv_bytes);
-    if (get_module_arena(spec->specialized_module) != get_module_arena(spec->key.base->module))
-        destroy_ir_arena(get_module_arena(spec->specialized_module));
     for (size_t i = 0; i < spec->resources.num_resources; i++) {
         ProgramResourceInfo* resource = spec->resources.resources[i];
         if (resource->buffer)
@@ -0,0 +1,303 @@
+#include "scope.h"
+
+#include "list.h"
+#include "dict.h"
+#include "portability.h"
+#include "log.h"
+
+#include "../visit.h"
+#include "../type.h"
+#include "../transform/memory_layout.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+// A static estimate of what a compiled module costs to run: how many 32-bit registers each function needs at its
+// worst point, and how much memory each thread, subgroup and workgroup needs. Meant to be run on the final module,
+// so that regressions can be caught in CI without running anything on a GPU.
+
+KeyHash hash_node(const Node**);
+bool compare_node(const Node**, const Node**);
+
+typedef struct {
+    Visitor visitor;
+    /// maps variables to the position of their definition
+    struct Dict* defs;
+    /// maps variables to the position of their last use
+    struct Dict* last_uses;
+    /// variables used inside the loop being walked, if any
+    struct List* loop_uses;
+    size_t position;
+    size_t instructions;
+} LivenessVisitor;
+
+static void define(LivenessVisitor* v, Nodes vars) {
+    for (size_t i = 0; i < vars.count; i++)
+        insert_dict(const Node*, size_t, v->defs, vars.nodes[i], v->position);
+}
+
+static void extend_live_range(LivenessVisitor* v, const Node* var, size_t position) {
+    size_t* last = find_value_dict(const Node*, size_t, v->last_uses, var);
+    if (!last)
+        insert_dict(const Node*, size_t, v->last_uses, var, position);
+    else if (*last < position)
+        *last = position;
+}
+
+static void walk_abstraction(LivenessVisitor* v, const Node* abs) {
+    if (!abs)
+        return;
+    define(v, get_abstraction_params(abs));
+    v->visitor.visit_node_fn(&v->visitor, get_abstraction_body(abs));
+}
+
+static void walk_liveness(LivenessVisitor* v, const Node* node) {
+    switch (node->tag) {
+        case Variable_TAG: {
+            extend_live_range(v, node, v->position);
+            if (v->loop_uses)
+                append_list(const Node*, v->loop_uses, node);
+            return;
+        }
+        case Let_TAG: {
+            v->position++;
+            v->instructions++;
+            walk_liveness(v, get_let_instruction(node));
+            walk_abstraction(v, get_let_tail(node));
+            return;
+        }
+        case If_TAG: {
+            visit_node_operands(&v->visitor, IGNORE_ABSTRACTIONS_MASK | NcType, node);
+            walk_abstraction(v, node->payload.if_instr.if_true);
+            walk_abstraction(v, node->payload.if_instr.if_false);
+            return;
+        }
+        case Match_TAG: {
+            visit_node_operands(&v->visitor, IGNORE_ABSTRACTIONS_MASK | NcType, node);
+            for (size_t i = 0; i < node->payload.match_instr.cases.count; i++)
+                walk_abstraction(v, node->payload.match_instr.cases.nodes[i]);
+            walk_abstraction(v, node->payload.match_instr.default_case);
+            return;
+        }
+        case Control_TAG: {
+            walk_abstraction(v, node->payload.control.inside);
+            return;
+        }
+        case Block_TAG: {
+            walk_abstraction(v, node->payload.block.inside);
+            return;
+        }
+        case Loop_TAG: {
+            // anything defined before the loop and used inside stays live for the whole loop
+            visit_node_operands(&v->visitor, IGNORE_ABSTRACTIONS_MASK | NcType, node);
+            struct List* outer_uses = v->loop_uses;
+            v->loop_uses = new_list(const Node*);
+            size_t start = v->position;
+            walk_abstraction(v, node->payload.loop_instr.body);
+            size_t end = v->position;
+            for (size_t i = 0; i < entries_count_list(v->loop_uses); i++) {
+                const Node* var = read_list(const Node*, v->loop_uses)[i];
+                size_t* def = find_value_dict(const Node*, size_t, v->defs, var);
+                if (def && *def < start)
+                    extend_live_range(v, var, end);
+                if (outer_uses)
+                    append_list(const Node*, outer_uses, var);
+            }
+            destroy_list(v->loop_uses);
+            v->loop_uses = outer_uses;
+            return;
+        }
+        default: break;
+    }
+    if (is_terminator(node))
+        v->position++;
+    visit_node_operands(&v->visitor, IGNORE_ABSTRACTIONS_MASK | NcType, node);
+}
+
+static size_t count_registers(const Type* t) {
+    switch (t->tag) {
+        case Int_TAG: return t->payload.int_type.width == IntTy64 ? 2 : 1;
+        case Float_TAG: return t->payload.float_type.width == FloatTy64 ? 2 : 1;
+        case PackType_TAG: return t->payload.pack_type.width * count_registers(t->payload.pack_type.element_type);
+        case ArrType_TAG: {
+            const IntLiteral* size = t->payload.arr_type.size ? resolve_to_int_literal(t->payload.arr_type.size) : NULL;
+            return size ? get_int_literal_value(*size, false) * count_registers(t->payload.arr_type.element_type) : 1;
+        }
+        case RecordType_TAG: {
+            size_t total = 0;
+            for (size_t i = 0; i < t->payload.record_type.members.count; i++)
+                total += count_registers(t->payload.record_type.members.nodes[i]);
+            return total;
+        }
+        case TypeDeclRef_TAG: {
+            const Node* body = t->payload.type_decl_ref.decl->payload.nom_type.body;
+            return body ? count_registers(body) : 1;
+        }
+        default: return 1;
+    }
+}
+
+typedef struct {
+    size_t max_live_varying;
+    size_t max_live_uniform;
+    size_t instructions;
+} FnPressure;
+
+static FnPressure estimate_register_pressure(const Node* fn) {
+    LivenessVisitor v = {
+        .visitor = {
+            .visit_node_fn = (VisitNodeFn) walk_liveness,
+        },
+        .defs = new_dict(const Node*, size_t, (HashFn) hash_node, (CmpFn) compare_node),
+        .last_uses = new_dict(const Node*, size_t, (HashFn) hash_node, (CmpFn) compare_node),
+    };
+
+    // basic blocks are walked in reverse post-order, which is a decent linearization as long as they don't loop
+    Scope* scope = new_scope(fn);
+    for (size_t i = 0; i < scope->size; i++) {
+        const Node* abs = scope->rpo[i]->node;
+        if (abs->tag == Function_TAG || abs->tag == BasicBlock_TAG)
+            walk_abstraction(&v, abs);
+    }
+    destroy_scope(scope);
+
+    // sweep over the live ranges, separately for values that need a register per lane and those that don't
+    size_t* varying = calloc(v.position + 2, sizeof(size_t));
+    size_t* uniform = calloc(v.position + 2, sizeof(size_t));
+    const Node* var;
+    size_t def;
+    size_t i = 0;
+    while (dict_iter(v.defs, &i, &var, &def)) {
+        size_t* last = find_value_dict(const Node*, size_t, v.last_uses, var);
+        size_t end = last && *last > def ? *last : def;
+        const Type* t = var->type;
+        bool is_uniform = deconstruct_qualified_type(&t);
+        size_t* diff = is_uniform ? uniform : varying;
+        size_t registers = count_registers(t);
+        diff[def] += registers;
+        diff[end + 1] -= registers;
+    }
+
+    FnPressure pressure = { .instructions = v.instructions };
+    size_t live_varying = 0, live_uniform = 0;
+    for (size_t p = 0; p <= v.position; p++) {
+        live_varying += varying[p];
+        live_uniform += uniform[p];
+        pressure.max_live_varying = live_varying > pressure.max_live_varying ? live_varying : pressure.max_live_varying;
+        pressure.max_live_uniform = live_uniform > pressure.max_live_uniform ? live_uniform : pressure.max_live_uniform;
+    }
+
+    free(varying);
+    free(uniform);
+    destroy_dict(v.defs);
+    destroy_dict(v.last_uses);
+    return pressure;
+}
+
+/// Prints s as a JSON string literal, names coming from other front-ends can contain anything
+static void print_json_string(FILE* output, String s) {
+    fputc('"', output);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\')
+            fprintf(output, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(output, "\\u%04x", c);
+        else
+            fputc(c, output);
+    }
+    fputc('"', output);
+}
+
+static size_t get_footprint(IrArena* a, const Type* t) {
+    if (t->tag == ArrType_TAG) {
+        const IntLiteral* size = t->payload.arr_type.size ? resolve_to_int_literal(t->payload.arr_type.size) : NULL;
+        if (!size)
+            return 0;
+        return get_int_literal_value(*size, false) * get_footprint(a, t->payload.arr_type.element_type);
+    }
+    return get_mem_layout(a, t).size_in_bytes;
+}
+
+void dump_occupancy_report(FILE* output, Module* mod) {
+    if (output == NULL)
+        output = stderr;
+
+    IrArena* a = get_module_arena(mod);
+    Nodes decls = get_module_declarations(mod);
+
+    size_t private_bytes = 0, subgroup_bytes = 0, shared_bytes = 0, stack_bytes = 0, dispatch_targets = 0;
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        // lower_stack records how big it made the stack, since it gets merged with the other private globals later
+        const Node* stack_size = lookup_annotation(decl, "StackSize");
+        if (stack_size) {
+            const IntLiteral* lit = resolve_to_int_literal(get_annotation_value(stack_size));
+            if (lit)
+                stack_bytes = get_int_literal_value(*lit, false);
+        }
+        if (decl->tag == Function_TAG && lookup_annotation(decl, "FnId"))
+            dispatch_targets++;
+        if (decl->tag != GlobalVariable_TAG || lookup_annotation(decl, "Builtin"))
+            continue;
+        switch (decl->payload.global_variable.address_space) {
+            case AsPrivateLogical:
+            case AsPrivatePhysical: private_bytes += get_footprint(a, decl->payload.global_variable.type); break;
+            case AsSubgroupLogical:
+            case AsSubgroupPhysical: subgroup_bytes += get_footprint(a, decl->payload.global_variable.type); break;
+            case AsSharedLogical:
+            case AsSharedPhysical: shared_bytes += get_footprint(a, decl->payload.global_variable.type); break;
+            default: break;
+        }
+    }
+
+    fprintf(output, "{\n");
+    fprintf(output, "  \"module\": ");
+    print_json_string(output, get_module_name(mod));
+    fprintf(output, ",\n");
+    fprintf(output, "  \"stack_bytes_per_thread\": %zu,\n", stack_bytes);
+    fprintf(output, "  \"private_bytes_per_thread\": %zu,\n", private_bytes);
+    fprintf(output, "  \"subgroup_bytes\": %zu,\n", subgroup_bytes);
+    fprintf(output, "  \"shared_bytes\": %zu,\n", shared_bytes);
+    fprintf(output, "  \"dispatch_targets\": %zu,\n", dispatch_targets);
+
+    size_t max_live_varying = 0, max_live_uniform = 0;
+    bool first_dispatcher = true;
+    fprintf(output, "  \"dispatchers\": [");
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != Function_TAG || !get_abstraction_body(decl) || strncmp(get_abstraction_name(decl), "top_dispatcher", strlen("top_dispatcher")) != 0)
+            continue;
+        FnPressure pressure = estimate_register_pressure(decl);
+        fprintf(output, "%s\n    { \"name\": ", first_dispatcher ? "" : ",");
+        print_json_string(output, get_abstraction_name(decl));
+        fprintf(output, ", \"instructions\": %zu }", pressure.instructions);
+        first_dispatcher = false;
+    }
+    fprintf(output, first_dispatcher ? "],\n" : "\n  ],\n");
+
+    bool first_fn = true;
+    fprintf(output, "  \"functions\": [");
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != Function_TAG || !get_abstraction_body(decl))
+            continue;
+        FnPressure pressure = estimate_register_pressure(decl);
+        if (pressure.max_live_varying > max_live_varying)
+            max_live_varying = pressure.max_live_varying;
+        if (pressure.max_live_uniform > max_live_uniform)
+            max_live_uniform = pressure.max_live_uniform;
+        fprintf(output, "%s\n    { \"name\": ", first_fn ? "" : ",");
+        print_json_string(output, get_abstraction_name(decl));
+        fprintf(output, ", \"entry_point\": %s, \"instructions\": %zu, \"max_live_registers\": %zu, \"max_live_uniform_registers\": %zu }",
+                lookup_annotation(decl, "EntryPoint") ? "true" : "false", pressure.instructions, pressure.max_live_varying, pressure.max_live_uniform);
+        first_fn = false;
+    }
+    fprintf(output, first_fn ? "],\n" : "\n  ],\n");
+
+    fprintf(output, "  \"max_live_registers\": %zu,\n", max_live_varying);
+    fprintf(output, "  \"max_live_uniform_registers\": %zu\n", max_live_uniform);
+    fprintf(output, "}\n");
+}
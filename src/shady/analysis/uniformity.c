@@ -0,0 +1,413 @@
+#include "uniformity.h"
+#include "leak.h"
+
+#include "log.h"
+#include "list.h"
+#include "dict.h"
+
+#include "../type.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+KeyHash hash_node(const Node**);
+bool compare_node(const Node**, const Node**);
+
+typedef struct Region_ Region;
+
+/// The body of a structured construct, nested in the body of another one (or at the top level of a basic block)
+struct Region_ {
+    const Node* let;
+    const Node* construct;
+    /// Selects which body of the construct runs: if it diverges, so does everything merging back out of it.
+    const Node* guard;
+    /// Set on loops some threads leave earlier than others, anything they stored in there can't be trusted afterwards.
+    bool divergent_exits;
+    Region* parent;
+};
+
+typedef struct {
+    Scope* scope;
+    const UsesMap* uses;
+
+    /// Innermost region of each CF node, indexed by rpo_index
+    Region** regions;
+    Region* regions_storage;
+
+    /// Varying-typed variables we know how to analyse, everything else is trusted to be what its type says
+    struct Dict* candidates;
+    struct Dict* divergent;
+    /// Thread-private slots that are only ever loaded from and stored to directly, i.e. the phis left behind by
+    /// the restructuring passes. Loading from one is uniform if every store to it was, under uniform control flow.
+    struct Dict* tracked_slots;
+    struct Dict* divergent_slots;
+    /// Set once any branch or switch diverges, at which point we give up on tracking basic block parameters
+    bool divergent_jumps;
+    bool changed;
+} Context;
+
+static bool is_divergent(Context* ctx, const Node* value) {
+    if (is_qualified_type_uniform(value->type))
+        return false;
+    if (value->tag != Variable_TAG || !find_key_dict(const Node*, ctx->candidates, value))
+        return true;
+    return find_key_dict(const Node*, ctx->divergent, value);
+}
+
+static bool any_divergent(Context* ctx, Nodes values) {
+    for (size_t i = 0; i < values.count; i++)
+        if (is_divergent(ctx, values.nodes[i]))
+            return true;
+    return false;
+}
+
+static void mark_divergent(Context* ctx, const Node* var) {
+    if (!find_key_dict(const Node*, ctx->candidates, var))
+        return;
+    if (insert_set_get_result(const Node*, ctx->divergent, var))
+        ctx->changed = true;
+}
+
+static void mark_all_divergent(Context* ctx, Nodes vars) {
+    for (size_t i = 0; i < vars.count; i++)
+        mark_divergent(ctx, vars.nodes[i]);
+}
+
+static void merge_values(Context* ctx, Nodes dst, Nodes values, bool diverged) {
+    assert(dst.count == values.count);
+    for (size_t i = 0; i < dst.count; i++)
+        if (diverged || is_divergent(ctx, values.nodes[i]))
+            mark_divergent(ctx, dst.nodes[i]);
+}
+
+static void mark_divergent_slot(Context* ctx, const Node* slot) {
+    if (insert_set_get_result(const Node*, ctx->divergent_slots, slot))
+        ctx->changed = true;
+}
+
+static bool is_slot_divergent(Context* ctx, const Node* slot) {
+    return ctx->divergent_jumps || find_key_dict(const Node*, ctx->divergent_slots, slot);
+}
+
+/// Did the control flow diverge between entering @p outer and reaching @p inner ?
+static bool regions_diverge(Context* ctx, Region* inner, Region* outer) {
+    for (Region* r = inner; r; r = r->parent) {
+        if (r->guard && is_divergent(ctx, r->guard))
+            return true;
+        if (r == outer)
+            break;
+    }
+    return false;
+}
+
+/// Threads leaving @p outer from @p inner diverged, which makes every loop on the way exit divergently.
+static void mark_divergent_exits(Context* ctx, Region* inner, Region* outer) {
+    for (Region* r = inner; r; r = r->parent) {
+        if (r->construct->tag == Loop_TAG && !r->divergent_exits) {
+            r->divergent_exits = true;
+            ctx->changed = true;
+        }
+        if (r == outer)
+            break;
+    }
+}
+
+/// Could the threads that get there disagree about what got stored in thread-private memory from @p region ?
+static bool stores_diverge(Context* ctx, Region* region) {
+    for (Region* r = region; r; r = r->parent) {
+        if (r->divergent_exits)
+            return true;
+    }
+    return regions_diverge(ctx, region, NULL);
+}
+
+static void merge_exit(Context* ctx, Region* region, Region* target, Nodes dst, Nodes values) {
+    bool diverged = regions_diverge(ctx, region, target);
+    if (diverged)
+        mark_divergent_exits(ctx, region, target);
+    merge_values(ctx, dst, values, diverged);
+}
+
+static Region* find_enclosing_construct(Region* r, NodeTag tag0, NodeTag tag1, NodeTag tag2) {
+    for (; r; r = r->parent) {
+        NodeTag tag = r->construct->tag;
+        if (tag == tag0 || tag == tag1 || tag == tag2)
+            return r;
+    }
+    return NULL;
+}
+
+static Region* find_control(Region* r, const Node* jp) {
+    for (; r; r = r->parent) {
+        if (r->construct->tag == Control_TAG && first(get_abstraction_params(r->construct->payload.control.inside)) == jp)
+            return r;
+    }
+    return NULL;
+}
+
+static Nodes get_construct_results(Region* r) {
+    return get_abstraction_params(get_let_tail(r->let));
+}
+
+static const Node* get_guard(const Node* construct) {
+    switch (construct->tag) {
+        case If_TAG: return construct->payload.if_instr.condition;
+        case Match_TAG: return construct->payload.match_instr.inspect;
+        default: return NULL;
+    }
+}
+
+/// Whether the result of a primop is uniform as soon as its operands are.
+static bool preserves_uniformity(const Node* instruction) {
+    PrimOp payload = instruction->payload.prim_op;
+    if (get_primop_class(payload.op) & (OcArithmetic | OcLogic | OcCompare | OcShift | OcMath))
+        return true;
+    switch (payload.op) {
+        case quote_op:
+        case select_op:
+        case convert_op:
+        case reinterpret_op:
+        case extract_op:
+        case extract_dynamic_op:
+        case insert_op:
+        case lea_op:
+            return true;
+        case load_op: {
+            const Type* ptr_type = first(payload.operands)->type;
+            deconstruct_qualified_type(&ptr_type);
+            deconstruct_maybe_packed_type(&ptr_type);
+            assert(ptr_type->tag == PtrType_TAG);
+            return is_addr_space_uniform(instruction->arena, ptr_type->payload.ptr_type.address_space);
+        }
+        default: return false;
+    }
+}
+
+static const Node* get_tracked_slot(Context* ctx, const Node* ptr) {
+    if (find_key_dict(const Node*, ctx->tracked_slots, ptr))
+        return ptr;
+    return NULL;
+}
+
+static void visit_let(Context* ctx, Region* region, const Node* let) {
+    const Node* instruction = get_let_instruction(let);
+    Nodes results = get_abstraction_params(get_let_tail(let));
+    switch (instruction->tag) {
+        case PrimOp_TAG: {
+            Nodes operands = instruction->payload.prim_op.operands;
+            const Node* slot = operands.count > 0 ? get_tracked_slot(ctx, first(operands)) : NULL;
+            if (slot && instruction->payload.prim_op.op == load_op) {
+                if (is_slot_divergent(ctx, slot))
+                    mark_all_divergent(ctx, results);
+                break;
+            }
+            if (slot && instruction->payload.prim_op.op == store_op) {
+                if (is_divergent(ctx, operands.nodes[1]) || stores_diverge(ctx, region))
+                    mark_divergent_slot(ctx, slot);
+                break;
+            }
+            if (!preserves_uniformity(instruction) || any_divergent(ctx, instruction->payload.prim_op.operands))
+                mark_all_divergent(ctx, results);
+            break;
+        }
+        case If_TAG:
+        case Match_TAG:
+            if (is_divergent(ctx, get_guard(instruction)))
+                mark_all_divergent(ctx, results);
+            break;
+        case Loop_TAG:
+            merge_values(ctx, get_abstraction_params(instruction->payload.loop_instr.body), instruction->payload.loop_instr.initial_args, false);
+            break;
+        case Control_TAG:
+            // if the join point escapes, we can't see all the places the results come from
+            if (!is_control_static(ctx->uses, instruction))
+                mark_all_divergent(ctx, results);
+            break;
+        case Block_TAG: break;
+        default:
+            mark_all_divergent(ctx, results);
+            break;
+    }
+}
+
+static void mark_divergent_jumps(Context* ctx, bool diverged) {
+    if (diverged && !ctx->divergent_jumps) {
+        ctx->divergent_jumps = true;
+        ctx->changed = true;
+    }
+}
+
+static void visit_jump(Context* ctx, Region* region, const Node* jump, bool diverged) {
+    const Node* target = jump->payload.jump.target;
+    diverged |= regions_diverge(ctx, region, NULL);
+    mark_divergent_jumps(ctx, diverged);
+    merge_values(ctx, get_abstraction_params(target), jump->payload.jump.args, diverged);
+}
+
+static void visit_cf_node(Context* ctx, CFNode* node) {
+    Region* region = ctx->regions[node->rpo_index];
+    const Node* terminator = get_abstraction_body(node->node);
+    if (!terminator)
+        return;
+
+    if (ctx->divergent_jumps && node->node->tag == BasicBlock_TAG)
+        mark_all_divergent(ctx, get_abstraction_params(node->node));
+
+    switch (is_terminator(terminator)) {
+        case Let_TAG: visit_let(ctx, region, terminator); break;
+        case Jump_TAG: visit_jump(ctx, region, terminator, false); break;
+        case Branch_TAG: {
+            bool diverged = is_divergent(ctx, terminator->payload.branch.branch_condition);
+            visit_jump(ctx, region, terminator->payload.branch.true_jump, diverged);
+            visit_jump(ctx, region, terminator->payload.branch.false_jump, diverged);
+            break;
+        }
+        case Switch_TAG: {
+            bool diverged = is_divergent(ctx, terminator->payload.br_switch.switch_value);
+            for (size_t i = 0; i < terminator->payload.br_switch.case_jumps.count; i++)
+                visit_jump(ctx, region, terminator->payload.br_switch.case_jumps.nodes[i], diverged);
+            visit_jump(ctx, region, terminator->payload.br_switch.default_jump, diverged);
+            break;
+        }
+        case Yield_TAG: {
+            Region* target = find_enclosing_construct(region, If_TAG, Match_TAG, Block_TAG);
+            if (!target)
+                break;
+            merge_exit(ctx, region, target, get_construct_results(target), terminator->payload.yield.args);
+            break;
+        }
+        case MergeContinue_TAG: {
+            Region* target = find_enclosing_construct(region, Loop_TAG, Loop_TAG, Loop_TAG);
+            if (!target)
+                break;
+            Nodes params = get_abstraction_params(target->construct->payload.loop_instr.body);
+            merge_values(ctx, params, terminator->payload.merge_continue.args, regions_diverge(ctx, region, target));
+            break;
+        }
+        case MergeBreak_TAG: {
+            // threads that break out at different iterations see different values, even if each iteration was uniform
+            Region* target = find_enclosing_construct(region, Loop_TAG, Loop_TAG, Loop_TAG);
+            if (!target)
+                break;
+            merge_exit(ctx, region, target, get_construct_results(target), terminator->payload.merge_break.args);
+            break;
+        }
+        case Join_TAG: {
+            Region* target = find_control(region, terminator->payload.join.join_point);
+            if (!target)
+                break;
+            merge_exit(ctx, region, target, get_construct_results(target), terminator->payload.join.args);
+            break;
+        }
+        default: break;
+    }
+}
+
+/// Only slots that never escape can be tracked: all their uses are as the address of a load or a store.
+static bool is_trackable_slot(Context* ctx, const Node* slot) {
+    for (const Use* use = get_first_use(ctx->uses, slot); use; use = use->next_use) {
+        if (use->operand_class == NcVariable)
+            continue;
+        const Node* user = use->user;
+        if (user->tag != PrimOp_TAG || first(user->payload.prim_op.operands) != slot)
+            return false;
+        switch (user->payload.prim_op.op) {
+            case load_op: continue;
+            case store_op: if (user->payload.prim_op.operands.nodes[1] != slot) continue; return false;
+            default: return false;
+        }
+    }
+    return true;
+}
+
+static void add_candidates(Context* ctx, Nodes vars) {
+    for (size_t i = 0; i < vars.count; i++) {
+        if (!is_qualified_type_uniform(vars.nodes[i]->type))
+            insert_set_get_result(const Node*, ctx->candidates, vars.nodes[i]);
+    }
+}
+
+static void compute_regions(Context* ctx) {
+    Scope* scope = ctx->scope;
+    for (size_t i = 0; i < scope->size; i++) {
+        CFNode* node = scope->rpo[i];
+        assert(node->rpo_index == i);
+        const Node* abs = node->node;
+        ctx->regions[i] = NULL;
+        for (size_t j = 0; j < entries_count_list(node->pred_edges); j++) {
+            CFEdge edge = read_list(CFEdge, node->pred_edges)[j];
+            // structured edges always come from a node that dominates us, and so has already been visited
+            if (edge.type == StructuredEnterBodyEdge) {
+                const Node* let = get_abstraction_body(edge.src->node);
+                Region* region = &ctx->regions_storage[i];
+                *region = (Region) {
+                    .let = let,
+                    .construct = get_let_instruction(let),
+                    .guard = get_guard(get_let_instruction(let)),
+                    .parent = ctx->regions[edge.src->rpo_index],
+                };
+                ctx->regions[i] = region;
+                break;
+            } else if (edge.type == LetTailEdge || edge.type == StructuredPseudoExitEdge) {
+                ctx->regions[i] = ctx->regions[edge.src->rpo_index];
+                break;
+            }
+        }
+
+        if (abs->tag == BasicBlock_TAG)
+            add_candidates(ctx, get_abstraction_params(abs));
+        const Node* terminator = get_abstraction_body(abs);
+        if (terminator && terminator->tag == Let_TAG) {
+            add_candidates(ctx, get_abstraction_params(get_let_tail(terminator)));
+            const Node* instruction = get_let_instruction(terminator);
+            if (instruction->tag == Loop_TAG)
+                add_candidates(ctx, get_abstraction_params(instruction->payload.loop_instr.body));
+            if (instruction->tag == PrimOp_TAG && (instruction->payload.prim_op.op == alloca_logical_op || instruction->payload.prim_op.op == alloca_op)) {
+                const Node* slot = first(get_abstraction_params(get_let_tail(terminator)));
+                if (is_trackable_slot(ctx, slot))
+                    insert_set_get_result(const Node*, ctx->tracked_slots, slot);
+            }
+        }
+    }
+}
+
+struct Dict* compute_uniform_variables(Scope* scope, const UsesMap* uses) {
+    Context ctx = {
+        .scope = scope,
+        .uses = uses,
+        .regions = calloc(scope->size, sizeof(Region*)),
+        .regions_storage = calloc(scope->size, sizeof(Region)),
+        .candidates = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+        .divergent = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+        .tracked_slots = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+        .divergent_slots = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+    };
+
+    compute_regions(&ctx);
+
+    // Optimistically assume all the candidates are uniform, and only ever move them to the divergent set.
+    size_t iterations = 0;
+    do {
+        ctx.changed = false;
+        for (size_t i = 0; i < scope->size; i++)
+            visit_cf_node(&ctx, scope->rpo[i]);
+        iterations++;
+    } while (ctx.changed);
+
+    struct Dict* uniform = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node);
+    size_t i = 0;
+    const Node* var;
+    while (dict_iter(ctx.candidates, &i, &var, NULL)) {
+        if (!find_key_dict(const Node*, ctx.divergent, var))
+            insert_set_get_result(const Node*, uniform, var);
+    }
+    debugv_print("Uniformity analysis of %s: %zu out of %zu varying variables are uniform (%zu iterations)\n", get_abstraction_name(scope->entry->node), entries_count_dict(uniform), entries_count_dict(ctx.candidates), iterations);
+
+    destroy_dict(ctx.candidates);
+    destroy_dict(ctx.divergent);
+    destroy_dict(ctx.tracked_slots);
+    destroy_dict(ctx.divergent_slots);
+    free(ctx.regions);
+    free(ctx.regions_storage);
+    return uniform;
+}
@@ -0,0 +1,15 @@
+#ifndef SHADY_UNIFORMITY_H
+#define SHADY_UNIFORMITY_H
+
+#include "shady/ir.h"
+
+#include "scope.h"
+#include "uses.h"
+
+/// Divergence analysis: finds the variables of a function that are uniform even though their type says they are varying.
+/// This is a fixpoint over the scope that tracks sync dependence: values merged by structured control flow (or by jumps)
+/// are only divergent if they are divergent themselves, or if the control flow reaching the merge diverged.
+/// @returns @ref Dict set of the varying-typed @ref Variable nodes that are in fact uniform.
+struct Dict* compute_uniform_variables(Scope*, const UsesMap*);
+
+#endif
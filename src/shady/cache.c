@@ -0,0 +1,408 @@
+#include "ir_private.h"
+
+#include "log.h"
+#include "list.h"
+#include "growy.h"
+#include "util.h"
+#include "portability.h"
+
+#include "murmur3.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#define utime _utime
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+// embedded in compile.c
+extern const char shady_scheduler_src[];
+
+// Every entry is one file, named after the hex digits of its key. It holds a header, the SPIR-V and optionally the
+// module it was emitted from in the .shdb format, followed by that module's name. Entries are written under a
+// unique temporary name first and then renamed, so a concurrent reader never sees a partial one.
+//
+// Recency is tracked with the modification time of the files: hits touch their entry, and eviction removes the
+// oldest ones first.
+
+#define CACHE_ENTRY_MAGIC 0x43444853 // 'SHDC'
+#define CACHE_VERSION 1
+#define CACHE_ENTRY_EXTENSION ".shc"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    CompilationCacheKey key;
+    uint32_t spirv_size;
+    uint32_t module_size;
+    uint32_t module_name_size;
+    ArenaConfig module_arena_config;
+} CacheEntryHeader;
+
+static_assert(sizeof(CacheEntryHeader) % 4 == 0, "the SPIR-V and the module that follow the header need to be word-aligned");
+
+struct CompilationCache_ {
+    CompilationCacheConfig config;
+    CompilationCacheStats stats;
+};
+
+CompilationCacheConfig default_compilation_cache_config() {
+    return (CompilationCacheConfig) {
+        .path = NULL,
+        .max_entries = 1024,
+        .max_size = 256 * 1024 * 1024,
+    };
+}
+
+static bool make_directory(String path) {
+#ifdef _WIN32
+    return _mkdir(path) == 0 || GetFileAttributesA(path) & FILE_ATTRIBUTE_DIRECTORY;
+#else
+    struct stat st;
+    return mkdir(path, 0755) == 0 || (stat(path, &st) == 0 && S_ISDIR(st.st_mode));
+#endif
+}
+
+CompilationCache* open_compilation_cache(CompilationCacheConfig config) {
+    assert(config.path);
+    if (!make_directory(config.path)) {
+        error_print("Could not create the compilation cache directory '%s'\n", config.path);
+        return NULL;
+    }
+    CompilationCache* cache = calloc(1, sizeof(CompilationCache));
+    cache->config = config;
+    cache->config.path = format_string_new("%s", config.path);
+    return cache;
+}
+
+void close_compilation_cache(CompilationCache* cache) {
+    debug_print("Compilation cache: %zu hits, %zu misses, %zu stores, %zu evictions\n", cache->stats.hits, cache->stats.misses, cache->stats.stores, cache->stats.evictions);
+    free((void*) cache->config.path);
+    free(cache);
+}
+
+CompilationCacheStats get_compilation_cache_stats(const CompilationCache* cache) {
+    return cache->stats;
+}
+
+#define HASH_FIELD(g, field) growy_append_bytes(g, sizeof(field), (const char*) &(field))
+
+static void hash_arena_config(Growy* g, const ArenaConfig* config) {
+    HASH_FIELD(g, config->name_bound);
+    HASH_FIELD(g, config->check_op_classes);
+    HASH_FIELD(g, config->check_types);
+    HASH_FIELD(g, config->allow_fold);
+    HASH_FIELD(g, config->untyped_ptrs);
+    HASH_FIELD(g, config->validate_builtin_types);
+    HASH_FIELD(g, config->is_simt);
+    HASH_FIELD(g, config->allow_subgroup_memory);
+    HASH_FIELD(g, config->allow_shared_memory);
+    HASH_FIELD(g, config->specializations.subgroup_mask_representation);
+    HASH_FIELD(g, config->specializations.subgroup_size);
+    HASH_FIELD(g, config->specializations.workgroup_size);
+    HASH_FIELD(g, config->memory.ptr_size);
+    HASH_FIELD(g, config->memory.word_size);
+    HASH_FIELD(g, config->optimisations.delete_unreachable_structured_cases);
+}
+
+/// Logging settings and hooks are left out, they don't change the output
+static void hash_compiler_config(Growy* g, const CompilerConfig* config) {
+    HASH_FIELD(g, config->dynamic_scheduling);
+    HASH_FIELD(g, config->per_thread_stack_size);
+    HASH_FIELD(g, config->target_spirv_version.major);
+    HASH_FIELD(g, config->target_spirv_version.minor);
+
+    HASH_FIELD(g, config->lower.emulate_subgroup_ops);
+    HASH_FIELD(g, config->lower.emulate_subgroup_ops_extended_types);
+    HASH_FIELD(g, config->lower.emulate_subgroup_shuffles);
+    HASH_FIELD(g, config->lower.emulate_subgroup_partition);
+    HASH_FIELD(g, config->lower.simt_to_explicit_simd);
+    HASH_FIELD(g, config->lower.host_dispatched_workgroups);
+    HASH_FIELD(g, config->lower.int64);
+    HASH_FIELD(g, config->lower.decay_ptrs);
+    HASH_FIELD(g, config->lower.emulated_private_memory_word_size);
+    HASH_FIELD(g, config->lower.switch_lowering);
+
+    HASH_FIELD(g, config->hacks.spv_shuffle_instead_of_broadcast_first);
+    HASH_FIELD(g, config->hacks.force_join_point_lifting);
+    HASH_FIELD(g, config->hacks.no_physical_global_ptrs);
+
+    HASH_FIELD(g, config->optimisations.cleanup.after_every_pass);
+    HASH_FIELD(g, config->optimisations.cleanup.delete_unused_instructions);
+    HASH_FIELD(g, config->optimisations.per_entry_point_dispatchers);
+    HASH_FIELD(g, config->optimisations.partitioned_forks);
+    HASH_FIELD(g, config->optimisations.unroll.full_unroll_budget);
+    HASH_FIELD(g, config->optimisations.unroll.partial_unroll_factor);
+    HASH_FIELD(g, config->optimisations.spirv.compact);
+    HASH_FIELD(g, config->optimisations.spirv.strip_names);
+    // emission_threads is left out too, the module is the same no matter how many threads emit it
+
+    HASH_FIELD(g, config->printf_trace.memory_accesses);
+    HASH_FIELD(g, config->printf_trace.stack_accesses);
+    HASH_FIELD(g, config->printf_trace.god_function);
+    HASH_FIELD(g, config->printf_trace.stack_size);
+    HASH_FIELD(g, config->printf_trace.subgroup_ops);
+
+    HASH_FIELD(g, config->shader_diagnostics.max_top_iterations);
+
+    // the terminator keeps "no entry point" distinct from an empty name
+    if (config->specialization.entry_point)
+        growy_append_bytes(g, strlen(config->specialization.entry_point) + 1, config->specialization.entry_point);
+    HASH_FIELD(g, config->specialization.execution_model);
+    HASH_FIELD(g, config->specialization.subgroup_size);
+}
+
+CompilationCacheKey compute_compilation_cache_key_from_data(const CompilerConfig* config, ArenaConfig arena_config, size_t module_size, const char* module_data) {
+    Growy* g = new_growy();
+    uint32_t version = CACHE_VERSION;
+    HASH_FIELD(g, version);
+    // a different build of the compiler might not emit the same thing, the scheduler it links in included
+    growy_append_bytes(g, strlen(SHADY_BUILD_ID) + 1, SHADY_BUILD_ID);
+    growy_append_string(g, shady_scheduler_src);
+    hash_arena_config(g, &arena_config);
+    hash_compiler_config(g, config);
+    growy_append_bytes(g, module_size, module_data);
+
+    CompilationCacheKey key;
+    MurmurHash3_x64_128(growy_data(g), (int) growy_size(g), 0x1234567, key.words);
+    destroy_growy(g);
+    return key;
+}
+
+CompilationCacheKey compute_compilation_cache_key(const CompilerConfig* config, Module* mod) {
+    size_t module_size;
+    char* module_data;
+    serialize_module(mod, &module_size, &module_data);
+    CompilationCacheKey key = compute_compilation_cache_key_from_data(config, get_arena_config(get_module_arena(mod)), module_size, module_data);
+    free(module_data);
+    return key;
+}
+
+static char* get_entry_path(CompilationCache* cache, CompilationCacheKey key) {
+    return format_string_new("%s/%08x%08x%08x%08x" CACHE_ENTRY_EXTENSION, cache->config.path, key.words[0], key.words[1], key.words[2], key.words[3]);
+}
+
+/// Another process or thread might be storing the same entry, so each writer gets a file of its own
+static char* create_temp_file(String path) {
+#ifdef _WIN32
+    return format_string_new("%s.%lu.%lu.tmp", path, GetCurrentProcessId(), GetCurrentThreadId());
+#else
+    char* temp_path = format_string_new("%s.XXXXXX", path);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        free(temp_path);
+        return NULL;
+    }
+    // mkstemp only lets the owner read it, keep the entries readable by everyone like the cache directory
+    fchmod(fd, 0644);
+    close(fd);
+    return temp_path;
+#endif
+}
+
+bool lookup_compilation_cache(CompilationCache* cache, CompilationCacheKey key, size_t* spirv_size, char** spirv, Module** final_mod) {
+    char* path = get_entry_path(cache, key);
+    size_t size;
+    char* data;
+    if (!read_file(path, &size, &data)) {
+        debug_print("Compilation cache miss: %s\n", path);
+        cache->stats.misses++;
+        free(path);
+        return false;
+    }
+
+    CacheEntryHeader header;
+    bool valid = size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, data, sizeof(header));
+        valid = header.magic == CACHE_ENTRY_MAGIC && header.version == CACHE_VERSION && memcmp(&header.key, &key, sizeof(key)) == 0;
+        valid &= (size_t) header.spirv_size + header.module_size + header.module_name_size == size - sizeof(header);
+    }
+    if (!valid) {
+        warn_print("Compilation cache entry %s is corrupt, removing it\n", path);
+        remove(path);
+        goto miss;
+    }
+    if (final_mod && header.module_size == 0)
+        goto miss;
+
+    const char* module_data = data + sizeof(header) + header.spirv_size;
+    if (final_mod) {
+        String name = format_string_new("%.*s", (int) header.module_name_size, module_data + header.module_size);
+        IrArena* arena = new_ir_arena(header.module_arena_config);
+        Module* mod = new_module(arena, name);
+        free((void*) name);
+        if (!deserialize_module(mod, header.module_size, module_data)) {
+            destroy_ir_arena(arena);
+            warn_print("Compilation cache entry %s has a module that can't be loaded, removing it\n", path);
+            remove(path);
+            goto miss;
+        }
+        *final_mod = mod;
+    }
+
+    *spirv_size = header.spirv_size;
+    *spirv = malloc(header.spirv_size);
+    memcpy(*spirv, data + sizeof(header), header.spirv_size);
+    free(data);
+
+    utime(path, NULL);
+    debug_print("Compilation cache hit: %s\n", path);
+    cache->stats.hits++;
+    free(path);
+    return true;
+
+    miss:
+    debug_print("Compilation cache miss: %s\n", path);
+    cache->stats.misses++;
+    free(data);
+    free(path);
+    return false;
+}
+
+typedef struct {
+    char* path;
+    size_t size;
+    time_t last_used;
+} CacheEntryInfo;
+
+static struct List* list_entries(CompilationCache* cache) {
+    struct List* entries = new_list(CacheEntryInfo);
+#ifdef _WIN32
+    char* pattern = format_string_new("%s/*" CACHE_ENTRY_EXTENSION, cache->config.path);
+    WIN32_FIND_DATAA found;
+    HANDLE handle = FindFirstFileA(pattern, &found);
+    free(pattern);
+    if (handle == INVALID_HANDLE_VALUE)
+        return entries;
+    do {
+        ULARGE_INTEGER time = { .LowPart = found.ftLastWriteTime.dwLowDateTime, .HighPart = found.ftLastWriteTime.dwHighDateTime };
+        CacheEntryInfo info = {
+            .path = format_string_new("%s/%s", cache->config.path, found.cFileName),
+            .size = ((size_t) found.nFileSizeHigh << 32) | found.nFileSizeLow,
+            .last_used = (time_t) (time.QuadPart / 10000000),
+        };
+        append_list(CacheEntryInfo, entries, info);
+    } while (FindNextFileA(handle, &found));
+    FindClose(handle);
+#else
+    DIR* dir = opendir(cache->config.path);
+    if (!dir)
+        return entries;
+    struct dirent* dirent;
+    while ((dirent = readdir(dir))) {
+        if (!string_ends_with(dirent->d_name, CACHE_ENTRY_EXTENSION))
+            continue;
+        char* path = format_string_new("%s/%s", cache->config.path, dirent->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            free(path);
+            continue;
+        }
+        CacheEntryInfo info = { .path = path, .size = st.st_size, .last_used = st.st_mtime };
+        append_list(CacheEntryInfo, entries, info);
+    }
+    closedir(dir);
+#endif
+    return entries;
+}
+
+static int compare_entries_by_age(const CacheEntryInfo* a, const CacheEntryInfo* b) {
+    if (a->last_used != b->last_used)
+        return a->last_used < b->last_used ? -1 : 1;
+    return strcmp(a->path, b->path);
+}
+
+static void evict_entries(CompilationCache* cache) {
+    struct List* entries = list_entries(cache);
+    CacheEntryInfo* infos = read_list(CacheEntryInfo, entries);
+    size_t count = entries_count_list(entries);
+    qsort(infos, count, sizeof(CacheEntryInfo), (int(*)(const void*, const void*)) compare_entries_by_age);
+
+    size_t total_size = 0;
+    for (size_t i = 0; i < count; i++)
+        total_size += infos[i].size;
+
+    size_t live = count;
+    for (size_t i = 0; i < count; i++) {
+        bool too_many = cache->config.max_entries > 0 && live > cache->config.max_entries;
+        bool too_big = cache->config.max_size > 0 && total_size > cache->config.max_size;
+        if (!too_many && !too_big)
+            break;
+        if (remove(infos[i].path) == 0) {
+            debug_print("Compilation cache: evicted %s\n", infos[i].path);
+            cache->stats.evictions++;
+            live--;
+            total_size -= infos[i].size;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+        free(infos[i].path);
+    destroy_list(entries);
+}
+
+void store_in_compilation_cache(CompilationCache* cache, CompilationCacheKey key, size_t spirv_size, const char* spirv, Module* final_mod) {
+    assert(spirv_size % 4 == 0);
+    CacheEntryHeader header = {
+        .magic = CACHE_ENTRY_MAGIC,
+        .version = CACHE_VERSION,
+        .key = key,
+        .spirv_size = spirv_size,
+    };
+
+    size_t module_size = 0;
+    char* module_data = NULL;
+    String module_name = NULL;
+    if (final_mod) {
+        serialize_module(final_mod, &module_size, &module_data);
+        module_name = get_module_name(final_mod);
+        header.module_size = module_size;
+        header.module_name_size = strlen(module_name);
+        header.module_arena_config = get_arena_config(get_module_arena(final_mod));
+    }
+
+    size_t size = sizeof(header) + spirv_size + header.module_size + header.module_name_size;
+    if (cache->config.max_size > 0 && size > cache->config.max_size) {
+        free(module_data);
+        return;
+    }
+
+    Growy* g = new_growy();
+    growy_append_object(g, header);
+    growy_append_bytes(g, spirv_size, spirv);
+    if (final_mod) {
+        growy_append_bytes(g, module_size, module_data);
+        growy_append_bytes(g, header.module_name_size, module_name);
+    }
+    free(module_data);
+
+    char* path = get_entry_path(cache, key);
+    char* temp_path = create_temp_file(path);
+    bool written = temp_path && write_file(temp_path, growy_size(g), growy_data(g));
+    destroy_growy(g);
+    // rename() does not replace existing files on every platform, whoever was first wrote the same contents anyway
+    if (!written || rename(temp_path, path) != 0) {
+        if (temp_path)
+            remove(temp_path);
+        if (!written)
+            warn_print("Could not write the compilation cache entry %s\n", path);
+    } else {
+        cache->stats.stores++;
+        debug_print("Compilation cache: stored %s\n", path);
+    }
+    free(temp_path);
+    free(path);
+
+    evict_entries(cache);
+}
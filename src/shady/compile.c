@@ -9,6 +9,12 @@
 #include "util.h"
 
 #include <stdbool.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#if SHADY_HAS_THREADS
+#include <pthread.h>
+#endif
 
 #define KiB * 1024
 #define MiB * 1024 KiB
@@ -23,6 +29,13 @@ CompilerConfig default_compiler_config() {
             .minor = 4
         },
 
+        .lower = {
+            .emulated_private_memory_word_size = IntTy32,
+            .switch_lowering = SwitchLoweringDensity,
+            // partitions are an NVidia extension
+            .emulate_subgroup_partition = true,
+        },
+
         .logging = {
             // most of the time, we are not interested in seeing generated & internal code in the debug output
             .skip_internal = true,
@@ -33,7 +46,11 @@ CompilerConfig default_compiler_config() {
             .cleanup = {
                 .after_every_pass = true,
                 .delete_unused_instructions = true,
-            }
+            },
+            .unroll = {
+                .full_unroll_budget = 128,
+                .partial_unroll_factor = 1,
+            },
         },
 
         .specialization = {
@@ -61,14 +78,51 @@ ArenaConfig default_arena_config() {
     };
 }
 
-CompilationResult run_compiler_passes(CompilerConfig* config, Module** pmod) {
-    if (config->dynamic_scheduling) {
+/// The builtin scheduler only gets parsed once per process for every combination of the arena settings that affect how
+/// nodes get constructed, and is then kept in binary form to be read into every module that needs it. A blob is never
+/// rewritten once built, and lives until the process exits, so it can be read after the lock is released.
+typedef struct {
+    char* data;
+    size_t size;
+} SchedulerBlob;
+
+static SchedulerBlob scheduler_cache[16];
+#if SHADY_HAS_THREADS
+static pthread_mutex_t scheduler_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static const SchedulerBlob* get_scheduler_blob(ArenaConfig config) {
+    size_t index = (config.name_bound ? 1 : 0) | (config.check_types ? 2 : 0) | (config.check_op_classes ? 4 : 0) | (config.allow_fold ? 8 : 0);
+    SchedulerBlob* blob = &scheduler_cache[index];
+#if SHADY_HAS_THREADS
+    pthread_mutex_lock(&scheduler_cache_lock);
+#endif
+    if (!blob->data) {
         debugv_print("Parsing builtin scheduler code");
+        IrArena* arena = new_ir_arena(config);
+        Module* scheduler = new_module(arena, "scheduler");
         ParserConfig pconfig = {
             .front_end = true,
         };
-        parse_shady_ir(pconfig, shady_scheduler_src, *pmod);
+        parse_shady_ir(pconfig, shady_scheduler_src, scheduler);
+        serialize_module(scheduler, &blob->size, &blob->data);
+        destroy_ir_arena(arena);
     }
+#if SHADY_HAS_THREADS
+    pthread_mutex_unlock(&scheduler_cache_lock);
+#endif
+    return blob;
+}
+
+static void import_scheduler(Module* mod) {
+    const SchedulerBlob* blob = get_scheduler_blob(get_arena_config(get_module_arena(mod)));
+    SHADY_UNUSED bool ok = deserialize_module(mod, blob->size, blob->data);
+    assert(ok);
+}
+
+CompilationResult run_compiler_passes(CompilerConfig* config, Module** pmod) {
+    if (config->dynamic_scheduling)
+        import_scheduler(*pmod);
 
     IrArena* initial_arena = (*pmod)->arena;
     Module* old_mod = NULL;
@@ -83,8 +137,10 @@ CompilationResult run_compiler_passes(CompilerConfig* config, Module** pmod) {
     RUN_PASS(infer_program)
 
     RUN_PASS(opt_inline_jumps)
+    RUN_PASS(opt_ipo)
 
     RUN_PASS(lcssa)
+    RUN_PASS(opt_unroll)
     RUN_PASS(reconvergence_heuristics)
 
     RUN_PASS(lower_cf_instrs)
@@ -107,6 +163,7 @@ CompilationResult run_compiler_passes(CompilerConfig* config, Module** pmod) {
     RUN_PASS(lower_switch_btree)
     RUN_PASS(opt_restructurize)
     RUN_PASS(opt_inline_jumps)
+    RUN_PASS(opt_uniformity)
 
     RUN_PASS(lower_mask)
     RUN_PASS(lower_memcpy)
@@ -119,15 +176,13 @@ CompilationResult run_compiler_passes(CompilerConfig* config, Module** pmod) {
     RUN_PASS(lower_physical_ptrs)
     RUN_PASS(lower_subgroup_vars)
     RUN_PASS(lower_memory_layout)
+    RUN_PASS(opt_load_store)
 
     if (config->lower.decay_ptrs)
         RUN_PASS(lower_decay_ptrs)
 
     RUN_PASS(lower_int)
 
-    if (config->lower.simt_to_explicit_simd)
-        RUN_PASS(simt2d)
-
     if (config->specialization.entry_point)
         RUN_PASS(specialize_entry_point)
     RUN_PASS(lower_fill)
@@ -32,7 +32,7 @@ static void post_construction_validation(IrArena* arena, Node* node) {
 
 static void pre_construction_validation(IrArena* arena, Node* node);
 
-static Node* create_node_helper(IrArena* arena, Node node, bool* pfresh) {
+static Node* create_node_helper_locked(IrArena* arena, Node node, bool* pfresh) {
     pre_construction_validation(arena, &node);
 
     if (pfresh)
@@ -71,6 +71,13 @@ static Node* create_node_helper(IrArena* arena, Node node, bool* pfresh) {
     return alloc;
 }
 
+static Node* create_node_helper(IrArena* arena, Node node, bool* pfresh) {
+    lock_ir_arena(arena);
+    Node* created = create_node_helper_locked(arena, node, pfresh);
+    unlock_ir_arena(arena);
+    return created;
+}
+
 #include "constructors_generated.c"
 
 const Node* let(IrArena* arena, const Node* instruction, const Node* tail) {
@@ -138,13 +138,18 @@ static void emit_global_variable_definition(Emitter* emitter, String prefix, Str
     if (!has_forward_declarations(emitter->config.dialect) || !init)
         return;
 
+    // the storage class has to match the definition (_Thread_local does not mix with a plain declaration)
     String declaration = emit_type(emitter, type, decl_center);
-    print(emitter->fn_decls, "\n%s;", declaration);
+    print(emitter->fn_decls, "\n%s%s;", prefix, declaration);
 }
 
 CTerm emit_value(Emitter* emitter, Printer* block_printer, const Node* value) {
     CTerm* found = lookup_existing_term(emitter, value);
-    if (found) return *found;
+    if (found) {
+        if (emitter->simd.lane && is_simd_varying(emitter, value->type))
+            return term_from_cvalue(emit_simd_lane_value(emitter, value->type, to_cvalue(emitter, *found), emitter->simd.lane));
+        return *found;
+    }
 
     String emitted = NULL;
 
@@ -166,6 +171,12 @@ CTerm emit_value(Emitter* emitter, Printer* block_printer, const Node* value) {
                     emitted = format_string_arena(emitter->arena->arena, "%sU", emitted);
                 if (is_long)
                     emitted = format_string_arena(emitter->arena->arena, "%sL", emitted);
+            } else if (emitter->config.dialect == C) {
+                // keep unsigned literals unsigned, shifting a plain int literal into its sign bit is undefined
+                if (is_long)
+                    emitted = format_string_arena(emitter->arena->arena, is_signed ? "%sll" : "%sull", emitted);
+                else if (!is_signed)
+                    emitted = format_string_arena(emitter->arena->arena, "%su", emitted);
             }
 
             break;
@@ -204,6 +215,9 @@ CTerm emit_value(Emitter* emitter, Printer* block_printer, const Node* value) {
             const Type* type = value->payload.composite.type;
             Nodes elements = value->payload.composite.contents;
 
+            if (!emitter->simd.lane && is_simd_varying(emitter, value->type))
+                return emit_simd_lanewise_value(emitter, block_printer, value);
+
             Growy* g = new_growy();
             Printer* p = open_growy_as_printer(g);
 
@@ -303,6 +317,12 @@ CTerm emit_value(Emitter* emitter, Printer* block_printer, const Node* value) {
                 }
             }
 
+            // explicit SIMD keeps one copy of private variables per lane
+            if (emitter->simd.width && decl->tag == GlobalVariable_TAG) {
+                if (!is_addr_space_uniform(emitter->arena, decl->payload.global_variable.address_space) && !is_decl_builtin(decl))
+                    return emit_simd_lanes_ref(emitter, lookup_existing_term(emitter, decl)->var);
+            }
+
             return *lookup_existing_term(emitter, decl);
         }
     }
@@ -333,7 +353,9 @@ void emit_variable_declaration(Emitter* emitter, Printer* block_printer, const T
             center = format_string_arena(emitter->arena->arena, "const %s", center);
             break;
         case C:
-            prefix = "register ";
+            // varying values get indexed by lane, which is not allowed on arrays in register storage
+            if (!is_simd_varying(emitter, t) || emitter->simd.lane)
+                prefix = "register ";
             center = format_string_arena(emitter->arena->arena, "const %s", center);
             break;
         case GLSL:
@@ -407,11 +429,24 @@ static void emit_terminator(Emitter* emitter, Printer* block_printer, const Node
                     default: assert(false);
                 }
             }
+
+            // lanes may have left through the control flow construct, what follows only runs for the others
+            bool reconverge = emitter->simd.width && !emitter->simd.lane && (instruction->tag == If_TAG || instruction->tag == Match_TAG || instruction->tag == Loop_TAG);
+            if (reconverge) {
+                emit_simd_reconverge(emitter, block_printer);
+                indent(block_printer);
+            }
             emit_terminator(emitter, block_printer, tail->payload.case_.body);
+            if (reconverge) {
+                deindent(block_printer);
+                print(block_printer, "\n}");
+            }
 
             break;
         }
         case Terminator_Return_TAG: {
+            if (emitter->simd.width && emit_simd_terminator(emitter, block_printer, terminator))
+                break;
             Nodes args = terminator->payload.fn_ret.args;
             if (args.count == 0) {
                 print(block_printer, "\nreturn;");
@@ -428,6 +463,8 @@ static void emit_terminator(Emitter* emitter, Printer* block_printer, const Node
             break;
         }
         case Yield_TAG: {
+            if (emitter->simd.width && emit_simd_terminator(emitter, block_printer, terminator))
+                break;
             Nodes args = terminator->payload.yield.args;
             Phis phis = emitter->phis.selection;
             assert(phis.count == args.count);
@@ -437,6 +474,8 @@ static void emit_terminator(Emitter* emitter, Printer* block_printer, const Node
             break;
         }
         case MergeContinue_TAG: {
+            if (emitter->simd.width && emit_simd_terminator(emitter, block_printer, terminator))
+                break;
             Nodes args = terminator->payload.merge_continue.args;
             Phis phis = emitter->phis.loop_continue;
             assert(phis.count == args.count);
@@ -446,6 +485,8 @@ static void emit_terminator(Emitter* emitter, Printer* block_printer, const Node
             break;
         }
         case MergeBreak_TAG: {
+            if (emitter->simd.width && emit_simd_terminator(emitter, block_printer, terminator))
+                break;
             Nodes args = terminator->payload.merge_break.args;
             Phis phis = emitter->phis.loop_break;
             assert(phis.count == args.count);
@@ -504,6 +545,14 @@ void emit_decl(Emitter* emitter, const Node* decl) {
     CType* found2 = lookup_existing_type(emitter, decl);
     if (found2) return;
 
+    if (emitter->simd.lane) {
+        // declarations are not emitted on behalf of a single lane
+        Emitter e = *emitter;
+        e.simd.lane = NULL;
+        emit_decl(&e, decl);
+        return;
+    }
+
     const char* name = legalize_c_identifier(emitter, get_decl_name(decl));
     const Type* decl_type = decl->type;
     const char* decl_center = name;
@@ -534,6 +583,10 @@ void emit_decl(Emitter* emitter, const Node* decl) {
                     break;
                 case AsSubgroupLogical:
                 case AsSubgroupPhysical:
+                    if (emitter->compiler_config->lower.host_dispatched_workgroups) {
+                        address_space_prefix = "_Thread_local ";
+                        break;
+                    }
                     switch (emitter->config.dialect) {
                         case C:
                         case GLSL:
@@ -547,6 +600,11 @@ void emit_decl(Emitter* emitter, const Node* decl) {
                     break;
                 case AsPrivatePhysical:
                 case AsPrivateLogical:
+                    // each host thread runs whole workgroups, one invocation at a time
+                    if (emitter->compiler_config->lower.host_dispatched_workgroups) {
+                        address_space_prefix = "_Thread_local ";
+                        break;
+                    }
                     address_space_prefix = "";
                 case AsGlobalLogical:
                 case AsGlobalPhysical:
@@ -554,6 +612,10 @@ void emit_decl(Emitter* emitter, const Node* decl) {
                     break;
                 case AsSharedPhysical:
                 case AsSharedLogical:
+                    if (emitter->compiler_config->lower.host_dispatched_workgroups) {
+                        address_space_prefix = "_Thread_local ";
+                        break;
+                    }
                     switch (emitter->config.dialect) {
                         case C:
                             break;
@@ -566,7 +628,8 @@ void emit_decl(Emitter* emitter, const Node* decl) {
                     }
                     break;
                 case AsExternal:
-                    address_space_prefix = "extern ";
+                    // the host finds those in the compiled library, so we need to define them
+                    address_space_prefix = emitter->compiler_config->lower.host_dispatched_workgroups ? "" : "extern ";
                     break;
                 case AsInput:
                 case AsUInput:
@@ -592,6 +655,20 @@ void emit_decl(Emitter* emitter, const Node* decl) {
 
             register_emitted(emitter, decl, emit_as);
 
+            if (emitter->simd.width && !uniform) {
+                decl_center = format_string_arena(emitter->arena->arena, "%s[%zu]", decl_center, emitter->simd.width);
+                if (init) {
+                    Growy* g = new_growy();
+                    Printer* p = open_growy_as_printer(g);
+                    for (size_t i = 0; i < emitter->simd.width; i++)
+                        print(p, i + 1 < emitter->simd.width ? "%s, " : "%s", init);
+                    growy_append_bytes(g, 1, "\0");
+                    init = format_string_arena(emitter->arena->arena, "{ %s }", growy_data(g));
+                    destroy_growy(g);
+                    destroy_printer(p);
+                }
+            }
+
             emit_global_variable_definition(emitter, address_space_prefix, decl_center, decl_type, uniform, false, init);
             return;
         }
@@ -611,7 +688,7 @@ void emit_decl(Emitter* emitter, const Node* decl) {
                     register_emitted(emitter, decl->payload.fun.params.nodes[i], term_from_cvalue(param_name));
                 }
 
-                String fn_body = emit_lambda_body(emitter, body, NULL);
+                String fn_body = emitter->simd.width ? emit_simd_fn_body(emitter, decl) : emit_lambda_body(emitter, body, NULL);
                 String free_me = fn_body;
                 if (emitter->config.dialect == ISPC) {
                     // ISPC hack: This compiler (like seemingly all LLVM-based compilers) has broken handling of the execution mask - it fails to generated masked stores for the entry BB of a function that may be called non-uniformingly
@@ -677,15 +754,17 @@ static Module* run_backend_specific_passes(CompilerConfig* config, CEmitterConfi
     Module* old_mod = NULL;
     Module** pmod = &initial_mod;
 
-    if (econfig->dialect == ISPC) {
+    if (config->lower.host_dispatched_workgroups) {
+        RUN_PASS(lower_entrypoint_args)
+    }
+    // explicit SIMD code needs to know the workgroup size to iterate over its subgroups, that comes with the entry point
+    bool simd_workgroups = config->lower.simt_to_explicit_simd && config->specialization.entry_point;
+    if (econfig->dialect == ISPC || config->lower.host_dispatched_workgroups || simd_workgroups) {
         RUN_PASS(lower_workgroups)
     }
     if (econfig->dialect != GLSL) {
         RUN_PASS(lower_vec_arr)
     }
-    if (config->lower.simt_to_explicit_simd) {
-        RUN_PASS(simt2d)
-    }
     // C lacks a nice way to express constants that can be used in type definitions afterwards, so let's just inline them all.
     RUN_PASS(eliminate_constants)
     return *pmod;
@@ -693,6 +772,11 @@ static Module* run_backend_specific_passes(CompilerConfig* config, CEmitterConfi
 
 void emit_c(CompilerConfig compiler_config, CEmitterConfig config, Module* mod, size_t* output_size, char** output, Module** new_mod) {
     IrArena* initial_arena = get_module_arena(mod);
+    bool explicit_simd = compiler_config.lower.simt_to_explicit_simd && config.dialect == C;
+    size_t simd_width = compiler_config.specialization.subgroup_size;
+    // vector types only come in power-of-two sizes, and ballots pack the lanes into a 64-bit word
+    if (explicit_simd && (simd_width == 0 || simd_width > 64 || (simd_width & (simd_width - 1)) != 0))
+        error("explicit SIMD C needs a power-of-two subgroup size up to 64");
     mod = run_backend_specific_passes(&compiler_config, &config, mod);
     IrArena* arena = get_module_arena(mod);
 
@@ -702,6 +786,7 @@ void emit_c(CompilerConfig compiler_config, CEmitterConfig config, Module* mod,
 
     Emitter emitter = {
         .config = config,
+        .compiler_config = &compiler_config,
         .arena = arena,
         .type_decls = open_growy_as_printer(type_decls_g),
         .fn_decls = open_growy_as_printer(fn_decls_g),
@@ -710,6 +795,11 @@ void emit_c(CompilerConfig compiler_config, CEmitterConfig config, Module* mod,
         .emitted_types = new_dict(Node*, String, (HashFn) hash_node, (CmpFn) compare_node),
     };
 
+    if (explicit_simd) {
+        emitter.simd.width = simd_width;
+        emitter.simd.types = new_dict(const Type*, CType, (HashFn) hash_node, (CmpFn) compare_node);
+    }
+
     Nodes decls = get_module_declarations(mod);
     for (size_t i = 0; i < decls.count; i++)
         emit_decl(&emitter, decls.nodes[i]);
@@ -735,7 +825,10 @@ void emit_c(CompilerConfig compiler_config, CEmitterConfig config, Module* mod,
             print(finalp, "\n#include <stdint.h>");
             print(finalp, "\n#include <stddef.h>");
             print(finalp, "\n#include <stdio.h>");
+            print(finalp, "\n#include <string.h>");
             print(finalp, "\n#include <math.h>");
+            if (emitter.simd.width)
+                emit_simd_prelude(&emitter, finalp);
             break;
         case GLSL:
             print(finalp, "#extension GL_ARB_gpu_shader_int64: require\n");
@@ -764,6 +857,8 @@ void emit_c(CompilerConfig compiler_config, CEmitterConfig config, Module* mod,
 
     destroy_dict(emitter.emitted_types);
     destroy_dict(emitter.emitted_terms);
+    if (emitter.simd.types)
+        destroy_dict(emitter.simd.types);
 
     *output_size = growy_size(final);
     *output = growy_deconstruct(final);
@@ -31,14 +31,38 @@ typedef struct {
 
 typedef Strings Phis;
 
+/// The masks explicit SIMD code tracks for a loop, see emit_c_simd.c
+typedef struct SimdLoop_ {
+    /// lanes that have not left the loop yet
+    String live;
+    /// lanes that are done with the current iteration
+    String done;
+    const struct SimdLoop_* parent;
+} SimdLoop;
+
 typedef struct {
     CEmitterConfig config;
+    const CompilerConfig* compiler_config;
     IrArena* arena;
     Printer *type_decls, *fn_decls, *fn_defs;
     struct {
         Phis selection, loop_continue, loop_break;
     } phis;
 
+    struct {
+        /// Lanes in a subgroup when emitting explicit SIMD code, 0 otherwise
+        size_t width;
+        /// Set when emitting code for a single lane, varying values are then read from this lane
+        String lane;
+        /// Lanes executing the code being emitted
+        String mask;
+        String entry_mask, returned, return_value;
+        const Type* return_type;
+        const SimdLoop* loop;
+        Nodes selection_types, continue_types, break_types;
+        struct Dict* types;
+    } simd;
+
     struct Dict* emitted_terms;
     struct Dict* emitted_types;
 } Emitter;
@@ -78,6 +102,17 @@ void emit_instruction(Emitter* emitter, Printer* p, const Node* instruction, Ins
 String emit_lambda_body   (Emitter*,           const Node*, const Nodes* nested_basic_blocks);
 void   emit_lambda_body_at(Emitter*, Printer*, const Node*, const Nodes* nested_basic_blocks);
 
+bool is_simd_varying(Emitter*, const Type*);
+CType emit_simd_type(Emitter*, const Type*, String center);
+CValue emit_simd_lane_value(Emitter*, const Type*, CValue, String lane);
+CTerm emit_simd_lanes_ref(Emitter*, String name);
+CTerm emit_simd_lanewise_value(Emitter*, Printer*, const Node* value);
+bool emit_simd_instruction(Emitter*, Printer*, const Node* instruction, InstructionOutputs);
+bool emit_simd_terminator(Emitter*, Printer*, const Node* terminator);
+void emit_simd_reconverge(Emitter*, Printer*);
+String emit_simd_fn_body(Emitter*, const Node* fn);
+void emit_simd_prelude(Emitter*, Printer*);
+
 void emit_pack_code(Printer*, Strings, String dst);
 void emit_unpack_code(Printer*, String src, Strings dst);
 
@@ -4,6 +4,11 @@
 
 #pragma GCC diagnostic error "-Wswitch"
 
+static String c_builtins[BuiltinsCount] = {
+    // C subgroups are made of a single thread
+    [BuiltinSubgroupLocalInvocationId] = "0",
+};
+
 static String ispc_builtins[BuiltinsCount] = {
     [BuiltinSubgroupLocalInvocationId] = "programIndex",
 };
@@ -20,10 +25,13 @@ static String glsl_builtins[BuiltinsCount] = {
 CTerm emit_c_builtin(Emitter* emitter, Builtin b) {
     String name = NULL;
     switch(emitter->config.dialect) {
+        case C: name = c_builtins[b]; break;
         case ISPC: name = ispc_builtins[b]; break;
         case GLSL: name = glsl_builtins[b]; break;
-        default: break;
     }
+    // explicit SIMD C runs whole subgroups at once
+    if (emitter->simd.width && b == BuiltinSubgroupLocalInvocationId)
+        name = "shady_lane_id";
     if (name)
         return term_from_cvar(name);
     return term_from_cvar(get_builtin_name(b));
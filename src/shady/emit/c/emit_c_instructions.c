@@ -107,7 +107,9 @@ static const ISelTableEntry isel_table_c[PRIMOPS_COUNT] = {
     [pow_op] = { IsPoly, OsCall, .f_ops = {"powf", "powf", "pow"}},
 };
 
-static const ISelTableEntry isel_table_glsl[PRIMOPS_COUNT] = { 0 };
+static const ISelTableEntry isel_table_glsl[PRIMOPS_COUNT] = {
+    [subgroup_shuffle_op] = { IsMono, OsCall, "subgroupShuffle" },
+};
 
 static const ISelTableEntry isel_table_ispc[PRIMOPS_COUNT] = {
     [abs_op] = { IsMono, OsCall, "abs" },
@@ -125,6 +127,7 @@ static const ISelTableEntry isel_table_ispc[PRIMOPS_COUNT] = {
     [subgroup_active_mask_op] = { IsMono, OsCall, "lanemask" },
     [subgroup_ballot_op] = { IsMono, OsCall, "packmask" },
     [subgroup_reduce_sum_op] = { IsMono, OsCall, "reduce_add" },
+    [subgroup_shuffle_op] = { IsMono, OsCall, "shuffle" },
 };
 
 static bool emit_using_entry(CTerm* out, Emitter* emitter, Printer* p, const ISelTableEntry* entry, Nodes operands) {
@@ -409,7 +412,7 @@ static void emit_primop(Emitter* emitter, Printer* p, const Node* node, Instruct
                     String dst = unique_name(arena, "bitcast_result");
                     print(p, "\n%s = %s;", emit_type(emitter, src_type, src), to_cvalue(emitter, src_value));
                     print(p, "\n%s;", emit_type(emitter, dst_type, dst));
-                    print(p, "\nmemcpy(&%s, &s, sizeof(%s));", dst, src, src);
+                    print(p, "\nmemcpy(&%s, &%s, sizeof(%s));", dst, src, src);
                     outputs.results[0] = term_from_cvalue(dst);
                     outputs.binding[0] = NoBinding;
                     break;
@@ -551,20 +554,54 @@ static void emit_primop(Emitter* emitter, Printer* p, const Node* node, Instruct
         case subgroup_elect_first_op: {
             switch (emitter->config.dialect) {
                 case ISPC: term = term_from_cvalue(format_string_arena(emitter->arena->arena, "(programIndex == count_trailing_zeros(lanemask()))")); break;
-                case C:
+                // C subgroups are made of a single thread
+                case C: term = term_from_cvalue("true"); break;
                 case GLSL: error("TODO")
             }
             break;
         }
+        case subgroup_active_mask_op: {
+            // the one thread of a C subgroup is the only one there is to be active
+            if (emitter->config.dialect == C)
+                term = term_from_cvalue("1");
+            break;
+        }
+        case subgroup_ballot_op: {
+            if (emitter->config.dialect == C) {
+                CValue predicate = to_cvalue(emitter, emit_value(emitter, p, first(prim_op->operands)));
+                term = term_from_cvalue(format_string_arena(emitter->arena->arena, "(%s ? 1 : 0)", predicate));
+            }
+            break;
+        }
+        case subgroup_reduce_sum_op: {
+            if (emitter->config.dialect == C)
+                term = emit_value(emitter, p, first(prim_op->operands));
+            break;
+        }
         case subgroup_broadcast_first_op: {
             CValue value = to_cvalue(emitter, emit_value(emitter, p, first(prim_op->operands)));
             switch (emitter->config.dialect) {
                 case ISPC: term = term_from_cvalue(format_string_arena(emitter->arena->arena, "extract(%s, count_trailing_zeros(lanemask()))", value)); break;
-                case C:
+                case C: term = term_from_cvalue(value); break;
                 case GLSL: error("TODO")
             }
             break;
         }
+        case subgroup_assume_uniform_op: {
+            CValue value = to_cvalue(emitter, emit_value(emitter, p, first(prim_op->operands)));
+            switch (emitter->config.dialect) {
+                case ISPC: term = term_from_cvalue(format_string_arena(emitter->arena->arena, "extract(%s, count_trailing_zeros(lanemask()))", value)); break;
+                case C:
+                case GLSL: term = term_from_cvalue(value); break;
+            }
+            break;
+        }
+        case subgroup_barrier_op: {
+            // ISPC gangs and C subgroups are run by a single thread
+            if (emitter->config.dialect == GLSL)
+                print(p, "\nsubgroupBarrier();");
+            return;
+        }
         case empty_mask_op:
         case mask_is_thread_active_op: error("lower_me");
         case debug_printf_op: {
@@ -755,6 +792,9 @@ static void emit_loop(Emitter* emitter, Printer* p, const Node* loop_instr, Inst
 void emit_instruction(Emitter* emitter, Printer* p, const Node* instruction, InstructionOutputs outputs) {
     assert(is_instruction(instruction));
 
+    if (emitter->simd.width && !emitter->simd.lane && emit_simd_instruction(emitter, p, instruction, outputs))
+        return;
+
     switch (is_instruction(instruction)) {
         case NotAnInstruction: assert(false);
         case Instruction_PrimOp_TAG:       emit_primop(emitter, p, instruction, outputs); break;
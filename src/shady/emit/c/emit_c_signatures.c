@@ -51,9 +51,17 @@ String emit_fn_head(Emitter* emitter, const Node* fn_type, String center, const
     Growy* paramg = new_growy();
     Printer* paramp = open_growy_as_printer(paramg);
     Nodes dom = fn_type->payload.fn_type.param_types;
-    if (dom.count == 0 && emitter->config.dialect == C)
-        print(paramp, "void");
-    else if (fn) {
+    // explicit SIMD functions are told which lanes are calling them, entry points run for all of them
+    bool takes_mask = emitter->simd.width && !(fn && lookup_annotation(fn, "EntryPoint"));
+    if (takes_mask) {
+        print(paramp, fn ? "shady_mask mask_in" : "shady_mask");
+        if (dom.count > 0)
+            print(paramp, ", ");
+    }
+    if (dom.count == 0 && emitter->config.dialect == C) {
+        if (!takes_mask)
+            print(paramp, "void");
+    } else if (fn) {
         Nodes params = fn->payload.fun.params;
         assert(params.count == dom.count);
         for (size_t i = 0; i < dom.count; i++) {
@@ -205,6 +213,8 @@ String emit_type(Emitter* emitter, const Type* type, const char* center) {
         case Type_QualifiedType_TAG:
             switch (emitter->config.dialect) {
                 case C:
+                    if (emitter->simd.width)
+                        return emit_simd_type(emitter, type, center);
                 case GLSL:
                     return emit_type(emitter, type->payload.qualified_type.type, center);
                 case ISPC:
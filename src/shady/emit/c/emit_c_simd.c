@@ -0,0 +1,786 @@
+#include "emit_c.h"
+
+#include "portability.h"
+#include "dict.h"
+#include "log.h"
+#include "util.h"
+
+#include "../../type.h"
+#include "../../ir_private.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma GCC diagnostic error "-Wswitch"
+
+// Explicit SIMD: every C function runs a whole subgroup. Varying values hold one element per lane, in GCC/Clang
+// vector types when the element is a scalar, and control flow is driven by masks of the lanes executing it:
+// divergent branches run one after the other, loops keep going until every lane has left them.
+// Whatever has no vector counterpart is emitted once per lane, in a loop reusing the scalar code.
+
+typedef enum {
+    LanesInVector,
+    /// booleans become masks, where an active lane is all ones
+    LanesInMask,
+    /// pointers are kept as integers, since vector elements can't be pointers
+    LanesInAddresses,
+    LanesInArray,
+} LanesLayout;
+
+static LanesLayout get_lanes_layout(const Type* t) {
+    switch (t->tag) {
+        case Int_TAG:
+        case Float_TAG: return LanesInVector;
+        case Bool_TAG: return LanesInMask;
+        case PtrType_TAG: return LanesInAddresses;
+        default: return LanesInArray;
+    }
+}
+
+bool is_simd_varying(Emitter* emitter, const Type* type) {
+    if (!emitter->simd.width)
+        return false;
+    if (!deconstruct_qualified_type(&type))
+        return true;
+    // every lane has its own private memory, so even a uniform pointer into it is one address per lane
+    return type->tag == PtrType_TAG && !is_addr_space_uniform(emitter->arena, type->payload.ptr_type.address_space);
+}
+
+CType emit_simd_type(Emitter* emitter, const Type* type, String center) {
+    const Type* t = get_unqualified_type(type);
+    if (emitter->simd.lane || !is_simd_varying(emitter, type))
+        return emit_type(emitter, t, center);
+
+    CType emitted;
+    CType* found = find_value_dict(const Type*, CType, emitter->simd.types, t);
+    if (found)
+        emitted = *found;
+    else {
+        switch (get_lanes_layout(t)) {
+            case LanesInMask: emitted = "shady_mask"; break;
+            case LanesInAddresses: emitted = "shady_ptrs"; break;
+            case LanesInVector: {
+                CType element = emit_type(emitter, t, NULL);
+                emitted = unique_name(emitter->arena, "Varying");
+                print(emitter->type_decls, "\ntypedef %s __attribute__ ((vector_size (%zu * sizeof(%s) ))) %s;", element, emitter->simd.width, element, emitted);
+                break;
+            }
+            case LanesInArray: {
+                CType element = emit_type(emitter, t, format_string_arena(emitter->arena->arena, "lanes[%zu]", emitter->simd.width));
+                emitted = unique_name(emitter->arena, "Varying");
+                print(emitter->type_decls, "\ntypedef struct { %s; } %s;", element, emitted);
+                break;
+            }
+        }
+        insert_dict(const Type*, CType, emitter->simd.types, t, emitted);
+    }
+
+    if (center && strlen(center) > 0)
+        emitted = format_string_arena(emitter->arena->arena, "%s %s", emitted, center);
+    return emitted;
+}
+
+CValue emit_simd_lane_value(Emitter* emitter, const Type* type, CValue value, String lane) {
+    const Type* t = get_unqualified_type(type);
+    switch (get_lanes_layout(t)) {
+        case LanesInVector: return format_string_arena(emitter->arena->arena, "(%s)[%s]", value, lane);
+        case LanesInMask: return format_string_arena(emitter->arena->arena, "((%s)[%s] != 0)", value, lane);
+        case LanesInAddresses: return format_string_arena(emitter->arena->arena, "((%s) (%s)[%s])", emit_type(emitter, t, NULL), value, lane);
+        case LanesInArray: return format_string_arena(emitter->arena->arena, "(%s).lanes[%s]", value, lane);
+    }
+    SHADY_UNREACHABLE;
+}
+
+static void emit_simd_lane_store(Emitter* emitter, Printer* p, const Type* type, String dst, String lane, CValue value) {
+    switch (get_lanes_layout(get_unqualified_type(type))) {
+        case LanesInVector: print(p, "\n%s[%s] = %s;", dst, lane, value); break;
+        case LanesInMask: print(p, "\n%s[%s] = (%s) ? -1 : 0;", dst, lane, value); break;
+        case LanesInAddresses: print(p, "\n%s[%s] = (uintptr_t) (%s);", dst, lane, value); break;
+        case LanesInArray: print(p, "\n%s.lanes[%s] = %s;", dst, lane, value); break;
+    }
+}
+
+/// Refers to a variable holding one copy per lane
+CTerm emit_simd_lanes_ref(Emitter* emitter, String name) {
+    if (emitter->simd.lane)
+        return term_from_cvar(format_string_arena(emitter->arena->arena, "%s[%s]", name, emitter->simd.lane));
+    return term_from_cvalue(format_string_arena(emitter->arena->arena, "shady_lane_addresses(%s, sizeof(%s[0]))", name, name));
+}
+
+static Emitter lane_emitter(Emitter* emitter, String lane) {
+    Emitter e = *emitter;
+    e.simd.lane = lane;
+    return e;
+}
+
+static String first_active_lane(Emitter* emitter) {
+    return format_string_arena(emitter->arena->arena, "shady_first_lane(%s)", emitter->simd.mask);
+}
+
+static void open_lanes_loop(Emitter* emitter, Printer* p, bool masked) {
+    print(p, "\nfor (int lane = 0; lane < %zu; lane++) {", emitter->simd.width);
+    indent(p);
+    if (masked)
+        print(p, "\nif (!%s[lane]) continue;", emitter->simd.mask);
+}
+
+static void close_lanes_loop(Printer* p) {
+    deindent(p);
+    print(p, "\n}");
+}
+
+/// Builds a varying value one lane at a time
+CTerm emit_simd_lanewise_value(Emitter* emitter, Printer* p, const Node* value) {
+    assert(p && "varying values can only be built inside functions");
+    String gathered = unique_name(emitter->arena, "lanes");
+    print(p, "\n%s = { 0 };", emit_simd_type(emitter, value->type, gathered));
+    open_lanes_loop(emitter, p, false);
+    Emitter e = lane_emitter(emitter, "lane");
+    CValue lane_value = to_cvalue(emitter, emit_value(&e, p, value));
+    emit_simd_lane_store(emitter, p, value->type, gathered, "lane", lane_value);
+    close_lanes_loop(p);
+    return term_from_cvalue(gathered);
+}
+
+/// Runs the scalar code for an instruction once per lane, and gathers the results
+static void emit_simd_lanewise(Emitter* emitter, Printer* p, const Node* instruction, InstructionOutputs outputs, bool masked) {
+    IrArena* arena = emitter->arena;
+    Nodes yield_types = unwrap_multiple_yield_types(arena, instruction->type);
+    assert(yield_types.count == outputs.count);
+    LARRAY(String, gathered, outputs.count);
+    for (size_t i = 0; i < outputs.count; i++) {
+        if (!is_simd_varying(emitter, yield_types.nodes[i]))
+            error("explicit SIMD C cannot turn varying operands into a uniform result");
+        gathered[i] = unique_name(arena, "lanes");
+        print(p, "\n%s = { 0 };", emit_simd_type(emitter, yield_types.nodes[i], gathered[i]));
+    }
+
+    open_lanes_loop(emitter, p, masked);
+    Emitter e = lane_emitter(emitter, "lane");
+    LARRAY(CTerm, results, outputs.count);
+    LARRAY(InstrResultBinding, bindings, outputs.count);
+    emit_instruction(&e, p, instruction, (InstructionOutputs) {
+        .count = outputs.count,
+        .results = results,
+        .binding = bindings,
+    });
+    for (size_t i = 0; i < outputs.count; i++)
+        emit_simd_lane_store(emitter, p, yield_types.nodes[i], gathered[i], "lane", to_cvalue(emitter, results[i]));
+    close_lanes_loop(p);
+
+    for (size_t i = 0; i < outputs.count; i++) {
+        outputs.results[i] = term_from_cvalue(gathered[i]);
+        outputs.binding[i] = NoBinding;
+    }
+}
+
+/// Emits a value where something of type `type` is expected, uniform values get broadcast if that is varying
+static CTerm emit_simd_value_as(Emitter* emitter, Printer* p, const Node* value, const Type* type) {
+    CTerm term = emit_value(emitter, p, value);
+    if (emitter->simd.lane || !is_simd_varying(emitter, type) || is_simd_varying(emitter, value->type))
+        return term;
+
+    IrArena* arena = emitter->arena;
+    const Type* t = get_unqualified_type(type);
+    CValue scalar = to_cvalue(emitter, term);
+    switch (get_lanes_layout(t)) {
+        case LanesInVector: return term_from_cvalue(format_string_arena(arena->arena, "((%s) { 0 } + (%s) (%s))", emit_simd_type(emitter, type, NULL), emit_type(emitter, t, NULL), scalar));
+        case LanesInMask: return term_from_cvalue(format_string_arena(arena->arena, "((shady_mask) { 0 } - (int32_t) (%s))", scalar));
+        case LanesInAddresses: return term_from_cvalue(format_string_arena(arena->arena, "((shady_ptrs) { 0 } + (uintptr_t) (%s))", scalar));
+        case LanesInArray: {
+            String broadcast = unique_name(arena, "broadcast");
+            print(p, "\n%s;", emit_simd_type(emitter, type, broadcast));
+            open_lanes_loop(emitter, p, false);
+            print(p, "\n%s.lanes[lane] = %s;", broadcast, scalar);
+            close_lanes_loop(p);
+            return term_from_cvalue(broadcast);
+        }
+    }
+    SHADY_UNREACHABLE;
+}
+
+/// Scalar operands of vector operations are broadcast implicitly, they just need to have the element type
+static CValue emit_simd_operand(Emitter* emitter, Printer* p, const Node* operand) {
+    CValue value = to_cvalue(emitter, emit_value(emitter, p, operand));
+    if (is_simd_varying(emitter, operand->type))
+        return value;
+    const Type* t = get_unqualified_type(operand->type);
+    if (t->tag == Bool_TAG)
+        return format_string_arena(emitter->arena->arena, "(-(int32_t) (%s))", value);
+    return format_string_arena(emitter->arena->arena, "((%s) (%s))", emit_type(emitter, t, NULL), value);
+}
+
+/// Assigns the lanes executing the current code, the others keep their value
+static void emit_simd_assign(Emitter* emitter, Printer* p, String dst, const Type* dst_type, const Node* value) {
+    CValue cvalue = to_cvalue(emitter, emit_simd_value_as(emitter, p, value, dst_type));
+    if (!is_simd_varying(emitter, dst_type)) {
+        print(p, "\n%s = %s;", dst, cvalue);
+        return;
+    }
+    String blended = unique_name(emitter->arena, "blended");
+    print(p, "\n%s = %s;", emit_simd_type(emitter, dst_type, blended), cvalue);
+    print(p, "\nshady_blend(&%s, &%s, sizeof(%s), %s);", dst, blended, dst, emitter->simd.mask);
+}
+
+static void bind_result(InstructionOutputs outputs, CValue value) {
+    assert(outputs.count == 1);
+    outputs.results[0] = term_from_cvalue(value);
+    outputs.binding[0] = LetBinding;
+}
+
+static bool is_vector_element_type(const Type* t) {
+    return t->tag == Int_TAG || t->tag == Float_TAG || t->tag == Bool_TAG;
+}
+
+static const String simd_infix_ops[PRIMOPS_COUNT] = {
+    [add_op] = "+",
+    [sub_op] = "-",
+    [mul_op] = "*",
+    [div_op] = "/",
+    [and_op] = "&",
+    [or_op]  = "|",
+    [xor_op] = "^",
+    [rshift_arithm_op] = ">>",
+    [rshift_logical_op] = ">>",
+    [lshift_op] = "<<",
+};
+
+static const String simd_compare_ops[PRIMOPS_COUNT] = {
+    [gt_op]  = ">",
+    [gte_op] = ">=",
+    [lt_op]  = "<",
+    [lte_op] = "<=",
+    [eq_op]  = "==",
+    [neq_op] = "!=",
+};
+
+static const String simd_prefix_ops[PRIMOPS_COUNT] = {
+    [neg_op] = "-",
+    [not_op] = "~",
+};
+
+/// Uses the vector extensions directly, when there is an operator for that
+static bool emit_simd_vector_op(Emitter* emitter, Printer* p, const Node* node, InstructionOutputs outputs) {
+    IrArena* arena = emitter->arena;
+    const PrimOp* prim_op = &node->payload.prim_op;
+    Op op = prim_op->op;
+    Nodes operands = prim_op->operands;
+
+    if (outputs.count != 1 || !is_vector_element_type(get_unqualified_type(node->type)))
+        return false;
+    bool any_varying = false;
+    for (size_t i = 0; i < operands.count; i++) {
+        if (!is_vector_element_type(get_unqualified_type(operands.nodes[i]->type)))
+            return false;
+        any_varying |= is_simd_varying(emitter, operands.nodes[i]->type);
+    }
+    if (!any_varying)
+        return false;
+
+    if (operands.count == 1 && simd_prefix_ops[op]) {
+        bind_result(outputs, format_string_arena(arena->arena, "%s%s", simd_prefix_ops[op], emit_simd_operand(emitter, p, first(operands))));
+        return true;
+    }
+    if (operands.count != 2 || get_unqualified_type(operands.nodes[0]->type) != get_unqualified_type(operands.nodes[1]->type))
+        return false;
+    CValue a = emit_simd_operand(emitter, p, operands.nodes[0]);
+    CValue b = emit_simd_operand(emitter, p, operands.nodes[1]);
+    if (simd_infix_ops[op])
+        bind_result(outputs, format_string_arena(arena->arena, "%s %s %s", a, simd_infix_ops[op], b));
+    else if (simd_compare_ops[op])
+        // comparisons give lanes as wide as the operands, masks are 32-bit
+        bind_result(outputs, format_string_arena(arena->arena, "__builtin_convertvector(%s %s %s, shady_mask)", a, simd_compare_ops[op], b));
+    else
+        return false;
+    return true;
+}
+
+static bool emit_simd_primop(Emitter* emitter, Printer* p, const Node* node, InstructionOutputs outputs) {
+    IrArena* arena = emitter->arena;
+    const PrimOp* prim_op = &node->payload.prim_op;
+    Nodes operands = prim_op->operands;
+    String mask = emitter->simd.mask;
+
+    switch (prim_op->op) {
+        case alloca_op:
+        case alloca_logical_op: {
+            assert(is_simd_varying(emitter, node->type));
+            String name = unique_name(arena, "alloca");
+            print(p, "\n%s;", emit_type(emitter, first(prim_op->type_arguments), format_string_arena(arena->arena, "%s[%zu]", name, emitter->simd.width)));
+            outputs.results[0] = emit_simd_lanes_ref(emitter, name);
+            outputs.binding[0] = LetBinding;
+            return true;
+        }
+        case debug_printf_op:
+            // every active lane prints, like invocations would
+            emit_simd_lanewise(emitter, p, node, outputs, true);
+            return true;
+        case subgroup_barrier_op:
+            // the lanes of a subgroup already take every step together
+            return true;
+        case subgroup_elect_first_op:
+            bind_result(outputs, format_string_arena(arena->arena, "shady_elect_first(%s)", mask));
+            return true;
+        case subgroup_active_mask_op:
+            bind_result(outputs, format_string_arena(arena->arena, "shady_ballot(%s)", mask));
+            return true;
+        case subgroup_ballot_op:
+            bind_result(outputs, format_string_arena(arena->arena, "shady_ballot(%s & %s)", mask, emit_simd_operand(emitter, p, first(operands))));
+            return true;
+        case subgroup_broadcast_first_op:
+        case subgroup_assume_uniform_op: {
+            // pointers to private memory keep pointing to each lane's own copy
+            if (is_simd_varying(emitter, node->type)) {
+                outputs.results[0] = emit_value(emitter, p, first(operands));
+                outputs.binding[0] = NoBinding;
+                return true;
+            }
+            Emitter e = lane_emitter(emitter, first_active_lane(emitter));
+            outputs.results[0] = emit_value(&e, p, first(operands));
+            outputs.binding[0] = LetBinding;
+            return true;
+        }
+        case subgroup_reduce_sum_op: {
+            String sum = unique_name(arena, "reduced");
+            print(p, "\n%s = 0;", emit_type(emitter, get_unqualified_type(node->type), sum));
+            open_lanes_loop(emitter, p, true);
+            Emitter e = lane_emitter(emitter, "lane");
+            print(p, "\n%s += %s;", sum, to_cvalue(emitter, emit_value(&e, p, first(operands))));
+            close_lanes_loop(p);
+            outputs.results[0] = term_from_cvalue(sum);
+            outputs.binding[0] = NoBinding;
+            return true;
+        }
+        case subgroup_shuffle_op: {
+            String shuffled = unique_name(arena, "shuffled");
+            print(p, "\n%s = { 0 };", emit_simd_type(emitter, node->type, shuffled));
+            open_lanes_loop(emitter, p, false);
+            Emitter e = lane_emitter(emitter, "lane");
+            CValue source_lane = to_cvalue(emitter, emit_value(&e, p, operands.nodes[1]));
+            Emitter source = lane_emitter(emitter, source_lane);
+            emit_simd_lane_store(emitter, p, node->type, shuffled, "lane", to_cvalue(emitter, emit_value(&source, p, first(operands))));
+            close_lanes_loop(p);
+            outputs.results[0] = term_from_cvalue(shuffled);
+            outputs.binding[0] = NoBinding;
+            return true;
+        }
+        case subgroup_partition_op: error("explicit SIMD C does not support subgroup partitions");
+        default: break;
+    }
+
+    bool varying = false;
+    Nodes yield_types = unwrap_multiple_yield_types(arena, node->type);
+    for (size_t i = 0; i < yield_types.count; i++)
+        varying |= is_simd_varying(emitter, yield_types.nodes[i]);
+    for (size_t i = 0; i < operands.count; i++)
+        varying |= is_simd_varying(emitter, operands.nodes[i]->type);
+    if (!varying)
+        return false;
+
+    switch (prim_op->op) {
+        case load_op: {
+            const Node* ptr = first(operands);
+            // builtins provide the value of the whole subgroup at once
+            if (ptr->tag == RefDecl_TAG && is_decl_builtin(ptr->payload.ref_decl.decl))
+                return false;
+            emit_simd_lanewise(emitter, p, node, outputs, true);
+            return true;
+        }
+        case store_op: {
+            if (is_simd_varying(emitter, first(operands)->type)) {
+                emit_simd_lanewise(emitter, p, node, outputs, true);
+                return true;
+            }
+            // every lane writes to the same place, the first active one does it for all of them
+            Emitter e = lane_emitter(emitter, first_active_lane(emitter));
+            emit_instruction(&e, p, node, outputs);
+            return true;
+        }
+        case memcpy_op:
+        case mod_op:
+            emit_simd_lanewise(emitter, p, node, outputs, true);
+            return true;
+        case div_op:
+            // integer division traps on whatever inactive lanes may hold
+            if (get_unqualified_type(first(operands)->type)->tag == Int_TAG) {
+                emit_simd_lanewise(emitter, p, node, outputs, true);
+                return true;
+            }
+            break;
+        case convert_op: {
+            const Type* src_type = get_unqualified_type(first(operands)->type);
+            const Type* dst_type = first(prim_op->type_arguments);
+            if (get_lanes_layout(src_type) == LanesInVector && get_lanes_layout(dst_type) == LanesInVector) {
+                CValue src = to_cvalue(emitter, emit_value(emitter, p, first(operands)));
+                bind_result(outputs, format_string_arena(arena->arena, "__builtin_convertvector(%s, %s)", src, emit_simd_type(emitter, node->type, NULL)));
+                return true;
+            }
+            break;
+        }
+        case reinterpret_op: {
+            LanesLayout src_layout = get_lanes_layout(get_unqualified_type(first(operands)->type));
+            LanesLayout dst_layout = get_lanes_layout(first(prim_op->type_arguments));
+            if ((src_layout == LanesInVector || src_layout == LanesInAddresses) && (dst_layout == LanesInVector || dst_layout == LanesInAddresses)) {
+                String src = unique_name(arena, "bitcast_src");
+                String dst = unique_name(arena, "bitcast_result");
+                print(p, "\n%s = %s;", emit_simd_type(emitter, first(operands)->type, src), to_cvalue(emitter, emit_value(emitter, p, first(operands))));
+                print(p, "\n%s;", emit_simd_type(emitter, node->type, dst));
+                print(p, "\nmemcpy(&%s, &%s, sizeof(%s));", dst, src, src);
+                outputs.results[0] = term_from_cvalue(dst);
+                outputs.binding[0] = NoBinding;
+                return true;
+            }
+            break;
+        }
+        default: break;
+    }
+
+    if (emit_simd_vector_op(emitter, p, node, outputs))
+        return true;
+    emit_simd_lanewise(emitter, p, node, outputs, false);
+    return true;
+}
+
+static void emit_simd_call(Emitter* emitter, Printer* p, const Node* call, InstructionOutputs outputs) {
+    IrArena* arena = emitter->arena;
+    const Node* callee = call->payload.call.callee;
+    if (is_simd_varying(emitter, callee->type))
+        error("explicit SIMD C cannot call through varying function pointers");
+    const Type* callee_type = get_unqualified_type(callee->type);
+    deconstruct_pointer_type(&callee_type);
+    assert(callee_type->tag == FnType_TAG);
+    Nodes param_types = callee_type->payload.fn_type.param_types;
+
+    // callees run for the lanes executing the call
+    Nodes args = call->payload.call.args;
+    Growy* g = new_growy();
+    Printer* paramsp = open_growy_as_printer(g);
+    print(paramsp, "%s", emitter->simd.mask);
+    for (size_t i = 0; i < args.count; i++)
+        print(paramsp, ", %s", to_cvalue(emitter, emit_simd_value_as(emitter, p, args.nodes[i], param_types.nodes[i])));
+    growy_append_bytes(g, 1, "\0");
+    String params = printer_growy_unwrap(paramsp);
+
+    CValue e_callee;
+    if (callee->tag == FnAddr_TAG)
+        e_callee = get_decl_name(callee->payload.fn_addr.fn);
+    else
+        e_callee = to_cvalue(emitter, emit_value(emitter, p, callee));
+
+    Nodes yield_types = unwrap_multiple_yield_types(arena, call->type);
+    assert(yield_types.count == outputs.count);
+    if (yield_types.count > 1)
+        error("explicit SIMD C does not support returning multiple values");
+    if (yield_types.count == 1)
+        bind_result(outputs, format_string_arena(arena->arena, "%s(%s)", e_callee, params));
+    else
+        print(p, "\n%s(%s);", e_callee, params);
+    free_tmp_str(params);
+}
+
+static Strings emit_simd_phis(Emitter* emitter, Printer* p, String name, Nodes types) {
+    LARRAY(String, names, types.count);
+    CTerm zero = term_from_cvalue("{ 0 }");
+    for (size_t i = 0; i < types.count; i++) {
+        names[i] = format_string_arena(emitter->arena->arena, "%s_%d", name, fresh_id(emitter->arena));
+        emit_variable_declaration(emitter, p, types.nodes[i], names[i], true, &zero);
+    }
+    return strings(emitter->arena, types.count, names);
+}
+
+static void bind_phis(InstructionOutputs outputs, Strings phis) {
+    assert(outputs.count == phis.count);
+    for (size_t i = 0; i < outputs.count; i++) {
+        outputs.results[i] = term_from_cvalue(phis.strings[i]);
+        outputs.binding[i] = NoBinding;
+    }
+}
+
+/// Emits a case guarded by `mask`, with the lanes of that mask executing it
+static void emit_simd_masked_case(Emitter* emitter, Printer* p, String mask, const Node* case_) {
+    Emitter sub = *emitter;
+    sub.simd.mask = mask;
+    String body = emit_lambda_body(&sub, get_abstraction_body(case_), NULL);
+    print(p, "\nif (shady_any(%s)) { %s}", mask, body);
+    free_tmp_str(body);
+}
+
+static void emit_simd_if(Emitter* emitter, Printer* p, const Node* if_instr, InstructionOutputs outputs) {
+    IrArena* arena = emitter->arena;
+    const If* if_ = &if_instr->payload.if_instr;
+    Nodes yield_types = add_qualifiers(arena, if_->yield_types, false);
+    Emitter sub = *emitter;
+    sub.phis.selection = emit_simd_phis(emitter, p, "if_phi", yield_types);
+    sub.simd.selection_types = yield_types;
+
+    CValue condition = to_cvalue(emitter, emit_value(emitter, p, if_->condition));
+    if (!is_simd_varying(emitter, if_->condition->type)) {
+        // all the lanes go the same way
+        String true_body = emit_lambda_body(&sub, get_abstraction_body(if_->if_true), NULL);
+        print(p, "\nif (%s) { %s}", condition, true_body);
+        free_tmp_str(true_body);
+        if (if_->if_false) {
+            String false_body = emit_lambda_body(&sub, get_abstraction_body(if_->if_false), NULL);
+            print(p, " else {%s}", false_body);
+            free_tmp_str(false_body);
+        }
+    } else {
+        String true_mask = unique_name(arena, "if_true_mask");
+        String false_mask = unique_name(arena, "if_false_mask");
+        print(p, "\nshady_mask %s = %s & %s;", true_mask, emitter->simd.mask, condition);
+        print(p, "\nshady_mask %s = %s & ~%s;", false_mask, emitter->simd.mask, condition);
+        emit_simd_masked_case(&sub, p, true_mask, if_->if_true);
+        if (if_->if_false)
+            emit_simd_masked_case(&sub, p, false_mask, if_->if_false);
+    }
+
+    bind_phis(outputs, sub.phis.selection);
+}
+
+static void emit_simd_match(Emitter* emitter, Printer* p, const Node* match_instr, InstructionOutputs outputs) {
+    IrArena* arena = emitter->arena;
+    const Match* match = &match_instr->payload.match_instr;
+    Nodes yield_types = add_qualifiers(arena, match->yield_types, false);
+    Emitter sub = *emitter;
+    sub.phis.selection = emit_simd_phis(emitter, p, "match_phi", yield_types);
+    sub.simd.selection_types = yield_types;
+
+    // same if-chain as the scalar version, see emit_match
+    CValue inspectee = to_cvalue(emitter, emit_value(emitter, p, match->inspect));
+    if (!is_simd_varying(emitter, match->inspect->type)) {
+        for (size_t i = 0; i < match->cases.count; i++) {
+            CValue literal = to_cvalue(emitter, emit_value(emitter, p, match->literals.nodes[i]));
+            String case_body = emit_lambda_body(&sub, get_abstraction_body(match->cases.nodes[i]), NULL);
+            print(p, "\n%sif (%s == %s) { %s}", i > 0 ? "else " : "", inspectee, literal, case_body);
+            free_tmp_str(case_body);
+        }
+        if (match->default_case) {
+            String default_case_body = emit_lambda_body(&sub, get_abstraction_body(match->default_case), NULL);
+            print(p, "\nelse { %s}", default_case_body);
+            free_tmp_str(default_case_body);
+        }
+    } else {
+        // each case gets the lanes that match it, the default case gets whatever is left
+        String remaining = unique_name(arena, "match_default_mask");
+        print(p, "\nshady_mask %s = %s;", remaining, emitter->simd.mask);
+        for (size_t i = 0; i < match->cases.count; i++) {
+            String case_mask = unique_name(arena, "match_case_mask");
+            CValue literal = emit_simd_operand(emitter, p, match->literals.nodes[i]);
+            print(p, "\nshady_mask %s = %s & __builtin_convertvector(%s == %s, shady_mask);", case_mask, remaining, inspectee, literal);
+            print(p, "\n%s &= ~%s;", remaining, case_mask);
+            emit_simd_masked_case(&sub, p, case_mask, match->cases.nodes[i]);
+        }
+        if (match->default_case)
+            emit_simd_masked_case(&sub, p, remaining, match->default_case);
+    }
+
+    bind_phis(outputs, sub.phis.selection);
+}
+
+static void emit_simd_loop(Emitter* emitter, Printer* p, const Node* loop_instr, InstructionOutputs outputs) {
+    IrArena* arena = emitter->arena;
+    const Loop* loop = &loop_instr->payload.loop_instr;
+    Emitter sub = *emitter;
+
+    Nodes params = get_abstraction_params(loop->body);
+    Nodes param_types = get_variables_types(arena, params);
+    LARRAY(String, param_names, params.count);
+    for (size_t i = 0; i < params.count; i++) {
+        String name = get_value_name(params.nodes[i]);
+        name = name ? legalize_c_identifier(emitter, name) : "phi";
+        param_names[i] = format_string_arena(arena->arena, "%s_%d", name, fresh_id(arena));
+        CTerm initial_value = emit_simd_value_as(emitter, p, loop->initial_args.nodes[i], param_types.nodes[i]);
+        emit_variable_declaration(emitter, p, param_types.nodes[i], param_names[i], true, &initial_value);
+        register_emitted(&sub, params.nodes[i], term_from_cvalue(param_names[i]));
+    }
+    sub.phis.loop_continue = strings(arena, params.count, param_names);
+    sub.simd.continue_types = param_types;
+    Nodes yield_types = add_qualifiers(arena, loop->yield_types, false);
+    sub.phis.loop_break = emit_simd_phis(emitter, p, "loop_break_phi", yield_types);
+    sub.simd.break_types = yield_types;
+
+    SimdLoop simd_loop = {
+        .live = unique_name(arena, "loop_live_mask"),
+        .done = unique_name(arena, "loop_done_mask"),
+        .parent = emitter->simd.loop,
+    };
+    sub.simd.loop = &simd_loop;
+    sub.simd.mask = unique_name(arena, "loop_mask");
+    print(p, "\nshady_mask %s = %s;", simd_loop.live, emitter->simd.mask);
+    print(p, "\nshady_mask %s;", simd_loop.done);
+
+    // every iteration runs the lanes that are still in the loop
+    Growy* g = new_growy();
+    Printer* bodyp = open_growy_as_printer(g);
+    indent(bodyp);
+    print(bodyp, "\nif (!shady_any(%s)) break;", simd_loop.live);
+    print(bodyp, "\n%s = (shady_mask) { 0 };", simd_loop.done);
+    print(bodyp, "\nshady_mask %s = %s;", sub.simd.mask, simd_loop.live);
+    deindent(bodyp);
+    emit_lambda_body_at(&sub, bodyp, get_abstraction_body(loop->body), NULL);
+    growy_append_bytes(g, 1, "\0");
+    String body = printer_growy_unwrap(bodyp);
+    print(p, "\nwhile(true) { %s}", body);
+    free_tmp_str(body);
+
+    bind_phis(outputs, sub.phis.loop_break);
+}
+
+/// Returns false if the instruction is uniform and the scalar code does the job
+bool emit_simd_instruction(Emitter* emitter, Printer* p, const Node* instruction, InstructionOutputs outputs) {
+    switch (is_instruction(instruction)) {
+        case Instruction_PrimOp_TAG: return emit_simd_primop(emitter, p, instruction, outputs);
+        case Instruction_Call_TAG:   emit_simd_call (emitter, p, instruction, outputs); return true;
+        case Instruction_If_TAG:     emit_simd_if   (emitter, p, instruction, outputs); return true;
+        case Instruction_Match_TAG:  emit_simd_match(emitter, p, instruction, outputs); return true;
+        case Instruction_Loop_TAG:   emit_simd_loop (emitter, p, instruction, outputs); return true;
+        default: return false;
+    }
+}
+
+/// Jumps out of the innermost loop once none of its lanes have anything left to do in this iteration
+static void emit_simd_loop_exit(Emitter* emitter, Printer* p) {
+    const SimdLoop* loop = emitter->simd.loop;
+    print(p, "\nif (!shady_any(%s)) break;", loop->live);
+    print(p, "\nif (!shady_any(%s & ~%s)) continue;", loop->live, loop->done);
+}
+
+bool emit_simd_terminator(Emitter* emitter, Printer* p, const Node* terminator) {
+    String mask = emitter->simd.mask;
+    switch (is_terminator(terminator)) {
+        case Yield_TAG: {
+            Nodes args = terminator->payload.yield.args;
+            Phis phis = emitter->phis.selection;
+            assert(phis.count == args.count);
+            for (size_t i = 0; i < phis.count; i++)
+                emit_simd_assign(emitter, p, phis.strings[i], emitter->simd.selection_types.nodes[i], args.nodes[i]);
+            return true;
+        }
+        case MergeContinue_TAG: {
+            Nodes args = terminator->payload.merge_continue.args;
+            Phis phis = emitter->phis.loop_continue;
+            assert(phis.count == args.count && emitter->simd.loop);
+            for (size_t i = 0; i < phis.count; i++)
+                emit_simd_assign(emitter, p, phis.strings[i], emitter->simd.continue_types.nodes[i], args.nodes[i]);
+            print(p, "\n%s |= %s;", emitter->simd.loop->done, mask);
+            print(p, "\nif (!shady_any(%s & ~%s)) continue;", emitter->simd.loop->live, emitter->simd.loop->done);
+            return true;
+        }
+        case MergeBreak_TAG: {
+            Nodes args = terminator->payload.merge_break.args;
+            Phis phis = emitter->phis.loop_break;
+            assert(phis.count == args.count && emitter->simd.loop);
+            for (size_t i = 0; i < phis.count; i++)
+                emit_simd_assign(emitter, p, phis.strings[i], emitter->simd.break_types.nodes[i], args.nodes[i]);
+            print(p, "\n%s &= ~%s;", emitter->simd.loop->live, mask);
+            emit_simd_loop_exit(emitter, p);
+            return true;
+        }
+        case Terminator_Return_TAG: {
+            Nodes args = terminator->payload.fn_ret.args;
+            assert(args.count == (emitter->simd.return_value ? 1 : 0));
+            if (args.count == 1)
+                emit_simd_assign(emitter, p, emitter->simd.return_value, emitter->simd.return_type, first(args));
+            print(p, "\n%s |= %s;", emitter->simd.returned, mask);
+            for (const SimdLoop* loop = emitter->simd.loop; loop; loop = loop->parent)
+                print(p, "\n%s &= ~%s;", loop->live, mask);
+            print(p, "\nif (!shady_any(%s & ~%s)) return%s%s;", emitter->simd.entry_mask, emitter->simd.returned, args.count == 1 ? " " : "", args.count == 1 ? emitter->simd.return_value : "");
+            if (emitter->simd.loop)
+                emit_simd_loop_exit(emitter, p);
+            return true;
+        }
+        default: return false;
+    }
+}
+
+/// After a structured construct, drops the lanes that left through it, and opens a block for the code that follows
+void emit_simd_reconverge(Emitter* emitter, Printer* p) {
+    if (emitter->simd.loop)
+        print(p, "\n%s &= %s & ~%s;", emitter->simd.mask, emitter->simd.loop->live, emitter->simd.loop->done);
+    else
+        print(p, "\n%s &= ~%s;", emitter->simd.mask, emitter->simd.returned);
+    print(p, "\nif (shady_any(%s)) {", emitter->simd.mask);
+}
+
+String emit_simd_fn_body(Emitter* emitter, const Node* fn) {
+    IrArena* arena = emitter->arena;
+    Nodes return_types = fn->payload.fun.return_types;
+    if (return_types.count > 1)
+        error("explicit SIMD C does not support returning multiple values");
+
+    Emitter sub = *emitter;
+    sub.simd.loop = NULL;
+    sub.simd.entry_mask = lookup_annotation(fn, "EntryPoint") ? "(~(shady_mask) { 0 })" : "mask_in";
+    sub.simd.mask = unique_name(arena, "mask");
+    sub.simd.returned = unique_name(arena, "returned");
+    sub.simd.return_value = NULL;
+    sub.simd.return_type = NULL;
+
+    Growy* g = new_growy();
+    Printer* p = open_growy_as_printer(g);
+    indent(p);
+    print(p, "\nshady_mask %s = %s;", sub.simd.mask, sub.simd.entry_mask);
+    print(p, "\nshady_mask %s = { 0 };", sub.simd.returned);
+    if (return_types.count == 1) {
+        // lanes can return at different points, the value is collected until they all did
+        sub.simd.return_value = unique_name(arena, "return_value");
+        sub.simd.return_type = first(return_types);
+        CTerm zero = term_from_cvalue("{ 0 }");
+        emit_variable_declaration(&sub, p, sub.simd.return_type, sub.simd.return_value, true, &zero);
+    }
+    deindent(p);
+    emit_lambda_body_at(&sub, p, fn->payload.fun.body, NULL);
+    if (sub.simd.return_value) {
+        indent(p);
+        print(p, "return %s;", sub.simd.return_value);
+        deindent(p);
+        print(p, "\n");
+    }
+    growy_append_bytes(g, 1, "\0");
+    return printer_growy_unwrap(p);
+}
+
+void emit_simd_prelude(Emitter* emitter, Printer* p) {
+    size_t width = emitter->simd.width;
+    print(p, "\n\n/* explicit SIMD: functions run whole subgroups of %zu lanes */", width);
+    print(p, "\ntypedef int32_t shady_mask __attribute__ ((vector_size (%zu * sizeof(int32_t) )));", width);
+    print(p, "\ntypedef uintptr_t shady_ptrs __attribute__ ((vector_size (%zu * sizeof(uintptr_t) )));", width);
+    print(p, "\ntypedef uint32_t shady_lane_ids __attribute__ ((vector_size (%zu * sizeof(uint32_t) )));", width);
+    print(p, "\nstatic const shady_lane_ids shady_lane_id = {");
+    for (size_t i = 0; i < width; i++)
+        print(p, i + 1 < width ? " %zu," : " %zu ", i);
+    print(p, "};");
+    print(p, "\nstatic inline bool shady_any(shady_mask mask) {"
+             "\n    for (int lane = 0; lane < %zu; lane++)"
+             "\n        if (mask[lane]) return true;"
+             "\n    return false;"
+             "\n}", width);
+    print(p, "\nstatic inline uint64_t shady_ballot(shady_mask mask) {"
+             "\n    uint64_t bits = 0;"
+             "\n    for (int lane = 0; lane < %zu; lane++)"
+             "\n        if (mask[lane]) bits |= 1ull << lane;"
+             "\n    return bits;"
+             "\n}", width);
+    print(p, "\nstatic inline int shady_first_lane(shady_mask mask) {"
+             "\n    for (int lane = 0; lane < %zu; lane++)"
+             "\n        if (mask[lane]) return lane;"
+             "\n    return 0;"
+             "\n}", width);
+    print(p, "\nstatic inline shady_mask shady_elect_first(shady_mask mask) {"
+             "\n    shady_mask elected = { 0 };"
+             "\n    if (shady_any(mask)) elected[shady_first_lane(mask)] = -1;"
+             "\n    return elected;"
+             "\n}");
+    print(p, "\nstatic inline shady_ptrs shady_lane_addresses(void* base, size_t stride) {"
+             "\n    shady_ptrs addresses;"
+             "\n    for (int lane = 0; lane < %zu; lane++)"
+             "\n        addresses[lane] = (uintptr_t) base + lane * stride;"
+             "\n    return addresses;"
+             "\n}", width);
+    print(p, "\nstatic inline void shady_blend(void* dst, const void* src, size_t size, shady_mask mask) {"
+             "\n    size_t lane_size = size / %zu;"
+             "\n    for (int lane = 0; lane < %zu; lane++)"
+             "\n        if (mask[lane]) memcpy((char*) dst + lane * lane_size, (const char*) src + lane * lane_size, lane_size);"
+             "\n}", width, width);
+}
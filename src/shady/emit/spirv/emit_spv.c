@@ -17,23 +17,55 @@
 #include <stdint.h>
 #include <assert.h>
 
+#if SHADY_HAS_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
 extern SpvBuiltIn spv_builtins[];
 
+KeyHash hash_node(Node**);
+bool compare_node(Node**, Node**);
+
 #pragma GCC diagnostic error "-Wswitch"
 
 void register_result(Emitter* emitter, const Node* node, SpvId id) {
+    assert(emitter->fn_node_ids && "only things inside of functions have results");
     if (is_value(node)) {
         String name = get_value_name(node);
         if (name)
             spvb_name(emitter->file_builder, id, name);
     }
-    insert_dict_and_get_result(struct Node*, SpvId, emitter->node_ids, node, id);
+    insert_dict_and_get_result(struct Node*, SpvId, emitter->fn_node_ids, node, id);
+}
+
+static SpvId* find_emitted(Emitter* emitter, const Node* node) {
+    SpvId* found = emitter->fn_node_ids ? find_value_dict(const Node*, SpvId, emitter->fn_node_ids, node) : NULL;
+    if (!found)
+        found = find_value_dict(const Node*, SpvId, emitter->node_ids, node);
+    if (!found && emitter->placeholders)
+        found = find_value_dict(const Node*, SpvId, emitter->placeholders, node);
+    return found;
+}
+
+/// Whether the ID of that value is shared by the whole module, instead of being the result of an instruction
+static bool is_module_scoped_value(const Node* node, BBBuilder bb_builder) {
+    switch (node->tag) {
+        case Composite_TAG: return !bb_builder;
+        case RefDecl_TAG: {
+            const Node* decl = node->payload.ref_decl.decl;
+            return decl->tag != Constant_TAG || get_quoted_value(decl->payload.constant.instruction) || !bb_builder;
+        }
+        default: return true;
+    }
 }
 
 SpvId emit_value(Emitter* emitter, BBBuilder bb_builder, const Node* node) {
-    SpvId* existing = find_value_dict(const Node*, SpvId, emitter->node_ids, node);
+    SpvId* existing = find_emitted(emitter, node);
     if (existing)
         return *existing;
+    if (emitter->placeholders && is_module_scoped_value(node, bb_builder))
+        return emit_placeholder(emitter, PlaceholderValue, node, NULL);
 
     SpvId new;
     switch (is_value(node)) {
@@ -143,7 +175,7 @@ SpvId emit_value(Emitter* emitter, BBBuilder bb_builder, const Node* node) {
 }
 
 SpvId spv_find_reserved_id(Emitter* emitter, const Node* node) {
-    SpvId* found = find_value_dict(const Node*, SpvId, emitter->node_ids, node);
+    SpvId* found = find_emitted(emitter, node);
     assert(found);
     return *found;
 }
@@ -221,7 +253,7 @@ void emit_terminator(Emitter* emitter, FnBuilder fn_builder, BBBuilder basic_blo
             add_branch_phis(emitter, fn_builder, basic_block_builder, terminator->payload.br_switch.default_jump);
             SpvId default_tgt = find_reserved_id(emitter, terminator->payload.br_switch.default_jump->payload.jump.target);
 
-            spvb_switch(basic_block_builder, inspectee, default_tgt, terminator->payload.br_switch.case_jumps.count, targets);
+            spvb_switch(basic_block_builder, inspectee, 1, default_tgt, terminator->payload.br_switch.case_jumps.count, targets);
         }
         case LetMut_TAG:
         case TailCall_TAG:
@@ -281,6 +313,9 @@ static void emit_basic_block(Emitter* emitter, FnBuilder fn_builder, const Scope
 
 static void emit_function(Emitter* emitter, const Node* node) {
     assert(node->tag == Function_TAG);
+    assert(!emitter->fn_node_ids && !emitter->bb_builders && "functions are emitted one at a time");
+    emitter->fn_node_ids = new_dict(Node*, SpvId, (HashFn) hash_node, (CmpFn) compare_node);
+    emitter->bb_builders = new_dict(Node*, BBBuilder, (HashFn) hash_node, (CmpFn) compare_node);
 
     const Type* fn_type = node->type;
     SpvId fn_id = find_reserved_id(emitter, node);
@@ -290,7 +325,7 @@ static void emit_function(Emitter* emitter, const Node* node) {
     for (size_t i = 0; i < params.count; i++) {
         const Type* param_type = params.nodes[i]->payload.var.type;
         SpvId param_id = spvb_parameter(fn_builder, emit_type(emitter, param_type));
-        insert_dict_and_get_result(struct Node*, SpvId, emitter->node_ids, params.nodes[i], param_id);
+        insert_dict_and_get_result(struct Node*, SpvId, emitter->fn_node_ids, params.nodes[i], param_id);
         deconstruct_qualified_type(&param_type);
         if (param_type->tag == PtrType_TAG && param_type->payload.ptr_type.address_space == AsGlobalPhysical) {
             spvb_decorate(emitter->file_builder, param_id, SpvDecorationAliased, 0, NULL);
@@ -344,18 +379,24 @@ static void emit_function(Emitter* emitter, const Node* node) {
         destroy_growy(g);
         spvb_declare_function(emitter->file_builder, fn_builder);
     }
+
+    destroy_dict(emitter->fn_node_ids);
+    destroy_dict(emitter->bb_builders);
+    emitter->fn_node_ids = NULL;
+    emitter->bb_builders = NULL;
 }
 
 SpvId emit_decl(Emitter* emitter, const Node* decl) {
     SpvId* existing = find_value_dict(const Node*, SpvId, emitter->node_ids, decl);
     if (existing)
         return *existing;
+    assert(!emitter->placeholders && "declarations are all emitted before the function bodies");
 
     switch (is_declaration(decl)) {
         case GlobalVariable_TAG: {
             const GlobalVariable* gvar = &decl->payload.global_variable;
             SpvId given_id = spvb_fresh_id(emitter->file_builder);
-            register_result(emitter, decl, given_id);
+            insert_dict(const Node*, SpvId, emitter->node_ids, decl, given_id);
             spvb_name(emitter->file_builder, given_id, gvar->name);
             SpvId init = 0;
             if (gvar->init)
@@ -410,10 +451,10 @@ SpvId emit_decl(Emitter* emitter, const Node* decl) {
 
             return given_id;
         } case Function_TAG: {
+            // only reserves an ID, the bodies are emitted once everything at module scope is (see emit_decls)
             SpvId given_id = spvb_fresh_id(emitter->file_builder);
-            register_result(emitter, decl, given_id);
+            insert_dict(const Node*, SpvId, emitter->node_ids, decl, given_id);
             spvb_name(emitter->file_builder, given_id, decl->payload.fun.name);
-            emit_function(emitter, decl);
             return given_id;
         } case Constant_TAG: {
             // We don't emit constants at all !
@@ -424,7 +465,7 @@ SpvId emit_decl(Emitter* emitter, const Node* decl) {
             return 0;
         } case NominalType_TAG: {
             SpvId given_id = spvb_fresh_id(emitter->file_builder);
-            register_result(emitter, decl, given_id);
+            insert_dict(const Node*, SpvId, emitter->node_ids, decl, given_id);
             spvb_name(emitter->file_builder, given_id, decl->payload.nom_type.name);
             emit_nominal_type_body(emitter, decl->payload.nom_type.body, given_id);
             return given_id;
@@ -497,29 +538,159 @@ static void emit_entry_points(Emitter* emitter, Nodes declarations) {
     }
 }
 
+KeyHash hash_string(const char** string);
+bool compare_string(const char** a, const char** b);
+
+SpvId emit_placeholder(Emitter* emitter, PlaceholderKind kind, const Node* node, String name) {
+    SpvId* found = kind == PlaceholderExtInstSet ? find_value_dict(const char*, SpvId, emitter->placeholder_sets, name) : find_value_dict(const Node*, SpvId, emitter->placeholders, node);
+    if (found)
+        return *found;
+
+    Placeholder* placeholder = malloc(sizeof(Placeholder));
+    *placeholder = (Placeholder) {
+        .kind = kind,
+        .node = node,
+        .name = name,
+    };
+    append_list(Placeholder*, emitter->placeholder_payloads, placeholder);
+    SpvId id = spvb_fragment_placeholder(emitter->file_builder, placeholder);
+    if (kind == PlaceholderExtInstSet)
+        insert_dict(const char*, SpvId, emitter->placeholder_sets, name, id);
+    else
+        insert_dict(const Node*, SpvId, emitter->placeholders, node, id);
+    return id;
+}
+
+static SpvId resolve_placeholder(Emitter* emitter, Placeholder* placeholder) {
+    switch (placeholder->kind) {
+        case PlaceholderType: return emit_type(emitter, placeholder->node);
+        case PlaceholderValue: return emit_value(emitter, NULL, placeholder->node);
+        case PlaceholderExtInstSet: return get_extended_instruction_set(emitter, placeholder->name);
+    }
+    SHADY_UNREACHABLE;
+}
+
+typedef struct {
+    /// Only read from while the functions are being emitted
+    Emitter* emitter;
+    const Node** functions;
+    size_t functions_count;
+    FileBuilder* fragments;
+    struct List** placeholder_payloads;
+#if SHADY_HAS_THREADS
+    /// Index of the next function to emit, shared by all the threads
+    atomic_size_t next;
+#else
+    size_t next;
+#endif
+} FunctionsEmission;
+
+static void* emit_functions_into_fragments(FunctionsEmission* emission) {
+    while (true) {
+#if SHADY_HAS_THREADS
+        size_t i = atomic_fetch_add(&emission->next, 1);
+#else
+        size_t i = emission->next++;
+#endif
+        if (i >= emission->functions_count)
+            break;
+        Emitter emitter = *emission->emitter;
+        emitter.file_builder = spvb_begin_fragment();
+        emitter.placeholders = new_dict(Node*, SpvId, (HashFn) hash_node, (CmpFn) compare_node);
+        emitter.placeholder_sets = new_dict(const char*, SpvId, (HashFn) hash_string, (CmpFn) compare_string);
+        emitter.placeholder_payloads = new_list(Placeholder*);
+        emit_function(&emitter, emission->functions[i]);
+        destroy_dict(emitter.placeholders);
+        destroy_dict(emitter.placeholder_sets);
+        emission->fragments[i] = emitter.file_builder;
+        emission->placeholder_payloads[i] = emitter.placeholder_payloads;
+    }
+    return NULL;
+}
+
+/// Emits the functions into fragments on several threads, then merges those in order,
+/// which gives the exact same module as emitting them one after another.
+static void emit_functions_in_parallel(Emitter* emitter, size_t functions_count, const Node** functions, size_t threads_count) {
+    LARRAY(FileBuilder, fragments, functions_count);
+    LARRAY(struct List*, placeholder_payloads, functions_count);
+    FunctionsEmission emission = {
+        .emitter = emitter,
+        .functions = functions,
+        .functions_count = functions_count,
+        .fragments = fragments,
+        .placeholder_payloads = placeholder_payloads,
+    };
+
+#if SHADY_HAS_THREADS
+    atomic_init(&emission.next, 0);
+    set_ir_arena_shared(emitter->arena, true);
+    // the calling thread pitches in too
+    LARRAY(pthread_t, threads, threads_count);
+    size_t started = 0;
+    for (size_t i = 1; i < threads_count; i++) {
+        if (pthread_create(&threads[started], NULL, (void*(*)(void*)) emit_functions_into_fragments, &emission) != 0)
+            break;
+        started++;
+    }
+    emit_functions_into_fragments(&emission);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    set_ir_arena_shared(emitter->arena, false);
+#else
+    emit_functions_into_fragments(&emission);
+#endif
+
+    for (size_t i = 0; i < functions_count; i++) {
+        if (!spvb_merge_fragment(emitter->file_builder, fragments[i], (SpvbResolvePlaceholder) resolve_placeholder, emitter)) {
+            debug_print("Function %s has instructions that can't be renumbered, emitting it again in place\n", get_abstraction_name(functions[i]));
+            emit_function(emitter, functions[i]);
+        }
+        for (size_t j = 0; j < entries_count_list(placeholder_payloads[i]); j++)
+            free(read_list(Placeholder*, placeholder_payloads[i])[j]);
+        destroy_list(placeholder_payloads[i]);
+    }
+}
+
 static void emit_decls(Emitter* emitter, Nodes declarations) {
+    // Everything at module scope goes first: functions only get their IDs reserved here,
+    // so that no function body is emitted in the middle of another one.
     for (size_t i = 0; i < declarations.count; i++) {
         const Node* decl = declarations.nodes[i];
         emit_decl(emitter, decl);
     }
+
+    // Function bodies then only depend on module scoped IDs and on their own state
+    LARRAY(const Node*, functions, declarations.count);
+    size_t functions_count = 0;
+    for (size_t i = 0; i < declarations.count; i++) {
+        const Node* decl = declarations.nodes[i];
+        if (decl->tag == Function_TAG)
+            functions[functions_count++] = decl;
+    }
+
+    size_t threads_count = emitter->configuration->optimisations.spirv.emission_threads;
+    if (threads_count > functions_count)
+        threads_count = functions_count;
+    if (threads_count > 1) {
+        emit_functions_in_parallel(emitter, functions_count, functions, threads_count);
+        return;
+    }
+    for (size_t i = 0; i < functions_count; i++)
+        emit_function(emitter, functions[i]);
 }
 
 SpvId get_extended_instruction_set(Emitter* emitter, const char* name) {
     SpvId* found = find_value_dict(const char*, SpvId, emitter->extended_instruction_sets, name);
     if (found)
         return *found;
+    if (emitter->placeholders)
+        return emit_placeholder(emitter, PlaceholderExtInstSet, NULL, name);
 
     SpvId new = spvb_extended_import(emitter->file_builder, name);
     insert_dict(const char*, SpvId, emitter->extended_instruction_sets, name, new);
     return new;
 }
 
-KeyHash hash_node(Node**);
-bool compare_node(Node**, Node**);
-
-KeyHash hash_string(const char** string);
-bool compare_string(const char** a, const char** b);
-
 static Module* run_backend_specific_passes(CompilerConfig* config, Module* initial_mod) {
     IrArena* initial_arena = initial_mod->arena;
     Module* old_mod = NULL;
@@ -533,7 +704,7 @@ static Module* run_backend_specific_passes(CompilerConfig* config, Module* initi
     return *pmod;
 }
 
-void emit_spirv(CompilerConfig* config, Module* mod, size_t* output_size, char** output, Module** new_mod) {
+static FileBuilder emit_spirv_module(CompilerConfig* config, Module* mod, Module** new_mod) {
     IrArena* initial_arena = get_module_arena(mod);
     mod = run_backend_specific_passes(config, mod);
     IrArena* arena = get_module_arena(mod);
@@ -548,7 +719,6 @@ void emit_spirv(CompilerConfig* config, Module* mod, size_t* output_size, char**
         .configuration = config,
         .file_builder = file_builder,
         .node_ids = new_dict(Node*, SpvId, (HashFn) hash_node, (CmpFn) compare_node),
-        .bb_builders = new_dict(Node*, BBBuilder, (HashFn) hash_node, (CmpFn) compare_node),
         .num_entry_pts = 0,
     };
 
@@ -567,15 +737,39 @@ void emit_spirv(CompilerConfig* config, Module* mod, size_t* output_size, char**
 
     spvb_capability(file_builder, SpvCapabilityShader);
 
-    *output_size = spvb_finish(file_builder, output);
-
-    // cleanup the emitter
+    // cleanup the emitter, the file builder owns everything that's left
     destroy_dict(emitter.node_ids);
-    destroy_dict(emitter.bb_builders);
     destroy_dict(emitter.extended_instruction_sets);
 
     if (new_mod)
         *new_mod = mod;
     else if (initial_arena != arena)
         destroy_ir_arena(arena);
+
+    return file_builder;
+}
+
+static bool should_compact(CompilerConfig* config) {
+    return config->optimisations.spirv.compact || config->optimisations.spirv.strip_names;
+}
+
+void emit_spirv(CompilerConfig* config, Module* mod, size_t* output_size, char** output, Module** new_mod) {
+    FileBuilder file_builder = emit_spirv_module(config, mod, new_mod);
+    *output_size = spvb_finish(file_builder, output);
+    if (should_compact(config))
+        *output_size = spvb_compact(*output, *output_size, config->optimisations.spirv.strip_names);
+}
+
+void emit_spirv_into(CompilerConfig* config, Module* mod, EmitterSink sink, void* uptr, Module** new_mod) {
+    // compacting needs to see the whole module at once
+    if (should_compact(config)) {
+        size_t size;
+        char* words;
+        emit_spirv(config, mod, &size, &words, new_mod);
+        sink(uptr, size, words);
+        free(words);
+        return;
+    }
+    FileBuilder file_builder = emit_spirv_module(config, mod, new_mod);
+    spvb_finish_into(file_builder, (SpvbSink) sink, uptr);
 }
@@ -14,13 +14,34 @@ typedef struct Emitter_ {
     CompilerConfig* configuration;
     FileBuilder file_builder;
     SpvId void_t;
+    /// IDs of the declarations, types and constants, shared by the whole module
     struct Dict* node_ids;
+    /// IDs of the params, basic blocks and results of the function being emitted, discarded once it's done
+    struct Dict* fn_node_ids;
     struct Dict* bb_builders;
     size_t num_entry_pts;
 
     struct Dict* extended_instruction_sets;
+
+    /// Only set when emitting a function into a fragment (see spvb_begin_fragment): the module scoped dicts are then only read,
+    /// and what's missing from them gets a placeholder, which the merge resolves with the real thing
+    struct Dict* placeholders;
+    struct Dict* placeholder_sets;
+    struct List* placeholder_payloads;
 } Emitter;
 
+typedef enum {
+    PlaceholderType,
+    PlaceholderValue,
+    PlaceholderExtInstSet,
+} PlaceholderKind;
+
+typedef struct {
+    PlaceholderKind kind;
+    const Node* node;
+    String name;
+} Placeholder;
+
 typedef SpvbPhi** Phis;
 
 typedef struct {
@@ -46,6 +67,7 @@ SpvId find_reserved_id(Emitter* emitter, const Node* node);
 void register_result(Emitter*, const Node*, SpvId id);
 
 SpvId get_extended_instruction_set(Emitter*, const char*);
+SpvId emit_placeholder(Emitter*, PlaceholderKind, const Node* node, String name);
 
 SpvStorageClass emit_addr_space(Emitter*, AddressSpace address_space);
 // SPIR-V doesn't have multiple return types, this bridges the gap...
@@ -170,6 +170,17 @@ static SpvOp get_opcode(SHADY_UNUSED Emitter* emitter, IselTableEntry entry, Nod
     }
 }
 
+/// Ballots come as four 32-bit words, we only keep the first two
+static SpvId emit_ballot_as_u64(Emitter* emitter, BBBuilder bb_builder, SpvId raw_result) {
+    // TODO: why are we doing this in SPIR-V and not the IR ?
+    SpvId low32 = spvb_extract(bb_builder, emit_type(emitter, uint32_type(emitter->arena)), raw_result, 1, (uint32_t[]) { 0 });
+    SpvId hi32 = spvb_extract(bb_builder, emit_type(emitter, uint32_type(emitter->arena)), raw_result, 1, (uint32_t[]) { 1 });
+    SpvId low64 = spvb_op(bb_builder, SpvOpUConvert, emit_type(emitter, uint64_type(emitter->arena)), 1, &low32);
+    SpvId hi64 = spvb_op(bb_builder, SpvOpUConvert, emit_type(emitter, uint64_type(emitter->arena)), 1, &hi32);
+    hi64 = spvb_op(bb_builder, SpvOpShiftLeftLogical, emit_type(emitter, uint64_type(emitter->arena)), 2, (SpvId []) { hi64, emit_value(emitter, bb_builder, int64_literal(emitter->arena, 32)) });
+    return spvb_op(bb_builder, SpvOpBitwiseOr, emit_type(emitter, uint64_type(emitter->arena)), 2, (SpvId []) { low64, hi64 });
+}
+
 static void emit_primop(Emitter* emitter, FnBuilder fn_builder, BBBuilder bb_builder, const Node* instr, size_t results_count, SpvId results[]) {
     PrimOp the_op = instr->payload.prim_op;
     Nodes args = the_op.operands;
@@ -215,22 +226,27 @@ static void emit_primop(Emitter* emitter, FnBuilder fn_builder, BBBuilder bb_bui
         return;
     }
     switch (the_op.op) {
+        // the active lanes are the ones that vote for true
+        case subgroup_active_mask_op:
         case subgroup_ballot_op: {
             const Type* i32x4 = pack_type(emitter->arena, (PackType) { .width = 4, .element_type = uint32_type(emitter->arena) });
             SpvId scope_subgroup = emit_value(emitter, bb_builder, int32_literal(emitter->arena, SpvScopeSubgroup));
-            SpvId raw_result = spvb_group_ballot(bb_builder, emit_type(emitter, i32x4), emit_value(emitter, bb_builder, first(args)), scope_subgroup);
-            // TODO: why are we doing this in SPIR-V and not the IR ?
-            SpvId low32 = spvb_extract(bb_builder, emit_type(emitter, uint32_type(emitter->arena)), raw_result, 1, (uint32_t[]) { 0 });
-            SpvId hi32 = spvb_extract(bb_builder, emit_type(emitter, uint32_type(emitter->arena)), raw_result, 1, (uint32_t[]) { 1 });
-            SpvId low64 = spvb_op(bb_builder, SpvOpUConvert, emit_type(emitter, uint64_type(emitter->arena)), 1, &low32);
-            SpvId hi64 = spvb_op(bb_builder, SpvOpUConvert, emit_type(emitter, uint64_type(emitter->arena)), 1, &hi32);
-            hi64 = spvb_op(bb_builder, SpvOpShiftLeftLogical, emit_type(emitter, uint64_type(emitter->arena)), 2, (SpvId []) { hi64, emit_value(emitter, bb_builder, int64_literal(emitter->arena, 32)) });
-            SpvId final_result = spvb_op(bb_builder, SpvOpBitwiseOr, emit_type(emitter, uint64_type(emitter->arena)), 2, (SpvId []) { low64, hi64 });
+            const Node* predicate = the_op.op == subgroup_ballot_op ? first(args) : true_lit(emitter->arena);
+            SpvId raw_result = spvb_group_ballot(bb_builder, emit_type(emitter, i32x4), emit_value(emitter, bb_builder, predicate), scope_subgroup);
             assert(results_count == 1);
-            results[0] = final_result;
+            results[0] = emit_ballot_as_u64(emitter, bb_builder, raw_result);
             spvb_capability(emitter->file_builder, SpvCapabilityGroupNonUniformBallot);
             return;
         }
+        case subgroup_partition_op: {
+            const Type* i32x4 = pack_type(emitter->arena, (PackType) { .width = 4, .element_type = uint32_type(emitter->arena) });
+            SpvId raw_result = spvb_op(bb_builder, SpvOpGroupNonUniformPartitionNV, emit_type(emitter, i32x4), 1, (SpvId []) { emit_value(emitter, bb_builder, first(args)) });
+            assert(results_count == 1);
+            results[0] = emit_ballot_as_u64(emitter, bb_builder, raw_result);
+            spvb_capability(emitter->file_builder, SpvCapabilityGroupNonUniformPartitionedNV);
+            spvb_extension(emitter->file_builder, "SPV_NV_shader_subgroup_partitioned");
+            return;
+        }
         case subgroup_broadcast_first_op: {
             SpvId scope_subgroup = emit_value(emitter, bb_builder, int32_literal(emitter->arena, SpvScopeSubgroup));
             SpvId result;
@@ -250,6 +266,20 @@ static void emit_primop(Emitter* emitter, FnBuilder fn_builder, BBBuilder bb_bui
             spvb_capability(emitter->file_builder, SpvCapabilityGroupNonUniformBallot);
             return;
         }
+        case subgroup_shuffle_op: {
+            SpvId scope_subgroup = emit_value(emitter, bb_builder, int32_literal(emitter->arena, SpvScopeSubgroup));
+            assert(results_count == 1);
+            results[0] = spvb_group_shuffle(bb_builder, emit_type(emitter, get_unqualified_type(first(args)->type)), scope_subgroup, emit_value(emitter, bb_builder, first(args)), emit_value(emitter, bb_builder, args.nodes[1]));
+            spvb_capability(emitter->file_builder, SpvCapabilityGroupNonUniformShuffle);
+            return;
+        }
+        case subgroup_barrier_op: {
+            // subgroup memory lives in shared memory
+            SpvId scope_subgroup = emit_value(emitter, bb_builder, int32_literal(emitter->arena, SpvScopeSubgroup));
+            SpvId semantics = emit_value(emitter, bb_builder, int32_literal(emitter->arena, SpvMemorySemanticsAcquireReleaseMask | SpvMemorySemanticsWorkgroupMemoryMask));
+            spvb_control_barrier(bb_builder, scope_subgroup, scope_subgroup, semantics);
+            return;
+        }
         case subgroup_reduce_sum_op: {
             SpvId scope_subgroup = emit_value(emitter, bb_builder, int32_literal(emitter->arena, SpvScopeSubgroup));
             assert(results_count == 1);
@@ -507,7 +537,7 @@ static void emit_match(Emitter* emitter, FnBuilder fn_builder, BBBuilder* bb_bui
     }
 
     spvb_selection_merge(*bb_builder, join_bb_id, 0);
-    spvb_switch(*bb_builder, inspectee, default_id, match.cases.count * literal_case_entry_size, literals_and_cases);
+    spvb_switch(*bb_builder, inspectee, literal_width, default_id, match.cases.count * literal_case_entry_size, literals_and_cases);
 
     // When 'join' is codegen'd, these will be filled with the values given to it
     BBBuilder join_bb = spvb_begin_bb(fn_builder, join_bb_id);
@@ -568,7 +598,7 @@ static void emit_loop(Emitter* emitter, FnBuilder fn_builder, BBBuilder* bb_buil
     // Wire up the phi nodes for loop exit
     LARRAY(SpvbPhi*, loop_break_phis, yield_types.count);
     for (size_t i = 0; i < yield_types.count; i++) {
-        SpvId yielded_type = emit_type(emitter, get_unqualified_type(yield_types.nodes[i]));
+        SpvId yielded_type = emit_type(emitter, yield_types.nodes[i]);
 
         SpvId break_phi_id = spvb_fresh_id(emitter->file_builder);
         SpvbPhi* phi = spvb_add_phi(next, yielded_type, break_phi_id);
@@ -106,6 +106,8 @@ SpvId emit_type(Emitter* emitter, const Type* type) {
     SpvId* existing = find_value_dict(struct Node*, SpvId, emitter->node_ids, type);
     if (existing)
         return *existing;
+    if (emitter->placeholders)
+        return emit_placeholder(emitter, PlaceholderType, type, NULL);
 
     SpvId new;
     switch (is_type(type)) {
@@ -3,6 +3,7 @@
 #include "list.h"
 #include "growy.h"
 #include "dict.h"
+#include "portability.h"
 
 #include <string.h>
 #include <stddef.h>
@@ -91,8 +92,23 @@ struct SpvbFileBuilder_ {
 
     struct Dict* capabilities_set;
     struct Dict* extensions_set;
+
+    /// Only for fragments, see spvb_begin_fragment
+    bool is_fragment;
+    struct List* placeholders;
+    /// The set above only keeps the names, the merge needs them in order
+    struct List* extension_names;
+    /// The merge can't look at the type of the selectors to renumber switches
+    struct Dict* switch_literal_widths;
 };
 
+typedef struct {
+    SpvId id;
+    void* payload;
+    /// How far the fragment got with its names, annotations, capabilities and extensions when the placeholder was handed out
+    size_t names, annotations, capabilities, extensions;
+} SpvbPlaceholder;
+
 static KeyHash hash_u32(uint32_t* p) { return hash_murmur(p, sizeof(uint32_t)); }
 static bool compare_u32s(uint32_t* a, uint32_t* b) { return *a == *b; }
 
@@ -124,36 +140,15 @@ SpvbFileBuilder* spvb_begin() {
     return file_builder;
 }
 
-#define target_data final_output
-inline static void merge_sections(SpvbFileBuilder* file_builder, SpvbSectionBuilder final_output) {
-    literal_int(SpvMagicNumber);
-    uint32_t version_tag = 0;
-    version_tag |= ((uint32_t) file_builder->version.major) << 16;
-    version_tag |= ((uint32_t) file_builder->version.minor) << 8;
-    literal_int(version_tag);
-    literal_int(SHADY_GENERATOR_MAGIC_NUMBER);
-    literal_int(file_builder->bound);
-    literal_int(0); // instruction schema padding
-
-    copy_section(file_builder->capabilities);
-    copy_section(file_builder->extensions);
-    copy_section(file_builder->ext_inst_import);
-
-    op(SpvOpMemoryModel, 3);
-    literal_int(file_builder->addressing_model);
-    literal_int(file_builder->memory_model);
-
-    copy_section(file_builder->entry_points);
-    copy_section(file_builder->execution_modes);
-    copy_section(file_builder->debug_string_source);
-    copy_section(file_builder->debug_names);
-    copy_section(file_builder->debug_module_processed);
-    copy_section(file_builder->annotations);
-    copy_section(file_builder->types_constants);
-    copy_section(file_builder->fn_decls);
-    copy_section(file_builder->fn_defs);
+SpvbFileBuilder* spvb_begin_fragment() {
+    SpvbFileBuilder* fragment = spvb_begin();
+    fragment->bound = SPVB_FRAGMENT_ID_BIT | 1;
+    fragment->is_fragment = true;
+    fragment->placeholders = new_list(SpvbPlaceholder);
+    fragment->extension_names = new_list(const char*);
+    fragment->switch_literal_widths = new_dict(SpvId, uint8_t, (HashFn) hash_u32, (CmpFn) compare_u32s);
+    return fragment;
 }
-#undef target_data
 
 static const uint8_t endian_check_helper[4] = { 1, 2, 3, 4 };
 
@@ -174,10 +169,37 @@ static uint32_t byteswap(uint32_t v) {
     return v;
 }
 
-size_t spvb_finish(SpvbFileBuilder* file_builder, char** output) {
-    Growy* g = new_growy();
-    merge_sections(file_builder, g);
+/// Hands a chunk of words to the sink, fixing their endianness in place first.
+static size_t send_words(SpvbSink sink, void* uptr, size_t size, char* words) {
+    assert(size % 4 == 0);
+    if (size == 0)
+        return 0;
+    if (is_big_endian()) for (size_t i = 0; i < size / 4; i++) {
+        ((uint32_t*) words)[i] = byteswap(((uint32_t*) words)[i]);
+    }
+    sink(uptr, size, words);
+    return size;
+}
+
+static size_t send_section(SpvbSink sink, void* uptr, SpvbSectionBuilder section) {
+    return send_words(sink, uptr, growy_size(section), growy_data(section));
+}
 
+#define SECTIONS_AFTER_MEMORY_MODEL 9
+
+static void get_sections_after_memory_model(SpvbFileBuilder* file_builder, SpvbSectionBuilder sections[SECTIONS_AFTER_MEMORY_MODEL]) {
+    sections[0] = file_builder->entry_points;
+    sections[1] = file_builder->execution_modes;
+    sections[2] = file_builder->debug_string_source;
+    sections[3] = file_builder->debug_names;
+    sections[4] = file_builder->debug_module_processed;
+    sections[5] = file_builder->annotations;
+    sections[6] = file_builder->types_constants;
+    sections[7] = file_builder->fn_decls;
+    sections[8] = file_builder->fn_defs;
+}
+
+static void destroy_file_builder(SpvbFileBuilder* file_builder) {
     destroy_growy(file_builder->fn_defs);
     destroy_growy(file_builder->fn_decls);
     destroy_growy(file_builder->types_constants);
@@ -194,16 +216,70 @@ size_t spvb_finish(SpvbFileBuilder* file_builder, char** output) {
     destroy_dict(file_builder->capabilities_set);
     destroy_dict(file_builder->extensions_set);
 
+    if (file_builder->is_fragment) {
+        destroy_list(file_builder->placeholders);
+        destroy_list(file_builder->extension_names);
+        destroy_dict(file_builder->switch_literal_widths);
+    }
+
     free(file_builder);
+}
+
+size_t spvb_finish_into(SpvbFileBuilder* file_builder, SpvbSink sink, void* uptr) {
+    // The sections are never concatenated: the few words that don't live in one are sent from the stack
+    uint32_t header[] = {
+        SpvMagicNumber,
+        ((uint32_t) file_builder->version.major) << 16 | ((uint32_t) file_builder->version.minor) << 8,
+        SHADY_GENERATOR_MAGIC_NUMBER,
+        file_builder->bound,
+        0, // instruction schema padding
+    };
+    uint32_t memory_model[] = {
+        (SpvOpMemoryModel & 0xFFFFu) | (3u << 16),
+        file_builder->addressing_model,
+        file_builder->memory_model,
+    };
 
-    size_t s = growy_size(g);
-    assert(s % 4 == 0);
-    *output = growy_deconstruct(g);
+    size_t total = 0;
+    total += send_words(sink, uptr, sizeof(header), (char*) header);
+    total += send_section(sink, uptr, file_builder->capabilities);
+    total += send_section(sink, uptr, file_builder->extensions);
+    total += send_section(sink, uptr, file_builder->ext_inst_import);
+    total += send_words(sink, uptr, sizeof(memory_model), (char*) memory_model);
+    SpvbSectionBuilder sections[SECTIONS_AFTER_MEMORY_MODEL];
+    get_sections_after_memory_model(file_builder, sections);
+    for (size_t i = 0; i < SECTIONS_AFTER_MEMORY_MODEL; i++)
+        total += send_section(sink, uptr, sections[i]);
 
-    if (is_big_endian()) for (size_t i = 0; i < s / 4; i++) {
-        ((uint32_t*)*output)[i] = byteswap(((uint32_t*)(*output))[i]);
-    }
+    destroy_file_builder(file_builder);
+    return total;
+}
+
+typedef struct {
+    char* buffer;
+    size_t written;
+} BufferSink;
+
+static void write_into_buffer(BufferSink* buffer, size_t size, const char* data) {
+    memcpy(buffer->buffer + buffer->written, data, size);
+    buffer->written += size;
+}
 
+size_t spvb_finish(SpvbFileBuilder* file_builder, char** output) {
+    // the final size is known upfront, so the output is allocated once and every section is copied into it once
+    size_t size = (5 + 3) * sizeof(uint32_t);
+    size += growy_size(file_builder->capabilities);
+    size += growy_size(file_builder->extensions);
+    size += growy_size(file_builder->ext_inst_import);
+    SpvbSectionBuilder sections[SECTIONS_AFTER_MEMORY_MODEL];
+    get_sections_after_memory_model(file_builder, sections);
+    for (size_t i = 0; i < SECTIONS_AFTER_MEMORY_MODEL; i++)
+        size += growy_size(sections[i]);
+
+    BufferSink buffer = { .buffer = malloc(size) };
+    size_t s = spvb_finish_into(file_builder, (SpvbSink) write_into_buffer, &buffer);
+    assert(s == size && buffer.written == size);
+    *output = buffer.buffer;
     return s;
 }
 
@@ -211,6 +287,101 @@ SpvId spvb_fresh_id(SpvbFileBuilder* file_builder) {
     return file_builder->bound++;
 }
 
+SpvId spvb_fragment_placeholder(SpvbFileBuilder* fragment, void* payload) {
+    assert(fragment->is_fragment);
+    SpvbPlaceholder placeholder = {
+        .id = spvb_fresh_id(fragment),
+        .payload = payload,
+        .names = growy_size(fragment->debug_names),
+        .annotations = growy_size(fragment->annotations),
+        .capabilities = growy_size(fragment->capabilities),
+        .extensions = entries_count_list(fragment->extension_names),
+    };
+    append_list(SpvbPlaceholder, fragment->placeholders, placeholder);
+    return placeholder.id;
+}
+
+typedef struct {
+    SpvbFileBuilder* file_builder;
+    SpvbFileBuilder* fragment;
+    /// Module IDs for the fragment ones, indexed without the tag bit
+    SpvId* new_ids;
+    /// What has been merged so far, in the same units as SpvbPlaceholder
+    size_t names, annotations, capabilities, extensions;
+} SpvbMerge;
+
+static SpvId remap_fragment_id(SpvbMerge* merge, SpvId id) {
+    if (!(id & SPVB_FRAGMENT_ID_BIT))
+        return id;
+    SpvId new = merge->new_ids[id & ~SPVB_FRAGMENT_ID_BIT];
+    assert(new != 0 && "fragment ID used before it was merged");
+    return new;
+}
+
+static void merge_section(SpvbMerge* merge, SpvbSectionBuilder target, SpvbSectionBuilder source, size_t from, size_t to) {
+    size_t offset = growy_size(target);
+    growy_append_bytes(target, to - from, growy_data(source) + from);
+    SHADY_UNUSED bool understood = spvb_remap_ids((uint32_t*) (growy_data(target) + offset), (to - from) / 4, merge->fragment->switch_literal_widths, (SpvbRemapId) remap_fragment_id, merge);
+    assert(understood);
+}
+
+/// Merges whatever the fragment emitted before that point, the module then looks the same as if it was emitted there
+static void catch_up(SpvbMerge* merge, size_t names, size_t annotations, size_t capabilities, size_t extensions) {
+    merge_section(merge, merge->file_builder->debug_names, merge->fragment->debug_names, merge->names, names);
+    merge->names = names;
+    merge_section(merge, merge->file_builder->annotations, merge->fragment->annotations, merge->annotations, annotations);
+    merge->annotations = annotations;
+    // OpCapability takes two words
+    for (; merge->capabilities < capabilities; merge->capabilities += 2 * sizeof(uint32_t))
+        spvb_capability(merge->file_builder, ((uint32_t*) (growy_data(merge->fragment->capabilities) + merge->capabilities))[1]);
+    for (; merge->extensions < extensions; merge->extensions++)
+        spvb_extension(merge->file_builder, read_list(const char*, merge->fragment->extension_names)[merge->extensions]);
+}
+
+bool spvb_merge_fragment(SpvbFileBuilder* file_builder, SpvbFileBuilder* fragment, SpvbResolvePlaceholder resolve, void* uptr) {
+    assert(fragment->is_fragment && !file_builder->is_fragment);
+    // nothing at module scope is supposed to end up in there
+    bool understood = true;
+    SpvbSectionBuilder module_scoped[] = { fragment->ext_inst_import, fragment->entry_points, fragment->execution_modes, fragment->debug_string_source, fragment->debug_module_processed, fragment->types_constants };
+    for (size_t i = 0; i < sizeof(module_scoped) / sizeof(module_scoped[0]); i++)
+        understood &= growy_size(module_scoped[i]) == 0;
+    SpvbSectionBuilder renumbered[] = { fragment->debug_names, fragment->annotations, fragment->fn_decls, fragment->fn_defs };
+    for (size_t i = 0; i < sizeof(renumbered) / sizeof(renumbered[0]); i++)
+        understood &= spvb_remap_ids((uint32_t*) growy_data(renumbered[i]), growy_size(renumbered[i]) / 4, fragment->switch_literal_widths, NULL, NULL);
+    if (!understood) {
+        destroy_file_builder(fragment);
+        return false;
+    }
+
+    size_t ids_count = fragment->bound & ~SPVB_FRAGMENT_ID_BIT;
+    SpvbMerge merge = {
+        .file_builder = file_builder,
+        .fragment = fragment,
+        .new_ids = calloc(ids_count, sizeof(SpvId)),
+    };
+    size_t placeholders_count = entries_count_list(fragment->placeholders);
+    size_t next_placeholder = 0;
+    for (size_t i = 1; i < ids_count; i++) {
+        SpvbPlaceholder* placeholder = next_placeholder < placeholders_count ? &read_list(SpvbPlaceholder, fragment->placeholders)[next_placeholder] : NULL;
+        if (placeholder && (placeholder->id & ~SPVB_FRAGMENT_ID_BIT) == i) {
+            catch_up(&merge, placeholder->names, placeholder->annotations, placeholder->capabilities, placeholder->extensions);
+            merge.new_ids[i] = resolve(uptr, placeholder->payload);
+            next_placeholder++;
+        } else {
+            merge.new_ids[i] = spvb_fresh_id(file_builder);
+        }
+    }
+    catch_up(&merge, growy_size(fragment->debug_names), growy_size(fragment->annotations), growy_size(fragment->capabilities), entries_count_list(fragment->extension_names));
+    merge_section(&merge, file_builder->fn_decls, fragment->fn_decls, 0, growy_size(fragment->fn_decls));
+    merge_section(&merge, file_builder->fn_defs, fragment->fn_defs, 0, growy_size(fragment->fn_defs));
+    if (fragment->addressing_model != SpvAddressingModelLogical)
+        spvb_set_addressing_model(file_builder, fragment->addressing_model);
+
+    free(merge.new_ids);
+    destroy_file_builder(fragment);
+    return true;
+}
+
 void spvb_set_version(SpvbFileBuilder* file_builder, uint8_t major, uint8_t minor) {
     file_builder->version.major = major;
     file_builder->version.minor = minor;
@@ -235,6 +406,8 @@ void spvb_extension(SpvbFileBuilder* file_builder, const char* name) {
     if (insert_set_get_result(char*, file_builder->extensions_set, name)) {
         op(SpvOpExtension, 1 + div_roundup(strlen(name) + 1, 4));
         literal_name(name);
+        if (file_builder->is_fragment)
+            append_list(const char*, file_builder->extension_names, name);
     }
 }
 #undef target_data
@@ -819,6 +992,13 @@ SpvId spvb_group_broadcast_first(SpvbBasicBlockBuilder* bb_builder, SpvId result
     return id;
 }
 
+void spvb_control_barrier(SpvbBasicBlockBuilder* bb_builder, SpvId execution_scope, SpvId memory_scope, SpvId semantics) {
+    op(SpvOpControlBarrier, 4);
+    ref_id(execution_scope);
+    ref_id(memory_scope);
+    ref_id(semantics);
+}
+
 SpvId spvb_group_shuffle(SpvbBasicBlockBuilder* bb_builder, SpvId result_type, SpvId scope, SpvId value, SpvId id) {
     op(SpvOpGroupNonUniformShuffle, 6);
     SpvId rid = spvb_fresh_id(bb_builder->fn_builder->file_builder);
@@ -855,7 +1035,12 @@ void spvb_branch_conditional(SpvbBasicBlockBuilder* bb_builder, SpvId condition,
     ref_id(false_target);
 }
 
-void spvb_switch(SpvbBasicBlockBuilder* bb_builder, SpvId selector, SpvId default_target, size_t targets_and_literals_size, SpvId* targets_and_literals) {
+void spvb_switch(SpvbBasicBlockBuilder* bb_builder, SpvId selector, size_t literal_width, SpvId default_target, size_t targets_and_literals_size, SpvId* targets_and_literals) {
+    SpvbFileBuilder* file_builder = bb_builder->fn_builder->file_builder;
+    if (file_builder->is_fragment) {
+        uint8_t width = literal_width;
+        insert_dict(SpvId, uint8_t, file_builder->switch_literal_widths, selector, width);
+    }
     op(SpvOpSwitch, 3 + targets_and_literals_size);
     ref_id(selector);
     ref_id(default_target);
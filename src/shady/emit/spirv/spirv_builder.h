@@ -12,17 +12,46 @@ typedef struct SpvbFileBuilder_ SpvbFileBuilder;
 typedef struct SpvbPhi_ SpvbPhi;
 
 typedef struct Growy_ Growy;
+struct Dict;
 typedef Growy* SpvbSectionBuilder;
 
 typedef const char* String;
 
 void spvb_literal_name(SpvbSectionBuilder data, const char* str);
 
+/// Receives the finished module one piece at a time, in order. The data is only valid for the duration of the call.
+typedef void (*SpvbSink)(void* uptr, size_t size, const char* data);
+
 SpvbFileBuilder* spvb_begin();
+/// Streams the module section by section into the sink and destroys the builder, returns the total size in bytes.
+size_t spvb_finish_into(SpvbFileBuilder*, SpvbSink sink, void* uptr);
+/// Same as spvb_finish_into, but into a single buffer that the caller has to free.
 size_t spvb_finish(SpvbFileBuilder*, char** pwords);
 
+/// Removes the types, constants, strings and decorations nothing uses from a finished module, and renumbers its IDs without gaps.
+/// Works in place and returns the new size in bytes. Modules with instructions it doesn't know about are left untouched.
+size_t spvb_compact(char* words, size_t size, bool strip_names);
+
+typedef SpvId (*SpvbRemapId)(void* uptr, SpvId id);
+/// Replaces every ID referenced or defined by a run of instructions with remap(uptr, id), remap can be NULL to only check.
+/// Switches are only understood if their selector has an entry in switch_literal_widths (SpvId -> uint8_t, can be NULL).
+/// Returns false and leaves the words untouched if any of the instructions isn't understood.
+bool spvb_remap_ids(uint32_t* words, size_t words_count, struct Dict* switch_literal_widths, SpvbRemapId remap, void* uptr);
+
 SpvId spvb_fresh_id(SpvbFileBuilder*);
 
+/// Fragments are file builders for emitting functions away from the module: they get the functions themselves, their names,
+/// decorations, capabilities and extensions, but nothing at module scope. They hand out IDs of their own, tagged with
+/// SPVB_FRAGMENT_ID_BIT, and the things they need from the module scope are stood in for by placeholder IDs.
+#define SPVB_FRAGMENT_ID_BIT 0x80000000u
+SpvbFileBuilder* spvb_begin_fragment();
+SpvId spvb_fragment_placeholder(SpvbFileBuilder* fragment, void* payload);
+typedef SpvId (*SpvbResolvePlaceholder)(void* uptr, void* payload);
+/// Appends a fragment to a module as if it had been emitted there directly, and destroys it: the IDs of the fragment are
+/// given module IDs in the order they were handed out, with placeholders resolved on the spot.
+/// Returns false and leaves the module untouched if the fragment holds instructions that can't be renumbered.
+bool spvb_merge_fragment(SpvbFileBuilder*, SpvbFileBuilder* fragment, SpvbResolvePlaceholder resolve, void* uptr);
+
 void spvb_set_version(SpvbFileBuilder*, uint8_t major, uint8_t minor);
 void spvb_set_addressing_model(SpvbFileBuilder*, SpvAddressingModel model);
 void spvb_capability(SpvbFileBuilder*, SpvCapability cap);
@@ -95,6 +124,7 @@ void  spvb_store(SpvbBasicBlockBuilder*, SpvId value, SpvId pointer, size_t oper
 SpvId  spvb_vecshuffle(SpvbBasicBlockBuilder*, SpvId result_type, SpvId a, SpvId b, size_t operands_count, uint32_t operands[]);
 SpvId spvb_group_elect(SpvbBasicBlockBuilder*, SpvId result_type, SpvId scope);
 SpvId spvb_group_ballot(SpvbBasicBlockBuilder*, SpvId result_t, SpvId predicate, SpvId scope);
+void spvb_control_barrier(SpvbBasicBlockBuilder*, SpvId execution_scope, SpvId memory_scope, SpvId semantics);
 SpvId spvb_group_shuffle(SpvbBasicBlockBuilder*, SpvId result_type, SpvId scope, SpvId value, SpvId id);
 SpvId spvb_group_broadcast_first(SpvbBasicBlockBuilder*, SpvId result_t, SpvId value, SpvId scope);
 SpvId spvb_group_non_uniform_iadd(SpvbBasicBlockBuilder*, SpvId result_t, SpvId value, SpvId scope, SpvGroupOperation group_op, SpvId* cluster_size);
@@ -102,7 +132,8 @@ SpvId spvb_group_non_uniform_iadd(SpvbBasicBlockBuilder*, SpvId result_t, SpvId
 // Terminators
 void  spvb_branch(SpvbBasicBlockBuilder*, SpvId target);
 void  spvb_branch_conditional(SpvbBasicBlockBuilder*, SpvId condition, SpvId true_target, SpvId false_target);
-void  spvb_switch(SpvbBasicBlockBuilder*, SpvId selector, SpvId default_target, size_t targets_count, SpvId* targets);
+/// literal_width is the size in words of the case literals, which depends on the type of the selector
+void  spvb_switch(SpvbBasicBlockBuilder*, SpvId selector, size_t literal_width, SpvId default_target, size_t targets_count, SpvId* targets);
 void  spvb_selection_merge(SpvbBasicBlockBuilder*, SpvId merge_bb, SpvSelectionControlMask selection_control) ;
 void  spvb_loop_merge(SpvbBasicBlockBuilder*, SpvId merge_bb, SpvId continue_bb, SpvLoopControlMask loop_control, size_t loop_control_ops_count, uint32_t loop_control_ops[]);
 SpvId spvb_call(SpvbBasicBlockBuilder*, SpvId return_type, SpvId callee, size_t arguments_count, SpvId arguments[]);
@@ -0,0 +1,454 @@
+#include "spirv_builder.h"
+
+#include "log.h"
+#include "dict.h"
+#include "portability.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+// A post-pass over finished modules: the emitter creates types and constants as it goes and never takes them back,
+// and adds debug names for everything it can. This strips what ends up unused and renumbers the IDs without gaps.
+
+/// Describes the operands of an instruction, one character per operand:
+/// T: result type, R: result id, i: id, l: literal word, s: literal string,
+/// I: all remaining words are ids, L: all remaining words are literals,
+/// M: memory operands (a mask then literals), O: image operands (a mask then ids),
+/// W: switch targets (pairs of literals and ids)
+/// Trailing operands are optional, the word count of the instruction decides how many are present.
+static const char* get_operands_layout(SpvOp op) {
+    switch (op) {
+        case SpvOpCapability: return "l";
+        case SpvOpExtension: return "s";
+        case SpvOpExtInstImport: return "Rs";
+        case SpvOpMemoryModel: return "ll";
+        case SpvOpEntryPoint: return "lisI";
+        case SpvOpExecutionMode: return "iL";
+        case SpvOpString: return "Rs";
+        case SpvOpName: return "is";
+        case SpvOpMemberName: return "ils";
+        case SpvOpDecorate: return "iL";
+        case SpvOpMemberDecorate: return "ilL";
+
+        case SpvOpTypeVoid:
+        case SpvOpTypeBool:
+        case SpvOpTypeSampler: return "R";
+        case SpvOpTypeInt: return "Rll";
+        case SpvOpTypeFloat: return "Rl";
+        case SpvOpTypeVector: return "Ril";
+        case SpvOpTypeArray: return "Rii";
+        case SpvOpTypeRuntimeArray:
+        case SpvOpTypeSampledImage: return "Ri";
+        case SpvOpTypeStruct:
+        case SpvOpTypeFunction: return "RI";
+        case SpvOpTypePointer: return "Rli";
+        case SpvOpTypeImage: return "RiL";
+
+        case SpvOpConstant: return "TRL";
+        case SpvOpConstantTrue:
+        case SpvOpConstantFalse:
+        case SpvOpConstantNull:
+        case SpvOpUndef: return "TR";
+        case SpvOpConstantComposite: return "TRI";
+
+        case SpvOpFunction: return "TRli";
+        case SpvOpFunctionParameter: return "TR";
+        case SpvOpFunctionEnd: return "";
+        case SpvOpVariable: return "TRli";
+        case SpvOpLabel: return "R";
+
+        case SpvOpLoad: return "TRiM";
+        case SpvOpStore: return "iiM";
+        case SpvOpCompositeExtract: return "TRiL";
+        case SpvOpCompositeInsert: return "TRiiL";
+        case SpvOpVectorShuffle: return "TRiiL";
+        case SpvOpExtInst: return "TRilI";
+        case SpvOpGroupNonUniformIAdd: return "TRilI";
+        case SpvOpImageSampleImplicitLod: return "TRiiO";
+
+        case SpvOpSelectionMerge: return "il";
+        case SpvOpLoopMerge: return "iilL";
+        case SpvOpBranch:
+        case SpvOpReturnValue: return "i";
+        case SpvOpBranchConditional: return "iiiL";
+        case SpvOpSwitch: return "iiW";
+        case SpvOpReturn:
+        case SpvOpUnreachable: return "";
+
+        // everything else the emitter produces only takes ids
+        case SpvOpFunctionCall:
+        case SpvOpPhi:
+        case SpvOpAccessChain:
+        case SpvOpPtrAccessChain:
+        case SpvOpCompositeConstruct:
+        case SpvOpVectorExtractDynamic:
+        case SpvOpVectorInsertDynamic:
+        case SpvOpSelect:
+        case SpvOpBitcast:
+        case SpvOpConvertFToS:
+        case SpvOpConvertFToU:
+        case SpvOpConvertSToF:
+        case SpvOpConvertUToF:
+        case SpvOpConvertPtrToU:
+        case SpvOpConvertUToPtr:
+        case SpvOpSConvert:
+        case SpvOpUConvert:
+        case SpvOpFConvert:
+        case SpvOpIAdd:
+        case SpvOpISub:
+        case SpvOpIMul:
+        case SpvOpSDiv:
+        case SpvOpUDiv:
+        case SpvOpSMod:
+        case SpvOpUMod:
+        case SpvOpFAdd:
+        case SpvOpFSub:
+        case SpvOpFMul:
+        case SpvOpFDiv:
+        case SpvOpFMod:
+        case SpvOpSNegate:
+        case SpvOpFNegate:
+        case SpvOpIAddCarry:
+        case SpvOpISubBorrow:
+        case SpvOpSMulExtended:
+        case SpvOpUMulExtended:
+        case SpvOpIEqual:
+        case SpvOpINotEqual:
+        case SpvOpSLessThan:
+        case SpvOpULessThan:
+        case SpvOpSLessThanEqual:
+        case SpvOpULessThanEqual:
+        case SpvOpSGreaterThan:
+        case SpvOpUGreaterThan:
+        case SpvOpSGreaterThanEqual:
+        case SpvOpUGreaterThanEqual:
+        case SpvOpFOrdEqual:
+        case SpvOpFOrdNotEqual:
+        case SpvOpFOrdLessThan:
+        case SpvOpFOrdLessThanEqual:
+        case SpvOpFOrdGreaterThan:
+        case SpvOpFOrdGreaterThanEqual:
+        case SpvOpLogicalEqual:
+        case SpvOpLogicalNotEqual:
+        case SpvOpLogicalAnd:
+        case SpvOpLogicalOr:
+        case SpvOpLogicalNot:
+        case SpvOpNot:
+        case SpvOpBitwiseAnd:
+        case SpvOpBitwiseOr:
+        case SpvOpBitwiseXor:
+        case SpvOpShiftLeftLogical:
+        case SpvOpShiftRightLogical:
+        case SpvOpShiftRightArithmetic:
+        case SpvOpGroupNonUniformElect:
+        case SpvOpGroupNonUniformBallot:
+        case SpvOpGroupNonUniformBroadcastFirst:
+        case SpvOpGroupNonUniformShuffle:
+        case SpvOpGroupNonUniformPartitionNV: return "TRI";
+
+        default: return NULL;
+    }
+}
+
+/// Things that are only worth keeping if something refers to them
+static bool is_removable(SpvOp op) {
+    switch (op) {
+        case SpvOpTypeVoid:
+        case SpvOpTypeBool:
+        case SpvOpTypeInt:
+        case SpvOpTypeFloat:
+        case SpvOpTypeVector:
+        case SpvOpTypeArray:
+        case SpvOpTypeRuntimeArray:
+        case SpvOpTypeStruct:
+        case SpvOpTypePointer:
+        case SpvOpTypeFunction:
+        case SpvOpTypeImage:
+        case SpvOpTypeSampler:
+        case SpvOpTypeSampledImage:
+        case SpvOpConstant:
+        case SpvOpConstantTrue:
+        case SpvOpConstantFalse:
+        case SpvOpConstantNull:
+        case SpvOpConstantComposite:
+        case SpvOpUndef:
+        case SpvOpString:
+        case SpvOpExtInstImport: return true;
+        default: return false;
+    }
+}
+
+/// Things that talk about an id without using it
+static bool is_annotation(SpvOp op) {
+    switch (op) {
+        case SpvOpName:
+        case SpvOpMemberName:
+        case SpvOpDecorate:
+        case SpvOpMemberDecorate: return true;
+        default: return false;
+    }
+}
+
+typedef struct {
+    uint32_t* words;
+    size_t words_count;
+    uint32_t bound;
+    /// offset of the instruction defining each id, or 0
+    size_t* defs;
+    /// width in words of the switch literals for each selector, worked out before anything moves
+    uint8_t* switch_literal_widths;
+    /// or given upfront, for instructions taken out of a module (see spvb_remap_ids)
+    struct Dict* known_switch_literal_widths;
+} SpvModule;
+
+static SpvOp get_opcode(uint32_t word) { return (SpvOp) (word & 0xFFFFu); }
+static size_t get_word_count(uint32_t word) { return word >> 16u; }
+
+static size_t get_string_words(const uint32_t* words, size_t available) {
+    for (size_t i = 0; i < available; i++) {
+        if ((words[i] >> 24u) == 0)
+            return i + 1;
+    }
+    return available;
+}
+
+/// Width in words of the literals used to compare against the selector of a switch
+static size_t get_switch_literal_width(SpvModule* m, uint32_t selector) {
+    if (m->known_switch_literal_widths) {
+        uint8_t* found = find_value_dict(SpvId, uint8_t, m->known_switch_literal_widths, selector);
+        return found ? *found : 0;
+    }
+    if (selector >= m->bound)
+        return 0;
+    if (m->switch_literal_widths[selector])
+        return m->switch_literal_widths[selector];
+    size_t def = m->defs[selector];
+    const char* layout = def ? get_operands_layout(get_opcode(m->words[def])) : NULL;
+    if (!layout || layout[0] != 'T')
+        return 0;
+    uint32_t type = m->words[def + 1];
+    size_t type_def = type < m->bound ? m->defs[type] : 0;
+    if (!type_def || get_opcode(m->words[type_def]) != SpvOpTypeInt)
+        return 0;
+    m->switch_literal_widths[selector] = m->words[type_def + 2] > 32 ? 2 : 1;
+    return m->switch_literal_widths[selector];
+}
+
+/// Writes down the positions (relative to the instruction) of the words holding ids, result id included.
+/// Returns false if the instruction can't be understood.
+static bool find_ids(SpvModule* m, size_t offset, size_t* positions, size_t* count, size_t* result) {
+    const uint32_t* inst = &m->words[offset];
+    size_t word_count = get_word_count(inst[0]);
+    const char* layout = get_operands_layout(get_opcode(inst[0]));
+    if (!layout || word_count == 0 || offset + word_count > m->words_count)
+        return false;
+
+    *count = 0;
+    *result = 0;
+    size_t w = 1;
+    for (const char* c = layout; *c && w < word_count; c++) {
+        switch (*c) {
+            case 'R': *result = w; SHADY_FALLTHROUGH
+            case 'T':
+            case 'i': positions[(*count)++] = w++; break;
+            case 'l': w++; break;
+            case 's': w += get_string_words(&inst[w], word_count - w); break;
+            case 'I': while (w < word_count) positions[(*count)++] = w++; break;
+            case 'L': w = word_count; break;
+            case 'M': {
+                // volatile, aligned and non-temporal are the only memory operands without ids
+                if (inst[w] & ~(uint32_t) (SpvMemoryAccessVolatileMask | SpvMemoryAccessAlignedMask | SpvMemoryAccessNontemporalMask))
+                    return false;
+                w = word_count;
+                break;
+            }
+            case 'O': {
+                w++;
+                while (w < word_count) positions[(*count)++] = w++;
+                break;
+            }
+            case 'W': {
+                size_t literal_width = get_switch_literal_width(m, inst[1]);
+                if (literal_width == 0)
+                    return false;
+                while (w + literal_width < word_count) {
+                    w += literal_width;
+                    positions[(*count)++] = w++;
+                }
+                break;
+            }
+            default: assert(false);
+        }
+    }
+    return w == word_count;
+}
+
+#define FOR_EACH_INSTRUCTION(m, offset) for (size_t offset = 5; offset < (m)->words_count; offset += get_word_count((m)->words[offset]))
+
+static bool is_non_semantic_import(const uint32_t* inst) {
+    return get_opcode(inst[0]) == SpvOpExtInstImport && strncmp((const char*) &inst[2], "NonSemantic.", strlen("NonSemantic.")) == 0;
+}
+
+static bool is_non_semantic_extension(const uint32_t* inst) {
+    return get_opcode(inst[0]) == SpvOpExtension && strcmp((const char*) &inst[1], "SPV_KHR_non_semantic_info") == 0;
+}
+
+size_t spvb_compact(char* data, size_t size, bool strip_names) {
+    assert(size % 4 == 0);
+    SpvModule m = {
+        .words = (uint32_t*) data,
+        .words_count = size / 4,
+    };
+    // byte-swapped modules are left alone, so are those that don't even have a header
+    if (m.words_count < 5 || m.words[0] != SpvMagicNumber)
+        return size;
+    m.bound = m.words[3];
+
+    // first find where every id is defined, and check we understand everything in the module
+    m.defs = calloc(m.bound, sizeof(size_t));
+    m.switch_literal_widths = calloc(m.bound, sizeof(uint8_t));
+    bool* live = calloc(m.bound, sizeof(bool));
+    uint32_t* new_ids = calloc(m.bound, sizeof(uint32_t));
+    size_t* worklist = malloc(sizeof(size_t) * m.bound);
+    size_t worklist_size = 0;
+    // no instruction has more than 0xFFFF words
+    size_t* positions = malloc(sizeof(size_t) * 0xFFFF);
+    size_t count, result;
+    bool understood = true;
+    FOR_EACH_INSTRUCTION(&m, offset) {
+        if (!get_operands_layout(get_opcode(m.words[offset])) || get_word_count(m.words[offset]) == 0 || offset + get_word_count(m.words[offset]) > m.words_count) {
+            understood = false;
+            break;
+        }
+        const char* layout = get_operands_layout(get_opcode(m.words[offset]));
+        const char* r = strchr(layout, 'R');
+        if (r) {
+            uint32_t id = m.words[offset + (r - layout) + 1];
+            if (id >= m.bound) {
+                understood = false;
+                break;
+            }
+            m.defs[id] = offset;
+        }
+    }
+    if (understood) FOR_EACH_INSTRUCTION(&m, offset) {
+        if (!find_ids(&m, offset, positions, &count, &result)) {
+            understood = false;
+            break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (m.words[offset + positions[i]] >= m.bound)
+                understood = false;
+        }
+    }
+    if (!understood) {
+        debug_print("spvb_compact: module contains instructions it doesn't understand, leaving it untouched\n");
+        goto cleanup;
+    }
+
+    // everything but types, constants, strings, imports and annotations is kept, and keeps what it refers to alive
+    FOR_EACH_INSTRUCTION(&m, offset) {
+        SpvOp op = get_opcode(m.words[offset]);
+        if (is_removable(op) || is_annotation(op))
+            continue;
+        find_ids(&m, offset, positions, &count, &result);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t id = m.words[offset + positions[i]];
+            if (!live[id]) {
+                live[id] = true;
+                worklist[worklist_size++] = id;
+            }
+        }
+    }
+    while (worklist_size > 0) {
+        uint32_t id = worklist[--worklist_size];
+        size_t def = m.defs[id];
+        if (!def || !is_removable(get_opcode(m.words[def])))
+            continue;
+        find_ids(&m, def, positions, &count, &result);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t operand = m.words[def + positions[i]];
+            if (!live[operand]) {
+                live[operand] = true;
+                worklist[worklist_size++] = operand;
+            }
+        }
+    }
+
+    bool needs_non_semantic_info = false;
+    FOR_EACH_INSTRUCTION(&m, offset) {
+        if (is_non_semantic_import(&m.words[offset]) && live[m.words[offset + 1]])
+            needs_non_semantic_info = true;
+    }
+
+    // IDs are handed out again in order of appearance, and the survivors are moved down in place
+    uint32_t next_id = 1;
+    size_t out = 5;
+    size_t removed = 0;
+    for (size_t offset = 5, word_count; offset < m.words_count; offset += word_count) {
+        // read before the instruction is moved, as that might overwrite it
+        SpvOp op = get_opcode(m.words[offset]);
+        word_count = get_word_count(m.words[offset]);
+        find_ids(&m, offset, positions, &count, &result);
+        bool keep = true;
+        if (is_removable(op))
+            keep = live[m.words[offset + result]];
+        else if (is_annotation(op))
+            keep = live[m.words[offset + 1]] && !(strip_names && (op == SpvOpName || op == SpvOpMemberName));
+        else if (is_non_semantic_extension(&m.words[offset]))
+            keep = needs_non_semantic_info;
+        if (!keep) {
+            removed++;
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            uint32_t* word = &m.words[offset + positions[i]];
+            if (!new_ids[*word])
+                new_ids[*word] = next_id++;
+            *word = new_ids[*word];
+        }
+        memmove(&m.words[out], &m.words[offset], word_count * sizeof(uint32_t));
+        out += word_count;
+    }
+    m.words[3] = next_id;
+    debug_print("spvb_compact: removed %zu instructions, bound went from %d to %d\n", removed, m.bound, next_id);
+    size = out * sizeof(uint32_t);
+
+    cleanup:
+    free(m.defs);
+    free(m.switch_literal_widths);
+    free(positions);
+    free(live);
+    free(new_ids);
+    free(worklist);
+    return size;
+}
+
+bool spvb_remap_ids(uint32_t* words, size_t words_count, struct Dict* switch_literal_widths, SpvbRemapId remap, void* uptr) {
+    // there are no definitions to look at, switches need their literal widths given
+    SpvModule m = {
+        .words = words,
+        .words_count = words_count,
+        .known_switch_literal_widths = switch_literal_widths,
+    };
+    size_t* positions = malloc(sizeof(size_t) * 0xFFFF);
+    size_t count, result;
+    bool understood = true;
+    for (size_t offset = 0; offset < m.words_count; offset += get_word_count(m.words[offset])) {
+        if (!find_ids(&m, offset, positions, &count, &result)) {
+            understood = false;
+            break;
+        }
+    }
+    if (understood && remap) {
+        for (size_t offset = 0; offset < m.words_count; offset += get_word_count(m.words[offset])) {
+            find_ids(&m, offset, positions, &count, &result);
+            for (size_t i = 0; i < count; i++)
+                m.words[offset + positions[i]] = remap(uptr, m.words[offset + positions[i]]);
+        }
+    }
+    free(positions);
+    return understood;
+}
@@ -146,6 +146,15 @@ else break;
 #define BIN_OP(primop, op) case primop##_op: \
 if (all_int_literals)        return quote_single(arena, int_literal(arena, (IntLiteral) { .is_signed = is_signed, .width = int_width, .value = int_literals[0]->value op int_literals[1]->value })); \
 else if (all_float_literals) return quote_single(arena, fp_literal_helper(arena, float_width, get_float_literal_value(*float_literals[0]) op get_float_literal_value(*float_literals[1]))); \
+break;
+
+#define INT_BIN_OP(primop, op) case primop##_op: \
+if (all_int_literals)        return quote_single(arena, int_literal(arena, (IntLiteral) { .is_signed = is_signed, .width = int_width, .value = int_literals[0]->value op int_literals[1]->value })); \
+break;
+
+#define CMP_OP(primop, op) case primop##_op: \
+if (all_int_literals && is_signed) return quote_single(arena, get_int_literal_value(*int_literals[0], true) op get_int_literal_value(*int_literals[1], true) ? true_lit(arena) : false_lit(arena)); \
+else if (all_int_literals)    return quote_single(arena, (uint64_t) get_int_literal_value(*int_literals[0], false) op (uint64_t) get_int_literal_value(*int_literals[1], false) ? true_lit(arena) : false_lit(arena)); \
 break;
 
     if (all_int_literals || all_float_literals) {
@@ -155,6 +164,15 @@ break;
             BIN_OP(sub, -)
             BIN_OP(mul, *)
             BIN_OP(div, /)
+            INT_BIN_OP(and, &)
+            INT_BIN_OP(or, |)
+            INT_BIN_OP(xor, ^)
+            CMP_OP(lt, <)
+            CMP_OP(lte, <=)
+            CMP_OP(gt, >)
+            CMP_OP(gte, >=)
+            CMP_OP(eq, ==)
+            CMP_OP(neq, !=)
             case mod_op:
                 if (all_int_literals)
                     return quote_single(arena, int_literal(arena, (IntLiteral) { .is_signed = is_signed, .width = int_width, .value = int_literals[0]->value % int_literals[1]->value }));
@@ -19,7 +19,7 @@ void add_comments(Growy* g, String indent, json_object* comments) {
     }
 }
 
-String to_snake_case(String camel) {
+char* to_snake_case(String camel) {
     size_t camel_len = strlen(camel);
     size_t buffer_size = camel_len + 16;
     char* dst = malloc(buffer_size);
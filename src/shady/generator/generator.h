@@ -23,7 +23,7 @@ void generate(Growy* g, Data);
 
 void generate_header(Growy* g, Data data);
 void add_comments(Growy* g, String indent, json_object* comments);
-String to_snake_case(String camel);
+char* to_snake_case(String camel);
 String capitalize(String str);
 bool starts_with_vowel(String str);
 
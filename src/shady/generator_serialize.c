@@ -0,0 +1,106 @@
+#include "generator.h"
+
+static void generate_can_be_default_serialized_fn(Growy* g, json_object* nodes) {
+    growy_append_formatted(g, "static bool can_be_default_serialized(NodeTag tag) {\n");
+    growy_append_formatted(g, "\tswitch (tag) { \n");
+    assert(json_object_get_type(nodes) == json_type_array);
+    for (size_t i = 0; i < json_object_array_length(nodes); i++) {
+        json_object* node = json_object_array_get_idx(nodes, i);
+        if (has_custom_ctor(node))
+            continue;
+        String name = json_object_get_string(json_object_object_get(node, "name"));
+        growy_append_formatted(g, "\t\tcase %s_TAG: return true;\n", name);
+    }
+    growy_append_formatted(g, "\t\tdefault: return false;\n");
+    growy_append_formatted(g, "\t}\n");
+    growy_append_formatted(g, "}\n\n");
+}
+
+static void generate_serializer_fns(Growy* g, json_object* nodes, bool write) {
+    if (write) {
+        growy_append_formatted(g, "static void serialize_payload_generated(Serializer* s, const Node* node) {\n");
+        growy_append_formatted(g, "\tswitch (node->tag) { \n");
+    } else {
+        growy_append_formatted(g, "static const Node* deserialize_payload_generated(Deserializer* d, NodeTag tag) {\n");
+        growy_append_formatted(g, "\tswitch (tag) { \n");
+    }
+    assert(json_object_get_type(nodes) == json_type_array);
+    for (size_t i = 0; i < json_object_array_length(nodes); i++) {
+        json_object* node = json_object_array_get_idx(nodes, i);
+
+        if (has_custom_ctor(node))
+            continue;
+
+        String name = json_object_get_string(json_object_object_get(node, "name"));
+        String snake_name = json_object_get_string(json_object_object_get(node, "snake_name"));
+        char* alloc = NULL;
+        if (!snake_name)
+            snake_name = alloc = to_snake_case(name);
+        growy_append_formatted(g, "\t\tcase %s_TAG: {\n", name);
+        json_object* ops = json_object_object_get(node, "ops");
+        if (ops) {
+            assert(json_object_get_type(ops) == json_type_array);
+            if (write)
+                growy_append_formatted(g, "\t\t\t%s payload = node->payload.%s;\n", name, snake_name);
+            else
+                growy_append_formatted(g, "\t\t\t%s payload = { 0 };\n", name);
+            for (size_t j = 0; j < json_object_array_length(ops); j++) {
+                json_object* op = json_object_array_get_idx(ops, j);
+                String op_name = json_object_get_string(json_object_object_get(op, "name"));
+                bool list = json_object_get_boolean(json_object_object_get(op, "list"));
+                bool ignore = json_object_get_boolean(json_object_object_get(op, "ignore"));
+                if (ignore)
+                    continue;
+                String class = json_object_get_string(json_object_object_get(op, "class"));
+                String type = json_object_get_string(json_object_object_get(op, "type"));
+                String what;
+                if (class && strcmp(class, "string") == 0)
+                    what = list ? "strings" : "string";
+                else if (class)
+                    what = list ? "refs" : "ref";
+                else if (strcmp(type, "String") == 0)
+                    what = "string";
+                else {
+                    assert(!list && strcmp(type, "const Node*") != 0);
+                    what = NULL;
+                }
+
+                if (what && write)
+                    growy_append_formatted(g, "\t\t\tserialize_%s(s, payload.%s);\n", what, op_name);
+                else if (what)
+                    growy_append_formatted(g, "\t\t\tpayload.%s = deserialize_%s(d);\n", op_name, what);
+                else if (write)
+                    growy_append_formatted(g, "\t\t\tserialize_pod(s, &payload.%s, sizeof(payload.%s));\n", op_name, op_name);
+                else
+                    growy_append_formatted(g, "\t\t\tdeserialize_pod(d, &payload.%s, sizeof(payload.%s));\n", op_name, op_name);
+            }
+            if (write)
+                growy_append_formatted(g, "\t\t\tbreak;\n");
+            else {
+                growy_append_formatted(g, "\t\t\tif (d->failed) return NULL;\n");
+                growy_append_formatted(g, "\t\t\treturn %s(d->arena, payload);\n", snake_name);
+            }
+        } else if (write)
+            growy_append_formatted(g, "\t\t\tbreak;\n");
+        else
+            growy_append_formatted(g, "\t\t\treturn %s(d->arena);\n", snake_name);
+        growy_append_formatted(g, "\t\t}\n");
+        if (alloc)
+            free(alloc);
+    }
+    if (write)
+        growy_append_formatted(g, "\t\tdefault: assert(false);\n");
+    else
+        growy_append_formatted(g, "\t\tdefault: d->failed = true; return NULL;\n");
+    growy_append_formatted(g, "\t}\n");
+    growy_append_formatted(g, "}\n\n");
+}
+
+void generate(Growy* g, Data data) {
+    generate_header(g, data);
+
+    json_object* nodes = json_object_object_get(data.shd, "nodes");
+    generate_can_be_default_serialized_fn(g, nodes);
+    generate_serializer_fns(g, nodes, true);
+    generate_serializer_fns(g, nodes, false);
+}
@@ -10,6 +10,10 @@
 #include <assert.h>
 #include <stdarg.h>
 
+#if SHADY_HAS_THREADS
+#include <pthread.h>
+#endif
+
 static KeyHash hash_nodes(Nodes* nodes);
 bool compare_nodes(Nodes* a, Nodes* b);
 
@@ -52,6 +56,7 @@ void destroy_ir_arena(IrArena* arena) {
     destroy_dict(arena->nodes_set);
     destroy_dict(arena->node_set);
     destroy_arena(arena->arena);
+    set_ir_arena_shared(arena, false);
     free(arena);
 }
 
@@ -59,8 +64,45 @@ ArenaConfig get_arena_config(const IrArena* a) {
     return a->config;
 }
 
+void set_ir_arena_shared(IrArena* arena, bool shared) {
+#if SHADY_HAS_THREADS
+    if (shared && !arena->lock) {
+        // the functions adding to the arena call each other, hence the recursive mutex
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        arena->lock = malloc(sizeof(pthread_mutex_t));
+        pthread_mutex_init(arena->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+    } else if (!shared && arena->lock) {
+        pthread_mutex_destroy(arena->lock);
+        free(arena->lock);
+        arena->lock = NULL;
+    }
+#else
+    assert(!shared && "this build has no thread support");
+#endif
+}
+
+void lock_ir_arena(IrArena* arena) {
+#if SHADY_HAS_THREADS
+    if (arena->lock)
+        pthread_mutex_lock(arena->lock);
+#endif
+}
+
+void unlock_ir_arena(IrArena* arena) {
+#if SHADY_HAS_THREADS
+    if (arena->lock)
+        pthread_mutex_unlock(arena->lock);
+#endif
+}
+
 VarId fresh_id(IrArena* arena) {
-    return arena->next_free_id++;
+    lock_ir_arena(arena);
+    VarId id = arena->next_free_id++;
+    unlock_ir_arena(arena);
+    return id;
 }
 
 Nodes nodes(IrArena* arena, size_t count, const Node* in_nodes[]) {
@@ -68,9 +110,13 @@ Nodes nodes(IrArena* arena, size_t count, const Node* in_nodes[]) {
         .count = count,
         .nodes = in_nodes
     };
+    lock_ir_arena(arena);
     const Nodes* found = find_key_dict(Nodes, arena->nodes_set, tmp);
-    if (found)
-        return *found;
+    if (found) {
+        Nodes existing = *found;
+        unlock_ir_arena(arena);
+        return existing;
+    }
 
     Nodes nodes;
     nodes.count = count;
@@ -79,6 +125,7 @@ Nodes nodes(IrArena* arena, size_t count, const Node* in_nodes[]) {
         nodes.nodes[i] = in_nodes[i];
 
     insert_set_get_result(Nodes, arena->nodes_set, nodes);
+    unlock_ir_arena(arena);
     return nodes;
 }
 
@@ -87,9 +134,13 @@ Strings strings(IrArena* arena, size_t count, const char* in_strs[])  {
         .count = count,
         .strings = in_strs,
     };
+    lock_ir_arena(arena);
     const Strings* found = find_key_dict(Strings, arena->strings_set, tmp);
-    if (found)
-        return *found;
+    if (found) {
+        Strings existing = *found;
+        unlock_ir_arena(arena);
+        return existing;
+    }
 
     Strings strings;
     strings.count = count;
@@ -98,6 +149,7 @@ Strings strings(IrArena* arena, size_t count, const char* in_strs[])  {
         strings.strings[i] = in_strs[i];
 
     insert_set_get_result(Strings, arena->strings_set, strings);
+    unlock_ir_arena(arena);
     return strings;
 }
 
@@ -156,15 +208,20 @@ static const char* string_impl(IrArena* arena, size_t size, const char* zero_ter
     if (!zero_terminated)
         return NULL;
     const char* ptr = zero_terminated;
+    lock_ir_arena(arena);
     const char** found = find_key_dict(const char*, arena->string_set, ptr);
-    if (found)
-        return *found;
+    if (found) {
+        const char* existing = *found;
+        unlock_ir_arena(arena);
+        return existing;
+    }
 
     char* new_str = (char*) arena_alloc(arena->arena, strlen(zero_terminated) + 1);
     strncpy(new_str, zero_terminated, size);
     new_str[size] = '\0';
 
     insert_set_get_result(const char*, arena->string_set, new_str);
+    unlock_ir_arena(arena);
     return new_str;
 }
 
@@ -174,7 +231,7 @@ const char* string_sized(IrArena* arena, size_t size, const char* str) {
     strncpy(new_str, str, size);
     new_str[size] = '\0';
     assert(strlen(new_str) == size);
-    return string_impl(arena, size, str);
+    return string_impl(arena, size, new_str);
 }
 
 const char* string(IrArena* arena, const char* str) {
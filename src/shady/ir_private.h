@@ -20,6 +20,9 @@ typedef struct IrArena_ {
 
     struct Dict* nodes_set;
     struct Dict* strings_set;
+
+    /// Only there while the arena is shared between threads, see set_ir_arena_shared
+    void* lock;
 } IrArena_;
 
 struct Module_ {
@@ -39,6 +42,12 @@ struct BodyBuilder_ {
 
 VarId fresh_id(IrArena*);
 
+/// While an arena is shared, nodes, strings and IDs can be created in it from several threads at once.
+/// Only the functions creating them take the lock, what's already in the arena can be read without it.
+void set_ir_arena_shared(IrArena*, bool);
+void lock_ir_arena(IrArena*);
+void unlock_ir_arena(IrArena*);
+
 struct List;
 Nodes list_to_nodes(IrArena*, struct List*);
 
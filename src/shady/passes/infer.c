@@ -524,6 +524,7 @@ static const Node* _infer_primop(Context* ctx, const Node* node, const Type* exp
         case empty_mask_op:
         case subgroup_active_mask_op:
         case subgroup_elect_first_op:
+        case subgroup_barrier_op:
             input_types = nodes(a, 0, NULL);
             break;
         case subgroup_broadcast_first_op:
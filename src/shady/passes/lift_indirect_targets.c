@@ -37,14 +37,233 @@ static const Node* process_node(Context* ctx, const Node* node);
 typedef struct {
     const Node* old_cont;
     const Node* lifted_fn;
+    /// Free variables that go on the stack as-is
     struct List* save_values;
+    /// Sub-word free variables, packed together into 32-bit words before going on the stack
+    struct List* packed_values;
+    /// Free variables that are cheap to recompute out of the other ones, instead of being spilled
+    struct Dict* remat_values;
 } LiftedCont;
 
 #pragma GCC diagnostic error "-Wswitch"
 
-static const Node* add_spill_instrs(Context* ctx, BodyBuilder* builder, struct List* spilled_vars) {
+/// How many intermediate values deep we go to recompute a value instead of spilling it
+#define MAX_REMAT_DEPTH 3
+
+/// Returns the instruction that binds a variable, if it is the only result of a pure and cheap primop
+static const Node* get_rematerializable_def(Context* ctx, const Node* ovar) {
+    const Node* abs = ovar->payload.var.abs;
+    if (!abs || !is_case(abs) || get_abstraction_params(abs).count != 1)
+        return NULL;
+    const Use* use = get_first_use(ctx->scope_uses, abs);
+    for (; use; use = use->next_use) {
+        if (use->user->tag != Let_TAG || strcmp(use->operand_name, "tail") != 0)
+            continue;
+        const Node* instruction = get_let_instruction(use->user);
+        if (instruction->tag != PrimOp_TAG)
+            return NULL;
+        Op op = instruction->payload.prim_op.op;
+        if (get_primop_class(op) & (OcArithmetic | OcLogic | OcCompare | OcShift))
+            return instruction;
+        switch (op) {
+            case select_op:
+            case convert_op:
+            case reinterpret_op:
+            case extract_op:
+            case lea_op: return instruction;
+            default: return NULL;
+        }
+    }
+    return NULL;
+}
+
+static size_t get_packed_bits(const Node* ovar) {
+    const Type* t = get_unqualified_type(ovar->type);
+    switch (t->tag) {
+        case Bool_TAG: return 1;
+        case Int_TAG:
+            switch (t->payload.int_type.width) {
+                case IntTy8: return 8;
+                case IntTy16: return 16;
+                default: return 0;
+            }
+        default: return 0;
+    }
+}
+
+static bool is_in_chain(struct List* chain, const Node* value) {
+    for (size_t i = 0; i < entries_count_list(chain); i++)
+        if (read_list(const Node*, chain)[i] == value)
+            return true;
+    return false;
+}
+
+/// Whether @p value can be recomputed in the continuation, out of the variables in @p available that are recovered anyways.
+/// Intermediate values that are not live themselves get recomputed as well, as long as the chain stays short.
+/// The values to recompute are collected into @p chain, and only kept by the caller once the whole chain checks out.
+static bool can_rematerialize(Context* ctx, LiftedCont* lifted_cont, struct Dict* available, struct List* chain, const Node* value, size_t depth) {
+    switch (value->tag) {
+        case Variable_TAG: break;
+        case IntLiteral_TAG:
+        case FloatLiteral_TAG:
+        case True_TAG:
+        case False_TAG:
+        case NullPtr_TAG:
+        case RefDecl_TAG:
+        case FnAddr_TAG: return true;
+        default: return false;
+    }
+    if (find_key_dict(const Node*, lifted_cont->remat_values, value) || is_in_chain(chain, value))
+        return true;
+    if (depth > 0 && find_key_dict(const Node*, available, value))
+        return true;
+    if (depth > MAX_REMAT_DEPTH)
+        return false;
+
+    const Node* def = get_rematerializable_def(ctx, value);
+    if (!def)
+        return false;
+    Nodes operands = def->payload.prim_op.operands;
+    for (size_t i = 0; i < operands.count; i++) {
+        if (!can_rematerialize(ctx, lifted_cont, available, chain, operands.nodes[i], depth + 1))
+            return false;
+    }
+    append_list(const Node*, chain, value);
+    return true;
+}
+
+static void try_rematerialize(Context* ctx, LiftedCont* lifted_cont, struct Dict* available, const Node* value) {
+    struct List* chain = new_list(const Node*);
+    if (can_rematerialize(ctx, lifted_cont, available, chain, value, 0)) {
+        for (size_t i = 0; i < entries_count_list(chain); i++) {
+            const Node* link = read_list(const Node*, chain)[i];
+            const Node* def = get_rematerializable_def(ctx, link);
+            insert_dict(const Node*, const Node*, lifted_cont->remat_values, link, def);
+        }
+    }
+    destroy_list(chain);
+}
+
+/// Sorts the free variables of a continuation into the ones we recompute, the ones we pack together and the ones we spill as-is.
+static void plan_spills(Context* ctx, LiftedCont* lifted_cont, struct List* free_vars) {
+    struct Dict* available = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node);
+    for (size_t i = 0; i < entries_count_list(free_vars); i++)
+        insert_set_get_result(const Node*, available, read_list(const Node*, free_vars)[i]);
+
+    // a value is recomputed when its operands are recovered anyways, so that it never costs extra spills
+    lifted_cont->remat_values = new_dict(const Node*, const Node*, (HashFn) hash_node, (CmpFn) compare_node);
+    for (size_t i = 0; i < entries_count_list(free_vars); i++)
+        try_rematerialize(ctx, lifted_cont, available, read_list(const Node*, free_vars)[i]);
+    destroy_dict(available);
+
+    lifted_cont->save_values = new_list(const Node*);
+    lifted_cont->packed_values = new_list(const Node*);
+    for (size_t i = 0; i < entries_count_list(free_vars); i++) {
+        const Node* ovar = read_list(const Node*, free_vars)[i];
+        if (find_key_dict(const Node*, lifted_cont->remat_values, ovar))
+            continue;
+        if (get_packed_bits(ovar) > 0)
+            append_list(const Node*, lifted_cont->packed_values, ovar);
+        else
+            append_list(const Node*, lifted_cont->save_values, ovar);
+    }
+    // packing a lone value would only add work
+    if (entries_count_list(lifted_cont->packed_values) == 1) {
+        append_list(const Node*, lifted_cont->save_values, read_list(const Node*, lifted_cont->packed_values)[0]);
+        clear_list(lifted_cont->packed_values);
+    }
+}
+
+typedef struct {
+    size_t start, count;
+} PackedWord;
+
+/// Splits the packed values into the 32-bit words that hold them
+static struct List* get_packed_words(struct List* packed_values) {
+    struct List* words = new_list(PackedWord);
+    size_t count = entries_count_list(packed_values);
+    size_t start = 0, bits = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t value_bits = get_packed_bits(read_list(const Node*, packed_values)[i]);
+        if (bits + value_bits > 32) {
+            append_list(PackedWord, words, ((PackedWord) { start, i - start }));
+            start = i;
+            bits = 0;
+        }
+        bits += value_bits;
+    }
+    if (count > start)
+        append_list(PackedWord, words, ((PackedWord) { start, count - start }));
+    return words;
+}
+
+static void gen_push_packed_word(Context* ctx, BodyBuilder* bb, struct List* packed_values, PackedWord packed_word) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    const Node* word = NULL;
+    size_t offset = 0;
+    for (size_t i = packed_word.start; i < packed_word.start + packed_word.count; i++) {
+        const Node* ovar = read_list(const Node*, packed_values)[i];
+        const Node* nvar = rewrite_node(&ctx->rewriter, ovar);
+        const Type* t = get_unqualified_type(nvar->type);
+        const Node* bits;
+        if (t->tag == Bool_TAG)
+            bits = gen_primop_e(bb, select_op, empty(a), mk_nodes(a, nvar, uint32_literal(a, 1), uint32_literal(a, 0)));
+        else
+            bits = gen_conversion(bb, uint32_type(a), gen_reinterpret_cast(bb, int_type_helper(a, false, t->payload.int_type.width), nvar));
+        if (offset > 0)
+            bits = gen_primop_e(bb, lshift_op, empty(a), mk_nodes(a, bits, uint32_literal(a, offset)));
+        word = word ? gen_primop_e(bb, or_op, empty(a), mk_nodes(a, word, bits)) : bits;
+        offset += get_packed_bits(ovar);
+    }
+    gen_primop(bb, push_stack_op, singleton(uint32_type(a)), singleton(word));
+}
+
+static void gen_pop_packed_word(Context* ctx, Rewriter* lifting_rewriter, BodyBuilder* bb, struct List* packed_values, PackedWord packed_word) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    const Node* word = first(bind_instruction(bb, prim_op(a, (PrimOp) { .op = pop_stack_op, .type_arguments = singleton(uint32_type(a)) })));
+    size_t offset = 0;
+    for (size_t i = packed_word.start; i < packed_word.start + packed_word.count; i++) {
+        const Node* ovar = read_list(const Node*, packed_values)[i];
+        const Type* t = get_unqualified_type(rewrite_node(&ctx->rewriter, ovar->type));
+        const Node* bits = word;
+        if (offset > 0)
+            bits = gen_primop_e(bb, rshift_logical_op, empty(a), mk_nodes(a, bits, uint32_literal(a, offset)));
+        const Node* recovered_value;
+        if (t->tag == Bool_TAG) {
+            bits = gen_primop_e(bb, and_op, empty(a), mk_nodes(a, bits, uint32_literal(a, 1)));
+            recovered_value = gen_primop_e(bb, neq_op, empty(a), mk_nodes(a, bits, uint32_literal(a, 0)));
+        } else {
+            recovered_value = gen_conversion(bb, int_type_helper(a, false, t->payload.int_type.width), bits);
+            if (t->payload.int_type.is_signed)
+                recovered_value = gen_reinterpret_cast(bb, t, recovered_value);
+        }
+
+        if (is_qualified_type_uniform(ovar->type))
+            recovered_value = first(bind_instruction_named(bb, prim_op(a, (PrimOp) { .op = subgroup_broadcast_first_op, .operands = singleton(recovered_value) }), &ovar->payload.var.name));
+
+        register_processed(lifting_rewriter, ovar, recovered_value);
+        offset += get_packed_bits(ovar);
+    }
+}
+
+/// Recomputes a value in the lifted continuation, after the ones it depends on.
+static void gen_rematerialize(Rewriter* lifting_rewriter, BodyBuilder* bb, struct Dict* remat_values, const Node* ovar) {
+    if (search_processed(lifting_rewriter, ovar))
+        return;
+    const Node* def = *find_value_dict(const Node*, const Node*, remat_values, ovar);
+    Nodes operands = def->payload.prim_op.operands;
+    for (size_t i = 0; i < operands.count; i++) {
+        if (operands.nodes[i]->tag == Variable_TAG && find_key_dict(const Node*, remat_values, operands.nodes[i]))
+            gen_rematerialize(lifting_rewriter, bb, remat_values, operands.nodes[i]);
+    }
+    const Node* value = first(bind_instruction_named(bb, rewrite_node(lifting_rewriter, def), &ovar->payload.var.name));
+    register_processed(lifting_rewriter, ovar, value);
+}
+
+static const Node* add_spill_instrs(Context* ctx, BodyBuilder* builder, LiftedCont* lifted_cont) {
     IrArena* a = ctx->rewriter.dst_arena;
 
+    struct List* spilled_vars = lifted_cont->save_values;
     size_t recover_context_size = entries_count_list(spilled_vars);
     for (size_t i = 0; i < recover_context_size; i++) {
         const Node* ovar = read_list(const Node*, spilled_vars)[i];
@@ -60,6 +279,11 @@ static const Node* add_spill_instrs(Context* ctx, BodyBuilder* builder, struct L
         bind_instruction(builder, save_instruction);
     }
 
+    struct List* packed_words = get_packed_words(lifted_cont->packed_values);
+    for (size_t i = 0; i < entries_count_list(packed_words); i++)
+        gen_push_packed_word(ctx, builder, lifted_cont->packed_values, read_list(PackedWord, packed_words)[i]);
+    destroy_list(packed_words);
+
     const Node* sp = gen_primop_ce(builder, get_stack_pointer_op, 0, NULL);
 
     return sp;
@@ -79,10 +303,17 @@ static LiftedCont* lambda_lift(Context* ctx, const Node* cont, String given_name
 
     // Compute the live stuff we'll need
     Scope* scope = new_scope(cont);
-    struct List* recover_context = compute_free_variables(scope, cont);
-    size_t recover_context_size = entries_count_list(recover_context);
+    struct List* free_vars = compute_free_variables(scope, cont);
     destroy_scope(scope);
 
+    LiftedCont* lifted_cont = calloc(sizeof(LiftedCont), 1);
+    lifted_cont->old_cont = cont;
+    plan_spills(ctx, lifted_cont, free_vars);
+    destroy_list(free_vars);
+    insert_dict(const Node*, LiftedCont*, ctx->lifted, cont, lifted_cont);
+
+    struct List* recover_context = lifted_cont->save_values;
+    size_t recover_context_size = entries_count_list(recover_context);
     debugv_print("free (spilled) variables at '%s': ", name);
     for (size_t i = 0; i < recover_context_size; i++) {
         const Node* item = read_list(const Node*, recover_context)[i];
@@ -90,16 +321,11 @@ static LiftedCont* lambda_lift(Context* ctx, const Node* cont, String given_name
         if (i + 1 < recover_context_size)
             debugv_print(", ");
     }
-    debugv_print("\n");
+    debugv_print(" (%zu packed, %zu recomputed)\n", entries_count_list(lifted_cont->packed_values), entries_count_dict(lifted_cont->remat_values));
 
     // Create and register new parameters for the lifted continuation
     Nodes new_params = recreate_variables(&ctx->rewriter, oparams);
 
-    LiftedCont* lifted_cont = calloc(sizeof(LiftedCont), 1);
-    lifted_cont->old_cont = cont;
-    lifted_cont->save_values = recover_context;
-    insert_dict(const Node*, LiftedCont*, ctx->lifted, cont, lifted_cont);
-
     Context lifting_ctx = *ctx;
     lifting_ctx.rewriter = create_rewriter(ctx->rewriter.src_module, ctx->rewriter.dst_module, (RewriteNodeFn) process_node);
     register_processed_list(&lifting_ctx.rewriter, oparams, new_params);
@@ -115,6 +341,10 @@ static LiftedCont* lambda_lift(Context* ctx, const Node* cont, String given_name
     // Recover that stuff inside the new body
     BodyBuilder* bb = begin_body(a);
     gen_primop(bb, set_stack_pointer_op, empty(a), singleton(payload));
+    struct List* packed_words = get_packed_words(lifted_cont->packed_values);
+    for (size_t i = entries_count_list(packed_words) - 1; i < entries_count_list(packed_words); i--)
+        gen_pop_packed_word(ctx, &lifting_ctx.rewriter, bb, lifted_cont->packed_values, read_list(PackedWord, packed_words)[i]);
+    destroy_list(packed_words);
     for (size_t i = recover_context_size - 1; i < recover_context_size; i--) {
         const Node* ovar = read_list(const Node*, recover_context)[i];
         assert(ovar->tag == Variable_TAG);
@@ -132,6 +362,11 @@ static LiftedCont* lambda_lift(Context* ctx, const Node* cont, String given_name
         register_processed(&lifting_ctx.rewriter, ovar, recovered_value);
     }
 
+    size_t iter = 0;
+    const Node* ovar;
+    while (dict_iter(lifted_cont->remat_values, &iter, &ovar, NULL))
+        gen_rematerialize(&lifting_ctx.rewriter, bb, lifted_cont->remat_values, ovar);
+
     const Node* substituted = rewrite_node(&lifting_ctx.rewriter, obody);
     //destroy_dict(lifting_ctx.rewriter.processed);
     destroy_rewriter(&lifting_ctx.rewriter);
@@ -184,7 +419,7 @@ static const Node* process_node(Context* ctx, const Node* node) {
                     const Node* otail = get_let_tail(node);
                     BodyBuilder* bb = begin_body(a);
                     LiftedCont* lifted_tail = lambda_lift(ctx, otail, unique_name(a, format_string_arena(a->arena, "post_control_%s", get_abstraction_name(ctx->scope->entry->node))));
-                    const Node* sp = add_spill_instrs(ctx, bb, lifted_tail->save_values);
+                    const Node* sp = add_spill_instrs(ctx, bb, lifted_tail);
                     const Node* tail_ptr = fn_addr_helper(a, lifted_tail->lifted_fn);
 
                     const Node* jp = gen_primop_e(bb, create_joint_point_op, rewrite_nodes(&ctx->rewriter, oinstruction->payload.control.yield_types), mk_nodes(a, tail_ptr, sp));
@@ -215,6 +450,8 @@ Module* lift_indirect_targets(const CompilerConfig* config, Module* src) {
     LiftedCont* lifted_cont;
     while (dict_iter(ctx.lifted, &iter, NULL, &lifted_cont)) {
         destroy_list(lifted_cont->save_values);
+        destroy_list(lifted_cont->packed_values);
+        destroy_dict(lifted_cont->remat_values);
         free(lifted_cont);
     }
     destroy_dict(ctx.lifted);
@@ -4,26 +4,35 @@
 #include "portability.h"
 #include "util.h"
 #include "dict.h"
+#include "arena.h"
 
 #include "../rewrite.h"
 #include "../type.h"
 #include "../ir_private.h"
 #include "../transform/ir_gen_helpers.h"
 #include "../transform/memory_layout.h"
+#include "../analysis/callgraph.h"
 
 #include <assert.h>
 
+/// One bit per generic pointer tag: the address spaces a generic pointer might point into
+typedef uint32_t TagMask;
+
 typedef struct {
     Rewriter rewriter;
     const Node* generic_ptr_type;
     struct Dict* fns;
     const CompilerConfig* config;
+    /// Maps (old) generic pointer values to the tags they might carry
+    struct Dict* origins;
 } Context;
 
 static AddressSpace generic_ptr_tags[4] = { AsGlobalPhysical, AsSharedPhysical, AsSubgroupPhysical, AsPrivatePhysical };
 
 static size_t generic_ptr_tag_bitwidth = 2;
 
+#define ALL_TAGS ((TagMask) ((1 << (sizeof(generic_ptr_tags) / sizeof(generic_ptr_tags[0]))) - 1))
+
 static AddressSpace get_addr_space_from_tag(size_t tag) {
     size_t max_tag = sizeof(generic_ptr_tags) / sizeof(generic_ptr_tags[0]);
     assert(tag < max_tag);
@@ -71,14 +80,271 @@ static bool allowed(Context* ctx, AddressSpace as) {
     return true;
 }
 
+static TagMask get_allowed_tags(Context* ctx) {
+    TagMask mask = 0;
+    for (size_t tag = 0; tag < sizeof(generic_ptr_tags) / sizeof(generic_ptr_tags[0]); tag++) {
+        if (allowed(ctx, generic_ptr_tags[tag]))
+            mask |= 1 << tag;
+    }
+    return mask;
+}
+
+KeyHash hash_node(const Node**);
+bool compare_node(const Node**, const Node**);
+
+/// Tracks the address spaces generic pointers might have been converted from, through the variables they flow into.
+/// This iterates over the whole module until no new origins are found.
+typedef struct {
+    struct Dict* origins;
+    /// Maps functions to an array of masks, one per return value
+    struct Dict* returns;
+    struct Dict* visited_bbs;
+    Arena* arena;
+    const Node* current_fn;
+    bool changed;
+} OriginsAnalysis;
+
+typedef struct {
+    Nodes yield_targets;
+    Nodes break_targets;
+    Nodes continue_targets;
+} StructuredTargets;
+
+static TagMask get_origins(OriginsAnalysis* oa, const Node* value) {
+    switch (value->tag) {
+        case Variable_TAG: {
+            TagMask* found = find_value_dict(const Node*, TagMask, oa->origins, value);
+            return found ? *found : 0;
+        }
+        case NullPtr_TAG: return 0;
+        default: return ALL_TAGS;
+    }
+}
+
+static void add_origins(OriginsAnalysis* oa, const Node* var, TagMask mask) {
+    assert(var->tag == Variable_TAG);
+    if (!is_generic_ptr_type(get_unqualified_type(var->type)))
+        return;
+    TagMask* found = find_value_dict(const Node*, TagMask, oa->origins, var);
+    if (found) {
+        if ((*found | mask) == *found)
+            return;
+        *found |= mask;
+    } else {
+        if (!mask)
+            return;
+        insert_dict(const Node*, TagMask, oa->origins, var, mask);
+    }
+    oa->changed = true;
+}
+
+static void flow_into(OriginsAnalysis* oa, Nodes dst, Nodes src) {
+    for (size_t i = 0; i < dst.count && i < src.count; i++)
+        add_origins(oa, dst.nodes[i], get_origins(oa, src.nodes[i]));
+}
+
+static void flow_anything_into(OriginsAnalysis* oa, Nodes dst) {
+    for (size_t i = 0; i < dst.count; i++)
+        add_origins(oa, dst.nodes[i], ALL_TAGS);
+}
+
+static TagMask* get_return_origins(OriginsAnalysis* oa, const Node* fn) {
+    TagMask** found = find_value_dict(const Node*, TagMask*, oa->returns, fn);
+    if (found)
+        return *found;
+    size_t count = fn->payload.fun.return_types.count;
+    TagMask* masks = arena_alloc(oa->arena, sizeof(TagMask) * count);
+    // we can't see what functions without a body return
+    for (size_t i = 0; i < count; i++)
+        masks[i] = fn->payload.fun.body ? 0 : ALL_TAGS;
+    insert_dict(const Node*, TagMask*, oa->returns, fn, masks);
+    return masks;
+}
+
+static void analyze_body(OriginsAnalysis* oa, const Node* body, StructuredTargets targets);
+
+static void analyze_jump(OriginsAnalysis* oa, const Node* jump) {
+    assert(jump->tag == Jump_TAG);
+    const Node* target = jump->payload.jump.target;
+    flow_into(oa, get_abstraction_params(target), jump->payload.jump.args);
+    if (insert_set_get_result(const Node*, oa->visited_bbs, target))
+        analyze_body(oa, get_abstraction_body(target), (StructuredTargets) { 0 });
+}
+
+static void analyze_instruction(OriginsAnalysis* oa, const Node* instr, Nodes results, StructuredTargets targets) {
+    switch (is_instruction(instr)) {
+        case Instruction_PrimOp_TAG: {
+            Nodes ops = instr->payload.prim_op.operands;
+            switch (instr->payload.prim_op.op) {
+                case convert_op: {
+                    const Type* src_t = first(ops)->type;
+                    deconstruct_qualified_type(&src_t);
+                    if (src_t->tag == PtrType_TAG && src_t->payload.ptr_type.address_space != AsGeneric) {
+                        add_origins(oa, first(results), 1 << get_tag_for_addr_space(src_t->payload.ptr_type.address_space));
+                        return;
+                    }
+                    break;
+                }
+                case reinterpret_op: {
+                    if (is_generic_ptr_type(get_unqualified_type(first(ops)->type))) {
+                        add_origins(oa, first(results), get_origins(oa, first(ops)));
+                        return;
+                    }
+                    break;
+                }
+                case lea_op: add_origins(oa, first(results), get_origins(oa, first(ops))); return;
+                case select_op: add_origins(oa, first(results), get_origins(oa, ops.nodes[1]) | get_origins(oa, ops.nodes[2])); return;
+                case quote_op: flow_into(oa, results, ops); return;
+                default: break;
+            }
+            break;
+        }
+        case Instruction_Call_TAG: {
+            const Node* callee = instr->payload.call.callee;
+            if (callee->tag != FnAddr_TAG)
+                break;
+            const Node* fn = callee->payload.fn_addr.fn;
+            flow_into(oa, fn->payload.fun.params, instr->payload.call.args);
+            TagMask* returned = get_return_origins(oa, fn);
+            for (size_t i = 0; i < results.count && i < fn->payload.fun.return_types.count; i++)
+                add_origins(oa, results.nodes[i], returned[i]);
+            return;
+        }
+        case Instruction_If_TAG: {
+            targets.yield_targets = results;
+            analyze_body(oa, get_abstraction_body(instr->payload.if_instr.if_true), targets);
+            if (instr->payload.if_instr.if_false)
+                analyze_body(oa, get_abstraction_body(instr->payload.if_instr.if_false), targets);
+            return;
+        }
+        case Instruction_Match_TAG: {
+            targets.yield_targets = results;
+            for (size_t i = 0; i < instr->payload.match_instr.cases.count; i++)
+                analyze_body(oa, get_abstraction_body(instr->payload.match_instr.cases.nodes[i]), targets);
+            analyze_body(oa, get_abstraction_body(instr->payload.match_instr.default_case), targets);
+            return;
+        }
+        case Instruction_Block_TAG: {
+            targets.yield_targets = results;
+            analyze_body(oa, get_abstraction_body(instr->payload.block.inside), targets);
+            return;
+        }
+        case Instruction_Loop_TAG: {
+            const Node* loop_body = instr->payload.loop_instr.body;
+            flow_into(oa, get_abstraction_params(loop_body), instr->payload.loop_instr.initial_args);
+            targets.break_targets = results;
+            targets.continue_targets = get_abstraction_params(loop_body);
+            analyze_body(oa, get_abstraction_body(loop_body), targets);
+            return;
+        }
+        case Instruction_Control_TAG: {
+            // we don't track what flows through join points
+            flow_anything_into(oa, results);
+            analyze_body(oa, get_abstraction_body(instr->payload.control.inside), targets);
+            return;
+        }
+        default: break;
+    }
+    flow_anything_into(oa, results);
+}
+
+static void analyze_body(OriginsAnalysis* oa, const Node* body, StructuredTargets targets) {
+    switch (is_terminator(body)) {
+        case Let_TAG:
+        case LetMut_TAG: {
+            const Node* tail = get_let_tail(body);
+            analyze_instruction(oa, get_let_instruction(body), get_abstraction_params(tail), targets);
+            analyze_body(oa, get_abstraction_body(tail), targets);
+            break;
+        }
+        case Jump_TAG: analyze_jump(oa, body); break;
+        case Branch_TAG: {
+            analyze_jump(oa, body->payload.branch.true_jump);
+            analyze_jump(oa, body->payload.branch.false_jump);
+            break;
+        }
+        case Switch_TAG: {
+            for (size_t i = 0; i < body->payload.br_switch.case_jumps.count; i++)
+                analyze_jump(oa, body->payload.br_switch.case_jumps.nodes[i]);
+            analyze_jump(oa, body->payload.br_switch.default_jump);
+            break;
+        }
+        case Yield_TAG: flow_into(oa, targets.yield_targets, body->payload.yield.args); break;
+        case MergeContinue_TAG: flow_into(oa, targets.continue_targets, body->payload.merge_continue.args); break;
+        case MergeBreak_TAG: flow_into(oa, targets.break_targets, body->payload.merge_break.args); break;
+        case Return_TAG: {
+            const Node* fn = oa->current_fn;
+            TagMask* returned = get_return_origins(oa, fn);
+            Nodes args = body->payload.fn_ret.args;
+            for (size_t i = 0; i < args.count && i < fn->payload.fun.return_types.count; i++) {
+                TagMask mask = returned[i] | get_origins(oa, args.nodes[i]);
+                if (mask != returned[i]) {
+                    returned[i] = mask;
+                    oa->changed = true;
+                }
+            }
+            break;
+        }
+        case TailCall_TAG: {
+            const Node* target = body->payload.tail_call.target;
+            if (target->tag == FnAddr_TAG)
+                flow_into(oa, target->payload.fn_addr.fn->payload.fun.params, body->payload.tail_call.args);
+            break;
+        }
+        default: break;
+    }
+}
+
+static struct Dict* analyze_generic_ptr_origins(Module* m) {
+    OriginsAnalysis oa = {
+        .origins = new_dict(const Node*, TagMask, (HashFn) hash_node, (CmpFn) compare_node),
+        .returns = new_dict(const Node*, TagMask*, (HashFn) hash_node, (CmpFn) compare_node),
+        .visited_bbs = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+        .arena = new_arena(),
+    };
+
+    // we don't get to see all the callers of entry points and of functions whose address is taken
+    CallGraph* graph = new_callgraph(m);
+    Nodes decls = get_module_declarations(m);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != Function_TAG)
+            continue;
+        CGNode* node = *find_value_dict(const Node*, CGNode*, graph->fn2cgn, decl);
+        if (node->is_address_captured || lookup_annotation(decl, "EntryPoint"))
+            flow_anything_into(&oa, decl->payload.fun.params);
+    }
+    destroy_callgraph(graph);
+
+    do {
+        oa.changed = false;
+        clear_dict(oa.visited_bbs);
+        for (size_t i = 0; i < decls.count; i++) {
+            const Node* decl = decls.nodes[i];
+            if (decl->tag != Function_TAG || !decl->payload.fun.body)
+                continue;
+            oa.current_fn = decl;
+            analyze_body(&oa, decl->payload.fun.body, (StructuredTargets) { 0 });
+        }
+    } while (oa.changed);
+
+    destroy_dict(oa.returns);
+    destroy_dict(oa.visited_bbs);
+    destroy_arena(oa.arena);
+    return oa.origins;
+}
+
 typedef enum { LoadFn, StoreFn } WhichFn;
-static const Node* get_or_make_access_fn(Context* ctx, WhichFn which, bool uniform_ptr, const Type* t) {
+/// Makes a function that dispatches the access on the tag of the pointer, only considering the tags in `mask`
+static const Node* get_or_make_access_fn(Context* ctx, WhichFn which, TagMask mask, const Type* t) {
     IrArena* a = ctx->rewriter.dst_arena;
     String name;
     switch (which) {
         case LoadFn: name = format_string_interned(a, "generated_load_Generic_%s", name_type_safe(a, t)); break;
         case StoreFn: name = format_string_interned(a, "generated_store_Generic_%s", name_type_safe(a, t)); break;
     }
+    if (mask != ALL_TAGS)
+        name = format_string_interned(a, "%s_tags%x", name, mask);
 
     const Node** found = find_value_dict(String, const Node*, ctx->fns, name);
     if (found)
@@ -105,18 +371,18 @@ static const Node* get_or_make_access_fn(Context* ctx, WhichFn which, bool unifo
         case LoadFn: {
             LARRAY(const Node*, literals, max_tag);
             LARRAY(const Node*, cases, max_tag);
+            size_t cases_count = 0;
             for (size_t tag = 0; tag < max_tag; tag++) {
-                literals[tag] = size_t_literal(a, tag);
-                if (!allowed(ctx, generic_ptr_tags[tag])) {
-                    cases[tag] = case_(a, empty(a), unreachable(a));
+                if (!(mask & (1 << tag)))
                     continue;
-                }
                 BodyBuilder* case_bb = begin_body(a);
                 const Node* reinterpreted_ptr = recover_full_pointer(ctx, case_bb, tag, ptr_param, t);
                 const Node* loaded_value = gen_load(case_bb, reinterpreted_ptr);
-                cases[tag] = case_(a, empty(a), finish_body(case_bb, yield(a, (Yield) {
+                literals[cases_count] = size_t_literal(a, tag);
+                cases[cases_count] = case_(a, empty(a), finish_body(case_bb, yield(a, (Yield) {
                         .args = singleton(loaded_value),
                 })));
+                cases_count++;
             }
 
             BodyBuilder* bb = begin_body(a);
@@ -127,8 +393,8 @@ static const Node* get_or_make_access_fn(Context* ctx, WhichFn which, bool unifo
             const Node* loaded_value = first(bind_instruction(bb, match_instr(a, (Match) {
                     .inspect = extracted_tag,
                     .yield_types = singleton(t),
-                    .literals = nodes(a, max_tag, literals),
-                    .cases = nodes(a, max_tag, cases),
+                    .literals = nodes(a, cases_count, literals),
+                    .cases = nodes(a, cases_count, cases),
                     .default_case = case_(a, empty(a), unreachable(a)),
             })));
             new_fn->payload.fun.body = finish_body(bb, fn_ret(a, (Return) { .args = singleton(loaded_value), .fn = new_fn }));
@@ -137,18 +403,18 @@ static const Node* get_or_make_access_fn(Context* ctx, WhichFn which, bool unifo
         case StoreFn: {
             LARRAY(const Node*, literals, max_tag);
             LARRAY(const Node*, cases, max_tag);
+            size_t cases_count = 0;
             for (size_t tag = 0; tag < max_tag; tag++) {
-                literals[tag] = size_t_literal(a, tag);
-                if (!allowed(ctx, generic_ptr_tags[tag])) {
-                    cases[tag] = case_(a, empty(a), unreachable(a));
+                if (!(mask & (1 << tag)))
                     continue;
-                }
                 BodyBuilder* case_bb = begin_body(a);
                 const Node* reinterpreted_ptr = recover_full_pointer(ctx, case_bb, tag, ptr_param, t);
                 gen_store(case_bb, reinterpreted_ptr, value_param);
-                cases[tag] = case_(a, empty(a), finish_body(case_bb, yield(a, (Yield) {
+                literals[cases_count] = size_t_literal(a, tag);
+                cases[cases_count] = case_(a, empty(a), finish_body(case_bb, yield(a, (Yield) {
                         .args = empty(a),
                 })));
+                cases_count++;
             }
 
             BodyBuilder* bb = begin_body(a);
@@ -159,8 +425,8 @@ static const Node* get_or_make_access_fn(Context* ctx, WhichFn which, bool unifo
             bind_instruction(bb, match_instr(a, (Match) {
                     .inspect = extracted_tag,
                     .yield_types = empty(a),
-                    .literals = nodes(a, max_tag, literals),
-                    .cases = nodes(a, max_tag, cases),
+                    .literals = nodes(a, cases_count, literals),
+                    .cases = nodes(a, cases_count, cases),
                     .default_case = case_(a, empty(a), unreachable(a)),
             }));
             new_fn->payload.fun.body = finish_body(bb, fn_ret(a, (Return) { .args = empty(a), .fn = new_fn }));
@@ -170,6 +436,31 @@ static const Node* get_or_make_access_fn(Context* ctx, WhichFn which, bool unifo
     return new_fn;
 }
 
+/// The tags a generic pointer might have, or all the allowed ones when we don't know anything
+static TagMask get_ptr_origins(Context* ctx, const Node* old_ptr) {
+    TagMask allowed_tags = get_allowed_tags(ctx);
+    TagMask mask = ALL_TAGS;
+    if (old_ptr->tag == Variable_TAG) {
+        TagMask* found = find_value_dict(const Node*, TagMask, ctx->origins, old_ptr);
+        if (found)
+            mask = *found;
+    }
+    mask &= allowed_tags;
+    return mask ? mask : allowed_tags;
+}
+
+static bool is_single_tag(TagMask mask) {
+    return mask && !(mask & (mask - 1));
+}
+
+static size_t get_single_tag(TagMask mask) {
+    assert(is_single_tag(mask));
+    size_t tag = 0;
+    while (!(mask & (1 << tag)))
+        tag++;
+    return tag;
+}
+
 static const Node* process(Context* ctx, const Node* old) {
     const Node* found = search_processed(&ctx->rewriter, old);
     if (found) return found;
@@ -220,22 +511,39 @@ static const Node* process(Context* ctx, const Node* old) {
                     break;
                 }
                 case load_op: {
-                    const Type* old_ptr_t = first(old->payload.prim_op.operands)->type;
+                    const Node* old_ptr = first(old->payload.prim_op.operands);
+                    const Type* old_ptr_t = old_ptr->type;
                     deconstruct_qualified_type(&old_ptr_t);
                     if (old_ptr_t->payload.ptr_type.address_space == AsGeneric) {
+                        const Type* t = rewrite_node(&ctx->rewriter, old_ptr_t->payload.ptr_type.pointed_type);
+                        TagMask mask = get_ptr_origins(ctx, old_ptr);
+                        if (is_single_tag(mask)) {
+                            BodyBuilder* bb = begin_body(a);
+                            const Node* ptr = recover_full_pointer(ctx, bb, get_single_tag(mask), rewrite_node(&ctx->rewriter, old_ptr), t);
+                            return yield_values_and_wrap_in_block(bb, singleton(gen_load(bb, ptr)));
+                        }
                         return call(a, (Call) {
-                            .callee = fn_addr_helper(a, get_or_make_access_fn(ctx, LoadFn, false, rewrite_node(&ctx->rewriter, old_ptr_t->payload.ptr_type.pointed_type))),
-                            .args = singleton(rewrite_node(&ctx->rewriter, first(old->payload.prim_op.operands))),
+                            .callee = fn_addr_helper(a, get_or_make_access_fn(ctx, LoadFn, mask, t)),
+                            .args = singleton(rewrite_node(&ctx->rewriter, old_ptr)),
                         });
                     }
                     break;
                 }
                 case store_op: {
-                    const Type* old_ptr_t = first(old->payload.prim_op.operands)->type;
+                    const Node* old_ptr = first(old->payload.prim_op.operands);
+                    const Type* old_ptr_t = old_ptr->type;
                     deconstruct_qualified_type(&old_ptr_t);
                     if (old_ptr_t->payload.ptr_type.address_space == AsGeneric) {
+                        const Type* t = rewrite_node(&ctx->rewriter, old_ptr_t->payload.ptr_type.pointed_type);
+                        TagMask mask = get_ptr_origins(ctx, old_ptr);
+                        if (is_single_tag(mask)) {
+                            BodyBuilder* bb = begin_body(a);
+                            const Node* ptr = recover_full_pointer(ctx, bb, get_single_tag(mask), rewrite_node(&ctx->rewriter, old_ptr), t);
+                            gen_store(bb, ptr, rewrite_node(&ctx->rewriter, old->payload.prim_op.operands.nodes[1]));
+                            return yield_values_and_wrap_in_block(bb, empty(a));
+                        }
                         return call(a, (Call) {
-                            .callee = fn_addr_helper(a, get_or_make_access_fn(ctx, StoreFn, false, rewrite_node(&ctx->rewriter, old_ptr_t->payload.ptr_type.pointed_type))),
+                            .callee = fn_addr_helper(a, get_or_make_access_fn(ctx, StoreFn, mask, t)),
                             .args = rewrite_nodes(&ctx->rewriter, old->payload.prim_op.operands),
                         });
                     }
@@ -262,9 +570,11 @@ Module* lower_generic_ptrs(const CompilerConfig* config, Module* src) {
         .fns = new_dict(String, const Node*, (HashFn) hash_string, (CmpFn) compare_string),
         .generic_ptr_type = int_type(a, (Int) {.width = a->config.memory.ptr_size, .is_signed = false}),
         .config = config,
+        .origins = analyze_generic_ptr_origins(src),
     };
     rewrite_module(&ctx.rewriter);
     destroy_rewriter(&ctx.rewriter);
     destroy_dict(ctx.fns);
+    destroy_dict(ctx.origins);
     return dst;
 }
@@ -1,97 +1,364 @@
-#include "passes.h"
-
-#include "log.h"
-#include "portability.h"
-
-#include "../ir_private.h"
-#include "../type.h"
-#include "../rewrite.h"
-#include "../transform/ir_gen_helpers.h"
-
-typedef struct {
-    Rewriter rewriter;
-    const CompilerConfig* config;
-} Context;
-
-static bool should_convert(Context* ctx, const Type* t) {
-    t = get_unqualified_type(t);
-    return t->tag == Int_TAG && t->payload.int_type.width == IntTy64 && ctx->config->lower.int64;
-}
-
-static void extract_low_hi_halves(BodyBuilder* bb, const Node* src, const Node** lo, const Node** hi) {
-    *lo = first(bind_instruction(bb, prim_op(bb->arena,
-        (PrimOp) { .op = extract_op, .operands = mk_nodes(bb->arena, src, int32_literal(bb->arena, 0))})));
-    *hi = first(bind_instruction(bb, prim_op(bb->arena,
-        (PrimOp) { .op = extract_op, .operands = mk_nodes(bb->arena, src, int32_literal(bb->arena, 1))})));
-}
-
-static void extract_low_hi_halves_list(BodyBuilder* bb, Nodes src, const Node** lows, const Node** his) {
-    for (size_t i = 0; i < src.count; i++) {
-        extract_low_hi_halves(bb, src.nodes[i], lows, his);
-        lows++;
-        his++;
-    }
-}
-
-static const Node* process(Context* ctx, const Node* node) {
-    const Node* found = search_processed(&ctx->rewriter, node);
-    if (found) return found;
-
-    IrArena* a = ctx->rewriter.dst_arena;
-
-    switch (node->tag) {
-        case Int_TAG:
-            if (node->payload.int_type.width == IntTy64 && ctx->config->lower.int64)
-                return record_type(a, (RecordType) {
-                    .members = mk_nodes(a, int32_type(a), int32_type(a))
-                });
-            break;
-        case IntLiteral_TAG:
-            if (node->payload.int_literal.width == IntTy64 && ctx->config->lower.int64) {
-                uint64_t raw = node->payload.int_literal.value;
-                const Node* lower = uint32_literal(a, (uint32_t) raw);
-                const Node* upper = uint32_literal(a, (uint32_t) (raw >> 32));
-                return tuple_helper(a, mk_nodes(a, lower, upper));
-            }
-            break;
-        case PrimOp_TAG: {
-            Op op = node->payload.prim_op.op;
-            Nodes old_nodes = node->payload.prim_op.operands;
-            LARRAY(const Node*, lows, old_nodes.count);
-            LARRAY(const Node*, his, old_nodes.count);
-            switch(op) {
-                case add_op: if (should_convert(ctx, first(old_nodes)->type)) {
-                    Nodes new_nodes = rewrite_nodes(&ctx->rewriter, old_nodes);
-                    // TODO: convert into and then out of unsigned
-                    BodyBuilder* bb = begin_body(a);
-                    extract_low_hi_halves_list(bb, new_nodes, lows, his);
-                    Nodes low_and_carry = bind_instruction(bb, prim_op(a, (PrimOp) { .op = add_carry_op, .operands = nodes(a, 2, lows)}));
-                    const Node* lo = first(low_and_carry);
-                    // compute the high side, without forgetting the carry bit
-                    const Node* hi = first(bind_instruction(bb, prim_op(a, (PrimOp) { .op = add_op, .operands = nodes(a, 2, his)})));
-                                hi = first(bind_instruction(bb, prim_op(a, (PrimOp) { .op = add_op, .operands = mk_nodes(a, hi, low_and_carry.nodes[1])})));
-                    return yield_values_and_wrap_in_block(bb, singleton(tuple_helper(a, mk_nodes(a, lo, hi))));
-                } break;
-                default: break;
-            }
-            break;
-        }
-        default: break;
-    }
-
-    rebuild:
-    return recreate_node_identity(&ctx->rewriter, node);
-}
-
-Module* lower_int(const CompilerConfig* config, Module* src) {
-    ArenaConfig aconfig = get_arena_config(get_module_arena(src));
-    IrArena* a = new_ir_arena(aconfig);
-    Module* dst = new_module(a, get_module_name(src));
-    Context ctx = {
-        .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
-        .config = config,
-    };
-    rewrite_module(&ctx.rewriter);
-    destroy_rewriter(&ctx.rewriter);
-    return dst;
-}
+#include "passes.h"
+
+#include "log.h"
+#include "portability.h"
+#include "dict.h"
+
+#include "../ir_private.h"
+#include "../type.h"
+#include "../rewrite.h"
+#include "../transform/ir_gen_helpers.h"
+
+// 64-bit integers become a pair of u32 halves. Lowered instructions bind their halves in the enclosing scope and remember
+// them, so chains of 64-bit arithmetic (typically pointer arithmetic with ptr_size = IntTy64) go from halves to halves
+// instead of rebuilding and taking apart a record at every step. Halves known to be constant are folded on the fly,
+// which is what makes shifts, masks and additions of small constants cheap.
+
+typedef struct {
+    Rewriter rewriter;
+    const CompilerConfig* config;
+    /// old 64-bit variables whose halves are already available
+    struct Dict* halves;
+} Context;
+
+typedef struct {
+    const Node* lo;
+    const Node* hi;
+} Halves;
+
+static bool should_convert(Context* ctx, const Type* t) {
+    t = get_unqualified_type(t);
+    return t->tag == Int_TAG && t->payload.int_type.width == IntTy64 && ctx->config->lower.int64;
+}
+
+static void extract_low_hi_halves(BodyBuilder* bb, const Node* src, const Node** lo, const Node** hi) {
+    *lo = first(bind_instruction(bb, prim_op(bb->arena,
+        (PrimOp) { .op = extract_op, .operands = mk_nodes(bb->arena, src, int32_literal(bb->arena, 0))})));
+    *hi = first(bind_instruction(bb, prim_op(bb->arena,
+        (PrimOp) { .op = extract_op, .operands = mk_nodes(bb->arena, src, int32_literal(bb->arena, 1))})));
+}
+
+static Halves get_halves(Context* ctx, BodyBuilder* bb, const Node* old) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    if (old->tag == IntLiteral_TAG) {
+        uint64_t raw = old->payload.int_literal.value;
+        return (Halves) { uint32_literal(a, (uint32_t) raw), uint32_literal(a, (uint32_t) (raw >> 32)) };
+    }
+    Halves* found = find_value_dict(const Node*, Halves, ctx->halves, old);
+    if (found)
+        return *found;
+    Halves h;
+    extract_low_hi_halves(bb, rewrite_node(&ctx->rewriter, old), &h.lo, &h.hi);
+    return h;
+}
+
+static bool is_literal(const Node* n, uint32_t value) {
+    return n->tag == IntLiteral_TAG && (uint32_t) n->payload.int_literal.value == value;
+}
+
+static const Node* gen_binop(BodyBuilder* bb, Op op, const Node* x, const Node* y) {
+    return gen_primop_ce(bb, op, 2, (const Node* []) { x, y });
+}
+
+/// add_carry, sub_borrow and mul_extended give us a record of the result and the carry (or high) word
+static Halves gen_extended(BodyBuilder* bb, Op op, const Node* x, const Node* y) {
+    Halves h;
+    extract_low_hi_halves(bb, gen_binop(bb, op, x, y), &h.lo, &h.hi);
+    return h;
+}
+
+static const Node* gen_add(BodyBuilder* bb, const Node* x, const Node* y) {
+    if (is_literal(x, 0)) return y;
+    if (is_literal(y, 0)) return x;
+    if (x->tag == IntLiteral_TAG && y->tag == IntLiteral_TAG)
+        return uint32_literal(bb->arena, (uint32_t) (x->payload.int_literal.value + y->payload.int_literal.value));
+    return gen_binop(bb, add_op, x, y);
+}
+
+static const Node* gen_sub(BodyBuilder* bb, const Node* x, const Node* y) {
+    if (is_literal(y, 0)) return x;
+    if (x->tag == IntLiteral_TAG && y->tag == IntLiteral_TAG)
+        return uint32_literal(bb->arena, (uint32_t) (x->payload.int_literal.value - y->payload.int_literal.value));
+    return gen_binop(bb, sub_op, x, y);
+}
+
+static const Node* gen_shift(BodyBuilder* bb, Op op, const Node* x, uint32_t k) {
+    if (k == 0)
+        return x;
+    if (is_literal(x, 0))
+        return x;
+    return gen_binop(bb, op, x, uint32_literal(bb->arena, k));
+}
+
+/// The halves are unsigned, and C-like targets print arithmetic shifts as a plain >>, so shift a signed view of x.
+static const Node* gen_arithm_shift(BodyBuilder* bb, const Node* x, uint32_t k) {
+    IrArena* a = bb->arena;
+    if (k == 0)
+        return x;
+    if (x->tag == IntLiteral_TAG)
+        return uint32_literal(a, (uint32_t) ((int32_t) (uint32_t) x->payload.int_literal.value >> k));
+    const Node* shifted = gen_binop(bb, rshift_arithm_op, gen_reinterpret_cast(bb, int32_type(a), x), uint32_literal(a, k));
+    return gen_reinterpret_cast(bb, uint32_type(a), shifted);
+}
+
+static const Node* gen_logic(BodyBuilder* bb, Op op, const Node* x, const Node* y) {
+    for (int swap = 0; swap < 2; swap++) {
+        switch (op) {
+            case and_op:
+                if (is_literal(x, 0)) return x;
+                if (is_literal(x, UINT32_MAX)) return y;
+                break;
+            case or_op:
+                if (is_literal(x, 0)) return y;
+                if (is_literal(x, UINT32_MAX)) return x;
+                break;
+            case xor_op:
+                if (is_literal(x, 0)) return y;
+                break;
+            default: assert(false);
+        }
+        const Node* t = x;
+        x = y;
+        y = t;
+    }
+    return gen_binop(bb, op, x, y);
+}
+
+static Halves lower_add(BodyBuilder* bb, Halves x, Halves y) {
+    // no carry can come out of the low half if either side is zero there
+    if (is_literal(y.lo, 0))
+        return (Halves) { x.lo, gen_add(bb, x.hi, y.hi) };
+    if (is_literal(x.lo, 0))
+        return (Halves) { y.lo, gen_add(bb, x.hi, y.hi) };
+    Halves low_and_carry = gen_extended(bb, add_carry_op, x.lo, y.lo);
+    return (Halves) { low_and_carry.lo, gen_add(bb, gen_add(bb, x.hi, y.hi), low_and_carry.hi) };
+}
+
+static Halves lower_sub(BodyBuilder* bb, Halves x, Halves y) {
+    if (is_literal(y.lo, 0))
+        return (Halves) { x.lo, gen_sub(bb, x.hi, y.hi) };
+    Halves low_and_borrow = gen_extended(bb, sub_borrow_op, x.lo, y.lo);
+    return (Halves) { low_and_borrow.lo, gen_sub(bb, gen_sub(bb, x.hi, y.hi), low_and_borrow.hi) };
+}
+
+static Halves lower_shift(BodyBuilder* bb, Op op, Halves x, uint32_t k) {
+    IrArena* a = bb->arena;
+    k &= 63;
+    switch (op) {
+        case lshift_op:
+            if (k >= 32)
+                return (Halves) { uint32_literal(a, 0), gen_shift(bb, lshift_op, x.lo, k - 32) };
+            if (k == 0)
+                return x;
+            return (Halves) { gen_shift(bb, lshift_op, x.lo, k), gen_logic(bb, or_op, gen_shift(bb, lshift_op, x.hi, k), gen_shift(bb, rshift_logical_op, x.lo, 32 - k)) };
+        case rshift_logical_op:
+            if (k >= 32)
+                return (Halves) { gen_shift(bb, rshift_logical_op, x.hi, k - 32), uint32_literal(a, 0) };
+            if (k == 0)
+                return x;
+            return (Halves) { gen_logic(bb, or_op, gen_shift(bb, rshift_logical_op, x.lo, k), gen_shift(bb, lshift_op, x.hi, 32 - k)), gen_shift(bb, rshift_logical_op, x.hi, k) };
+        case rshift_arithm_op:
+            if (k >= 32)
+                return (Halves) { gen_arithm_shift(bb, x.hi, k - 32), gen_arithm_shift(bb, x.hi, 31) };
+            if (k == 0)
+                return x;
+            return (Halves) { gen_logic(bb, or_op, gen_shift(bb, rshift_logical_op, x.lo, k), gen_shift(bb, lshift_op, x.hi, 32 - k)), gen_arithm_shift(bb, x.hi, k) };
+        default: assert(false);
+    }
+}
+
+static bool get_power_of_two(Halves x, uint32_t* log2) {
+    if (x.lo->tag != IntLiteral_TAG || x.hi->tag != IntLiteral_TAG)
+        return false;
+    uint64_t value = x.lo->payload.int_literal.value | (x.hi->payload.int_literal.value << 32);
+    if (value == 0 || (value & (value - 1)) != 0)
+        return false;
+    for (*log2 = 0; (value >> *log2) != 1; (*log2)++);
+    return true;
+}
+
+static Halves lower_mul(BodyBuilder* bb, Halves x, Halves y) {
+    uint32_t k;
+    if (get_power_of_two(y, &k))
+        return lower_shift(bb, lshift_op, x, k);
+    if (get_power_of_two(x, &k))
+        return lower_shift(bb, lshift_op, y, k);
+    // the cross products only contribute to the high half, and the high product doesn't contribute at all
+    Halves product = gen_extended(bb, mul_extended_op, x.lo, y.lo);
+    const Node* hi = product.hi;
+    if (!is_literal(x.lo, 0) && !is_literal(y.hi, 0))
+        hi = gen_add(bb, hi, gen_binop(bb, mul_op, x.lo, y.hi));
+    if (!is_literal(x.hi, 0) && !is_literal(y.lo, 0))
+        hi = gen_add(bb, hi, gen_binop(bb, mul_op, x.hi, y.lo));
+    return (Halves) { product.lo, hi };
+}
+
+/// Lowers a 64-bit primop into halves, returns false if this isn't something we know how to do.
+static bool lower_primop_halves(Context* ctx, BodyBuilder* bb, const Node* old, Halves* result) {
+    PrimOp payload = old->payload.prim_op;
+    Nodes ops = payload.operands;
+    switch (payload.op) {
+        case add_op: *result = lower_add(bb, get_halves(ctx, bb, ops.nodes[0]), get_halves(ctx, bb, ops.nodes[1])); return true;
+        case sub_op: *result = lower_sub(bb, get_halves(ctx, bb, ops.nodes[0]), get_halves(ctx, bb, ops.nodes[1])); return true;
+        case mul_op: *result = lower_mul(bb, get_halves(ctx, bb, ops.nodes[0]), get_halves(ctx, bb, ops.nodes[1])); return true;
+        case and_op:
+        case or_op:
+        case xor_op: {
+            Halves x = get_halves(ctx, bb, ops.nodes[0]);
+            Halves y = get_halves(ctx, bb, ops.nodes[1]);
+            *result = (Halves) { gen_logic(bb, payload.op, x.lo, y.lo), gen_logic(bb, payload.op, x.hi, y.hi) };
+            return true;
+        }
+        case lshift_op:
+        case rshift_logical_op:
+        case rshift_arithm_op: {
+            // variable shift amounts would need a branch on which half they land in, leave them alone
+            const Node* amount = ops.nodes[1];
+            if (amount->tag != IntLiteral_TAG)
+                return false;
+            *result = lower_shift(bb, payload.op, get_halves(ctx, bb, ops.nodes[0]), (uint32_t) amount->payload.int_literal.value);
+            return true;
+        }
+        case reinterpret_op: {
+            if (!should_convert(ctx, first(ops)->type))
+                return false;
+            *result = get_halves(ctx, bb, first(ops));
+            return true;
+        }
+        case convert_op: {
+            const Type* src_t = get_unqualified_type(first(ops)->type);
+            if (src_t->tag != Int_TAG)
+                return false;
+            if (should_convert(ctx, first(ops)->type)) {
+                *result = get_halves(ctx, bb, first(ops));
+                return true;
+            }
+            IrArena* a = ctx->rewriter.dst_arena;
+            const Node* src = rewrite_node(&ctx->rewriter, first(ops));
+            bool sign_extend = src_t->payload.int_type.is_signed;
+            if (src_t->payload.int_type.width != IntTy32)
+                src = gen_conversion(bb, int_type(a, (Int) { .width = IntTy32, .is_signed = sign_extend }), src);
+            if (sign_extend)
+                src = gen_reinterpret_cast(bb, uint32_type(a), src);
+            result->lo = src;
+            result->hi = sign_extend ? gen_arithm_shift(bb, src, 31) : uint32_literal(a, 0);
+            return true;
+        }
+        default: return false;
+    }
+}
+
+/// Lowers a primop that consumes 64-bit values but produces something else.
+static const Node* lower_primop_from_halves(Context* ctx, BodyBuilder* bb, const Node* old) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    PrimOp payload = old->payload.prim_op;
+    Nodes ops = payload.operands;
+    switch (payload.op) {
+        case eq_op:
+        case neq_op: {
+            if (!should_convert(ctx, first(ops)->type))
+                return NULL;
+            Halves x = get_halves(ctx, bb, ops.nodes[0]);
+            Halves y = get_halves(ctx, bb, ops.nodes[1]);
+            const Node* lo = gen_binop(bb, payload.op, x.lo, y.lo);
+            const Node* hi = gen_binop(bb, payload.op, x.hi, y.hi);
+            return gen_binop(bb, payload.op == eq_op ? and_op : or_op, lo, hi);
+        }
+        case convert_op:
+        case reinterpret_op: {
+            const Type* dst_t = first(payload.type_arguments);
+            if (!should_convert(ctx, first(ops)->type) || dst_t->tag != Int_TAG)
+                return NULL;
+            const Node* lo = get_halves(ctx, bb, first(ops)).lo;
+            const Type* ndst_t = rewrite_node(&ctx->rewriter, dst_t);
+            if (dst_t->payload.int_type.width == IntTy32)
+                return payload.op == convert_op && !dst_t->payload.int_type.is_signed ? lo : gen_reinterpret_cast(bb, ndst_t, lo);
+            if (payload.op == reinterpret_op)
+                return NULL;
+            return gen_conversion(bb, ndst_t, lo);
+        }
+        default: return NULL;
+    }
+}
+
+static const Node* process_let(Context* ctx, const Node* node) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    const Node* instruction = get_let_instruction(node);
+    const Node* tail = get_let_tail(node);
+    Nodes oparams = get_abstraction_params(tail);
+    if (instruction->tag != PrimOp_TAG || oparams.count != 1)
+        return NULL;
+
+    const Node* oresult = first(oparams);
+    BodyBuilder* bb = begin_body(a);
+    if (should_convert(ctx, oresult->type)) {
+        Halves h;
+        if (!lower_primop_halves(ctx, bb, instruction, &h)) {
+            cancel_body(bb);
+            return NULL;
+        }
+        insert_dict(const Node*, Halves, ctx->halves, oresult, h);
+        register_processed(&ctx->rewriter, oresult, tuple_helper(a, mk_nodes(a, h.lo, h.hi)));
+    } else {
+        const Node* result = lower_primop_from_halves(ctx, bb, instruction);
+        if (!result) {
+            cancel_body(bb);
+            return NULL;
+        }
+        register_processed(&ctx->rewriter, oresult, result);
+    }
+    return finish_body(bb, rewrite_node(&ctx->rewriter, get_abstraction_body(tail)));
+}
+
+static const Node* process(Context* ctx, const Node* node) {
+    const Node* found = search_processed(&ctx->rewriter, node);
+    if (found) return found;
+
+    IrArena* a = ctx->rewriter.dst_arena;
+
+    switch (node->tag) {
+        case Int_TAG:
+            if (node->payload.int_type.width == IntTy64 && ctx->config->lower.int64)
+                return record_type(a, (RecordType) {
+                    .members = mk_nodes(a, uint32_type(a), uint32_type(a))
+                });
+            break;
+        case IntLiteral_TAG:
+            if (node->payload.int_literal.width == IntTy64 && ctx->config->lower.int64) {
+                uint64_t raw = node->payload.int_literal.value;
+                const Node* lower = uint32_literal(a, (uint32_t) raw);
+                const Node* upper = uint32_literal(a, (uint32_t) (raw >> 32));
+                return tuple_helper(a, mk_nodes(a, lower, upper));
+            }
+            break;
+        case Let_TAG: {
+            if (!ctx->config->lower.int64)
+                break;
+            const Node* lowered = process_let(ctx, node);
+            if (lowered)
+                return lowered;
+            break;
+        }
+        default: break;
+    }
+
+    return recreate_node_identity(&ctx->rewriter, node);
+}
+
+KeyHash hash_node(const Node**);
+bool compare_node(const Node**, const Node**);
+
+Module* lower_int(const CompilerConfig* config, Module* src) {
+    ArenaConfig aconfig = get_arena_config(get_module_arena(src));
+    IrArena* a = new_ir_arena(aconfig);
+    Module* dst = new_module(a, get_module_name(src));
+    Context ctx = {
+        .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
+        .config = config,
+        .halves = new_dict(const Node*, Halves, (HashFn) hash_node, (CmpFn) compare_node),
+    };
+    rewrite_module(&ctx.rewriter);
+    destroy_rewriter(&ctx.rewriter);
+    destroy_dict(ctx.halves);
+    return dst;
+}
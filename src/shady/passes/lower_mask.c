@@ -10,6 +10,7 @@
 
 typedef struct {
     Rewriter rewriter;
+    const CompilerConfig* config;
     const Node* zero;
     const Node* one;
 } Context;
@@ -28,6 +29,9 @@ static const Node* process(Context* ctx, const Node* node) {
             switch(op) {
                 case empty_mask_op: return quote_helper(a, singleton(ctx->zero));
                 case subgroup_active_mask_op: // this is just ballot(true)
+                    // ... unless ballots get emulated, which in turn need to know which lanes are active
+                    if (ctx->config->lower.emulate_subgroup_ops)
+                        break;
                     return prim_op(a, (PrimOp) { .op = subgroup_ballot_op, .type_arguments = empty(a), .operands = singleton(true_lit(ctx->rewriter.dst_arena)) });
                 // extract the relevant bit
                 case mask_is_thread_active_op: {
@@ -54,7 +58,7 @@ static const Node* process(Context* ctx, const Node* node) {
     return recreate_node_identity(&ctx->rewriter, node);
 }
 
-Module* lower_mask(SHADY_UNUSED const CompilerConfig* config, Module* src) {
+Module* lower_mask(const CompilerConfig* config, Module* src) {
     ArenaConfig aconfig = get_arena_config(get_module_arena(src));
     aconfig.specializations.subgroup_mask_representation = SubgroupMaskInt64;
     IrArena* a = new_ir_arena(aconfig);
@@ -65,6 +69,7 @@ Module* lower_mask(SHADY_UNUSED const CompilerConfig* config, Module* src) {
 
     Context ctx = {
         .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
+        .config = config,
         .zero = int_literal(a, (IntLiteral) { .width = mask_type->payload.int_type.width, .value = 0 }),
         .one = int_literal(a, (IntLiteral) { .width = mask_type->payload.int_type.width, .value = 1 }),
     };
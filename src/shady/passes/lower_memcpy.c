@@ -11,17 +11,201 @@
 
 #include <assert.h>
 
+/// Copies of a known size that take at most this many moves are fully unrolled
+#define MAX_UNROLLED_MOVES 16
+/// Widest chunk we'll move at once, in bytes
+#define MAX_CHUNK_SIZE 16
+
 typedef struct {
     Rewriter rewriter;
     const CompilerConfig* config;
 } Context;
 
+static size_t minof(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+static size_t get_pointee_alignment(IrArena* a, const Type* ptr_t) {
+    deconstruct_qualified_type(&ptr_t);
+    if (ptr_t->tag != PtrType_TAG)
+        return 1;
+    const Type* pointee = ptr_t->payload.ptr_type.pointed_type;
+    // unsized arrays are still as aligned as their elements
+    while (pointee && pointee->tag == ArrType_TAG && !pointee->payload.arr_type.size)
+        pointee = pointee->payload.arr_type.element_type;
+    if (!pointee)
+        return 1;
+    switch (pointee->tag) {
+        case TypeDeclRef_TAG: {
+            const Node* nom = pointee->payload.type_decl_ref.decl;
+            if (nom->tag != NominalType_TAG || !nom->payload.nom_type.body)
+                return 1;
+            SHADY_FALLTHROUGH
+        }
+        case Int_TAG:
+        case Float_TAG:
+        case Bool_TAG:
+        case ArrType_TAG:
+        case PackType_TAG:
+        case RecordType_TAG: return get_mem_layout(a, pointee).alignment_in_bytes;
+        default: return 1;
+    }
+}
+
+/// Conservatively figures out how aligned a pointer is, by looking through the casts it went through
+static size_t get_known_alignment(IrArena* a, const Node* ptr) {
+    size_t alignment = 1;
+    while (true) {
+        size_t pointee_alignment = get_pointee_alignment(a, ptr->type);
+        if (pointee_alignment > alignment)
+            alignment = pointee_alignment;
+
+        if (ptr->tag != Variable_TAG || ptr->payload.var.pindex != 0)
+            break;
+        const Node* abs = ptr->payload.var.abs;
+        if (!abs || abs->tag != Case_TAG)
+            break;
+        const Node* user = abs->payload.case_.structured_construct;
+        if (!user || user->tag != Let_TAG)
+            break;
+        const Node* instr = user->payload.let.instruction;
+        if (instr->tag != PrimOp_TAG)
+            break;
+        Op op = instr->payload.prim_op.op;
+        if (op != reinterpret_op && op != convert_op)
+            break;
+        ptr = first(instr->payload.prim_op.operands);
+    }
+    return alignment;
+}
+
+static const Type* get_chunk_type(Context* ctx, size_t size) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    size_t max_int_size = ctx->config->lower.int64 ? 4 : 8;
+    if (size > max_int_size) {
+        const Type* element_t = int_type_helper(a, false, max_int_size == 8 ? IntTy64 : IntTy32);
+        return pack_type(a, (PackType) { .element_type = element_t, .width = size / max_int_size });
+    }
+    switch (size) {
+        case 1: return uint8_type(a);
+        case 2: return uint16_type(a);
+        case 4: return uint32_type(a);
+        case 8: return uint64_type(a);
+        default: SHADY_UNREACHABLE;
+    }
+}
+
+static const Node* gen_chunk_array_ptr(BodyBuilder* bb, const Node* ptr, const Type* chunk_t) {
+    IrArena* a = ptr->arena;
+    const Type* ptr_t = ptr->type;
+    deconstruct_qualified_type(&ptr_t);
+    assert(ptr_t->tag == PtrType_TAG);
+    ptr_t = ptr_type(a, (PtrType) {
+        .address_space = ptr_t->payload.ptr_type.address_space,
+        .pointed_type = arr_type(a, (ArrType) { .element_type = chunk_t, .size = NULL }),
+    });
+    return gen_reinterpret_cast(bb, ptr_t, ptr);
+}
+
+/// Stores either the chunk at `index` from `src`, or `value` if there is no source, to `dst`.
+static void gen_move(BodyBuilder* bb, const Node* dst, const Node* src, const Node* value, const Node* index) {
+    IrArena* a = dst->arena;
+    if (src)
+        value = gen_load(bb, gen_lea(bb, src, index, singleton(uint32_literal(a, 0))));
+    gen_store(bb, gen_lea(bb, dst, index, singleton(uint32_literal(a, 0))), value);
+}
+
+static void gen_moves_unrolled(BodyBuilder* bb, const Node* dst, const Node* src, const Node* value, size_t start, size_t end) {
+    IrArena* a = dst->arena;
+    for (size_t i = start; i < end; i++)
+        gen_move(bb, dst, src, value, uint32_literal(a, i));
+}
+
+static void gen_moves_loop(BodyBuilder* bb, const Node* dst, const Node* src, const Node* value, const Node* start, const Node* end, String index_name) {
+    IrArena* a = dst->arena;
+    const Node* index = var(a, qualified_type_helper(uint32_type(a), false), index_name);
+    BodyBuilder* loop_bb = begin_body(a);
+    BodyBuilder* move_bb = begin_body(a);
+    gen_move(move_bb, dst, src, value, index);
+    const Node* next_index = gen_primop_e(move_bb, add_op, empty(a), mk_nodes(a, index, uint32_literal(a, 1)));
+    // the bounds are checked before moving anything, the count might be zero
+    bind_instruction(loop_bb, if_instr(a, (If) {
+        .condition = gen_primop_e(loop_bb, lt_op, empty(a), mk_nodes(a, index, end)),
+        .yield_types = empty(a),
+        .if_true = case_(a, empty(a), finish_body(move_bb, merge_continue(a, (MergeContinue) {.args = singleton(next_index)}))),
+        .if_false = case_(a, empty(a), merge_break(a, (MergeBreak) {.args = empty(a)}))
+    }));
+
+    bind_instruction(bb, loop_instr(a, (Loop) {
+        .yield_types = empty(a),
+        .body = case_(a, singleton(index), finish_body(loop_bb, unreachable(a))),
+        .initial_args = singleton(start)
+    }));
+}
+
+/// Moves `num` bytes as wide chunks first and finishes with `element_t`-sized ones.
+/// Copies have a `src`, memsets instead have the value to store, both as a whole chunk and as an element.
+static void gen_moves(Context* ctx, BodyBuilder* bb, const Node* dst, const Node* src, const Node* num, size_t chunk_size, const Type* element_t, const Node* chunk_value, const Node* element_value, String index_name) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    size_t element_size = get_mem_layout(a, element_t).size_in_bytes;
+    if (chunk_size < element_size)
+        chunk_size = element_size;
+    size_t elements_per_chunk = chunk_size / element_size;
+    const Type* chunk_t = chunk_size == element_size ? element_t : get_chunk_type(ctx, chunk_size);
+
+    const Node* dst_chunks = gen_chunk_array_ptr(bb, dst, chunk_t);
+    const Node* src_chunks = src ? gen_chunk_array_ptr(bb, src, chunk_t) : NULL;
+    const Node* dst_elements = elements_per_chunk > 1 ? gen_chunk_array_ptr(bb, dst, element_t) : NULL;
+    const Node* src_elements = elements_per_chunk > 1 && src ? gen_chunk_array_ptr(bb, src, element_t) : NULL;
+    if (!chunk_value)
+        chunk_value = element_value;
+
+    const IntLiteral* static_num = resolve_to_int_literal(num);
+    if (static_num) {
+        uint64_t bytes = get_int_literal_value(*static_num, false);
+        size_t chunks = bytes / chunk_size;
+        size_t tail_start = chunks * elements_per_chunk;
+        size_t tail_end = bytes / element_size;
+        if (chunks + (tail_end - tail_start) <= MAX_UNROLLED_MOVES)
+            gen_moves_unrolled(bb, dst_chunks, src_chunks, chunk_value, 0, chunks);
+        else
+            gen_moves_loop(bb, dst_chunks, src_chunks, chunk_value, uint32_literal(a, 0), uint32_literal(a, chunks), index_name);
+        if (tail_end > tail_start)
+            gen_moves_unrolled(bb, dst_elements, src_elements, element_value, tail_start, tail_end);
+        return;
+    }
+
+    num = gen_conversion(bb, uint32_type(a), num);
+    const Node* chunks = gen_primop_e(bb, div_op, empty(a), mk_nodes(a, num, uint32_literal(a, chunk_size)));
+    gen_moves_loop(bb, dst_chunks, src_chunks, chunk_value, uint32_literal(a, 0), chunks, index_name);
+    if (elements_per_chunk > 1) {
+        const Node* tail_start = gen_primop_e(bb, mul_op, empty(a), mk_nodes(a, chunks, uint32_literal(a, elements_per_chunk)));
+        const Node* tail_end = gen_primop_e(bb, div_op, empty(a), mk_nodes(a, num, uint32_literal(a, element_size)));
+        gen_moves_loop(bb, dst_elements, src_elements, element_value, tail_start, tail_end, index_name);
+    }
+}
+
+/// Broadcasts an integer value to all the bytes of a wider integer type.
+static const Node* gen_splat(BodyBuilder* bb, const Type* chunk_t, const Node* value) {
+    IrArena* a = value->arena;
+    const Type* value_t = get_unqualified_type(value->type);
+    assert(value_t->tag == Int_TAG && chunk_t->tag == Int_TAG);
+    size_t value_bits = int_size_in_bytes(value_t->payload.int_type.width) * 8;
+    size_t chunk_bits = int_size_in_bytes(chunk_t->payload.int_type.width) * 8;
+    uint64_t pattern = 0;
+    for (size_t i = 0; i < chunk_bits; i += value_bits)
+        pattern |= UINT64_C(1) << i;
+    const Node* unsigned_value = gen_reinterpret_cast(bb, int_type_helper(a, false, value_t->payload.int_type.width), value);
+    const Node* widened = gen_conversion(bb, chunk_t, unsigned_value);
+    const Node* splat = gen_primop_e(bb, mul_op, empty(a), mk_nodes(a, widened, int_literal(a, (IntLiteral) { .width = chunk_t->payload.int_type.width, .value = pattern })));
+    return splat;
+}
+
 static const Node* process(Context* ctx, const Node* old) {
     const Node* found = search_processed(&ctx->rewriter, old);
     if (found) return found;
 
     IrArena* a = ctx->rewriter.dst_arena;
-    Module* m = ctx->rewriter.dst_module;
 
     switch (old->tag) {
         case PrimOp_TAG: {
@@ -32,46 +216,12 @@ static const Node* process(Context* ctx, const Node* old) {
                     BodyBuilder* bb = begin_body(a);
                     Nodes old_ops = old->payload.prim_op.operands;
 
+                    size_t alignment = minof(get_known_alignment(ctx->rewriter.src_arena, old_ops.nodes[0]), get_known_alignment(ctx->rewriter.src_arena, old_ops.nodes[1]));
                     const Node* dst_addr = rewrite_node(&ctx->rewriter, old_ops.nodes[0]);
-                    const Type* dst_addr_type = dst_addr->type;
-                    deconstruct_qualified_type(&dst_addr_type);
-                    assert(dst_addr_type->tag == PtrType_TAG);
-                    dst_addr_type = ptr_type(a, (PtrType) {
-                        .address_space = dst_addr_type->payload.ptr_type.address_space,
-                        .pointed_type = arr_type(a, (ArrType) { .element_type = word_type, .size = NULL }),
-                    });
-                    dst_addr = gen_reinterpret_cast(bb, dst_addr_type, dst_addr);
-
                     const Node* src_addr = rewrite_node(&ctx->rewriter, old_ops.nodes[1]);
-                    const Type* src_addr_type = src_addr->type;
-                    deconstruct_qualified_type(&src_addr_type);
-                    assert(src_addr_type->tag == PtrType_TAG);
-                    src_addr_type = ptr_type(a, (PtrType) {
-                            .address_space = src_addr_type->payload.ptr_type.address_space,
-                            .pointed_type = arr_type(a, (ArrType) { .element_type = word_type, .size = NULL }),
-                    });
-                    src_addr = gen_reinterpret_cast(bb, src_addr_type, src_addr);
-
                     const Node* num = rewrite_node(&ctx->rewriter, old_ops.nodes[2]);
-                    const Node* num_in_bytes = gen_conversion(bb, uint32_type(a), bytes_to_words(bb, num));
-
-                    const Node* index = var(a, qualified_type_helper(uint32_type(a), false), "memcpy_i");
-                    BodyBuilder* loop_bb = begin_body(a);
-                    const Node* loaded_word = gen_load(loop_bb, gen_lea(loop_bb, src_addr, index, singleton(uint32_literal(a, 0))));
-                    gen_store(loop_bb, gen_lea(loop_bb, dst_addr, index, singleton(uint32_literal(a, 0))), loaded_word);
-                    const Node* next_index = gen_primop_e(loop_bb, add_op, empty(a), mk_nodes(a, index, uint32_literal(a, 1)));
-                    bind_instruction(loop_bb, if_instr(a, (If) {
-                        .condition = gen_primop_e(loop_bb, lt_op, empty(a), mk_nodes(a, next_index, num_in_bytes)),
-                        .yield_types = empty(a),
-                        .if_true = case_(a, empty(a), merge_continue(a, (MergeContinue) {.args = singleton(next_index)})),
-                        .if_false = case_(a, empty(a), merge_break(a, (MergeBreak) {.args = empty(a)}))
-                    }));
-
-                    bind_instruction(bb, loop_instr(a, (Loop) {
-                        .yield_types = empty(a),
-                        .body = case_(a, singleton(index), finish_body(loop_bb, unreachable(a))),
-                        .initial_args = singleton(uint32_literal(a, 0))
-                    }));
+
+                    gen_moves(ctx, bb, dst_addr, src_addr, num, minof(alignment, MAX_CHUNK_SIZE), word_type, NULL, NULL, "memcpy_i");
                     return yield_values_and_wrap_in_block(bb, empty(a));
                 }
                 case memset_op: {
@@ -80,39 +230,21 @@ static const Node* process(Context* ctx, const Node* old) {
                     const Type* src_type = src_value->type;
                     deconstruct_qualified_type(&src_type);
                     assert(src_type->tag == Int_TAG);
-                    const Type* word_type = src_type;// int_type(a, (Int) { .is_signed = false, .width = a->config.memory.word_size });
 
                     BodyBuilder* bb = begin_body(a);
 
+                    size_t alignment = get_known_alignment(ctx->rewriter.src_arena, old_ops.nodes[0]);
                     const Node* dst_addr = rewrite_node(&ctx->rewriter, old_ops.nodes[0]);
-                    const Type* dst_addr_type = dst_addr->type;
-                    deconstruct_qualified_type(&dst_addr_type);
-                    assert(dst_addr_type->tag == PtrType_TAG);
-                    dst_addr_type = ptr_type(a, (PtrType) {
-                        .address_space = dst_addr_type->payload.ptr_type.address_space,
-                        .pointed_type = arr_type(a, (ArrType) { .element_type = word_type, .size = NULL }),
-                    });
-                    dst_addr = gen_reinterpret_cast(bb, dst_addr_type, dst_addr);
-
                     const Node* num = rewrite_node(&ctx->rewriter, old_ops.nodes[2]);
-                    const Node* num_in_bytes = gen_conversion(bb, uint32_type(a), bytes_to_words(bb, num));
-
-                    const Node* index = var(a, qualified_type_helper(uint32_type(a), false), "memset_i");
-                    BodyBuilder* loop_bb = begin_body(a);
-                    gen_store(loop_bb, gen_lea(loop_bb, dst_addr, index, singleton(uint32_literal(a, 0))), src_value);
-                    const Node* next_index = gen_primop_e(loop_bb, add_op, empty(a), mk_nodes(a, index, uint32_literal(a, 1)));
-                    bind_instruction(loop_bb, if_instr(a, (If) {
-                        .condition = gen_primop_e(loop_bb, lt_op, empty(a), mk_nodes(a, next_index, num_in_bytes)),
-                        .yield_types = empty(a),
-                        .if_true = case_(a, empty(a), merge_continue(a, (MergeContinue) {.args = singleton(next_index)})),
-                        .if_false = case_(a, empty(a), merge_break(a, (MergeBreak) {.args = empty(a)}))
-                    }));
-
-                    bind_instruction(bb, loop_instr(a, (Loop) {
-                        .yield_types = empty(a),
-                        .body = case_(a, singleton(index), finish_body(loop_bb, unreachable(a))),
-                        .initial_args = singleton(uint32_literal(a, 0))
-                    }));
+
+                    // splatting only works with scalars
+                    size_t chunk_size = minof(alignment, ctx->config->lower.int64 ? 4 : 8);
+                    size_t value_size = int_size_in_bytes(src_type->payload.int_type.width);
+                    const Node* chunk_value = NULL;
+                    if (chunk_size > value_size)
+                        chunk_value = gen_splat(bb, get_chunk_type(ctx, chunk_size), src_value);
+
+                    gen_moves(ctx, bb, dst_addr, NULL, num, chunk_size, src_type, chunk_value, src_value, "memset_i");
                     return yield_values_and_wrap_in_block(bb, empty(a));
                 }
                 default: break;
@@ -125,13 +257,14 @@ static const Node* process(Context* ctx, const Node* old) {
     return recreate_node_identity(&ctx->rewriter, old);
 }
 
-Module* lower_memcpy(SHADY_UNUSED const CompilerConfig* config, Module* src) {
+Module* lower_memcpy(const CompilerConfig* config, Module* src) {
     ArenaConfig aconfig = get_arena_config(get_module_arena(src));
     IrArena* a = new_ir_arena(aconfig);
     Module* dst = new_module(a, get_module_name(src));
 
     Context ctx = {
-            .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process)
+        .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
+        .config = config,
     };
     rewrite_module(&ctx.rewriter);
     destroy_rewriter(&ctx.rewriter);
@@ -32,8 +32,32 @@ typedef struct Context_ {
     const Node* fake_private_memory;
     const Node* fake_subgroup_memory;
     const Node* fake_shared_memory;
+
+    /// Maps the (old) emulated global variables to their offset in bytes, in the memory of their address space
+    struct Dict* global_offsets;
 } Context;
 
+/// Accessors are specialised on how aligned their address is known to be, see get_known_alignment
+typedef struct {
+    const Type* element_type;
+    size_t alignment;
+} SerdesKey;
+
+KeyHash hash_node(Node**);
+bool compare_node(Node**, Node**);
+
+static KeyHash hash_serdes_key(SerdesKey* key) {
+    return hash_node((Node**) &key->element_type) ^ (KeyHash) key->alignment;
+}
+
+static bool compare_serdes_key(SerdesKey* a, SerdesKey* b) {
+    return a->element_type == b->element_type && a->alignment == b->alignment;
+}
+
+static size_t minof(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
 static void store_init_data(Context* ctx, AddressSpace as, Nodes collected, BodyBuilder* bb);
 
 // TODO: make this configuration-dependant
@@ -56,20 +80,183 @@ static const Node** get_emulated_as_word_array(Context* ctx, AddressSpace as) {
     }
 }
 
-static const Node* gen_deserialisation(Context* ctx, BodyBuilder* bb, const Type* element_type, const Node* arr, const Node* base_offset) {
+/// Private memory can be backed by words wider than the addressable ones, see CompilerConfig.lower
+/// Other address spaces are shared between invocations, where sub-word stores would race with their neighbours.
+static size_t get_words_per_backing_word(Context* ctx, AddressSpace as) {
+    if (as != AsPrivatePhysical)
+        return 1;
+    return get_private_memory_words_per_backing_word(ctx->config, ctx->rewriter.dst_arena);
+}
+
+static const Type* get_backing_word_type(Context* ctx, AddressSpace as) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    size_t backing_word_size = int_size_in_bytes(a->config.memory.word_size) * get_words_per_backing_word(ctx, as);
+    IntSizes width = a->config.memory.word_size;
+    while (int_size_in_bytes(width) < backing_word_size)
+        width++;
+    return int_type(a, (Int) { .width = width, .is_signed = false });
+}
+
+static AddressSpace get_arr_address_space(const Node* arr) {
+    const Type* arr_t = arr->type;
+    deconstruct_qualified_type(&arr_t);
+    assert(arr_t->tag == PtrType_TAG);
+    switch (arr_t->payload.ptr_type.address_space) {
+        case AsPrivateLogical: return AsPrivatePhysical;
+        case AsSubgroupLogical: return AsSubgroupPhysical;
+        case AsSharedLogical: return AsSharedPhysical;
+        default: error("not an emulated memory array");
+    }
+}
+
+static const Node* gen_backing_word_ptr(BodyBuilder* bb, const Node* arr, const Node* index) {
+    IrArena* a = arr->arena;
+    return gen_primop_ce(bb, lea_op, 3, (const Node* []) { arr, size_t_literal(a, 0), index });
+}
+
+/// Shift (in bits) needed to get to the addressable word at `offset` inside the backing word containing it
+static const Node* gen_sub_word_shift(BodyBuilder* bb, const Node* offset, size_t k) {
+    IrArena* a = offset->arena;
+    const Node* sub = gen_primop_e(bb, mod_op, empty(a), mk_nodes(a, offset, size_t_literal(a, k)));
+    return gen_primop_e(bb, mul_op, empty(a), mk_nodes(a, sub, size_t_literal(a, int_size_in_bytes(a->config.memory.word_size) * 8)));
+}
+
+static const Node* gen_load_addressable_word(BodyBuilder* bb, const Node* arr, const Node* offset, size_t k) {
+    IrArena* a = arr->arena;
+    const Type* word_t = int_type(a, (Int) { .width = a->config.memory.word_size, .is_signed = false });
+    const Node* index = gen_primop_e(bb, div_op, empty(a), mk_nodes(a, offset, size_t_literal(a, k)));
+    const Node* backing_word = gen_load(bb, gen_backing_word_ptr(bb, arr, index));
+    backing_word = gen_primop_e(bb, rshift_logical_op, empty(a), mk_nodes(a, backing_word, gen_sub_word_shift(bb, offset, k)));
+    return gen_conversion(bb, word_t, backing_word);
+}
+
+static const Node* gen_all_ones(IrArena* a, IntSizes width) {
+    uint64_t value = width == IntTy64 ? UINT64_MAX : (UINT64_C(1) << (int_size_in_bytes(width) * 8)) - 1;
+    return int_literal(a, (IntLiteral) { .width = width, .is_signed = false, .value = value });
+}
+
+/// Overwrites `bits_count` bits at `shift` in the backing word at `index`, preserving the rest of it
+static void gen_store_bits(BodyBuilder* bb, const Node* arr, const Node* index, const Node* shift, size_t bits_count, const Node* value) {
+    IrArena* a = arr->arena;
+    const Node* ptr = gen_backing_word_ptr(bb, arr, index);
+    const Type* backing_t = get_pointer_type_element(get_unqualified_type(ptr->type));
+    IntSizes backing_width = backing_t->payload.int_type.width;
+    assert(bits_count < int_size_in_bytes(backing_width) * 8);
+    const Node* mask = int_literal(a, (IntLiteral) { .width = backing_width, .is_signed = false, .value = (UINT64_C(1) << bits_count) - 1 });
+    mask = gen_primop_e(bb, lshift_op, empty(a), mk_nodes(a, mask, shift));
+    const Node* kept_mask = gen_primop_e(bb, xor_op, empty(a), mk_nodes(a, mask, gen_all_ones(a, backing_width)));
+    const Node* old_word = gen_load(bb, ptr);
+    const Node* kept = gen_primop_e(bb, and_op, empty(a), mk_nodes(a, old_word, kept_mask));
+    const Node* inserted = gen_primop_e(bb, lshift_op, empty(a), mk_nodes(a, gen_conversion(bb, backing_t, value), shift));
+    gen_store(bb, ptr, gen_primop_e(bb, or_op, empty(a), mk_nodes(a, kept, inserted)));
+}
+
+static void gen_store_addressable_word(BodyBuilder* bb, const Node* arr, const Node* offset, size_t k, const Node* word) {
+    IrArena* a = arr->arena;
+    const Node* index = gen_primop_e(bb, div_op, empty(a), mk_nodes(a, offset, size_t_literal(a, k)));
+    gen_store_bits(bb, arr, index, gen_sub_word_shift(bb, offset, k), int_size_in_bytes(a->config.memory.word_size) * 8, word);
+}
+
+static size_t get_int_size_in_words(IrArena* a, IntSizes width) {
+    size_t words = int_size_in_bytes(width) / int_size_in_bytes(a->config.memory.word_size);
+    return words > 0 ? words : 1;
+}
+
+/// Alignment of an address that is `offset` bytes past one aligned to `alignment`
+static size_t get_offset_alignment(size_t alignment, size_t offset) {
+    size_t offset_alignment = 1;
+    while (offset_alignment < alignment && offset % (offset_alignment * 2) == 0)
+        offset_alignment *= 2;
+    return offset_alignment;
+}
+
+/// Loads an unsigned integer from memory backed by words that are `k` times wider than the addressable ones.
+/// Whole backing words are only used when `alignment` (in bytes) guarantees the access won't straddle them.
+static const Node* gen_deserialise_int_wide(BodyBuilder* bb, const Type* uint_t, const Node* arr, const Node* offset, size_t k, size_t alignment) {
+    IrArena* a = arr->arena;
+    size_t word_bits = int_size_in_bytes(a->config.memory.word_size) * 8;
+    size_t words = get_int_size_in_words(a, uint_t->payload.int_type.width);
+    size_t alignment_in_words = alignment / int_size_in_bytes(a->config.memory.word_size);
+
+    if (alignment_in_words < (words < k ? words : k)) {
+        const Node* narrow = int_literal(a, (IntLiteral) { .width = uint_t->payload.int_type.width, .is_signed = false, .value = 0 });
+        for (size_t i = 0; i < words; i++) {
+            const Node* word_offset = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, offset, size_t_literal(a, i)));
+            const Node* word = gen_conversion(bb, uint_t, gen_load_addressable_word(bb, arr, word_offset, k));
+            word = gen_primop_e(bb, lshift_op, empty(a), mk_nodes(a, word, size_t_literal(a, i * word_bits)));
+            narrow = gen_primop_e(bb, or_op, empty(a), mk_nodes(a, narrow, word));
+        }
+        return narrow;
+    }
+
+    const Node* index = gen_primop_e(bb, div_op, empty(a), mk_nodes(a, offset, size_t_literal(a, k)));
+    if (words <= k) {
+        const Node* backing_word = gen_load(bb, gen_backing_word_ptr(bb, arr, index));
+        backing_word = gen_primop_e(bb, rshift_logical_op, empty(a), mk_nodes(a, backing_word, gen_sub_word_shift(bb, offset, k)));
+        return gen_conversion(bb, uint_t, backing_word);
+    }
+    const Node* wide = int_literal(a, (IntLiteral) { .width = uint_t->payload.int_type.width, .is_signed = false, .value = 0 });
+    for (size_t i = 0; i < words / k; i++) {
+        const Node* backing_index = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, index, size_t_literal(a, i)));
+        const Node* backing_word = gen_conversion(bb, uint_t, gen_load(bb, gen_backing_word_ptr(bb, arr, backing_index)));
+        backing_word = gen_primop_e(bb, lshift_op, empty(a), mk_nodes(a, backing_word, size_t_literal(a, i * k * word_bits)));
+        wide = gen_primop_e(bb, or_op, empty(a), mk_nodes(a, wide, backing_word));
+    }
+    return wide;
+}
+
+/// Stores an unsigned integer to memory backed by words that are `k` times wider than the addressable ones, see gen_deserialise_int_wide
+static void gen_serialise_int_wide(BodyBuilder* bb, const Node* arr, const Node* offset, size_t k, size_t alignment, const Node* value) {
+    IrArena* a = arr->arena;
+    const Type* uint_t = get_unqualified_type(value->type);
+    const Type* backing_t = get_pointer_type_element(get_unqualified_type(gen_backing_word_ptr(bb, arr, size_t_literal(a, 0))->type));
+    size_t word_bits = int_size_in_bytes(a->config.memory.word_size) * 8;
+    size_t words = get_int_size_in_words(a, uint_t->payload.int_type.width);
+    size_t alignment_in_words = alignment / int_size_in_bytes(a->config.memory.word_size);
+
+    if (alignment_in_words < (words < k ? words : k)) {
+        const Type* word_t = int_type(a, (Int) { .width = a->config.memory.word_size, .is_signed = false });
+        for (size_t i = 0; i < words; i++) {
+            const Node* word_offset = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, offset, size_t_literal(a, i)));
+            const Node* word = gen_primop_e(bb, rshift_logical_op, empty(a), mk_nodes(a, value, size_t_literal(a, i * word_bits)));
+            gen_store_addressable_word(bb, arr, word_offset, k, gen_conversion(bb, word_t, word));
+        }
+        return;
+    }
+
+    const Node* index = gen_primop_e(bb, div_op, empty(a), mk_nodes(a, offset, size_t_literal(a, k)));
+    if (words < k) {
+        gen_store_bits(bb, arr, index, gen_sub_word_shift(bb, offset, k), words * word_bits, value);
+        return;
+    }
+    for (size_t i = 0; i < words / k; i++) {
+        const Node* backing_index = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, index, size_t_literal(a, i)));
+        const Node* backing_word = gen_primop_e(bb, rshift_logical_op, empty(a), mk_nodes(a, value, size_t_literal(a, i * k * word_bits)));
+        gen_store(bb, gen_backing_word_ptr(bb, arr, backing_index), gen_conversion(bb, backing_t, backing_word));
+    }
+}
+
+/// `alignment` is what the address (in bytes) of the data is statically known to be a multiple of
+static const Node* gen_deserialisation(Context* ctx, BodyBuilder* bb, const Type* element_type, const Node* arr, const Node* base_offset, size_t alignment) {
     IrArena* a = ctx->rewriter.dst_arena;
     const CompilerConfig* config = ctx->config;
     const Node* zero = size_t_literal(a, 0);
     switch (element_type->tag) {
         case Bool_TAG: {
-            const Node* logical_ptr = gen_primop_ce(bb, lea_op, 3, (const Node* []) { arr, zero, base_offset });
-            const Node* value = gen_load(bb, logical_ptr);
+            size_t k = get_words_per_backing_word(ctx, get_arr_address_space(arr));
+            const Node* value;
+            if (k > 1) {
+                value = gen_load_addressable_word(bb, arr, base_offset, k);
+            } else {
+                const Node* logical_ptr = gen_primop_ce(bb, lea_op, 3, (const Node* []) { arr, zero, base_offset });
+                value = gen_load(bb, logical_ptr);
+            }
             return gen_primop_ce(bb, neq_op, 2, (const Node*[]) {value, int_literal(a, (IntLiteral) { .value = 0, .width = a->config.memory.word_size })});
         }
         case PtrType_TAG: switch (element_type->payload.ptr_type.address_space) {
             case AsGlobalPhysical: {
                 const Type* ptr_int_t = int_type(a, (Int) {.width = a->config.memory.ptr_size, .is_signed = false });
-                const Node* unsigned_int = gen_deserialisation(ctx, bb, ptr_int_t, arr, base_offset);
+                const Node* unsigned_int = gen_deserialisation(ctx, bb, ptr_int_t, arr, base_offset, alignment);
                 return gen_reinterpret_cast(bb, element_type, unsigned_int);
             }
             default: error("TODO")
@@ -79,17 +266,22 @@ static const Node* gen_deserialisation(Context* ctx, BodyBuilder* bb, const Type
             const Node* acc = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = 0 });
             size_t length_in_bytes = int_size_in_bytes(element_type->payload.int_type.width);
             size_t word_size_in_bytes = int_size_in_bytes(a->config.memory.word_size);
-            const Node* offset = base_offset;
-            const Node* shift = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = 0 });
-            const Node* word_bitwidth = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = word_size_in_bytes * 8 });
-            for (size_t byte = 0; byte < length_in_bytes; byte += word_size_in_bytes) {
-                const Node* word = gen_load(bb, gen_primop_ce(bb, lea_op, 3, (const Node* []) {arr, zero, offset}));
-                            word = gen_conversion(bb, int_type(a, (Int) { .width = element_type->payload.int_type.width, .is_signed = false }), word); // widen/truncate the word we just loaded
-                            word = first(gen_primop(bb, lshift_op, empty(a), mk_nodes(a, word, shift))); // shift it
-                acc = gen_primop_e(bb, or_op, empty(a), mk_nodes(a, acc, word));
-
-                offset = first(gen_primop(bb, add_op, empty(a), mk_nodes(a, offset, size_t_literal(a, 1))));
-                shift = first(gen_primop(bb, add_op, empty(a), mk_nodes(a, shift, word_bitwidth)));
+            size_t k = get_words_per_backing_word(ctx, get_arr_address_space(arr));
+            if (k > 1) {
+                acc = gen_deserialise_int_wide(bb, int_type(a, (Int) { .width = element_type->payload.int_type.width, .is_signed = false }), arr, base_offset, k, alignment);
+            } else {
+                const Node* offset = base_offset;
+                const Node* shift = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = 0 });
+                const Node* word_bitwidth = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = word_size_in_bytes * 8 });
+                for (size_t byte = 0; byte < length_in_bytes; byte += word_size_in_bytes) {
+                    const Node* word = gen_load(bb, gen_primop_ce(bb, lea_op, 3, (const Node* []) {arr, zero, offset}));
+                                word = gen_conversion(bb, int_type(a, (Int) { .width = element_type->payload.int_type.width, .is_signed = false }), word); // widen/truncate the word we just loaded
+                                word = first(gen_primop(bb, lshift_op, empty(a), mk_nodes(a, word, shift))); // shift it
+                    acc = gen_primop_e(bb, or_op, empty(a), mk_nodes(a, acc, word));
+
+                    offset = first(gen_primop(bb, add_op, empty(a), mk_nodes(a, offset, size_t_literal(a, 1))));
+                    shift = first(gen_primop(bb, add_op, empty(a), mk_nodes(a, shift, word_bitwidth)));
+                }
             }
             if (config->printf_trace.memory_accesses) {
                 AddressSpace as = get_unqualified_type(arr->type)->payload.ptr_type.address_space;
@@ -104,7 +296,7 @@ static const Node* gen_deserialisation(Context* ctx, BodyBuilder* bb, const Type
         }
         case Float_TAG: {
             const Type* unsigned_int_t = int_type(a, (Int) {.width = float_to_int_width(element_type->payload.float_type.width), .is_signed = false });
-            const Node* unsigned_int = gen_deserialisation(ctx, bb, unsigned_int_t, arr, base_offset);
+            const Node* unsigned_int = gen_deserialisation(ctx, bb, unsigned_int_t, arr, base_offset, alignment);
             return gen_reinterpret_cast(bb, element_type, unsigned_int);
         }
         case TypeDeclRef_TAG:
@@ -114,11 +306,13 @@ static const Node* gen_deserialisation(Context* ctx, BodyBuilder* bb, const Type
 
             Nodes member_types = compound_type->payload.record_type.members;
             LARRAY(const Node*, loaded, member_types.count);
+            LARRAY(FieldLayout, fields, member_types.count);
+            get_record_layout(a, compound_type, fields);
             for (size_t i = 0; i < member_types.count; i++) {
                 const Node* field_offset = gen_primop_e(bb, offset_of_op, singleton(element_type), singleton(size_t_literal(a, i)));
                             field_offset = bytes_to_words(bb, field_offset);
                 const Node* adjusted_offset = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, base_offset, field_offset));
-                loaded[i] = gen_deserialisation(ctx, bb, member_types.nodes[i], arr, adjusted_offset);
+                loaded[i] = gen_deserialisation(ctx, bb, member_types.nodes[i], arr, adjusted_offset, get_offset_alignment(alignment, fields[i].offset_in_bytes));
             }
             return composite_helper(a, element_type, nodes(a, member_types.count, loaded));
         }
@@ -134,8 +328,9 @@ static const Node* gen_deserialisation(Context* ctx, BodyBuilder* bb, const Type
             const Type* component_type = get_fill_type_element_type(element_type);
             LARRAY(const Node*, components, components_count);
             const Node* offset = base_offset;
+            size_t component_size = get_mem_layout(a, component_type).size_in_bytes;
             for (size_t i = 0; i < components_count; i++) {
-                components[i] = gen_deserialisation(ctx, bb, component_type, arr, offset);
+                components[i] = gen_deserialisation(ctx, bb, component_type, arr, offset, get_offset_alignment(alignment, i * component_size));
                 offset = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, offset, gen_primop_e(bb, size_of_op, singleton(component_type), empty(a))));
             }
             return composite_helper(a, element_type, nodes(a, components_count, components));
@@ -144,7 +339,7 @@ static const Node* gen_deserialisation(Context* ctx, BodyBuilder* bb, const Type
     }
 }
 
-static void gen_serialisation(Context* ctx, BodyBuilder* bb, const Type* element_type, const Node* arr, const Node* base_offset, const Node* value) {
+static void gen_serialisation(Context* ctx, BodyBuilder* bb, const Type* element_type, const Node* arr, const Node* base_offset, size_t alignment, const Node* value) {
     IrArena* a = ctx->rewriter.dst_arena;
     const CompilerConfig* config = ctx->config;
     const Node* zero = size_t_literal(a, 0);
@@ -154,6 +349,11 @@ static void gen_serialisation(Context* ctx, BodyBuilder* bb, const Type* element
             const Node* zero_b = int_literal(a, (IntLiteral) { .value = 1, .width = a->config.memory.word_size });
             const Node* one_b =  int_literal(a, (IntLiteral) { .value = 0, .width = a->config.memory.word_size });
             const Node* int_value = gen_primop_ce(bb, select_op, 3, (const Node*[]) { value, one_b, zero_b });
+            size_t k = get_words_per_backing_word(ctx, get_arr_address_space(arr));
+            if (k > 1) {
+                gen_store_addressable_word(bb, arr, base_offset, k, int_value);
+                return;
+            }
             gen_store(bb, logical_ptr, int_value);
             return;
         }
@@ -161,7 +361,7 @@ static void gen_serialisation(Context* ctx, BodyBuilder* bb, const Type* element
             case AsGlobalPhysical: {
                 const Type* ptr_int_t = int_type(a, (Int) {.width = a->config.memory.ptr_size, .is_signed = false });
                 const Node* unsigned_value = gen_primop_e(bb, reinterpret_op, singleton(ptr_int_t), singleton(value));
-                return gen_serialisation(ctx, bb, ptr_int_t, arr, base_offset, unsigned_value);
+                return gen_serialisation(ctx, bb, ptr_int_t, arr, base_offset, alignment, unsigned_value);
             }
             default: error("TODO")
         }
@@ -174,26 +374,31 @@ static void gen_serialisation(Context* ctx, BodyBuilder* bb, const Type* element
             // const Node* acc = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = 0 });
             size_t length_in_bytes = int_size_in_bytes(element_type->payload.int_type.width);
             size_t word_size_in_bytes = int_size_in_bytes(a->config.memory.word_size);
-            const Node* offset = base_offset;
-            const Node* shift = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = 0 });
-            const Node* word_bitwidth = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = word_size_in_bytes * 8 });
-            for (size_t byte = 0; byte < length_in_bytes; byte += word_size_in_bytes) {
-                bool is_last_word = byte + word_size_in_bytes >= length_in_bytes;
-                /*bool needs_patch = is_last_word && word_size_in_bytes < length_in_bytes;
-                const Node* original_word = NULL;
-                if (needs_patch) {
-                    original_word = gen_load(bb, gen_primop_ce(bb, lea_op, 3, (const Node* []) {arr, zero, offset}));
-                    error_print("TODO");
-                    error_die();
-                    // word = gen_conversion(bb, int_type(a, (Int) { .width = element_type->payload.int_type.width, .is_signed = false }), word); // widen/truncate the word we just loaded
-                }*/
-                const Node* word = value;
-                word = first(gen_primop(bb, rshift_logical_op, empty(a), mk_nodes(a, word, shift))); // shift it
-                word = gen_conversion(bb, int_type(a, (Int) { .width = a->config.memory.word_size, .is_signed = false }), word); // widen/truncate the word we want to store
-                gen_store(bb, gen_primop_ce(bb, lea_op, 3, (const Node* []) {arr, zero, offset}), word);
-
-                offset = first(gen_primop(bb, add_op, empty(a), mk_nodes(a, offset, size_t_literal(a, 1))));
-                shift = first(gen_primop(bb, add_op, empty(a), mk_nodes(a, shift, word_bitwidth)));
+            size_t k = get_words_per_backing_word(ctx, get_arr_address_space(arr));
+            if (k > 1) {
+                gen_serialise_int_wide(bb, arr, base_offset, k, alignment, value);
+            } else {
+                const Node* offset = base_offset;
+                const Node* shift = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = 0 });
+                const Node* word_bitwidth = int_literal(a, (IntLiteral) { .width = element_type->payload.int_type.width, .is_signed = false, .value = word_size_in_bytes * 8 });
+                for (size_t byte = 0; byte < length_in_bytes; byte += word_size_in_bytes) {
+                    bool is_last_word = byte + word_size_in_bytes >= length_in_bytes;
+                    /*bool needs_patch = is_last_word && word_size_in_bytes < length_in_bytes;
+                    const Node* original_word = NULL;
+                    if (needs_patch) {
+                        original_word = gen_load(bb, gen_primop_ce(bb, lea_op, 3, (const Node* []) {arr, zero, offset}));
+                        error_print("TODO");
+                        error_die();
+                        // word = gen_conversion(bb, int_type(a, (Int) { .width = element_type->payload.int_type.width, .is_signed = false }), word); // widen/truncate the word we just loaded
+                    }*/
+                    const Node* word = value;
+                    word = first(gen_primop(bb, rshift_logical_op, empty(a), mk_nodes(a, word, shift))); // shift it
+                    word = gen_conversion(bb, int_type(a, (Int) { .width = a->config.memory.word_size, .is_signed = false }), word); // widen/truncate the word we want to store
+                    gen_store(bb, gen_primop_ce(bb, lea_op, 3, (const Node* []) {arr, zero, offset}), word);
+
+                    offset = first(gen_primop(bb, add_op, empty(a), mk_nodes(a, offset, size_t_literal(a, 1))));
+                    shift = first(gen_primop(bb, add_op, empty(a), mk_nodes(a, shift, word_bitwidth)));
+                }
             }
             if (config->printf_trace.memory_accesses) {
                 AddressSpace as = get_unqualified_type(arr->type)->payload.ptr_type.address_space;
@@ -208,23 +413,25 @@ static void gen_serialisation(Context* ctx, BodyBuilder* bb, const Type* element
         case Float_TAG: {
             const Type* unsigned_int_t = int_type(a, (Int) {.width = float_to_int_width(element_type->payload.float_type.width), .is_signed = false });
             const Node* unsigned_value = gen_primop_e(bb, reinterpret_op, singleton(unsigned_int_t), singleton(value));
-            return gen_serialisation(ctx, bb, unsigned_int_t, arr, base_offset, unsigned_value);
+            return gen_serialisation(ctx, bb, unsigned_int_t, arr, base_offset, alignment, unsigned_value);
         }
         case RecordType_TAG: {
             Nodes member_types = element_type->payload.record_type.members;
+            LARRAY(FieldLayout, fields, member_types.count);
+            get_record_layout(a, element_type, fields);
             for (size_t i = 0; i < member_types.count; i++) {
                 const Node* extracted_value = first(bind_instruction(bb, prim_op(a, (PrimOp) { .op = extract_op, .operands = mk_nodes(a, value, int32_literal(a, i)), .type_arguments = empty(a) })));
                 const Node* field_offset = gen_primop_e(bb, offset_of_op, singleton(element_type), singleton(size_t_literal(a, i)));
                             field_offset = bytes_to_words(bb, field_offset);
                 const Node* adjusted_offset = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, base_offset, field_offset));
-                gen_serialisation(ctx, bb, member_types.nodes[i], arr, adjusted_offset, extracted_value);
+                gen_serialisation(ctx, bb, member_types.nodes[i], arr, adjusted_offset, get_offset_alignment(alignment, fields[i].offset_in_bytes), extracted_value);
             }
             return;
         }
         case TypeDeclRef_TAG: {
             const Node* nom = element_type->payload.type_decl_ref.decl;
             assert(nom && nom->tag == NominalType_TAG);
-            gen_serialisation(ctx, bb, nom->payload.nom_type.body, arr, base_offset, value);
+            gen_serialisation(ctx, bb, nom->payload.nom_type.body, arr, base_offset, alignment, value);
             return;
         }
         case ArrType_TAG:
@@ -238,8 +445,9 @@ static void gen_serialisation(Context* ctx, BodyBuilder* bb, const Type* element
             size_t components_count = get_int_literal_value(*resolve_to_int_literal(size), 0);
             const Type* component_type = get_fill_type_element_type(element_type);
             const Node* offset = base_offset;
+            size_t component_size = get_mem_layout(a, component_type).size_in_bytes;
             for (size_t i = 0; i < components_count; i++) {
-                gen_serialisation(ctx, bb, component_type, arr, offset, gen_extract(bb, value, singleton(int32_literal(a, i))));
+                gen_serialisation(ctx, bb, component_type, arr, offset, get_offset_alignment(alignment, i * component_size), gen_extract(bb, value, singleton(int32_literal(a, i))));
                 offset = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, offset, gen_primop_e(bb, size_of_op, singleton(component_type), empty(a))));
             }
             return;
@@ -248,7 +456,7 @@ static void gen_serialisation(Context* ctx, BodyBuilder* bb, const Type* element
     }
 }
 
-static const Node* gen_serdes_fn(Context* ctx, const Type* element_type, bool uniform_address, bool ser, AddressSpace as) {
+static const Node* gen_serdes_fn(Context* ctx, const Type* element_type, size_t alignment, bool uniform_address, bool ser, AddressSpace as) {
     assert(is_as_emulated(ctx, as));
     struct Dict* cache;
 
@@ -257,7 +465,8 @@ static const Node* gen_serdes_fn(Context* ctx, const Type* element_type, bool un
     else
         cache = ser ? ctx->serialisation_varying[as] : ctx->deserialisation_varying[as];
 
-    const Node** found = find_value_dict(const Node*, const Node*, cache, element_type);
+    SerdesKey key = { .element_type = element_type, .alignment = alignment };
+    const Node** found = find_value_dict(SerdesKey, const Node*, cache, key);
     if (found)
         return *found;
 
@@ -274,23 +483,85 @@ static const Node* gen_serdes_fn(Context* ctx, const Type* element_type, bool un
     Nodes return_ts = ser ? empty(a) : singleton(return_value_t);
 
     String name = format_string_arena(a->arena, "generated_%s_%s_%s_%s", ser ? "store" : "load", get_address_space_name(as), uniform_address ? "uniform" : "varying", name_type_safe(a, element_type));
+    if (alignment > int_size_in_bytes(a->config.memory.word_size))
+        name = format_string_arena(a->arena, "%s_aligned%zu", name, alignment);
     Node* fun = function(ctx->rewriter.dst_module, params, name, singleton(annotation(a, (Annotation) { .name = "Generated" })), return_ts);
-    insert_dict(const Node*, Node*, cache, element_type, fun);
+    insert_dict(SerdesKey, Node*, cache, key, fun);
 
     BodyBuilder* bb = begin_body(a);
     const Node* address = bytes_to_words(bb, address_param);
     const Node* base = *get_emulated_as_word_array(ctx, as);
     if (ser) {
-        gen_serialisation(ctx, bb, element_type, base, address, value_param);
+        gen_serialisation(ctx, bb, element_type, base, address, alignment, value_param);
         fun->payload.fun.body = finish_body(bb, fn_ret(a, (Return) { .fn = fun, .args = empty(a) }));
     } else {
-        const Node* loaded_value = gen_deserialisation(ctx, bb, element_type, base, address);
+        const Node* loaded_value = gen_deserialisation(ctx, bb, element_type, base, address, alignment);
         assert(loaded_value);
         fun->payload.fun.body = finish_body(bb, fn_ret(a, (Return) { .fn = fun, .args = singleton(loaded_value) }));
     }
     return fun;
 }
 
+/// Conservatively figures out what an (old) address is a multiple of, in bytes, up to `cap`.
+/// Stack addresses are built on top of the stack pointer, which lower_stack annotates with the alignment it keeps it at.
+static size_t get_known_alignment(Context* ctx, const Node* old, size_t cap) {
+    IrArena* oa = ctx->rewriter.src_arena;
+    NodeResolveConfig config = default_node_resolve_config();
+    config.enter_loads = false;
+    old = resolve_node_to_definition(old, config);
+    switch (old->tag) {
+        case IntLiteral_TAG: return get_offset_alignment(cap, get_int_literal_value(old->payload.int_literal, false));
+        case GlobalVariable_TAG: {
+            size_t* found = find_value_dict(const Node*, size_t, ctx->global_offsets, old);
+            return found ? get_offset_alignment(cap, *found) : 1;
+        }
+        case PrimOp_TAG: {
+            Nodes ops = old->payload.prim_op.operands;
+            Nodes type_args = old->payload.prim_op.type_arguments;
+            switch (old->payload.prim_op.op) {
+                case convert_op:
+                case reinterpret_op: return get_known_alignment(ctx, first(ops), cap);
+                case add_op:
+                case sub_op: return minof(get_known_alignment(ctx, ops.nodes[0], cap), get_known_alignment(ctx, ops.nodes[1], cap));
+                case mul_op: return minof(get_known_alignment(ctx, ops.nodes[0], cap) * get_known_alignment(ctx, ops.nodes[1], cap), cap);
+                case select_op: return minof(get_known_alignment(ctx, ops.nodes[1], cap), get_known_alignment(ctx, ops.nodes[2], cap));
+                case size_of_op: return get_offset_alignment(cap, get_mem_layout(oa, first(type_args)).size_in_bytes);
+                case offset_of_op: {
+                    const Type* record_t = get_maybe_nominal_type_body(first(type_args));
+                    const IntLiteral* index = resolve_to_int_literal(first(ops));
+                    if (record_t->tag != RecordType_TAG || !index)
+                        break;
+                    LARRAY(FieldLayout, fields, record_t->payload.record_type.members.count);
+                    get_record_layout(oa, record_t, fields);
+                    return get_offset_alignment(cap, fields[get_int_literal_value(*index, false)].offset_in_bytes);
+                }
+                case load_op: {
+                    const Node* src = resolve_node_to_definition(first(ops), config);
+                    const Node* annotation = src->tag == GlobalVariable_TAG ? lookup_annotation(src, "Alignment") : NULL;
+                    const IntLiteral* alignment = annotation ? resolve_to_int_literal(get_annotation_value(annotation)) : NULL;
+                    if (alignment)
+                        return minof(get_int_literal_value(*alignment, false), cap);
+                    break;
+                }
+                default: break;
+            }
+            break;
+        }
+        default: break;
+    }
+    return 1;
+}
+
+/// Picks the alignment accesses through `old_ptr` get specialised for, between one addressable and one backing word.
+/// Anything past the natural alignment of `element_type` can't make its accesses any wider.
+static size_t get_access_alignment(Context* ctx, AddressSpace as, const Type* element_type, const Node* old_ptr) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    size_t word_size = int_size_in_bytes(a->config.memory.word_size);
+    size_t cap = minof(word_size * get_words_per_backing_word(ctx, as), get_mem_layout(a, element_type).alignment_in_bytes);
+    size_t alignment = get_known_alignment(ctx, old_ptr, cap);
+    return alignment > word_size ? alignment : word_size;
+}
+
 static const Node* process_node(Context* ctx, const Node* old) {
     const Node* found = search_processed(&ctx->rewriter, old);
     if (found) return found;
@@ -316,7 +587,8 @@ static const Node* process_node(Context* ctx, const Node* old) {
 
                     const Type* element_type = rewrite_node(&ctx->rewriter, ptr_type->payload.ptr_type.pointed_type);
                     const Node* pointer_as_offset = rewrite_node(&ctx->rewriter, old_ptr);
-                    const Node* fn = gen_serdes_fn(ctx, element_type, uniform_ptr, oprim_op->op == store_op, ptr_type->payload.ptr_type.address_space);
+                    AddressSpace as = ptr_type->payload.ptr_type.address_space;
+                    const Node* fn = gen_serdes_fn(ctx, element_type, get_access_alignment(ctx, as, element_type, old_ptr), uniform_ptr, oprim_op->op == store_op, as);
 
                     if (oprim_op->op == load_op) {
                         Nodes r = bind_instruction(bb, call(a, (Call) {.callee = fn_addr_helper(a, fn), .args = singleton(pointer_as_offset)}));
@@ -369,9 +641,6 @@ static const Node* process_node(Context* ctx, const Node* old) {
     return recreate_node_identity(&ctx->rewriter, old);
 }
 
-KeyHash hash_node(Node**);
-bool compare_node(Node**, Node**);
-
 static Nodes collect_globals(Context* ctx, AddressSpace as) {
     IrArena* a = ctx->rewriter.dst_arena;
     Nodes old_decls = get_module_declarations(ctx->rewriter.src_module);
@@ -451,7 +720,7 @@ static void construct_emulated_memory_array(Context* ctx, AddressSpace as, Addre
     Module* m = ctx->rewriter.dst_module;
     String as_name = get_address_space_name(as);
 
-    const Type* word_type = int_type(a, (Int) { .width = a->config.memory.word_size, .is_signed = false });
+    const Type* word_type = get_backing_word_type(ctx, as);
     const Type* ptr_size_type = int_type(a, (Int) { .width = a->config.memory.ptr_size, .is_signed = false });
 
     ctx->collected[as] = collect_globals(ctx, as);
@@ -465,13 +734,19 @@ static void construct_emulated_memory_array(Context* ctx, AddressSpace as, Addre
     }
 
     const Node* global_struct_t = make_record_type(ctx, as, ctx->collected[as]);
+    LARRAY(FieldLayout, fields, ctx->collected[as].count);
+    get_record_layout(a, global_struct_t->payload.nom_type.body, fields);
+    for (size_t i = 0; i < ctx->collected[as].count; i++)
+        insert_dict(const Node*, size_t, ctx->global_offsets, ctx->collected[as].nodes[i], fields[i].offset_in_bytes);
 
     Nodes annotations = singleton(annotation(a, (Annotation) { .name = "Generated" }));
 
     // compute the size
     BodyBuilder* bb = begin_body(a);
     const Node* size_of = gen_primop_e(bb, size_of_op, singleton(type_decl_ref(a, (TypeDeclRef) { .decl = global_struct_t })), empty(a));
-    const Node* size_in_words = bytes_to_words(bb, size_of);
+    const Node* size_in_words = bytes_to_words(bb, gen_align_up(bb, size_of, int_size_in_bytes(a->config.memory.word_size) * get_words_per_backing_word(ctx, as)));
+    if (get_words_per_backing_word(ctx, as) > 1)
+        size_in_words = gen_primop_e(bb, div_op, empty(a), mk_nodes(a, size_in_words, size_t_literal(a, get_words_per_backing_word(ctx, as))));
 
     Node* constant_decl = constant(m, annotations, ptr_size_type, format_string_interned(a, "globals_physical_%s_size", as_name));
     constant_decl->payload.constant.instruction = yield_values_and_wrap_in_block(bb, singleton(size_in_words));
@@ -494,6 +769,7 @@ Module* lower_physical_ptrs(const CompilerConfig* config, Module* src) {
     Context ctx = {
         .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process_node),
         .config = config,
+        .global_offsets = new_dict(const Node*, size_t, (HashFn) hash_node, (CmpFn) compare_node),
     };
 
     construct_emulated_memory_array(&ctx, AsPrivatePhysical, AsPrivateLogical);
@@ -504,15 +780,16 @@ Module* lower_physical_ptrs(const CompilerConfig* config, Module* src) {
 
     for (size_t i = 0; i < NumAddressSpaces; i++) {
         if (is_as_emulated(&ctx, i)) {
-            ctx.serialisation_varying[i] = new_dict(const Node*, Node*, (HashFn) hash_node, (CmpFn) compare_node);
-            ctx.deserialisation_varying[i] = new_dict(const Node*, Node*, (HashFn) hash_node, (CmpFn) compare_node);
-            ctx.serialisation_uniform[i] = new_dict(const Node*, Node*, (HashFn) hash_node, (CmpFn) compare_node);
-            ctx.deserialisation_uniform[i] = new_dict(const Node*, Node*, (HashFn) hash_node, (CmpFn) compare_node);
+            ctx.serialisation_varying[i] = new_dict(SerdesKey, Node*, (HashFn) hash_serdes_key, (CmpFn) compare_serdes_key);
+            ctx.deserialisation_varying[i] = new_dict(SerdesKey, Node*, (HashFn) hash_serdes_key, (CmpFn) compare_serdes_key);
+            ctx.serialisation_uniform[i] = new_dict(SerdesKey, Node*, (HashFn) hash_serdes_key, (CmpFn) compare_serdes_key);
+            ctx.deserialisation_uniform[i] = new_dict(SerdesKey, Node*, (HashFn) hash_serdes_key, (CmpFn) compare_serdes_key);
         }
     }
 
     rewrite_module(&ctx.rewriter);
     destroy_rewriter(&ctx.rewriter);
+    destroy_dict(ctx.global_offsets);
 
     for (size_t i = 0; i < NumAddressSpaces; i++) {
         if (is_as_emulated(&ctx, i)) {
@@ -7,10 +7,14 @@
 #include "util.h"
 
 #include "../rewrite.h"
+#include "../visit.h"
 #include "../type.h"
 #include "../ir_private.h"
 
+#include "../analysis/callgraph.h"
+
 #include "../transform/ir_gen_helpers.h"
+#include "../transform/memory_layout.h"
 
 #include <assert.h>
 #include <string.h>
@@ -49,6 +53,8 @@ static const Node* gen_fn(Context* ctx, const Type* element_type, bool push) {
 
     const Node* element_size = gen_primop_e(bb, size_of_op, singleton(element_type), empty(a));
     element_size = gen_conversion(bb, uint32_type(a), element_size);
+    // keep the stack pointer aligned to the words backing private memory so accesses can use them whole
+    element_size = gen_align_up(bb, element_size, int_size_in_bytes(a->config.memory.word_size) * get_private_memory_words_per_backing_word(ctx->config, a));
 
     // TODO somehow annotate the uniform guys as uniform
     const Node* stack_pointer = ctx->stack_pointer;
@@ -176,25 +182,138 @@ static const Node* process_node(Context* ctx, const Node* old) {
 KeyHash hash_node(Node**);
 bool compare_node(Node**, Node**);
 
+typedef struct {
+    Visitor visitor;
+    size_t usage;
+    bool unbounded;
+} StackUsageVisitor;
+
+static const Node* resolve_stack_pointer_value(const Node* value) {
+    NodeResolveConfig config = default_node_resolve_config();
+    config.enter_loads = false;
+    return resolve_node_to_definition(value, config);
+}
+
+static bool is_get_stack_pointer(const Node* value) {
+    value = resolve_stack_pointer_value(value);
+    return value->tag == PrimOp_TAG && value->payload.prim_op.op == get_stack_pointer_op;
+}
+
+static void search_stack_usage(StackUsageVisitor* v, const Node* node) {
+    if (node->tag == PrimOp_TAG) {
+        switch (node->payload.prim_op.op) {
+            case push_stack_op:
+            case pop_stack_op: v->unbounded = true; break;
+            case set_stack_pointer_op: {
+                // we only understand frames being set up as (saved SP + constant), and torn down by restoring the saved SP
+                const Node* value = first(node->payload.prim_op.operands);
+                if (is_get_stack_pointer(value))
+                    break;
+                value = resolve_stack_pointer_value(value);
+                if (value->tag == PrimOp_TAG && value->payload.prim_op.op == add_op && is_get_stack_pointer(value->payload.prim_op.operands.nodes[0])) {
+                    const IntLiteral* lit = resolve_to_int_literal(value->payload.prim_op.operands.nodes[1]);
+                    if (lit) {
+                        v->usage += get_int_literal_value(*lit, false);
+                        break;
+                    }
+                }
+                v->unbounded = true;
+                break;
+            }
+            default: break;
+        }
+    }
+    visit_node_operands(&v->visitor, IGNORE_ABSTRACTIONS_MASK, node);
+}
+
+/// Peak stack usage of a function and the ones it calls, or SIZE_MAX if that can't be known statically
+static size_t get_max_stack_depth(struct Dict* depths, CGNode* fn_node) {
+    size_t* found = find_value_dict(const Node*, size_t, depths, fn_node->fn);
+    if (found)
+        return *found;
+
+    const Node* fn = fn_node->fn;
+    size_t depth = SIZE_MAX;
+    if (!fn_node->is_recursive && !fn_node->is_address_captured) {
+        StackUsageVisitor v = {
+            .visitor = {
+                .visit_node_fn = (VisitNodeFn) search_stack_usage,
+            },
+        };
+        if (fn->payload.fun.body) {
+            search_stack_usage(&v, fn->payload.fun.body);
+            visit_function_rpo(&v.visitor, fn);
+        }
+
+        size_t callees_depth = 0;
+        size_t iter = 0;
+        CGEdge e;
+        while (!v.unbounded && dict_iter(fn_node->callees, &iter, &e, NULL)) {
+            size_t callee_depth = get_max_stack_depth(depths, e.dst_fn);
+            if (callee_depth == SIZE_MAX)
+                v.unbounded = true;
+            else if (callee_depth > callees_depth)
+                callees_depth = callee_depth;
+        }
+
+        if (!v.unbounded)
+            depth = v.usage + callees_depth;
+    }
+
+    insert_dict(const Node*, size_t, depths, fn, depth);
+    return depth;
+}
+
+/// Computes how deep the stack can get in this module. This is exact when the call graph has no cycles or indirect calls,
+/// and stack usage is limited to fixed-size frames, otherwise SIZE_MAX is returned.
+static size_t compute_max_stack_depth(Module* src) {
+    CallGraph* graph = new_callgraph(src);
+    struct Dict* depths = new_dict(const Node*, size_t, (HashFn) hash_node, (CmpFn) compare_node);
+
+    size_t max_depth = 0;
+    size_t iter = 0;
+    CGNode* fn_node;
+    while (dict_iter(graph->fn2cgn, &iter, NULL, &fn_node)) {
+        size_t depth = get_max_stack_depth(depths, fn_node);
+        if (depth > max_depth)
+            max_depth = depth;
+    }
+
+    destroy_dict(depths);
+    destroy_callgraph(graph);
+    return max_depth;
+}
+
 Module* lower_stack(SHADY_UNUSED const CompilerConfig* config, Module* src) {
     ArenaConfig aconfig = get_arena_config(get_module_arena(src));
     IrArena* a = new_ir_arena(aconfig);
     Module* dst = new_module(a, get_module_name(src));
 
+    // size the stack after what the program actually needs when we can figure that out
+    uint32_t stack_size = config->per_thread_stack_size;
+    size_t max_depth = compute_max_stack_depth(src);
+    if (max_depth != SIZE_MAX) {
+        debug_print("lower_stack: stack depth is bounded to %zu bytes\n", max_depth);
+        stack_size = max_depth > 0 ? max_depth : 1;
+    }
+
     const Type* stack_base_element = uint8_type(a);
     const Type* stack_arr_type = arr_type(a, (ArrType) {
         .element_type = stack_base_element,
-        .size = uint32_literal(a, config->per_thread_stack_size),
+        .size = uint32_literal(a, stack_size),
     });
     const Type* stack_counter_t = uint32_type(a);
 
     Nodes annotations = mk_nodes(a, annotation(a, (Annotation) { .name = "Generated" }));
 
-    // Arrays for the stacks
-    Node* stack_decl = global_var(dst, annotations, stack_arr_type, "stack", AsPrivatePhysical);
+    // Arrays for the stacks, lower_physical_ptrs merges it with the other private globals so we write down its size
+    Nodes stack_annotations = append_nodes(a, annotations, annotation_value(a, (AnnotationValue) { .name = "StackSize", .value = uint32_literal(a, stack_size) }));
+    Node* stack_decl = global_var(dst, stack_annotations, stack_arr_type, "stack", AsPrivatePhysical);
 
-    // Pointers into those arrays
-    Node* stack_ptr_decl = global_var(dst, annotations, stack_counter_t, "stack_ptr", AsPrivateLogical);
+    // Pointers into those arrays, stack frames and pushes keep them aligned to the words backing private memory, see lower_physical_ptrs
+    size_t stack_alignment = int_size_in_bytes(a->config.memory.word_size) * get_private_memory_words_per_backing_word(config, a);
+    Nodes stack_ptr_annotations = append_nodes(a, annotations, annotation_value(a, (AnnotationValue) { .name = "Alignment", .value = uint32_literal(a, stack_alignment) }));
+    Node* stack_ptr_decl = global_var(dst, stack_ptr_annotations, stack_counter_t, "stack_ptr", AsPrivateLogical);
     stack_ptr_decl->payload.global_variable.init = uint32_literal(a, 0);
 
     Context ctx = {
@@ -2,6 +2,7 @@
 
 #include "portability.h"
 #include "log.h"
+#include "list.h"
 
 #include "../rewrite.h"
 #include "../type.h"
@@ -11,6 +12,8 @@
 typedef struct {
     Rewriter rewriter;
     const CompilerConfig* config;
+    /// Subgroup memory used to exchange words between lanes, when the target lacks shuffles
+    const Node* shuffle_table;
 } Context;
 
 static bool is_extended_type(SHADY_UNUSED IrArena* a, const Type* t, bool allow_vectors) {
@@ -26,6 +29,312 @@ static bool is_extended_type(SHADY_UNUSED IrArena* a, const Type* t, bool allow_
     }
 }
 
+static bool is_int32(const Type* t) {
+    return t->tag == Int_TAG && t->payload.int_type.width == IntTy32;
+}
+
+static const Node* gen_reinterpret_if_needed(BodyBuilder* bb, const Type* dst, const Node* src) {
+    if (get_unqualified_type(src->type) == dst)
+        return src;
+    return gen_reinterpret_cast(bb, dst, src);
+}
+
+static const Node* gen_convert_if_needed(BodyBuilder* bb, const Type* dst, const Node* src) {
+    if (get_unqualified_type(src->type) == dst)
+        return src;
+    return gen_conversion(bb, dst, src);
+}
+
+/// Cuts a value of any data type into 32-bit words, so it can travel between lanes in registers.
+static void gen_split_into_words(BodyBuilder* bb, const Node* value, struct List* words) {
+    IrArena* a = value->arena;
+    const Type* t = get_unqualified_type(value->type);
+    switch (t->tag) {
+        case Bool_TAG: {
+            const Node* word = gen_primop_e(bb, select_op, empty(a), mk_nodes(a, value, uint32_literal(a, 1), uint32_literal(a, 0)));
+            append_list(const Node*, words, word);
+            return;
+        }
+        case Int_TAG: {
+            IntSizes width = t->payload.int_type.width;
+            const Node* unsigned_value = gen_reinterpret_if_needed(bb, int_type_helper(a, false, width), value);
+            if (width == IntTy64) {
+                const Node* lo = gen_conversion(bb, uint32_type(a), unsigned_value);
+                const Node* hi = gen_conversion(bb, uint32_type(a), gen_primop_e(bb, rshift_logical_op, empty(a), mk_nodes(a, unsigned_value, uint64_literal(a, 32))));
+                append_list(const Node*, words, lo);
+                append_list(const Node*, words, hi);
+                return;
+            }
+            const Node* word = gen_convert_if_needed(bb, uint32_type(a), unsigned_value);
+            append_list(const Node*, words, word);
+            return;
+        }
+        case Float_TAG: {
+            const Type* int_t = int_type_helper(a, false, float_to_int_width(t->payload.float_type.width));
+            gen_split_into_words(bb, gen_reinterpret_cast(bb, int_t, value), words);
+            return;
+        }
+        case PtrType_TAG: {
+            assert(is_physical_ptr_type(t) && "only physical pointers can be moved between lanes");
+            gen_split_into_words(bb, gen_reinterpret_cast(bb, int_type_helper(a, false, a->config.memory.ptr_size), value), words);
+            return;
+        }
+        case TypeDeclRef_TAG:
+        case RecordType_TAG: {
+            Nodes member_types = get_maybe_nominal_type_body(t)->payload.record_type.members;
+            for (size_t i = 0; i < member_types.count; i++)
+                gen_split_into_words(bb, gen_extract(bb, value, singleton(int32_literal(a, i))), words);
+            return;
+        }
+        case ArrType_TAG:
+        case PackType_TAG: {
+            size_t components_count = get_int_literal_value(*resolve_to_int_literal(get_fill_type_size(t)), false);
+            for (size_t i = 0; i < components_count; i++)
+                gen_split_into_words(bb, gen_extract(bb, value, singleton(int32_literal(a, i))), words);
+            return;
+        }
+        default: error("Can't split values of this type into words");
+    }
+}
+
+/// Does the opposite of gen_split_into_words, consuming the words starting at `cursor`.
+static const Node* gen_join_words(BodyBuilder* bb, const Type* t, const Node** words, size_t* cursor) {
+    IrArena* a = t->arena;
+    switch (t->tag) {
+        case Bool_TAG: return gen_primop_e(bb, neq_op, empty(a), mk_nodes(a, words[(*cursor)++], uint32_literal(a, 0)));
+        case Int_TAG: {
+            IntSizes width = t->payload.int_type.width;
+            const Type* unsigned_t = int_type_helper(a, false, width);
+            const Node* unsigned_value;
+            if (width == IntTy64) {
+                const Node* lo = gen_conversion(bb, unsigned_t, words[(*cursor)++]);
+                const Node* hi = gen_conversion(bb, unsigned_t, words[(*cursor)++]);
+                hi = gen_primop_e(bb, lshift_op, empty(a), mk_nodes(a, hi, uint64_literal(a, 32)));
+                unsigned_value = gen_primop_e(bb, or_op, empty(a), mk_nodes(a, lo, hi));
+            } else {
+                unsigned_value = gen_convert_if_needed(bb, unsigned_t, words[(*cursor)++]);
+            }
+            return gen_reinterpret_if_needed(bb, t, unsigned_value);
+        }
+        case Float_TAG: {
+            const Type* int_t = int_type_helper(a, false, float_to_int_width(t->payload.float_type.width));
+            return gen_reinterpret_cast(bb, t, gen_join_words(bb, int_t, words, cursor));
+        }
+        case PtrType_TAG: {
+            const Type* int_t = int_type_helper(a, false, a->config.memory.ptr_size);
+            return gen_reinterpret_cast(bb, t, gen_join_words(bb, int_t, words, cursor));
+        }
+        case TypeDeclRef_TAG:
+        case RecordType_TAG: {
+            Nodes member_types = get_maybe_nominal_type_body(t)->payload.record_type.members;
+            LARRAY(const Node*, members, member_types.count);
+            for (size_t i = 0; i < member_types.count; i++)
+                members[i] = gen_join_words(bb, member_types.nodes[i], words, cursor);
+            return composite_helper(a, t, nodes(a, member_types.count, members));
+        }
+        case ArrType_TAG:
+        case PackType_TAG: {
+            size_t components_count = get_int_literal_value(*resolve_to_int_literal(get_fill_type_size(t)), false);
+            const Type* component_t = get_fill_type_element_type(t);
+            LARRAY(const Node*, components, components_count);
+            for (size_t i = 0; i < components_count; i++)
+                components[i] = gen_join_words(bb, component_t, words, cursor);
+            return composite_helper(a, t, nodes(a, components_count, components));
+        }
+        default: error("Can't join words into values of this type");
+    }
+}
+
+static const Node* get_shuffle_table(Context* ctx) {
+    if (!ctx->shuffle_table) {
+        IrArena* a = ctx->rewriter.dst_arena;
+        const Type* table_t = arr_type(a, (ArrType) { .element_type = uint32_type(a), .size = uint32_literal(a, ctx->config->specialization.subgroup_size) });
+        Node* table = global_var(ctx->rewriter.dst_module, singleton(annotation(a, (Annotation) { .name = "Generated" })), table_t, "subgroup_shuffle_table", AsSubgroupLogical);
+        ctx->shuffle_table = ref_decl_helper(a, table);
+    }
+    return ctx->shuffle_table;
+}
+
+static void gen_subgroup_barrier(IrArena* a, BodyBuilder* bb) {
+    gen_primop(bb, subgroup_barrier_op, empty(a), empty(a));
+}
+
+/// Fetches a word from another lane, either with a native shuffle or through a table in subgroup memory.
+/// The latter relies on the lanes of a subgroup running in lockstep.
+static const Node* gen_shuffle_word(Context* ctx, BodyBuilder* bb, const Node* word, const Node* lane) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    if (!ctx->config->lower.emulate_subgroup_shuffles)
+        return gen_primop_e(bb, subgroup_shuffle_op, empty(a), mk_nodes(a, word, lane));
+
+    const Node* table = get_shuffle_table(ctx);
+    const Node* local_id = gen_builtin_load(ctx->rewriter.dst_module, bb, BuiltinSubgroupLocalInvocationId);
+    gen_store(bb, gen_lea(bb, table, int32_literal(a, 0), singleton(local_id)), word);
+    gen_subgroup_barrier(a, bb);
+    const Node* shuffled = gen_load(bb, gen_lea(bb, table, int32_literal(a, 0), singleton(lane)));
+    // everyone needs to be done reading before the table gets used again
+    gen_subgroup_barrier(a, bb);
+    return shuffled;
+}
+
+static const Node* gen_shuffle(Context* ctx, BodyBuilder* bb, const Node* value, const Node* lane) {
+    struct List* words = new_list(const Node*);
+    gen_split_into_words(bb, value, words);
+    size_t words_count = entries_count_list(words);
+    LARRAY(const Node*, shuffled, words_count);
+    for (size_t i = 0; i < words_count; i++)
+        shuffled[i] = gen_shuffle_word(ctx, bb, read_list(const Node*, words)[i], lane);
+    destroy_list(words);
+    size_t cursor = 0;
+    return gen_join_words(bb, get_unqualified_type(value->type), shuffled, &cursor);
+}
+
+/// Builds a ballot in the shuffle table: the active lanes first clear all of it, then each one raises its own slot if
+/// the predicate holds. Inactive lanes don't write anything, so their slots stay clear.
+static const Node* gen_ballot_through_table(Context* ctx, BodyBuilder* bb, const Node* predicate) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    const Type* mask_t = get_actual_mask_type(a);
+    IntSizes mask_width = mask_t->payload.int_type.width;
+    const Node* table = get_shuffle_table(ctx);
+    const Node* local_id = gen_builtin_load(ctx->rewriter.dst_module, bb, BuiltinSubgroupLocalInvocationId);
+    uint32_t subgroup_size = ctx->config->specialization.subgroup_size;
+
+    for (uint32_t lane = 0; lane < subgroup_size; lane++)
+        gen_store(bb, gen_lea(bb, table, int32_literal(a, 0), singleton(uint32_literal(a, lane))), uint32_literal(a, 0));
+    gen_subgroup_barrier(a, bb);
+    const Node* vote = gen_primop_e(bb, select_op, empty(a), mk_nodes(a, predicate, uint32_literal(a, 1), uint32_literal(a, 0)));
+    gen_store(bb, gen_lea(bb, table, int32_literal(a, 0), singleton(local_id)), vote);
+    gen_subgroup_barrier(a, bb);
+
+    const Node* result = int_literal(a, (IntLiteral) { .width = mask_width, .value = 0 });
+    for (uint32_t lane = 0; lane < subgroup_size; lane++) {
+        const Node* bit = gen_conversion(bb, mask_t, gen_load(bb, gen_lea(bb, table, int32_literal(a, 0), singleton(uint32_literal(a, lane)))));
+        bit = gen_primop_e(bb, lshift_op, empty(a), mk_nodes(a, bit, int_literal(a, (IntLiteral) { .width = mask_width, .value = lane })));
+        result = gen_primop_e(bb, or_op, empty(a), mk_nodes(a, result, bit));
+    }
+    gen_subgroup_barrier(a, bb);
+    return result;
+}
+
+/// Finds the lanes that are currently active, which are the only ones emulated subgroup ops may take values from.
+static const Node* gen_active_mask(Context* ctx, BodyBuilder* bb) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    if (ctx->config->lower.emulate_subgroup_shuffles)
+        return gen_ballot_through_table(ctx, bb, true_lit(a));
+    // lower_mask keeps the active mask around for us when ballots are emulated
+    if (ctx->config->lower.emulate_subgroup_ops)
+        return gen_primop_e(bb, subgroup_active_mask_op, empty(a), empty(a));
+    return gen_primop_e(bb, subgroup_ballot_op, empty(a), singleton(true_lit(a)));
+}
+
+/// Finds the index of the lowest set bit in `bits`, which are known to all be below `bits_count`.
+static const Node* gen_lowest_set_bit_index(BodyBuilder* bb, const Node* bits, uint32_t bits_count) {
+    IrArena* a = bits->arena;
+    const Type* t = get_unqualified_type(bits->type);
+    IntSizes width = t->payload.int_type.width;
+    const Node* zero = int_literal(a, (IntLiteral) { .width = width, .value = 0 });
+    const Node* lowest = gen_primop_e(bb, and_op, empty(a), mk_nodes(a, bits, gen_primop_e(bb, sub_op, empty(a), mk_nodes(a, zero, bits))));
+    // bit k of the index is set if the lowest bit is in one of the positions where that's the case
+    const Node* index = uint32_literal(a, 0);
+    for (uint32_t k = 0; (1u << k) < bits_count; k++) {
+        uint64_t positions = 0;
+        for (uint32_t i = 0; i < 64; i++)
+            if (i & (1u << k))
+                positions |= 1ull << i;
+        const Node* in_positions = gen_primop_e(bb, and_op, empty(a), mk_nodes(a, lowest, int_literal(a, (IntLiteral) { .width = width, .value = positions })));
+        in_positions = gen_primop_e(bb, neq_op, empty(a), mk_nodes(a, in_positions, zero));
+        index = gen_primop_e(bb, or_op, empty(a), mk_nodes(a, index, gen_primop_e(bb, select_op, empty(a), mk_nodes(a, in_positions, uint32_literal(a, 1u << k), uint32_literal(a, 0)))));
+    }
+    return index;
+}
+
+/// Reduces a value across the active lanes in log2(subgroup size) butterfly steps, leaving the result in all of them.
+/// After the step of size s, each active lane holds the reduction over the active lanes of its aligned block of 2s
+/// lanes. Lanes read the other half of that block from its lowest active lane, or use the identity if there is none.
+static const Node* gen_butterfly_reduction(Context* ctx, BodyBuilder* bb, Op op, const Node* value, const Node* active) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    assert((op == add_op || op == or_op) && "the identity of the operator is assumed to be zero");
+    const Node* identity = get_default_zero_value(a, get_unqualified_type(value->type));
+    const Type* mask_t = get_unqualified_type(active->type);
+    IntSizes mask_width = mask_t->payload.int_type.width;
+    const Node* local_id = gen_builtin_load(ctx->rewriter.dst_module, bb, BuiltinSubgroupLocalInvocationId);
+    for (uint32_t step = 1; step < ctx->config->specialization.subgroup_size; step <<= 1) {
+        const Node* partner = gen_primop_e(bb, xor_op, empty(a), mk_nodes(a, local_id, uint32_literal(a, step)));
+        const Node* partner_block = gen_primop_e(bb, and_op, empty(a), mk_nodes(a, partner, uint32_literal(a, ~(step - 1))));
+        const Node* partner_lanes = gen_primop_e(bb, rshift_logical_op, empty(a), mk_nodes(a, active, gen_conversion(bb, mask_t, partner_block)));
+        partner_lanes = gen_primop_e(bb, and_op, empty(a), mk_nodes(a, partner_lanes, int_literal(a, (IntLiteral) { .width = mask_width, .value = (1ull << step) - 1 })));
+        const Node* source = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, partner_block, gen_lowest_set_bit_index(bb, partner_lanes, step)));
+        const Node* partner_value = gen_shuffle(ctx, bb, value, source);
+        const Node* any_partner = gen_primop_e(bb, neq_op, empty(a), mk_nodes(a, partner_lanes, int_literal(a, (IntLiteral) { .width = mask_width, .value = 0 })));
+        partner_value = gen_primop_e(bb, select_op, empty(a), mk_nodes(a, any_partner, partner_value, identity));
+        value = gen_primop_e(bb, op, empty(a), mk_nodes(a, value, partner_value));
+    }
+    return value;
+}
+
+static const Node* gen_ballot(Context* ctx, BodyBuilder* bb, const Node* predicate) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    const Type* mask_t = get_actual_mask_type(a);
+    if (!ctx->config->lower.emulate_subgroup_ops || mask_t->tag != Int_TAG)
+        return gen_primop_e(bb, subgroup_ballot_op, empty(a), singleton(predicate));
+
+    const Node* result;
+    if (ctx->config->lower.emulate_subgroup_shuffles) {
+        result = gen_ballot_through_table(ctx, bb, predicate);
+    } else {
+        const Node* local_id = gen_builtin_load(ctx->rewriter.dst_module, bb, BuiltinSubgroupLocalInvocationId);
+        const Node* one = int_literal(a, (IntLiteral) { .width = mask_t->payload.int_type.width, .value = 1 });
+        const Node* zero = int_literal(a, (IntLiteral) { .width = mask_t->payload.int_type.width, .value = 0 });
+        const Node* own_bit = gen_primop_e(bb, lshift_op, empty(a), mk_nodes(a, one, gen_conversion(bb, mask_t, local_id)));
+        own_bit = gen_primop_e(bb, select_op, empty(a), mk_nodes(a, predicate, own_bit, zero));
+        result = gen_butterfly_reduction(ctx, bb, or_op, own_bit, gen_active_mask(ctx, bb));
+    }
+    return first(gen_primop(bb, subgroup_assume_uniform_op, empty(a), singleton(result)));
+}
+
+/// Finds which active lanes hold the same integer as this one, starting from every active lane and ruling out the
+/// ones that disagree on each bit in turn. The loop stops once no lane has any set bits left, so this costs one
+/// ballot per significant bit of the largest value, no matter how many distinct values there are.
+static const Node* gen_partition(Context* ctx, BodyBuilder* bb, const Node* value) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    const Type* mask_t = get_actual_mask_type(a);
+    assert(mask_t->tag == Int_TAG && "abstract masks can't be built out of bits");
+    const Type* value_t = get_unqualified_type(value->type);
+    assert(value_t->tag == Int_TAG);
+    IntSizes width = value_t->payload.int_type.width;
+    const Node* value_zero = int_literal(a, (IntLiteral) { .width = width, .value = 0 });
+    const Node* value_one = int_literal(a, (IntLiteral) { .width = width, .value = 1 });
+    const Node* mask_zero = int_literal(a, (IntLiteral) { .width = mask_t->payload.int_type.width, .value = 0 });
+
+    const Node* active = gen_active_mask(ctx, bb);
+    const Node* unsigned_value = gen_reinterpret_if_needed(bb, int_type_helper(a, false, width), value);
+
+    const Node* remaining = var(a, qualified_type_helper(int_type_helper(a, false, width), false), "remaining_bits");
+    const Node* partition = var(a, qualified_type_helper(mask_t, false), "partition");
+    BodyBuilder* loop_bb = begin_body(a);
+    BodyBuilder* step_bb = begin_body(a);
+    const Node* bit = gen_primop_e(step_bb, and_op, empty(a), mk_nodes(a, remaining, value_one));
+    const Node* bit_set = gen_primop_e(step_bb, neq_op, empty(a), mk_nodes(a, bit, value_zero));
+    const Node* set_lanes = gen_ballot(ctx, step_bb, bit_set);
+    const Node* clear_lanes = gen_primop_e(step_bb, xor_op, empty(a), mk_nodes(a, active, set_lanes));
+    const Node* agreeing_lanes = gen_primop_e(step_bb, select_op, empty(a), mk_nodes(a, bit_set, set_lanes, clear_lanes));
+    const Node* next_partition = gen_primop_e(step_bb, and_op, empty(a), mk_nodes(a, partition, agreeing_lanes));
+    const Node* next_remaining = gen_primop_e(step_bb, rshift_logical_op, empty(a), mk_nodes(a, remaining, value_one));
+
+    const Node* lanes_left = gen_ballot(ctx, loop_bb, gen_primop_e(loop_bb, neq_op, empty(a), mk_nodes(a, remaining, value_zero)));
+    bind_instruction(loop_bb, if_instr(a, (If) {
+        .condition = gen_primop_e(loop_bb, eq_op, empty(a), mk_nodes(a, lanes_left, mask_zero)),
+        .yield_types = empty(a),
+        .if_true = case_(a, empty(a), merge_break(a, (MergeBreak) { .args = singleton(partition) })),
+        .if_false = case_(a, empty(a), finish_body(step_bb, merge_continue(a, (MergeContinue) { .args = mk_nodes(a, next_remaining, next_partition) }))),
+    }));
+
+    return first(bind_instruction(bb, loop_instr(a, (Loop) {
+        .yield_types = singleton(mask_t),
+        .body = case_(a, mk_nodes(a, remaining, partition), finish_body(loop_bb, unreachable(a))),
+        .initial_args = mk_nodes(a, unsigned_value, active),
+    })));
+}
+
 static const Node* process_let(Context* ctx, const Node* old) {
     assert(old->tag == Let_TAG);
     IrArena* a = ctx->rewriter.dst_arena;
@@ -36,42 +345,69 @@ static const Node* process_let(Context* ctx, const Node* old) {
         PrimOp payload = old_instruction->payload.prim_op;
         switch (payload.op) {
             case subgroup_broadcast_first_op: {
-                BodyBuilder* builder = begin_body(a);
                 const Node* varying_value = rewrite_node(&ctx->rewriter, payload.operands.nodes[0]);
                 const Type* element_type = get_unqualified_type(varying_value->type);
 
-                if (element_type->tag == Int_TAG && element_type->payload.int_type.width == IntTy32) {
-                    cancel_body(builder);
+                if (is_int32(element_type))
                     break;
-                } else if (is_extended_type(a, element_type, true) && !ctx->config->lower.emulate_subgroup_ops_extended_types) {
-                    cancel_body(builder);
+                else if (is_extended_type(a, element_type, true) && !ctx->config->lower.emulate_subgroup_ops_extended_types)
                     break;
-                }
 
-                TypeMemLayout layout = get_mem_layout(a, element_type);
+                // broadcast the value one word at a time, without going through memory
+                BodyBuilder* builder = begin_body(a);
+                struct List* words = new_list(const Node*);
+                gen_split_into_words(builder, varying_value, words);
+                size_t words_count = entries_count_list(words);
+                LARRAY(const Node*, broadcasted, words_count);
+                for (size_t i = 0; i < words_count; i++) {
+                    broadcasted[i] = gen_primop_ce(builder, subgroup_broadcast_first_op, 1, (const Node* []) { read_list(const Node*, words)[i] });
 
-                const Type* local_arr_ty = arr_type(a, (ArrType) { .element_type = int32_type(a), .size = NULL });
+                    if (ctx->config->printf_trace.subgroup_ops)
+                        gen_primop(builder, debug_printf_op, empty(a), mk_nodes(a, string_lit(a, (StringLiteral) { .string = "partial_result %d"}), broadcasted[i]));
+                }
+                destroy_list(words);
+                size_t cursor = 0;
+                const Node* result = gen_join_words(builder, element_type, broadcasted, &cursor);
+                result = first(gen_primop(builder, subgroup_assume_uniform_op, empty(a), singleton(result)));
+                return finish_body(builder, let(a, quote_helper(a, singleton(result)), tail));
+            }
+            case subgroup_reduce_sum_op: {
+                const Node* varying_value = rewrite_node(&ctx->rewriter, payload.operands.nodes[0]);
+                const Type* element_type = get_unqualified_type(varying_value->type);
 
-                const Node* varying_top_of_stack = gen_primop_e(builder, get_stack_base_op, empty(a), empty(a));
-                const Type* varying_raw_ptr_t = ptr_type(a, (PtrType) { .address_space = AsPrivatePhysical, .pointed_type = local_arr_ty });
-                const Node* varying_raw_ptr = gen_reinterpret_cast(builder, varying_raw_ptr_t, varying_top_of_stack);
-                const Type* varying_typed_ptr_t = ptr_type(a, (PtrType) { .address_space = AsPrivatePhysical, .pointed_type = element_type });
-                const Node* varying_typed_ptr = gen_reinterpret_cast(builder, varying_typed_ptr_t, varying_top_of_stack);
+                if (!ctx->config->lower.emulate_subgroup_ops && (is_int32(element_type) || !ctx->config->lower.emulate_subgroup_ops_extended_types))
+                    break;
 
-                gen_store(builder, varying_typed_ptr, varying_value);
-                for (int32_t j = 0; j < bytes_to_words_static(a, layout.size_in_bytes); j++) {
-                    const Node* varying_logical_addr = gen_lea(builder, varying_raw_ptr, int32_literal(a, 0), nodes(a, 1, (const Node* []) {int32_literal(a, j) }));
-                    const Node* input = gen_load(builder, varying_logical_addr);
+                BodyBuilder* builder = begin_body(a);
+                const Node* result = gen_butterfly_reduction(ctx, builder, add_op, varying_value, gen_active_mask(ctx, builder));
+                result = first(gen_primop(builder, subgroup_assume_uniform_op, empty(a), singleton(result)));
+                return finish_body(builder, let(a, quote_helper(a, singleton(result)), tail));
+            }
+            case subgroup_active_mask_op: {
+                // leave it to the target if it can tell on its own
+                if (!ctx->config->lower.emulate_subgroup_ops || !ctx->config->lower.emulate_subgroup_shuffles)
+                    break;
 
-                    const Node* partial_result = gen_primop_ce(builder, subgroup_broadcast_first_op, 1, (const Node* []) { input });
+                BodyBuilder* builder = begin_body(a);
+                const Node* result = gen_ballot_through_table(ctx, builder, true_lit(a));
+                result = first(gen_primop(builder, subgroup_assume_uniform_op, empty(a), singleton(result)));
+                return finish_body(builder, let(a, quote_helper(a, singleton(result)), tail));
+            }
+            case subgroup_ballot_op: {
+                // abstract masks can't be built out of bits
+                if (!ctx->config->lower.emulate_subgroup_ops || get_actual_mask_type(a)->tag != Int_TAG)
+                    break;
 
-                    if (ctx->config->printf_trace.subgroup_ops)
-                        gen_primop(builder, debug_printf_op, empty(a), mk_nodes(a, string_lit(a, (StringLiteral) { .string = "partial_result %d"}), partial_result));
+                BodyBuilder* builder = begin_body(a);
+                const Node* result = gen_ballot(ctx, builder, rewrite_node(&ctx->rewriter, payload.operands.nodes[0]));
+                return finish_body(builder, let(a, quote_helper(a, singleton(result)), tail));
+            }
+            case subgroup_partition_op: {
+                if (!ctx->config->lower.emulate_subgroup_partition)
+                    break;
 
-                    gen_store(builder, varying_logical_addr, partial_result);
-                }
-                const Node* result = gen_load(builder, varying_typed_ptr);
-                result = first(gen_primop(builder, subgroup_assume_uniform_op, empty(a), singleton(result)));
+                BodyBuilder* builder = begin_body(a);
+                const Node* result = gen_partition(ctx, builder, rewrite_node(&ctx->rewriter, payload.operands.nodes[0]));
                 return finish_body(builder, let(a, quote_helper(a, singleton(result)), tail));
             }
             default: break;
@@ -96,7 +432,6 @@ Module* lower_subgroup_ops(const CompilerConfig* config, Module* src) {
     ArenaConfig aconfig = get_arena_config(get_module_arena(src));
     IrArena* a = new_ir_arena(aconfig);
     Module* dst = new_module(a, get_module_name(src));
-    assert(!config->lower.emulate_subgroup_ops && "TODO");
     Context ctx = {
         .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
         .config = config,
@@ -8,8 +8,16 @@
 #include "../rewrite.h"
 #include "../transform/ir_gen_helpers.h"
 
+#include <stdlib.h>
+
+/// Clusters of keys need to be at least this big to be worth a jump table of their own
+#define MIN_JUMP_TABLE_CASES 4
+/// ... and at least this dense (in percent of the covered range)
+#define MIN_JUMP_TABLE_DENSITY 40
+
 typedef struct {
     Rewriter rewriter;
+    const CompilerConfig* config;
 
     const Node* inspectee;
     const Node* run_default_case;
@@ -18,19 +26,21 @@ typedef struct {
 
 typedef struct TreeNode_ TreeNode;
 
+/// Covers the keys in [key, last], those are either a single case or a cluster of them
 struct TreeNode_ {
     TreeNode* children[2];
     int depth;
     uint64_t key;
+    uint64_t last;
     const Node* lam;
 };
 
 const Node* find(TreeNode* tree, uint64_t value) {
-    if (tree->key == value)
+    if (value >= tree->key && value <= tree->last)
         return tree->lam;
     else if (value < tree->key && tree->children[0])
         return find(tree->children[0], value);
-    else if (value > tree->key && tree->children[1])
+    else if (value > tree->last && tree->children[1])
         return find(tree->children[1], value);
     return NULL;
 }
@@ -66,7 +76,7 @@ TreeNode* insert(TreeNode* t, TreeNode* x) {
         return x;
     } else if (x->key < t->key) {
         t->children[0] = insert(t->children[0], x);
-    } else if (x->key > t->key) {
+    } else if (x->key > t->last) {
         t->children[1] = insert(t->children[1], x);
     } else
         assert(false);
@@ -94,9 +104,20 @@ static const Node* wrap_instr_in_lambda(const Node* instr) {
     return case_(a, empty(a), finish_body(bb, yield(a, (Yield) {.args = values})));
 }
 
+static const Node* generate_jump_table(Context* ctx, Nodes literals, Nodes cases) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    return wrap_instr_in_lambda(match_instr(a, (Match) {
+        .yield_types = ctx->yield_types,
+        .inspect = ctx->inspectee,
+        .literals = literals,
+        .cases = cases,
+        .default_case = generate_default_fallback_case(ctx),
+    }));
+}
+
 static const Node* generate_decision_tree(Context* ctx, TreeNode* n, uint64_t min, uint64_t max) {
     IrArena* a = ctx->rewriter.dst_arena;
-    assert(n->key >= min && n->key <= max);
+    assert(n->key >= min && n->last <= max);
     assert(n->lam);
 
     // instruction in case we match
@@ -106,9 +127,8 @@ static const Node* generate_decision_tree(Context* ctx, TreeNode* n, uint64_t mi
     deconstruct_qualified_type(&inspectee_t);
     assert(inspectee_t->tag == Int_TAG);
 
-    const Node* pivot = int_literal(a, (IntLiteral) { .width = inspectee_t->payload.int_type.width, .is_signed = inspectee_t->payload.int_type.is_signed, .value = n->key });
-
     if (min < n->key) {
+        const Node* pivot = int_literal(a, (IntLiteral) { .width = inspectee_t->payload.int_type.width, .is_signed = inspectee_t->payload.int_type.is_signed, .value = n->key });
         BodyBuilder* bb = begin_body(a);
         const Node* instr = if_instr(a, (If) {
             .yield_types = ctx->yield_types,
@@ -120,12 +140,13 @@ static const Node* generate_decision_tree(Context* ctx, TreeNode* n, uint64_t mi
         body = case_(a, empty(a), finish_body(bb, yield(a, (Yield) {.args = values})));
     }
 
-    if (max > n->key) {
+    if (max > n->last) {
+        const Node* pivot = int_literal(a, (IntLiteral) { .width = inspectee_t->payload.int_type.width, .is_signed = inspectee_t->payload.int_type.is_signed, .value = n->last });
         BodyBuilder* bb = begin_body(a);
         const Node* instr = if_instr(a, (If) {
             .yield_types = ctx->yield_types,
             .condition = gen_primop_e(bb, gt_op, empty(a), mk_nodes(a, ctx->inspectee, pivot)),
-            .if_true = n->children[1] ? generate_decision_tree(ctx, n->children[1], n->key + 1, max) : generate_default_fallback_case(ctx),
+            .if_true = n->children[1] ? generate_decision_tree(ctx, n->children[1], n->last + 1, max) : generate_default_fallback_case(ctx),
             .if_false = body,
         });
         Nodes values = bind_instruction(bb, instr);
@@ -135,6 +156,33 @@ static const Node* generate_decision_tree(Context* ctx, TreeNode* n, uint64_t mi
     return body;
 }
 
+typedef struct {
+    uint64_t key;
+    size_t index;
+} SwitchKey;
+
+static int compare_switch_keys(const void* l, const void* r) {
+    uint64_t lk = ((const SwitchKey*) l)->key;
+    uint64_t rk = ((const SwitchKey*) r)->key;
+    return lk < rk ? -1 : (lk > rk ? 1 : 0);
+}
+
+static bool is_dense_enough(const SwitchKey* keys, size_t first, size_t last) {
+    size_t count = last - first + 1;
+    double range = (double) (keys[last].key - keys[first].key) + 1.0;
+    return (double) count * 100.0 >= MIN_JUMP_TABLE_DENSITY * range;
+}
+
+/// Finds the largest cluster starting at `first` that is dense enough for a jump table, returns `first` if there is none
+static size_t find_cluster_end(const SwitchKey* keys, size_t keys_count, size_t first) {
+    size_t end = first;
+    for (size_t last = first + MIN_JUMP_TABLE_CASES - 1; last < keys_count; last++) {
+        if (is_dense_enough(keys, first, last))
+            end = last;
+    }
+    return end;
+}
+
 static const Node* process(Context* ctx, const Node* node) {
     IrArena* a = ctx->rewriter.dst_arena;
 
@@ -148,30 +196,69 @@ static const Node* process(Context* ctx, const Node* node) {
             // TODO or maybe do that in fold()
             assert(cases.count > 0);
 
+            const Node* inspectee = rewrite_node(&ctx->rewriter, node->payload.match_instr.inspect);
+            const Node* default_case = rewrite_node(&ctx->rewriter, node->payload.match_instr.default_case);
+            const Node* native = match_instr(a, (Match) {
+                .yield_types = yield_types,
+                .inspect = inspectee,
+                .literals = literals,
+                .cases = cases,
+                .default_case = default_case,
+            });
+
+            if (ctx->config->lower.switch_lowering == SwitchLoweringNative)
+                return native;
+
+            LARRAY(SwitchKey, keys, literals.count);
+            for (size_t i = 0; i < literals.count; i++)
+                keys[i] = (SwitchKey) { .key = get_int_literal_value(*resolve_to_int_literal(literals.nodes[i]), false), .index = i };
+            qsort(keys, literals.count, sizeof(SwitchKey), compare_switch_keys);
+
+            // Dense enough as a whole: that's already a jump table
+            bool use_jump_tables = ctx->config->lower.switch_lowering == SwitchLoweringDensity;
+            if (use_jump_tables && literals.count >= MIN_JUMP_TABLE_CASES && is_dense_enough(keys, 0, literals.count - 1))
+                return native;
+
+            Context ctx2 = *ctx;
+            ctx2.yield_types = yield_types;
+            ctx2.inspectee = inspectee;
+
+            BodyBuilder* bb = begin_body(a);
+            const Node* run_default_case = gen_primop_e(bb, alloca_logical_op, singleton(bool_type(a)), empty(a));
+            gen_store(bb, run_default_case, false_lit(a));
+            ctx2.run_default_case = run_default_case;
+
+            // Otherwise we build a tree, where the leaves are either single cases or dense clusters of them
             Arena* arena = new_arena();
             TreeNode* root = NULL;
-            for (size_t i = 0; i < literals.count; i++) {
+            for (size_t i = 0; i < literals.count;) {
+                size_t end = use_jump_tables ? find_cluster_end(keys, literals.count, i) : i;
                 TreeNode* t = arena_alloc(arena, sizeof(TreeNode));
-                t->key = get_int_literal_value(*resolve_to_int_literal(literals.nodes[i]), false);
-                t->lam = cases.nodes[i];
+                t->key = keys[i].key;
+                t->last = keys[end].key;
+                if (end == i) {
+                    t->lam = cases.nodes[keys[i].index];
+                } else {
+                    size_t cluster_size = end - i + 1;
+                    LARRAY(const Node*, cluster_literals, cluster_size);
+                    LARRAY(const Node*, cluster_cases, cluster_size);
+                    for (size_t j = 0; j < cluster_size; j++) {
+                        cluster_literals[j] = literals.nodes[keys[i + j].index];
+                        cluster_cases[j] = cases.nodes[keys[i + j].index];
+                    }
+                    t->lam = generate_jump_table(&ctx2, nodes(a, cluster_size, cluster_literals), nodes(a, cluster_size, cluster_cases));
+                }
                 root = insert(root, t);
+                i = end + 1;
             }
 
-            BodyBuilder* bb = begin_body(a);
-            const Node* run_default_case = gen_primop_e(bb, alloca_logical_op, singleton(bool_type(a)), empty(a));
-            gen_store(bb, run_default_case, false_lit(a));
-
-            Context ctx2 = *ctx;
-            ctx2.run_default_case = run_default_case;
-            ctx2.yield_types = yield_types;
-            ctx2.inspectee = rewrite_node(&ctx->rewriter, node->payload.match_instr.inspect);
             Nodes matched_results = bind_instruction(bb, block(a, (Block) { .yield_types = add_qualifiers(a, ctx2.yield_types, false), .inside = generate_decision_tree(&ctx2, root, 0, UINT64_MAX) }));
 
             // Check if we need to run the default case
             Nodes final_results = bind_instruction(bb, if_instr(a, (If) {
                 .yield_types = ctx2.yield_types,
                 .condition = gen_load(bb, run_default_case),
-                .if_true = rewrite_node(&ctx->rewriter, node->payload.match_instr.default_case),
+                .if_true = default_case,
                 .if_false = case_(a, empty(a), yield(a, (Yield) {
                         .args = matched_results,
                 }))
@@ -186,13 +273,14 @@ static const Node* process(Context* ctx, const Node* node) {
     return recreate_node_identity(&ctx->rewriter, node);
 }
 
-Module* lower_switch_btree(SHADY_UNUSED const CompilerConfig* config, Module* src) {
+Module* lower_switch_btree(const CompilerConfig* config, Module* src) {
     ArenaConfig aconfig = get_arena_config(get_module_arena(src));
     IrArena* a = new_ir_arena(aconfig);
     Module* dst = new_module(a, get_module_name(src));
 
     Context ctx = {
         .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
+        .config = config,
     };
     rewrite_module(&ctx.rewriter);
     destroy_rewriter(&ctx.rewriter);
@@ -12,12 +12,14 @@
 #include "../analysis/uses.h"
 #include "../analysis/leak.h"
 #include "../transform/ir_gen_helpers.h"
+#include "../visit.h"
 
 #include "list.h"
 #include "dict.h"
 
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
 
 typedef uint64_t FnPtr;
 
@@ -32,6 +34,11 @@ typedef struct Context_ {
     const UsesMap* scope_uses;
 
     Node** top_dispatcher_fn;
+    /// Old entry point functions, along with their dedicated dispatchers when we generate one per entry point
+    struct List* entry_points;
+    struct Dict* entry_point_dispatchers;
+    /// How many times each function is referenced statically, used to order the dispatcher
+    struct Dict* fn_weights;
     Node* init_fn;
 } Context;
 
@@ -41,18 +48,25 @@ static const Node* fn_ptr_as_value(IrArena* a, FnPtr ptr) {
     return uint64_literal(a, ptr);
 }
 
-static const Node* lower_fn_addr(Context* ctx, const Node* the_function) {
-    IrArena* a = ctx->rewriter.dst_arena;
+static FnPtr get_fn_ptr(Context* ctx, const Node* the_function) {
     assert(the_function->arena == ctx->rewriter.src_arena);
     assert(the_function->tag == Function_TAG);
 
     FnPtr* found = find_value_dict(const Node*, FnPtr, ctx->assigned_fn_ptrs, the_function);
-    if (found) return fn_ptr_as_value(a, *found);
+    if (found) return *found;
 
     FnPtr ptr = (*ctx->next_fn_ptr)++;
     bool r = insert_dict_and_get_result(const Node*, FnPtr, ctx->assigned_fn_ptrs, the_function, ptr);
     assert(r);
-    return fn_ptr_as_value(a, ptr);
+    return ptr;
+}
+
+static const Node* lower_fn_addr(Context* ctx, const Node* the_function) {
+    return fn_ptr_as_value(ctx->rewriter.dst_arena, get_fn_ptr(ctx, the_function));
+}
+
+static const Node* access_fork_fn(Context* ctx) {
+    return access_decl(&ctx->rewriter, ctx->config->optimisations.partitioned_forks ? "builtin_fork_partitioned" : "builtin_fork");
 }
 
 /// Turn a function into a top-level entry point, calling into the top dispatch function.
@@ -75,17 +89,25 @@ static void lift_entry_point(Context* ctx, const Node* old, const Node* fun) {
     }
 
     // Initialise next_fn/next_mask to the entry function
-    const Node* jump_fn = access_decl(&ctx->rewriter, "builtin_fork");
+    const Node* jump_fn = access_fork_fn(ctx);
     const Node* fn_addr = lower_fn_addr(ctx, old);
     fn_addr = gen_conversion(bb, uint32_type(a), fn_addr);
     bind_instruction(bb, call(a, (Call) { .callee = jump_fn, .args = singleton(fn_addr) }));
 
-    if (!*ctx->top_dispatcher_fn) {
-        *ctx->top_dispatcher_fn = function(ctx->rewriter.dst_module, nodes(a, 0, NULL), "top_dispatcher", mk_nodes(a, annotation(a, (Annotation) { .name = "Generated" }), annotation(a, (Annotation) { .name = "Leaf" }), annotation(a, (Annotation) { .name = "Structured" })), nodes(a, 0, NULL));
+    Nodes dispatcher_annotations = mk_nodes(a, annotation(a, (Annotation) { .name = "Generated" }), annotation(a, (Annotation) { .name = "Leaf" }), annotation(a, (Annotation) { .name = "Structured" }));
+    Node* dispatcher;
+    if (ctx->entry_point_dispatchers) {
+        dispatcher = function(ctx->rewriter.dst_module, nodes(a, 0, NULL), format_string_arena(a->arena, "top_dispatcher_%s", get_abstraction_name(old)), dispatcher_annotations, nodes(a, 0, NULL));
+        insert_dict(const Node*, Node*, ctx->entry_point_dispatchers, old, dispatcher);
+    } else {
+        if (!*ctx->top_dispatcher_fn)
+            *ctx->top_dispatcher_fn = function(ctx->rewriter.dst_module, nodes(a, 0, NULL), "top_dispatcher", dispatcher_annotations, nodes(a, 0, NULL));
+        dispatcher = *ctx->top_dispatcher_fn;
     }
+    append_list(const Node*, ctx->entry_points, old);
 
     bind_instruction(bb, call(a, (Call) {
-        .callee = fn_addr_helper(a, *ctx->top_dispatcher_fn),
+        .callee = fn_addr_helper(a, dispatcher),
         .args = nodes(a, 0, NULL)
     }));
 
@@ -204,7 +226,7 @@ static const Node* process(Context* ctx, const Node* old) {
             target = gen_conversion(bb, uint32_type(a), target);
 
             const Node* fork_call = call(a, (Call) {
-                .callee = access_decl(&ctx->rewriter, "builtin_fork"),
+                .callee = access_fork_fn(ctx),
                 .args = nodes(a, 1, (const Node*[]) { target })
             });
             bind_instruction(bb, fork_call);
@@ -269,10 +291,216 @@ static const Node* process(Context* ctx, const Node* old) {
     return recreate_node_identity(&ctx->rewriter, old);
 }
 
-void generate_top_level_dispatch_fn(Context* ctx) {
+KeyHash hash_node(Node**);
+bool compare_node(Node**, Node**);
+
+typedef struct {
+    Visitor visitor;
+    struct Dict* fn_weights;
+} WeightsVisitor;
+
+static void count_fn_references(WeightsVisitor* v, const Node* node) {
+    if (node->tag == FnAddr_TAG) {
+        const Node* fn = node->payload.fn_addr.fn;
+        size_t* weight = find_value_dict(const Node*, size_t, v->fn_weights, fn);
+        size_t one = 1;
+        if (weight)
+            (*weight)++;
+        else
+            insert_dict(const Node*, size_t, v->fn_weights, fn, one);
+        return;
+    }
+    visit_node_operands(&v->visitor, IGNORE_ABSTRACTIONS_MASK, node);
+}
+
+static void compute_fn_weights(Module* src, struct Dict* fn_weights) {
+    WeightsVisitor v = {
+        .visitor = {
+            .visit_node_fn = (VisitNodeFn) count_fn_references,
+        },
+        .fn_weights = fn_weights,
+    };
+    Nodes decls = get_module_declarations(src);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != Function_TAG || !decl->payload.fun.body)
+            continue;
+        count_fn_references(&v, decl->payload.fun.body);
+        visit_function_rpo(&v.visitor, decl);
+    }
+}
+
+typedef struct {
+    Visitor visitor;
+    /// every function whose address is taken
+    struct Dict* referenced;
+    /// the functions we can immediately continue into
+    struct Dict* tail_called;
+    bool has_dynamic_successor;
+} SuccessorsVisitor;
+
+static void search_successors(SuccessorsVisitor* v, const Node* node) {
+    switch (node->tag) {
+        case FnAddr_TAG:
+            insert_set_get_result(const Node*, v->referenced, node->payload.fn_addr.fn);
+            return;
+        case TailCall_TAG: {
+            const Node* target = node->payload.tail_call.target;
+            if (target->tag == FnAddr_TAG)
+                insert_set_get_result(const Node*, v->tail_called, target->payload.fn_addr.fn);
+            else
+                v->has_dynamic_successor = true;
+            break;
+        }
+        // where we go next depends on the join point
+        case Join_TAG: v->has_dynamic_successor = true; break;
+        default: break;
+    }
+    visit_node_operands(&v->visitor, IGNORE_ABSTRACTIONS_MASK, node);
+}
+
+static void search_fn_successors(SuccessorsVisitor* v, const Node* fn) {
+    if (!fn->payload.fun.body)
+        return;
+    search_successors(v, fn->payload.fun.body);
+    visit_function_rpo(&v->visitor, fn);
+}
+
+static SuccessorsVisitor create_successors_visitor() {
+    return (SuccessorsVisitor) {
+        .visitor = {
+            .visit_node_fn = (VisitNodeFn) search_successors,
+        },
+        .referenced = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+        .tail_called = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+    };
+}
+
+static void destroy_successors_visitor(SuccessorsVisitor* v) {
+    destroy_dict(v->referenced);
+    destroy_dict(v->tail_called);
+}
+
+/// Returns the only function that can be dispatched to right after this one, if there is such a thing
+static const Node* get_single_successor(const Node* old_fn) {
+    SuccessorsVisitor v = create_successors_visitor();
+    search_fn_successors(&v, old_fn);
+
+    const Node* successor = NULL;
+    if (!v.has_dynamic_successor && entries_count_dict(v.tail_called) == 1) {
+        size_t iter = 0;
+        dict_iter(v.tail_called, &iter, &successor, NULL);
+        // leaf functions never go through the dispatcher
+        if (lookup_annotation(successor, "Leaf"))
+            successor = NULL;
+    }
+    destroy_successors_visitor(&v);
+    return successor;
+}
+
+/// Collects the functions an entry point can reach, either by calling them or by taking their address
+static struct Dict* compute_reachable_fns(const Node* entry_point) {
+    struct Dict* reachable = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node);
+    struct List* queue = new_list(const Node*);
+    insert_set_get_result(const Node*, reachable, entry_point);
+    append_list(const Node*, queue, entry_point);
+    while (entries_count_list(queue) > 0) {
+        const Node* fn = pop_last_list(const Node*, queue);
+        SuccessorsVisitor v = create_successors_visitor();
+        search_fn_successors(&v, fn);
+        size_t iter = 0;
+        const Node* referenced;
+        while (dict_iter(v.referenced, &iter, &referenced, NULL)) {
+            if (insert_set_get_result(const Node*, reachable, referenced))
+                append_list(const Node*, queue, referenced);
+        }
+        destroy_successors_visitor(&v);
+    }
+    destroy_list(queue);
+    return reachable;
+}
+
+typedef struct {
+    const Node* fn;
+    size_t weight;
+    bool hot;
+    size_t index;
+} DispatchTarget;
+
+static int compare_dispatch_targets(const void* pa, const void* pb) {
+    const DispatchTarget* a = pa;
+    const DispatchTarget* b = pb;
+    if (a->hot != b->hot)
+        return a->hot ? -1 : 1;
+    if (a->weight != b->weight)
+        return a->weight > b->weight ? -1 : 1;
+    return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+/// At most this many targets get tested for ahead of the dispatch tree, unless they are explicitly marked as @Hot
+#define MAX_PEELED_DISPATCH_TARGETS 4
+
+typedef struct {
+    BodyBuilder* loop_body_builder;
+    const Node* local_id;
+    const Node* next_mask;
+    const Node* should_run;
+    const Node* continue_terminator;
+    bool fall_through;
+} DispatcherContext;
+
+static void gen_run_dispatch_target(Context* ctx, DispatcherContext* dctx, BodyBuilder* bb, const Node* next_mask, const Node* should_run, const Node* old_fn) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    const Node* fn_lit = lower_fn_addr(ctx, old_fn);
+
+    BodyBuilder* if_builder = begin_body(a);
+    if (ctx->config->printf_trace.god_function) {
+        const Node* sid = gen_builtin_load(ctx->rewriter.dst_module, dctx->loop_body_builder, BuiltinSubgroupId);
+        bind_instruction(if_builder, prim_op(a, (PrimOp) { .op = debug_printf_op, .operands = mk_nodes(a, string_lit(a, (StringLiteral) { .string = "trace: thread %d:%d will run fn %d with mask = %lx\n" }), sid, dctx->local_id, fn_lit, next_mask) }));
+    }
+    bind_instruction(if_builder, call(a, (Call) {
+        .callee = fn_addr_helper(a, find_processed(&ctx->rewriter, old_fn)),
+        .args = nodes(a, 0, NULL)
+    }));
+    const Node* if_true_lam = case_(a, empty(a), finish_body(if_builder, yield(a, (Yield) {.args = nodes(a, 0, NULL)})));
+    bind_instruction(bb, if_instr(a, (If) {
+        .condition = should_run,
+        .if_true = if_true_lam,
+        .if_false = NULL,
+        .yield_types = empty(a),
+    }));
+}
+
+static const Node* generate_dispatch_case(Context* ctx, DispatcherContext* dctx, const Node* old_fn) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    BodyBuilder* case_builder = begin_body(a);
+    gen_run_dispatch_target(ctx, dctx, case_builder, dctx->next_mask, dctx->should_run, old_fn);
+
+    // If this function can only continue into one other, we check for it straight away instead of going around the loop
+    const Node* successor = dctx->fall_through ? get_single_successor(old_fn) : NULL;
+    if (successor) {
+        const Node* next_function = gen_load(case_builder, access_decl(&ctx->rewriter, "next_fn"));
+        const Node* is_successor = gen_primop_e(case_builder, eq_op, empty(a), mk_nodes(a, next_function, uint32_literal(a, get_fn_ptr(ctx, successor))));
+
+        BodyBuilder* successor_builder = begin_body(a);
+        const Node* next_mask = first(bind_instruction(successor_builder, call(a, (Call) { .callee = access_decl(&ctx->rewriter, "builtin_get_active_branch"), .args = empty(a) })));
+        const Node* should_run = gen_primop_e(successor_builder, mask_is_thread_active_op, empty(a), mk_nodes(a, next_mask, dctx->local_id));
+        gen_run_dispatch_target(ctx, dctx, successor_builder, next_mask, should_run, successor);
+        bind_instruction(case_builder, if_instr(a, (If) {
+            .condition = is_successor,
+            .if_true = case_(a, empty(a), finish_body(successor_builder, yield(a, (Yield) {.args = nodes(a, 0, NULL)}))),
+            .if_false = NULL,
+            .yield_types = empty(a),
+        }));
+    }
+
+    return case_(a, nodes(a, 0, NULL), finish_body(case_builder, dctx->continue_terminator));
+}
+
+/// Generates the body of a dispatcher, including every non-leaf function in @p reachable (or all of them if NULL)
+static void generate_dispatch_fn(Context* ctx, Node* dispatcher, struct Dict* reachable) {
     assert(ctx->config->dynamic_scheduling);
-    assert(*ctx->top_dispatcher_fn);
-    assert((*ctx->top_dispatcher_fn)->tag == Function_TAG);
+    assert(dispatcher && dispatcher->tag == Function_TAG);
     IrArena* a = ctx->rewriter.dst_arena;
 
     BodyBuilder* loop_body_builder = begin_body(a);
@@ -317,6 +545,16 @@ void generate_top_level_dispatch_fn(Context* ctx) {
         bind_instruction(loop_body_builder, bail_if);
     }
 
+    DispatcherContext dctx = {
+        .loop_body_builder = loop_body_builder,
+        .local_id = local_id,
+        .next_mask = next_mask,
+        .should_run = should_run,
+        .continue_terminator = continue_terminator,
+        // falling through would skip the iterations accounting
+        .fall_through = !count_iterations,
+    };
+
     struct List* literals = new_list(const Node*);
     struct List* cases = new_list(const Node*);
 
@@ -345,55 +583,81 @@ void generate_top_level_dispatch_fn(Context* ctx) {
     append_list(const Node*, literals, zero_lit);
     append_list(const Node*, cases, zero_case_lam);
 
+    // Order the targets by how hot they are
+    struct List* targets = new_list(DispatchTarget);
     Nodes old_decls = get_module_declarations(ctx->rewriter.src_module);
     for (size_t i = 0; i < old_decls.count; i++) {
         const Node* decl = old_decls.nodes[i];
-        if (decl->tag == Function_TAG) {
-            if (lookup_annotation(decl, "Leaf"))
-                continue;
-
-            const Node* fn_lit = lower_fn_addr(ctx, decl);
-
-            BodyBuilder* if_builder = begin_body(a);
-            if (ctx->config->printf_trace.god_function) {
-                const Node* sid = gen_builtin_load(ctx->rewriter.dst_module, loop_body_builder, BuiltinSubgroupId);
-                bind_instruction(if_builder, prim_op(a, (PrimOp) { .op = debug_printf_op, .operands = mk_nodes(a, string_lit(a, (StringLiteral) { .string = "trace: thread %d:%d will run fn %d with mask = %lx\n" }), sid, local_id, fn_lit, next_mask) }));
-            }
-            bind_instruction(if_builder, call(a, (Call) {
-                .callee = fn_addr_helper(a, find_processed(&ctx->rewriter, decl)),
-                .args = nodes(a, 0, NULL)
-            }));
-            const Node* if_true_lam = case_(a, empty(a), finish_body(if_builder, yield(a, (Yield) {.args = nodes(a, 0, NULL)})));
-            const Node* if_instruction = if_instr(a, (If) {
-                .condition = should_run,
-                .if_true = if_true_lam,
-                .if_false = NULL,
-                .yield_types = empty(a),
-            });
-
-            BodyBuilder* case_builder = begin_body(a);
-            bind_instruction(case_builder, if_instruction);
-            const Node* case_lam = case_(a, nodes(a, 0, NULL), finish_body(case_builder, continue_terminator));
+        if (decl->tag != Function_TAG || lookup_annotation(decl, "Leaf"))
+            continue;
+        if (reachable && !find_key_dict(const Node*, reachable, decl))
+            continue;
+        size_t* weight = find_value_dict(const Node*, size_t, ctx->fn_weights, decl);
+        DispatchTarget target = {
+            .fn = decl,
+            .weight = weight ? *weight : 0,
+            .hot = lookup_annotation(decl, "Hot") != NULL,
+            .index = i,
+        };
+        append_list(DispatchTarget, targets, target);
+    }
+    size_t targets_count = entries_count_list(targets);
+    DispatchTarget* sorted_targets = read_list(DispatchTarget, targets);
+    qsort(sorted_targets, targets_count, sizeof(DispatchTarget), compare_dispatch_targets);
+
+    // The hottest targets are tested for directly, ahead of the tree: we do that for the @Hot ones, and for the
+    // ones that account for at least half of the remaining static references
+    size_t remaining_weight = 0;
+    for (size_t i = 0; i < targets_count; i++)
+        remaining_weight += sorted_targets[i].weight;
+    size_t peeled_count = 0;
+    while (peeled_count < targets_count) {
+        DispatchTarget* target = &sorted_targets[peeled_count];
+        bool dominant = target->weight > 0 && target->weight * 2 >= remaining_weight && peeled_count < MAX_PEELED_DISPATCH_TARGETS;
+        if (!target->hot && !dominant)
+            break;
+        remaining_weight -= target->weight;
+        peeled_count++;
+    }
 
-            append_list(const Node*, literals, fn_lit);
-            append_list(const Node*, cases, case_lam);
-        }
+    for (size_t i = peeled_count; i < targets_count; i++) {
+        const Node* fn_lit = lower_fn_addr(ctx, sorted_targets[i].fn);
+        const Node* case_lam = generate_dispatch_case(ctx, &dctx, sorted_targets[i].fn);
+        append_list(const Node*, literals, fn_lit);
+        append_list(const Node*, cases, case_lam);
     }
 
     const Node* default_case_lam = case_(a, nodes(a, 0, NULL), unreachable(a));
 
-    bind_instruction(loop_body_builder, match_instr(a, (Match) {
+    BodyBuilder* match_builder = begin_body(a);
+    bind_instruction(match_builder, match_instr(a, (Match) {
         .yield_types = nodes(a, 0, NULL),
         .inspect = next_function,
         .literals = nodes(a, entries_count_list(literals), read_list(const Node*, literals)),
         .cases = nodes(a, entries_count_list(cases), read_list(const Node*, cases)),
         .default_case = default_case_lam,
     }));
+    const Node* dispatch = finish_body(match_builder, unreachable(a));
 
     destroy_list(literals);
     destroy_list(cases);
 
-    const Node* loop_inside_lam = case_(a, count_iterations ? singleton(iterations_count_param) : nodes(a, 0, NULL), finish_body(loop_body_builder, unreachable(a)));
+    for (size_t i = peeled_count - 1; i < peeled_count; i--) {
+        const Node* old_fn = sorted_targets[i].fn;
+        debugv_print("lower_tailcalls: dispatching to %s ahead of the others\n", get_abstraction_name(old_fn));
+        BodyBuilder* bb = begin_body(a);
+        const Node* is_target = gen_primop_e(bb, eq_op, empty(a), mk_nodes(a, next_function, uint32_literal(a, get_fn_ptr(ctx, old_fn))));
+        bind_instruction(bb, if_instr(a, (If) {
+            .condition = is_target,
+            .if_true = generate_dispatch_case(ctx, &dctx, old_fn),
+            .if_false = case_(a, empty(a), dispatch),
+            .yield_types = empty(a),
+        }));
+        dispatch = finish_body(bb, unreachable(a));
+    }
+    destroy_list(targets);
+
+    const Node* loop_inside_lam = case_(a, count_iterations ? singleton(iterations_count_param) : nodes(a, 0, NULL), finish_body(loop_body_builder, dispatch));
 
     const Node* the_loop = loop_instr(a, (Loop) {
         .yield_types = nodes(a, 0, NULL),
@@ -406,15 +670,12 @@ void generate_top_level_dispatch_fn(Context* ctx) {
     if (ctx->config->printf_trace.god_function)
         bind_instruction(dispatcher_body_builder, prim_op(a, (PrimOp) { .op = debug_printf_op, .operands = mk_nodes(a, string_lit(a, (StringLiteral) { .string = "trace: end of top\n" })) }));
 
-    (*ctx->top_dispatcher_fn)->payload.fun.body = finish_body(dispatcher_body_builder, fn_ret(a, (Return) {
+    dispatcher->payload.fun.body = finish_body(dispatcher_body_builder, fn_ret(a, (Return) {
         .args = nodes(a, 0, NULL),
-        .fn = *ctx->top_dispatcher_fn,
+        .fn = dispatcher,
     }));
 }
 
-KeyHash hash_node(Node**);
-bool compare_node(Node**, Node**);
-
 Module* lower_tailcalls(SHADY_UNUSED const CompilerConfig* config, Module* src) {
     ArenaConfig aconfig = get_arena_config(get_module_arena(src));
     IrArena* a = new_ir_arena(aconfig);
@@ -437,15 +698,31 @@ Module* lower_tailcalls(SHADY_UNUSED const CompilerConfig* config, Module* src)
         .next_fn_ptr = &next_fn_ptr,
 
         .top_dispatcher_fn = &top_dispatcher_fn,
+        .entry_points = new_list(const Node*),
+        .entry_point_dispatchers = config->optimisations.per_entry_point_dispatchers ? new_dict(const Node*, Node*, (HashFn) hash_node, (CmpFn) compare_node) : NULL,
+        .fn_weights = new_dict(const Node*, size_t, (HashFn) hash_node, (CmpFn) compare_node),
         .init_fn = init_fn,
     };
 
+    compute_fn_weights(src, ctx.fn_weights);
+
     rewrite_module(&ctx.rewriter);
 
-    // Generate the top dispatcher, but only if it is used for realsies
-    if (*ctx.top_dispatcher_fn)
-        generate_top_level_dispatch_fn(&ctx);
+    // Generate the dispatchers, but only if they are used for realsies
+    if (ctx.entry_point_dispatchers) {
+        for (size_t i = 0; i < entries_count_list(ctx.entry_points); i++) {
+            const Node* entry_point = read_list(const Node*, ctx.entry_points)[i];
+            Node* dispatcher = *find_value_dict(const Node*, Node*, ctx.entry_point_dispatchers, entry_point);
+            struct Dict* reachable = compute_reachable_fns(entry_point);
+            generate_dispatch_fn(&ctx, dispatcher, reachable);
+            destroy_dict(reachable);
+        }
+        destroy_dict(ctx.entry_point_dispatchers);
+    } else if (*ctx.top_dispatcher_fn)
+        generate_dispatch_fn(&ctx, *ctx.top_dispatcher_fn, NULL);
 
+    destroy_list(ctx.entry_points);
+    destroy_dict(ctx.fn_weights);
     destroy_dict(ptrs);
     destroy_rewriter(&ctx.rewriter);
     return dst;
@@ -35,6 +35,9 @@ static const Node* process(Context* ctx, const Node* node) {
                     case BuiltinLocalInvocationId:
                         return global_var(m, filtered_as, rewrite_node(&ctx->rewriter, node->payload.global_variable.type), node->payload.global_variable.name, AsPrivateLogical);
                     case BuiltinNumWorkgroups:
+                        // the host looks it up by name to fill it in
+                        if (ctx->config->lower.host_dispatched_workgroups)
+                            return global_var(m, filtered_as, rewrite_node(&ctx->rewriter, node->payload.global_variable.type), get_builtin_name(b), AsExternal);
                         return global_var(m, filtered_as, rewrite_node(&ctx->rewriter, node->payload.global_variable.type), node->payload.global_variable.name, AsExternal);
                     case BuiltinWorkgroupSize:
                         assert(false);
@@ -53,9 +56,21 @@ static const Node* process(Context* ctx, const Node* node) {
                 ctx2.is_entry_point = true;
                 assert(node->payload.fun.return_types.count == 0 && "entry points do not return at this stage");
 
+                // when the host dispatches the workgroups, it passes the ID of the one to run after the regular parameters
+                bool host_dispatched = ctx->config->lower.host_dispatched_workgroups;
+                // explicit SIMD and host code run whole subgroups at once, so they iterate over them uniformly
+                bool uniform_ids = host_dispatched || ctx->config->lower.simt_to_explicit_simd;
+
+                // prepare variables for iterating over workgroups
+                String names[] = { "gx", "gy", "gz" };
+                const Node* workgroup_id[3];
+                for (int dim = 0; dim < 3; dim++)
+                    workgroup_id[dim] = var(a, qualified_type_helper(uint32_type(a), uniform_ids), names[dim]);
+
                 Nodes wannotations = rewrite_nodes(&ctx->rewriter, node->payload.fun.annotations);
                 Nodes wparams = recreate_variables(&ctx->rewriter, node->payload.fun.params);
-                Node* wrapper = function(m, wparams, get_abstraction_name(node), wannotations, empty(a));
+                Nodes wrapper_params = host_dispatched ? concat_nodes(a, wparams, nodes(a, 3, workgroup_id)) : wparams;
+                Node* wrapper = function(m, wrapper_params, get_abstraction_name(node), wannotations, empty(a));
                 register_processed(&ctx->rewriter, node, wrapper);
 
                 // recreate the old entry point, but this time it's not the entry point anymore
@@ -69,14 +84,9 @@ static const Node* process(Context* ctx, const Node* node) {
                 const Node* num_workgroups_var = rewrite_node(&ctx->rewriter, get_builtin(ctx->rewriter.src_module, BuiltinNumWorkgroups, NULL));
                 const Node* workgroup_num_vec3 = gen_load(bb, ref_decl_helper(a, num_workgroups_var));
 
-                // prepare variables for iterating over workgroups
-                String names[] = { "gx", "gy", "gz" };
-                const Node* workgroup_id[3];
                 const Node* num_workgroups[3];
-                for (int dim = 0; dim < 3; dim++) {
-                    workgroup_id[dim] = var(a, qualified_type_helper(uint32_type(a), false), names[dim]);
+                for (int dim = 0; dim < 3; dim++)
                     num_workgroups[dim] = gen_extract(bb, workgroup_num_vec3, singleton(uint32_literal(a, dim)));
-                }
 
                 // Prepare variables for iterating inside workgroups
                 const Node* subgroup_id[3];
@@ -89,7 +99,7 @@ static const Node* process(Context* ctx, const Node* node) {
                 num_subgroups[2] = a->config.specializations.workgroup_size[2];
                 String names2[] = { "sgx", "sgy", "sgz" };
                 for (int dim = 0; dim < 3; dim++) {
-                    subgroup_id[dim] = var(a, qualified_type_helper(uint32_type(a), false), names2[dim]);
+                    subgroup_id[dim] = var(a, qualified_type_helper(uint32_type(a), uniform_ids), names2[dim]);
                     num_subgroups_literals[dim] = uint32_literal(a, num_subgroups[dim]);
                 }
 
@@ -113,8 +123,8 @@ static const Node* process(Context* ctx, const Node* node) {
                 bind_instruction(bb2, call(a, (Call) { .callee = fn_addr_helper(a, inner), .args = wparams }));
                 const Node* instr = yield_values_and_wrap_in_block(bb2, empty(a));
 
-                // Wrap in 3 loops for iterating over subgroups, then again for workgroups
-                for (int scope = 0; scope < 2; scope++) {
+                // Wrap in 3 loops for iterating over subgroups, then again for workgroups (unless the host does that part)
+                for (int scope = 0; scope < (host_dispatched ? 1 : 2); scope++) {
                     const Node** params;
                     const Node** maxes;
                     if (scope == 0) {
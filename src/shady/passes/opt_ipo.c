@@ -0,0 +1,522 @@
+#include "passes.h"
+
+#include "portability.h"
+#include "dict.h"
+#include "list.h"
+#include "arena.h"
+#include "log.h"
+
+#include "../analysis/uses.h"
+
+#include "../rewrite.h"
+#include "../visit.h"
+#include "../type.h"
+
+#include <assert.h>
+
+// Interprocedural constant propagation and dead argument elimination.
+// Every parameter of a function eventually becomes a stack push and pop per call once lower_callf and lower_tailcalls
+// are done with it, so we remove the ones that carry the same constant at every call site (and substitute that constant
+// into the body), the ones that are never used, and the return values nobody reads.
+// Small functions called several times with the same constants get a specialized clone for that pattern.
+
+/// How big (in instructions) a function can be before we stop cloning it for its constant arguments
+#define SPECIALIZATION_MAX_SIZE 32
+/// How many clones of one function we're willing to make
+#define MAX_SPECIALIZATIONS 4
+/// How many call sites need to share a constant pattern before it's worth a clone
+#define SPECIALIZATION_MIN_SITES 2
+
+typedef struct FnInfo_ FnInfo;
+
+typedef struct {
+    FnInfo* info;
+    /// per param: the (old) constant substituted for it, or NULL
+    const Node** bound;
+    /// per param: whether the specialized function still has it
+    bool* dropped;
+    size_t sites_count;
+    Node* new_fn;
+} Version;
+
+struct FnInfo_ {
+    const Node* fn;
+    bool eligible;
+    bool results_used;
+    size_t size;
+    struct List* sites;
+
+    /// per param: the constant seen so far at every call site, unless varies is set
+    const Node** constant;
+    bool* varies;
+    bool* dead;
+
+    bool changed;
+    bool drop_results;
+    Version generic;
+    Version specializations[MAX_SPECIALIZATIONS];
+    size_t specializations_count;
+};
+
+typedef struct {
+    Rewriter rewriter;
+    Arena* arena;
+    struct Dict* infos;
+    /// maps old Call and TailCall nodes to the version of the callee they now target
+    struct Dict* sites;
+    Version* version;
+} Context;
+
+static bool is_ipo_constant(const Node* node) {
+    switch (node->tag) {
+        case IntLiteral_TAG:
+        case FloatLiteral_TAG:
+        case True_TAG:
+        case False_TAG:
+        case FnAddr_TAG:
+        case RefDecl_TAG: return true;
+        default: return false;
+    }
+}
+
+static bool is_variable_used(const UsesMap* uses, const Node* var, const Node* binder) {
+    for (const Use* use = get_first_use(uses, var); use; use = use->next_use) {
+        if (use->user == binder)
+            continue;
+        return true;
+    }
+    return false;
+}
+
+static FnInfo* get_fn_info(Context* ctx, const Node* fn) {
+    FnInfo** found = find_value_dict(const Node*, FnInfo*, ctx->infos, fn);
+    return found ? *found : NULL;
+}
+
+static const Node* get_direct_callee(const Node* callee) {
+    if (callee->tag == FnAddr_TAG)
+        return callee->payload.fn_addr.fn;
+    return NULL;
+}
+
+typedef struct {
+    Visitor visitor;
+    Context* ctx;
+    FnInfo* current;
+    const UsesMap* uses;
+} SiteVisitor;
+
+static void record_site(SiteVisitor* v, const Node* instr, const Node* callee, Nodes args) {
+    FnInfo* info = get_fn_info(v->ctx, callee);
+    assert(info);
+    append_list(const Node*, info->sites, instr);
+    Nodes params = get_abstraction_params(callee);
+    assert(params.count == args.count);
+    for (size_t i = 0; i < args.count; i++) {
+        const Node* arg = args.nodes[i];
+        // recursive calls that pass a parameter through unchanged don't tell us anything new about it
+        if (v->current && callee == v->current->fn && arg == params.nodes[i])
+            continue;
+        if (!is_ipo_constant(arg))
+            info->varies[i] = true;
+        else if (!info->constant[i])
+            info->constant[i] = arg;
+        else if (info->constant[i] != arg)
+            info->varies[i] = true;
+    }
+}
+
+static void search_for_sites(SiteVisitor* v, const Node* node) {
+    switch (node->tag) {
+        case Let_TAG: {
+            assert(v->current);
+            v->current->size++;
+            const Node* instr = get_let_instruction(node);
+            const Node* callee = instr->tag == Call_TAG ? get_direct_callee(instr->payload.call.callee) : NULL;
+            if (callee) {
+                FnInfo* info = get_fn_info(v->ctx, callee);
+                const Node* tail = get_let_tail(node);
+                Nodes results = get_abstraction_params(tail);
+                for (size_t i = 0; i < results.count; i++)
+                    info->results_used |= is_variable_used(v->uses, results.nodes[i], tail);
+            }
+            break;
+        }
+        case Call_TAG: {
+            const Node* callee = get_direct_callee(node->payload.call.callee);
+            if (callee) {
+                record_site(v, node, callee, node->payload.call.args);
+                visit_ops(&v->visitor, NcValue, "args", node->payload.call.args);
+                return;
+            }
+            break;
+        }
+        case TailCall_TAG: {
+            const Node* callee = get_direct_callee(node->payload.tail_call.target);
+            if (callee) {
+                // whatever the callee returns goes straight to our caller
+                get_fn_info(v->ctx, callee)->results_used = true;
+                record_site(v, node, callee, node->payload.tail_call.args);
+                visit_nodes(&v->visitor, node->payload.tail_call.args);
+                return;
+            }
+            break;
+        }
+        case FnAddr_TAG: {
+            // the address escapes, we can't see (or change) all the call sites anymore
+            get_fn_info(v->ctx, node->payload.fn_addr.fn)->eligible = false;
+            return;
+        }
+        default: break;
+    }
+    visit_node_operands(&v->visitor, IGNORE_ABSTRACTIONS_MASK, node);
+}
+
+static void analyze_fn(Context* ctx, FnInfo* info) {
+    const Node* fn = info->fn;
+    if (!get_abstraction_body(fn))
+        return;
+    const UsesMap* uses = create_uses_map(fn, (NcDeclaration | NcType));
+    Nodes params = get_abstraction_params(fn);
+    for (size_t i = 0; i < params.count; i++)
+        info->dead[i] = !is_variable_used(uses, params.nodes[i], fn);
+
+    SiteVisitor v = {
+        .visitor = {
+            .visit_node_fn = (VisitNodeFn) search_for_sites,
+        },
+        .ctx = ctx,
+        .current = info,
+        .uses = uses,
+    };
+    search_for_sites(&v, get_abstraction_body(fn));
+    visit_function_rpo(&v.visitor, fn);
+    destroy_uses_map(uses);
+}
+
+static void init_version(Context* ctx, Version* version, FnInfo* info) {
+    size_t params_count = get_abstraction_params(info->fn).count;
+    *version = (Version) {
+        .info = info,
+        .bound = arena_alloc(ctx->arena, sizeof(const Node*) * params_count),
+        .dropped = arena_alloc(ctx->arena, sizeof(bool) * params_count),
+    };
+    for (size_t i = 0; i < params_count; i++) {
+        version->bound[i] = NULL;
+        version->dropped[i] = false;
+    }
+}
+
+/// pattern holds the constants a call site passes for the parameters the generic version keeps
+static bool matches_pattern(const Version* version, const Node** pattern, size_t params_count) {
+    const Version* generic = &version->info->generic;
+    for (size_t i = 0; i < params_count; i++) {
+        if (version->bound[i] != (pattern[i] ? pattern[i] : generic->bound[i]))
+            return false;
+    }
+    return true;
+}
+
+static Version* find_specialization(FnInfo* info, const Node** pattern, size_t params_count) {
+    for (size_t s = 0; s < info->specializations_count; s++) {
+        if (matches_pattern(&info->specializations[s], pattern, params_count))
+            return &info->specializations[s];
+    }
+    return NULL;
+}
+
+static Nodes get_site_args(const Node* instr) {
+    return instr->tag == Call_TAG ? instr->payload.call.args : instr->payload.tail_call.args;
+}
+
+static void plan_fn(Context* ctx, FnInfo* info) {
+    const Node* fn = info->fn;
+    Nodes params = get_abstraction_params(fn);
+    size_t sites_count = entries_count_list(info->sites);
+    if (!info->eligible || sites_count == 0)
+        return;
+
+    init_version(ctx, &info->generic, info);
+    for (size_t i = 0; i < params.count; i++) {
+        if (!info->varies[i] && info->constant[i]) {
+            debugv_print("IPO: parameter %s of %s is always ", get_value_name_safe(params.nodes[i]), get_abstraction_name(fn));
+            log_node(DEBUGV, info->constant[i]);
+            debugv_print("\n");
+            info->generic.bound[i] = info->constant[i];
+        }
+        info->generic.dropped[i] = info->generic.bound[i] || info->dead[i];
+        info->changed |= info->generic.dropped[i];
+    }
+
+    if (!info->results_used && fn->payload.fun.return_types.count > 0) {
+        debugv_print("IPO: nobody uses the results of %s\n", get_abstraction_name(fn));
+        info->drop_results = true;
+        info->changed = true;
+    }
+
+    LARRAY(const Node*, pattern, params.count);
+    LARRAY(Version*, site_versions, sites_count);
+    // count how often each remaining constant pattern shows up, then keep the ones that are frequent enough
+    struct List* candidates = new_list(Version);
+    for (size_t s = 0; s < sites_count; s++) {
+        site_versions[s] = &info->generic;
+        if (info->size > SPECIALIZATION_MAX_SIZE)
+            continue;
+        Nodes args = get_site_args(read_list(const Node*, info->sites)[s]);
+        bool any = false;
+        for (size_t i = 0; i < params.count; i++) {
+            pattern[i] = !info->generic.dropped[i] && is_ipo_constant(args.nodes[i]) ? args.nodes[i] : NULL;
+            any |= pattern[i] != NULL;
+        }
+        if (!any)
+            continue;
+        Version* found = NULL;
+        for (size_t c = 0; c < entries_count_list(candidates) && !found; c++) {
+            if (matches_pattern(&read_list(Version, candidates)[c], pattern, params.count))
+                found = &read_list(Version, candidates)[c];
+        }
+        if (!found) {
+            Version candidate;
+            init_version(ctx, &candidate, info);
+            for (size_t i = 0; i < params.count; i++) {
+                candidate.bound[i] = pattern[i] ? pattern[i] : info->generic.bound[i];
+                candidate.dropped[i] = pattern[i] || info->generic.dropped[i];
+            }
+            append_list(Version, candidates, candidate);
+            found = &read_list(Version, candidates)[entries_count_list(candidates) - 1];
+        }
+        found->sites_count++;
+    }
+    for (size_t c = 0; c < entries_count_list(candidates); c++) {
+        Version candidate = read_list(Version, candidates)[c];
+        if (candidate.sites_count < SPECIALIZATION_MIN_SITES || info->specializations_count == MAX_SPECIALIZATIONS)
+            continue;
+        info->specializations[info->specializations_count++] = candidate;
+        info->changed = true;
+    }
+    destroy_list(candidates);
+
+    if (!info->changed)
+        return;
+
+    for (size_t s = 0; s < sites_count; s++) {
+        const Node* instr = read_list(const Node*, info->sites)[s];
+        Nodes args = get_site_args(instr);
+        for (size_t i = 0; i < params.count; i++)
+            pattern[i] = !info->generic.dropped[i] && is_ipo_constant(args.nodes[i]) ? args.nodes[i] : NULL;
+        Version* version = find_specialization(info, pattern, params.count);
+        if (version)
+            site_versions[s] = version;
+        insert_dict(const Node*, Version*, ctx->sites, instr, site_versions[s]);
+    }
+}
+
+static const Node* process(Context* ctx, const Node* node);
+
+static Node* emit_version(Context* ctx, Version* version) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    FnInfo* info = version->info;
+    const Node* ofn = info->fn;
+
+    Context fn_ctx = *ctx;
+    fn_ctx.rewriter.map = clone_dict(fn_ctx.rewriter.map);
+    fn_ctx.version = version;
+
+    Nodes oparams = get_abstraction_params(ofn);
+    LARRAY(const Node*, nparams, oparams.count);
+    size_t nparams_count = 0;
+    for (size_t i = 0; i < oparams.count; i++) {
+        if (version->bound[i])
+            register_processed(&fn_ctx.rewriter, oparams.nodes[i], rewrite_node(&ctx->rewriter, version->bound[i]));
+        else if (!version->dropped[i]) {
+            nparams[nparams_count] = first(recreate_variables(&fn_ctx.rewriter, singleton(oparams.nodes[i])));
+            register_processed(&fn_ctx.rewriter, oparams.nodes[i], nparams[nparams_count++]);
+        }
+    }
+
+    String name = get_abstraction_name(ofn);
+    if (version != &info->generic)
+        name = format_string_interned(a, "%s_specialized_%d", name, (int) (version - info->specializations));
+    Nodes return_types = info->drop_results ? empty(a) : rewrite_nodes(&ctx->rewriter, ofn->payload.fun.return_types);
+    Node* new = function(ctx->rewriter.dst_module, nodes(a, nparams_count, nparams), name, rewrite_nodes(&ctx->rewriter, ofn->payload.fun.annotations), return_types);
+    version->new_fn = new;
+    if (version == &info->generic)
+        register_processed(&ctx->rewriter, ofn, new);
+
+    new->payload.fun.body = rewrite_node(&fn_ctx.rewriter, get_abstraction_body(ofn));
+    destroy_dict(fn_ctx.rewriter.map);
+    return new;
+}
+
+static const Node* get_version_fn(Context* ctx, Version* version) {
+    if (!version->new_fn) {
+        if (version == &version->info->generic)
+            rewrite_node(&ctx->rewriter, version->info->fn);
+        else
+            emit_version(ctx, version);
+    }
+    assert(version->new_fn);
+    return version->new_fn;
+}
+
+static Nodes rewrite_site_args(Context* ctx, Version* version, Nodes oargs) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    LARRAY(const Node*, nargs, oargs.count);
+    size_t nargs_count = 0;
+    for (size_t i = 0; i < oargs.count; i++) {
+        if (!version->dropped[i])
+            nargs[nargs_count++] = rewrite_node(&ctx->rewriter, oargs.nodes[i]);
+    }
+    return nodes(a, nargs_count, nargs);
+}
+
+static Version* find_site(Context* ctx, const Node* instr) {
+    Version** found = find_value_dict(const Node*, Version*, ctx->sites, instr);
+    return found ? *found : NULL;
+}
+
+static const Node* process(Context* ctx, const Node* node) {
+    const Node* found = search_processed(&ctx->rewriter, node);
+    if (found) return found;
+
+    IrArena* a = ctx->rewriter.dst_arena;
+    switch (node->tag) {
+        case Function_TAG: {
+            FnInfo* info = get_fn_info(ctx, node);
+            if (info && info->changed)
+                return emit_version(ctx, &info->generic);
+            Context fn_ctx = *ctx;
+            fn_ctx.version = NULL;
+            return recreate_node_identity(&fn_ctx.rewriter, node);
+        }
+        case Let_TAG: {
+            const Node* oinstr = get_let_instruction(node);
+            Version* version = find_site(ctx, oinstr);
+            if (version && version->info->drop_results) {
+                const Node* ninstr = rewrite_node(&ctx->rewriter, oinstr);
+                return let(a, ninstr, case_(a, empty(a), rewrite_node(&ctx->rewriter, get_abstraction_body(get_let_tail(node)))));
+            }
+            break;
+        }
+        case Call_TAG: {
+            Version* version = find_site(ctx, node);
+            if (version) {
+                return call(a, (Call) {
+                    .callee = fn_addr_helper(a, get_version_fn(ctx, version)),
+                    .args = rewrite_site_args(ctx, version, node->payload.call.args),
+                });
+            }
+            break;
+        }
+        case TailCall_TAG: {
+            Version* version = find_site(ctx, node);
+            if (version) {
+                return tail_call(a, (TailCall) {
+                    .target = fn_addr_helper(a, get_version_fn(ctx, version)),
+                    .args = rewrite_site_args(ctx, version, node->payload.tail_call.args),
+                });
+            }
+            break;
+        }
+        case Return_TAG: {
+            if (!ctx->version)
+                break;
+            return fn_ret(a, (Return) {
+                .fn = node->payload.fn_ret.fn ? ctx->version->new_fn : NULL,
+                .args = ctx->version->info->drop_results ? empty(a) : rewrite_nodes(&ctx->rewriter, node->payload.fn_ret.args),
+            });
+        }
+        case BasicBlock_TAG: {
+            if (!ctx->version)
+                break;
+            Nodes params = recreate_variables(&ctx->rewriter, node->payload.basic_block.params);
+            register_processed_list(&ctx->rewriter, node->payload.basic_block.params, params);
+            Node* bb = basic_block(a, ctx->version->new_fn, params, node->payload.basic_block.name);
+            register_processed(&ctx->rewriter, node, bb);
+            bb->payload.basic_block.body = rewrite_node(&ctx->rewriter, node->payload.basic_block.body);
+            return bb;
+        }
+        case Constant_TAG:
+        case GlobalVariable_TAG: {
+            Context not_a_fn_ctx = *ctx;
+            not_a_fn_ctx.version = NULL;
+            return recreate_node_identity(&not_a_fn_ctx.rewriter, node);
+        }
+        default: break;
+    }
+
+    return recreate_node_identity(&ctx->rewriter, node);
+}
+
+KeyHash hash_node(const Node**);
+bool compare_node(const Node**, const Node**);
+
+Module* opt_ipo(SHADY_UNUSED const CompilerConfig* config, Module* src) {
+    ArenaConfig aconfig = get_arena_config(get_module_arena(src));
+    IrArena* a = new_ir_arena(aconfig);
+    Module* dst = new_module(a, get_module_name(src));
+    Context ctx = {
+        .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
+        .arena = new_arena(),
+        .infos = new_dict(const Node*, FnInfo*, (HashFn) hash_node, (CmpFn) compare_node),
+        .sites = new_dict(const Node*, Version*, (HashFn) hash_node, (CmpFn) compare_node),
+        .version = NULL,
+    };
+
+    Nodes decls = get_module_declarations(src);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != Function_TAG)
+            continue;
+        size_t params_count = decl->payload.fun.params.count;
+        FnInfo* info = arena_alloc(ctx.arena, sizeof(FnInfo));
+        *info = (FnInfo) {
+            .fn = decl,
+            // the scheduler functions are looked up by name by later passes
+            .eligible = get_abstraction_body(decl) && !lookup_annotation(decl, "EntryPoint") && !lookup_annotation(decl, "Internal") && !lookup_annotation(decl, "Generated"),
+            .sites = new_list(const Node*),
+            .constant = arena_alloc(ctx.arena, sizeof(const Node*) * params_count),
+            .varies = arena_alloc(ctx.arena, sizeof(bool) * params_count),
+            .dead = arena_alloc(ctx.arena, sizeof(bool) * params_count),
+        };
+        for (size_t j = 0; j < params_count; j++) {
+            info->constant[j] = NULL;
+            info->varies[j] = false;
+            info->dead[j] = false;
+        }
+        insert_dict(const Node*, FnInfo*, ctx.infos, decl, info);
+    }
+
+    // function addresses can also escape through the other declarations
+    SiteVisitor escapes = {
+        .visitor = {
+            .visit_node_fn = (VisitNodeFn) search_for_sites,
+        },
+        .ctx = &ctx,
+    };
+    for (size_t i = 0; i < decls.count; i++) {
+        FnInfo* info = get_fn_info(&ctx, decls.nodes[i]);
+        if (info)
+            analyze_fn(&ctx, info);
+        else
+            visit_node_operands(&escapes.visitor, NcDeclaration, decls.nodes[i]);
+    }
+
+    for (size_t i = 0; i < decls.count; i++) {
+        FnInfo* info = get_fn_info(&ctx, decls.nodes[i]);
+        if (info)
+            plan_fn(&ctx, info);
+    }
+
+    rewrite_module(&ctx.rewriter);
+    destroy_rewriter(&ctx.rewriter);
+
+    FnInfo* info;
+    size_t i = 0;
+    while (dict_iter(ctx.infos, &i, NULL, &info))
+        destroy_list(info->sites);
+    destroy_dict(ctx.infos);
+    destroy_dict(ctx.sites);
+    destroy_arena(ctx.arena);
+    return dst;
+}
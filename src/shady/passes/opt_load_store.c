@@ -0,0 +1,499 @@
+#include "passes.h"
+
+#include "portability.h"
+#include "dict.h"
+#include "list.h"
+#include "arena.h"
+#include "log.h"
+
+#include "../analysis/scope.h"
+
+#include "../rewrite.h"
+#include "../type.h"
+
+#include <string.h>
+
+// Forwards stored/loaded values to later loads and eliminates stores that get overwritten before being read.
+// Only thread-private memory is considered: other invocations can't observe it, so program order is all that matters.
+// This runs after memory emulation, where the stack and the emulated physical memory are word arrays indexed by
+// a (symbolic base + constant) address, so that is the shape of addresses we understand.
+
+#define MAX_SELECTORS 8
+#define MAX_LOOKUP_DEPTH 256
+#define MAX_DSE_SCAN 64
+#define MAX_INDEX_DECOMPOSITION 16
+
+typedef struct {
+    const Node* sym;
+    int64_t offset;
+} Selector;
+
+typedef struct {
+    const Node* root;
+    size_t depth;
+    Selector selectors[MAX_SELECTORS];
+} Location;
+
+typedef struct {
+    bool computing;
+    bool clobbers_all;
+    struct Dict* roots;
+} ModSummary;
+
+typedef enum {
+    EvNone,
+    EvLoad,
+    EvStore,
+    EvCall,
+    EvClobberAll,
+} EventTag;
+
+typedef struct KB KnowledgeBase;
+
+struct KB {
+    const KnowledgeBase* parent;
+    EventTag tag;
+    Location loc;
+    const Node* value;
+    const ModSummary* callee;
+};
+
+typedef struct {
+    Rewriter rewriter;
+    Arena* a;
+    struct Dict* summaries;
+    struct Dict* abs_to_kb;
+    const Node* abs;
+} Context;
+
+KeyHash hash_node(const Node**);
+bool compare_node(const Node**, const Node**);
+
+static bool is_tracked_address_space(AddressSpace as) {
+    switch (as) {
+        case AsPrivateLogical:
+        case AsFunctionLogical: return true;
+        default: return false;
+    }
+}
+
+static bool is_private_clobber(Op op) {
+    switch (op) {
+        case load_op:
+        case store_op:
+        case alloca_op:
+        case alloca_logical_op:
+        case alloca_subgroup_op:
+        case debug_printf_op:
+        case sample_texture_op:
+        case create_joint_point_op:
+        case default_join_point_op: return false;
+        default: return has_primop_got_side_effects(op);
+    }
+}
+
+static const Node* get_let_bound_instruction(const Node* value) {
+    if (value->tag != Variable_TAG || value->payload.var.pindex != 0)
+        return NULL;
+    const Node* abs = value->payload.var.abs;
+    if (!abs || abs->tag != Case_TAG)
+        return NULL;
+    const Node* user = abs->payload.case_.structured_construct;
+    if (!user || user->tag != Let_TAG)
+        return NULL;
+    return user->payload.let.instruction;
+}
+
+static void decompose_index(const Node* index, Selector* selector) {
+    selector->offset = 0;
+    for (size_t i = 0; i < MAX_INDEX_DECOMPOSITION; i++) {
+        if (index->tag == IntLiteral_TAG) {
+            selector->offset += get_int_literal_value(index->payload.int_literal, true);
+            selector->sym = NULL;
+            return;
+        }
+        const Node* def = get_let_bound_instruction(index);
+        if (!def || def->tag != PrimOp_TAG)
+            break;
+        PrimOp payload = def->payload.prim_op;
+        if (payload.op == quote_op && payload.operands.count == 1) {
+            index = first(payload.operands);
+            continue;
+        }
+        if ((payload.op != add_op && payload.op != sub_op) || payload.operands.count != 2)
+            break;
+        const IntLiteral* rhs = resolve_to_int_literal(payload.operands.nodes[1]);
+        const IntLiteral* lhs = resolve_to_int_literal(payload.operands.nodes[0]);
+        if (rhs) {
+            int64_t c = get_int_literal_value(*rhs, true);
+            selector->offset += payload.op == add_op ? c : -c;
+            index = payload.operands.nodes[0];
+        } else if (lhs && payload.op == add_op) {
+            selector->offset += get_int_literal_value(*lhs, true);
+            index = payload.operands.nodes[1];
+        } else
+            break;
+    }
+    selector->sym = index;
+}
+
+static bool get_location(const Node* ptr, Location* loc) {
+    if (ptr->tag == RefDecl_TAG && ptr->payload.ref_decl.decl->tag == GlobalVariable_TAG) {
+        *loc = (Location) { .root = ptr->payload.ref_decl.decl };
+        return true;
+    }
+
+    const Node* def = get_let_bound_instruction(ptr);
+    if (!def || def->tag != PrimOp_TAG)
+        return false;
+    PrimOp payload = def->payload.prim_op;
+    switch (payload.op) {
+        case alloca_logical_op: {
+            *loc = (Location) { .root = ptr };
+            return true;
+        }
+        case quote_op: {
+            if (payload.operands.count != 1)
+                return false;
+            return get_location(first(payload.operands), loc);
+        }
+        case lea_op: {
+            const IntLiteral* offset = resolve_to_int_literal(payload.operands.nodes[1]);
+            if (!offset || get_int_literal_value(*offset, false) != 0)
+                return false;
+            if (!get_location(first(payload.operands), loc))
+                return false;
+            for (size_t i = 2; i < payload.operands.count; i++) {
+                if (loc->depth == MAX_SELECTORS)
+                    return false;
+                decompose_index(payload.operands.nodes[i], &loc->selectors[loc->depth++]);
+            }
+            return true;
+        }
+        default: return false;
+    }
+}
+
+static bool get_tracked_location(const Node* ptr, Location* loc) {
+    const Type* t = ptr->type;
+    deconstruct_qualified_type(&t);
+    if (t->tag != PtrType_TAG || !is_tracked_address_space(t->payload.ptr_type.address_space))
+        return false;
+    return get_location(ptr, loc);
+}
+
+static bool is_tracked_ptr(const Node* ptr) {
+    const Type* t = ptr->type;
+    deconstruct_qualified_type(&t);
+    return t->tag == PtrType_TAG && is_tracked_address_space(t->payload.ptr_type.address_space);
+}
+
+static bool must_alias(const Location* a, const Location* b) {
+    if (a->root != b->root || a->depth != b->depth)
+        return false;
+    for (size_t i = 0; i < a->depth; i++) {
+        if (a->selectors[i].sym != b->selectors[i].sym || a->selectors[i].offset != b->selectors[i].offset)
+            return false;
+    }
+    return true;
+}
+
+static bool never_alias(const Location* a, const Location* b) {
+    if (a->root != b->root)
+        return true;
+    size_t depth = a->depth < b->depth ? a->depth : b->depth;
+    for (size_t i = 0; i < depth; i++) {
+        if (a->selectors[i].sym == b->selectors[i].sym && a->selectors[i].offset != b->selectors[i].offset)
+            return true;
+    }
+    return false;
+}
+
+static const Node* get_callee(const Node* call) {
+    const Node* callee = call->payload.call.callee;
+    if (callee->tag == FnAddr_TAG)
+        callee = callee->payload.fn_addr.fn;
+    return callee->tag == Function_TAG ? callee : NULL;
+}
+
+static const ModSummary* get_summary(Context* ctx, const Node* fn);
+
+/// Adds the effects of an instruction to a function summary, returns false if that makes the summary useless
+static bool summarize_instruction(Context* ctx, ModSummary* summary, const Node* instruction) {
+    switch (is_instruction(instruction)) {
+        case Instruction_PrimOp_TAG: {
+            PrimOp payload = instruction->payload.prim_op;
+            if (payload.op == store_op) {
+                const Node* ptr = first(payload.operands);
+                if (!is_tracked_ptr(ptr))
+                    return true;
+                Location loc;
+                if (!get_location(ptr, &loc))
+                    return false;
+                // stores to allocas are invisible to callers
+                if (loc.root->tag == GlobalVariable_TAG)
+                    insert_set_get_result(const Node*, summary->roots, loc.root);
+                return true;
+            }
+            return !is_private_clobber(payload.op);
+        }
+        case Instruction_Call_TAG: {
+            const Node* callee = get_callee(instruction);
+            if (!callee)
+                return false;
+            const ModSummary* callee_summary = get_summary(ctx, callee);
+            if (callee_summary->computing || callee_summary->clobbers_all)
+                return false;
+            size_t i = 0;
+            const Node* root;
+            while (dict_iter(callee_summary->roots, &i, &root, NULL))
+                insert_set_get_result(const Node*, summary->roots, root);
+            return true;
+        }
+        case Instruction_Comment_TAG: return true;
+        default: return true; // structured constructs have their contents visited as part of the scope
+    }
+}
+
+static const ModSummary* get_summary(Context* ctx, const Node* fn) {
+    ModSummary** found = find_value_dict(const Node*, ModSummary*, ctx->summaries, fn);
+    if (found)
+        return *found;
+
+    ModSummary* summary = arena_alloc(ctx->a, sizeof(ModSummary));
+    *summary = (ModSummary) {
+        .computing = true,
+        .roots = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+    };
+    insert_dict(const Node*, ModSummary*, ctx->summaries, fn, summary);
+
+    if (!fn->payload.fun.body) {
+        summary->clobbers_all = true;
+    } else {
+        Scope* scope = new_scope(fn);
+        for (size_t i = 0; i < scope->size && !summary->clobbers_all; i++) {
+            const Node* body = get_abstraction_body(read_list(CFNode*, scope->contents)[i]->node);
+            if (body && body->tag == Let_TAG && !summarize_instruction(ctx, summary, get_let_instruction(body)))
+                summary->clobbers_all = true;
+        }
+        destroy_scope(scope);
+    }
+
+    summary->computing = false;
+    return summary;
+}
+
+static void record_event(Context* ctx, KnowledgeBase* kb, const Node* let) {
+    const Node* instruction = get_let_instruction(let);
+    Nodes results = get_abstraction_params(get_let_tail(let));
+    switch (is_instruction(instruction)) {
+        case Instruction_PrimOp_TAG: {
+            PrimOp payload = instruction->payload.prim_op;
+            switch (payload.op) {
+                case load_op: {
+                    if (results.count == 1 && get_tracked_location(first(payload.operands), &kb->loc)) {
+                        kb->tag = EvLoad;
+                        kb->value = first(results);
+                    }
+                    return;
+                }
+                case store_op: {
+                    const Node* ptr = first(payload.operands);
+                    if (!is_tracked_ptr(ptr))
+                        return;
+                    if (get_location(ptr, &kb->loc)) {
+                        kb->tag = EvStore;
+                        kb->value = payload.operands.nodes[1];
+                    } else
+                        kb->tag = EvClobberAll;
+                    return;
+                }
+                default: break;
+            }
+            if (is_private_clobber(payload.op))
+                kb->tag = EvClobberAll;
+            return;
+        }
+        case Instruction_Call_TAG: {
+            const Node* callee = get_callee(instruction);
+            const ModSummary* summary = callee ? get_summary(ctx, callee) : NULL;
+            if (summary && !summary->computing && !summary->clobbers_all) {
+                kb->tag = EvCall;
+                kb->callee = summary;
+            } else
+                kb->tag = EvClobberAll;
+            return;
+        }
+        case Instruction_Comment_TAG: return;
+        default: kb->tag = EvClobberAll; return;
+    }
+}
+
+static KnowledgeBase* get_kb(Context* ctx, const Node* abs) {
+    KnowledgeBase** found = find_value_dict(const Node*, KnowledgeBase*, ctx->abs_to_kb, abs);
+    return found ? *found : NULL;
+}
+
+static void visit_cfnode(Context* ctx, CFNode* node, CFNode* dominator) {
+    KnowledgeBase* kb = arena_alloc(ctx->a, sizeof(KnowledgeBase));
+    memset(kb, 0, sizeof(KnowledgeBase));
+    // when the associated node has exactly one (lexically scoped) predecessor, everything we knew there still holds
+    if (entries_count_list(node->pred_edges) == 1) {
+        CFEdge edge = read_list(CFEdge, node->pred_edges)[0];
+        if (edge.src == dominator && (edge.type == JumpEdge || edge.type == LetTailEdge))
+            kb->parent = get_kb(ctx, dominator->node);
+    }
+    const Node* body = get_abstraction_body(node->node);
+    if (body && body->tag == Let_TAG)
+        record_event(ctx, kb, body);
+    insert_dict(const Node*, KnowledgeBase*, ctx->abs_to_kb, node->node, kb);
+
+    for (size_t i = 0; i < entries_count_list(node->dominates); i++) {
+        CFNode* dominated = read_list(CFNode*, node->dominates)[i];
+        visit_cfnode(ctx, dominated, node);
+    }
+}
+
+/// Finds the value held at a location, by walking the chain of dominating events
+static const Node* get_known_value(const KnowledgeBase* kb, const Location* loc) {
+    for (size_t i = 0; kb && i < MAX_LOOKUP_DEPTH; kb = kb->parent, i++) {
+        switch (kb->tag) {
+            case EvNone: continue;
+            case EvLoad:
+                if (must_alias(&kb->loc, loc))
+                    return kb->value;
+                continue;
+            case EvStore:
+                if (must_alias(&kb->loc, loc))
+                    return kb->value;
+                if (!never_alias(&kb->loc, loc))
+                    return NULL;
+                continue;
+            case EvCall: {
+                if (find_key_dict(const Node*, kb->callee->roots, loc->root))
+                    return NULL;
+                continue;
+            }
+            case EvClobberAll: return NULL;
+        }
+    }
+    return NULL;
+}
+
+/// Looks ahead in the current straight-line code for a store that overwrites this one before anyone can read it
+static bool is_dead_store(const Node* let, const Location* loc) {
+    const Node* body = get_abstraction_body(get_let_tail(let));
+    for (size_t i = 0; i < MAX_DSE_SCAN && body && body->tag == Let_TAG; i++, body = get_abstraction_body(get_let_tail(body))) {
+        const Node* instruction = get_let_instruction(body);
+        if (instruction->tag == Comment_TAG)
+            continue;
+        if (instruction->tag != PrimOp_TAG)
+            return false;
+        PrimOp payload = instruction->payload.prim_op;
+        Location other;
+        switch (payload.op) {
+            case store_op: {
+                if (get_tracked_location(first(payload.operands), &other) && must_alias(&other, loc))
+                    return true;
+                continue;
+            }
+            case load_op: {
+                const Node* ptr = first(payload.operands);
+                if (!is_tracked_ptr(ptr))
+                    continue;
+                if (get_location(ptr, &other) && never_alias(&other, loc))
+                    continue;
+                return false;
+            }
+            default: break;
+        }
+        if (is_private_clobber(payload.op))
+            return false;
+    }
+    return false;
+}
+
+static const Node* process(Context* ctx, const Node* old) {
+    const Node* found = search_processed(&ctx->rewriter, old);
+    if (found) return found;
+
+    IrArena* a = ctx->rewriter.dst_arena;
+    Context fn_ctx = *ctx;
+    if (old->tag == Function_TAG) {
+        if (!old->payload.fun.body)
+            return recreate_node_identity(&ctx->rewriter, old);
+        ctx = &fn_ctx;
+        Scope* scope = new_scope(old);
+        fn_ctx.abs_to_kb = new_dict(const Node*, KnowledgeBase*, (HashFn) hash_node, (CmpFn) compare_node);
+        visit_cfnode(&fn_ctx, scope->entry, NULL);
+        destroy_scope(scope);
+        fn_ctx.abs = old;
+        const Node* new_fn = recreate_node_identity(&fn_ctx.rewriter, old);
+        destroy_dict(fn_ctx.abs_to_kb);
+        return new_fn;
+    } else if (is_abstraction(old)) {
+        fn_ctx.abs = old;
+        return recreate_node_identity(&fn_ctx.rewriter, old);
+    }
+
+    KnowledgeBase* kb = ctx->abs && ctx->abs_to_kb ? get_kb(ctx, ctx->abs) : NULL;
+    const Node* let = ctx->abs ? get_abstraction_body(ctx->abs) : NULL;
+    if (!kb || !let || let->tag != Let_TAG || get_let_instruction(let) != old || old->tag != PrimOp_TAG)
+        return recreate_node_identity(&ctx->rewriter, old);
+
+    PrimOp payload = old->payload.prim_op;
+    Location loc;
+    switch (payload.op) {
+        case load_op: {
+            if (!get_tracked_location(first(payload.operands), &loc))
+                break;
+            const Node* value = get_known_value(kb->parent, &loc);
+            if (value && get_unqualified_type(value->type) == get_unqualified_type(old->type) && is_subtype(old->type, value->type)) {
+                debugv_print("opt_load_store: forwarding ");
+                log_node(DEBUGV, value);
+                debugv_print(" to a load from ");
+                log_node(DEBUGV, first(payload.operands));
+                debugv_print(".\n");
+                return quote_helper(a, singleton(rewrite_node(&ctx->rewriter, value)));
+            }
+            break;
+        }
+        case store_op: {
+            if (!get_tracked_location(first(payload.operands), &loc))
+                break;
+            if (get_known_value(kb->parent, &loc) == payload.operands.nodes[1]) {
+                debugv_print("opt_load_store: eliminating a store of a value already in memory.\n");
+                return quote_helper(a, empty(a));
+            }
+            if (is_dead_store(let, &loc)) {
+                debugv_print("opt_load_store: eliminating a dead store.\n");
+                return quote_helper(a, empty(a));
+            }
+            break;
+        }
+        default: break;
+    }
+
+    return recreate_node_identity(&ctx->rewriter, old);
+}
+
+Module* opt_load_store(SHADY_UNUSED const CompilerConfig* config, Module* src) {
+    ArenaConfig aconfig = get_arena_config(get_module_arena(src));
+    IrArena* a = new_ir_arena(aconfig);
+    Module* dst = new_module(a, get_module_name(src));
+    Context ctx = {
+        .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
+        .a = new_arena(),
+        .summaries = new_dict(const Node*, ModSummary*, (HashFn) hash_node, (CmpFn) compare_node),
+    };
+    rewrite_module(&ctx.rewriter);
+    destroy_rewriter(&ctx.rewriter);
+
+    size_t i = 0;
+    ModSummary* summary;
+    while (dict_iter(ctx.summaries, &i, NULL, &summary))
+        destroy_dict(summary->roots);
+    destroy_dict(ctx.summaries);
+    destroy_arena(ctx.a);
+    return dst;
+}
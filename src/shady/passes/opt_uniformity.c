@@ -0,0 +1,116 @@
+#include "passes.h"
+
+#include "portability.h"
+#include "dict.h"
+#include "log.h"
+
+#include "../analysis/scope.h"
+#include "../analysis/uses.h"
+#include "../analysis/uniformity.h"
+
+#include "../rewrite.h"
+#include "../type.h"
+
+#include <assert.h>
+
+// The type system only knows a value is uniform if everything it's computed from is, and the results of control flow
+// constructs are always varying. The divergence analysis knows better: wherever it proves a value uniform, we re-type
+// it with subgroup_assume_uniform, and let the rebuilt instructions propagate that to everything downstream.
+// This lets lower_physical_ptrs pick the uniform access paths, folds away redundant broadcasts and gives the ISPC
+// backend uniform variables.
+
+typedef struct {
+    Rewriter rewriter;
+    struct Dict* uniform;
+} Context;
+
+static const Node* assume_uniform(Context* ctx, BodyBuilder* bb, const Node* ovar, const Node* nvar) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    if (!ctx->uniform || !find_key_dict(const Node*, ctx->uniform, ovar))
+        return nvar;
+    if (is_qualified_type_uniform(nvar->type))
+        return nvar;
+    return first(bind_instruction_named(bb, prim_op(a, (PrimOp) { .op = subgroup_assume_uniform_op, .type_arguments = empty(a), .operands = singleton(nvar) }), (String []) { ovar->payload.var.name }));
+}
+
+static const Node* rebind_body(Context* ctx, Nodes oparams, Nodes nparams, const Node* obody) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    BodyBuilder* bb = begin_body(a);
+    for (size_t i = 0; i < oparams.count; i++)
+        register_processed(&ctx->rewriter, oparams.nodes[i], assume_uniform(ctx, bb, oparams.nodes[i], nparams.nodes[i]));
+    return finish_body(bb, rewrite_node(&ctx->rewriter, obody));
+}
+
+static const Node* process(Context* ctx, const Node* node) {
+    const Node* found = search_processed(&ctx->rewriter, node);
+    if (found) return found;
+
+    IrArena* a = ctx->rewriter.dst_arena;
+    switch (node->tag) {
+        case Function_TAG: {
+            Context fn_ctx = *ctx;
+            ctx = &fn_ctx;
+
+            Node* new = recreate_decl_header_identity(&ctx->rewriter, node);
+            if (get_abstraction_body(node)) {
+                Scope* scope = new_scope(node);
+                const UsesMap* uses = create_uses_map(node, (NcDeclaration | NcType));
+                ctx->uniform = compute_uniform_variables(scope, uses);
+                new->payload.fun.body = rewrite_node(&ctx->rewriter, get_abstraction_body(node));
+                destroy_dict(ctx->uniform);
+                destroy_uses_map(uses);
+                destroy_scope(scope);
+            }
+            return new;
+        }
+        case Constant_TAG:
+        case GlobalVariable_TAG: {
+            Context not_a_fn_ctx = *ctx;
+            ctx = &not_a_fn_ctx;
+            ctx->uniform = NULL;
+            return recreate_node_identity(&ctx->rewriter, node);
+        }
+        case Let_TAG: {
+            // like rebind_let: the results take the (possibly now uniform) type of the rewritten instruction
+            const Node* otail = get_let_tail(node);
+            const Node* ninstruction = rewrite_node(&ctx->rewriter, get_let_instruction(node));
+            Nodes oparams = get_abstraction_params(otail);
+            Nodes ntypes = unwrap_multiple_yield_types(a, ninstruction->type);
+            assert(ntypes.count == oparams.count);
+            LARRAY(const Node*, nparams, oparams.count);
+            for (size_t i = 0; i < oparams.count; i++)
+                nparams[i] = var(a, ntypes.nodes[i], oparams.nodes[i]->payload.var.name);
+            Nodes params = nodes(a, oparams.count, nparams);
+            return let(a, ninstruction, case_(a, params, rebind_body(ctx, oparams, params, get_abstraction_body(otail))));
+        }
+        case Case_TAG: {
+            Nodes oparams = get_abstraction_params(node);
+            Nodes nparams = recreate_variables(&ctx->rewriter, oparams);
+            return case_(a, nparams, rebind_body(ctx, oparams, nparams, get_abstraction_body(node)));
+        }
+        case BasicBlock_TAG: {
+            Nodes oparams = get_abstraction_params(node);
+            Nodes nparams = recreate_variables(&ctx->rewriter, oparams);
+            Node* bb = basic_block(a, (Node*) rewrite_node(&ctx->rewriter, node->payload.basic_block.fn), nparams, node->payload.basic_block.name);
+            register_processed(&ctx->rewriter, node, bb);
+            bb->payload.basic_block.body = rebind_body(ctx, oparams, nparams, get_abstraction_body(node));
+            return bb;
+        }
+        default: break;
+    }
+
+    return recreate_node_identity(&ctx->rewriter, node);
+}
+
+Module* opt_uniformity(SHADY_UNUSED const CompilerConfig* config, Module* src) {
+    ArenaConfig aconfig = get_arena_config(get_module_arena(src));
+    IrArena* a = new_ir_arena(aconfig);
+    Module* dst = new_module(a, get_module_name(src));
+    Context ctx = {
+        .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
+        .uniform = NULL,
+    };
+    rewrite_module(&ctx.rewriter);
+    destroy_rewriter(&ctx.rewriter);
+    return dst;
+}
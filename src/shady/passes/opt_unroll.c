@@ -0,0 +1,592 @@
+#include "passes.h"
+
+#include "portability.h"
+#include "list.h"
+#include "dict.h"
+#include "log.h"
+
+#include "../analysis/scope.h"
+#include "../analysis/looptree.h"
+
+#include "../rewrite.h"
+#include "../type.h"
+
+#include <assert.h>
+
+// Unrolls innermost loops. Structured loops are handled by emitting copies of their body in continuation-passing style:
+// the merge_continue of one copy is replaced by the next copy, with the loop parameters bound to the continue arguments.
+// If the trip count of the loop is a known constant, and small enough, we emit exactly that many copies and the loop
+// disappears entirely. Otherwise the body is repeated inside a new loop, with the last copy looping back.
+// Loops made of basic blocks, as detected by the loop tree, are only ever partially unrolled: we make copies of all the
+// blocks in the loop, and point the back-edges of each copy at the header of the next one.
+//
+// Functions can override the heuristics with an @Unroll annotation, which is what counted or full unroll pragmas turn into:
+// a plain @Unroll asks for a full unroll, @Unroll(N) asks for N copies, and @Unroll(0) or @Unroll(1) disable unrolling.
+
+KeyHash hash_node(Node**);
+bool compare_node(Node**, Node**);
+
+/// Upper bound on the iterations we simulate when looking for the trip count of a loop.
+#define MAX_TRIP_COUNT 4096
+
+typedef struct {
+    const Node* old_loop;
+    size_t count;
+    /// Full unrolls drop the loop: the last copy can't continue, and breaks become yields out of a block.
+    bool full;
+    bool breaks_yield;
+    /// Set when a break could not be turned into a yield because it's nested in another construct.
+    bool failed;
+    struct Dict* base_map;
+    /// @ref List of @ref Dict* with the maps of every copy, to be destroyed at the end
+    struct List* maps;
+} UnrolledLoop;
+
+typedef struct Context_ {
+    Rewriter rewriter;
+    const CompilerConfig* config;
+    /// -1 when the function has no @Unroll annotation, 0 when it asks for a full unroll, the unroll factor otherwise.
+    int64_t hint;
+    Scope* scope;
+    LoopTree* loop_tree;
+
+    UnrolledLoop* unrolled;
+    size_t copy;
+    /// Whether we are inside another construct, relative to the loop being unrolled
+    bool nested;
+    /// Ifs with a constant condition are replaced by the taken case, yields to them continue with the let tail instead
+    const Node* folded_let;
+    struct Context_* folded_ctx;
+} Context;
+
+static int64_t get_unroll_hint(const Node* fn) {
+    const Node* annotation = lookup_annotation(fn, "Unroll");
+    if (!annotation)
+        return -1;
+    if (annotation->tag == Annotation_TAG)
+        return 0;
+    const IntLiteral* lit = resolve_to_int_literal(get_annotation_value(annotation));
+    if (!lit)
+        error("@Unroll expects an integer literal");
+    int64_t value = get_int_literal_value(*lit, false);
+    return value == 0 ? 1 : value;
+}
+
+static bool is_construct(const Node* instruction) {
+    switch (instruction->tag) {
+        case If_TAG:
+        case Match_TAG:
+        case Loop_TAG:
+        case Control_TAG:
+        case Block_TAG: return true;
+        default: return false;
+    }
+}
+
+typedef struct {
+    size_t instructions;
+    size_t continues;
+    const Node* merge_continue;
+    /// Inner loops and jumps out of the loop make us give up
+    bool blocked;
+    /// @ref Dict from the single result of a let to its instruction
+    struct Dict* defs;
+} LoopBodyInfo;
+
+static void scan_terminator(LoopBodyInfo* info, const Node* terminator);
+
+static void scan_case(LoopBodyInfo* info, const Node* c) {
+    if (c)
+        scan_terminator(info, get_abstraction_body(c));
+}
+
+static void scan_instruction(LoopBodyInfo* info, const Node* instruction) {
+    switch (instruction->tag) {
+        case If_TAG:
+            scan_case(info, instruction->payload.if_instr.if_true);
+            scan_case(info, instruction->payload.if_instr.if_false);
+            break;
+        case Match_TAG:
+            for (size_t i = 0; i < instruction->payload.match_instr.cases.count; i++)
+                scan_case(info, instruction->payload.match_instr.cases.nodes[i]);
+            scan_case(info, instruction->payload.match_instr.default_case);
+            break;
+        case Control_TAG: scan_case(info, instruction->payload.control.inside); break;
+        case Block_TAG: scan_case(info, instruction->payload.block.inside); break;
+        case Loop_TAG: info->blocked = true; break;
+        default: break;
+    }
+}
+
+static void scan_terminator(LoopBodyInfo* info, const Node* terminator) {
+    switch (terminator->tag) {
+        case Let_TAG: {
+            const Node* instruction = get_let_instruction(terminator);
+            Nodes results = get_abstraction_params(get_let_tail(terminator));
+            info->instructions++;
+            if (results.count == 1)
+                insert_dict(const Node*, const Node*, info->defs, results.nodes[0], instruction);
+            scan_instruction(info, instruction);
+            scan_terminator(info, get_abstraction_body(get_let_tail(terminator)));
+            break;
+        }
+        case MergeContinue_TAG:
+            info->continues++;
+            info->merge_continue = terminator;
+            break;
+        case LetMut_TAG:
+        case Jump_TAG:
+        case Branch_TAG:
+        case Switch_TAG:
+            info->blocked = true;
+            break;
+        default: break;
+    }
+}
+
+/// Whether this case just runs some plain instructions and breaks out of the loop.
+static bool case_breaks(const Node* c) {
+    if (!c)
+        return false;
+    const Node* terminator = get_abstraction_body(c);
+    while (terminator->tag == Let_TAG) {
+        if (is_construct(get_let_instruction(terminator)))
+            return false;
+        terminator = get_abstraction_body(get_let_tail(terminator));
+    }
+    return terminator->tag == MergeBreak_TAG;
+}
+
+static const IntLiteral* get_defining_step(LoopBodyInfo* info, const Node* value, const Node* param, bool* negative) {
+    const Node** found = find_value_dict(const Node*, const Node*, info->defs, value);
+    if (!found || (*found)->tag != PrimOp_TAG)
+        return NULL;
+    PrimOp op = (*found)->payload.prim_op;
+    if (op.operands.count != 2)
+        return NULL;
+    const Node* a = op.operands.nodes[0];
+    const Node* b = op.operands.nodes[1];
+    if (op.op == add_op && b == param) {
+        const Node* tmp = a;
+        a = b;
+        b = tmp;
+    }
+    if (a != param || (op.op != add_op && op.op != sub_op))
+        return NULL;
+    *negative = op.op == sub_op;
+    return resolve_to_int_literal(b);
+}
+
+static bool evaluate_comparison(Op op, IntLiteral l, IntLiteral r) {
+    bool is_signed = r.is_signed;
+    int64_t sl = get_int_literal_value(l, is_signed), sr = get_int_literal_value(r, is_signed);
+    uint64_t ul = sl, ur = sr;
+    switch (op) {
+        case lt_op:  return is_signed ? sl < sr : ul < ur;
+        case lte_op: return is_signed ? sl <= sr : ul <= ur;
+        case gt_op:  return is_signed ? sl > sr : ul > ur;
+        case gte_op: return is_signed ? sl >= sr : ul >= ur;
+        case eq_op:  return ul == ur;
+        case neq_op: return ul != ur;
+        default: SHADY_UNREACHABLE;
+    }
+}
+
+/// Checks if this is a test of the shape `if (i < B) { ...; break; }`, where `i` starts at A and steps by C on every
+/// iteration, all of them constants, and simulates it to find how many times the body runs at most.
+static bool find_trip_count_from_test(LoopBodyInfo* info, const Node* old_loop, If exit_test, size_t* trip_count) {
+    Loop payload = old_loop->payload.loop_instr;
+    Nodes params = get_abstraction_params(payload.body);
+    bool exit_when;
+    if (case_breaks(exit_test.if_true))
+        exit_when = true;
+    else if (case_breaks(exit_test.if_false))
+        exit_when = false;
+    else
+        return false;
+
+    const Node** found = find_value_dict(const Node*, const Node*, info->defs, exit_test.condition);
+    if (!found || (*found)->tag != PrimOp_TAG)
+        return false;
+    PrimOp cmp = (*found)->payload.prim_op;
+    Op op = cmp.op;
+    switch (op) {
+        case lt_op: case lte_op: case gt_op: case gte_op: case eq_op: case neq_op: break;
+        default: return false;
+    }
+    const Node* iv = cmp.operands.nodes[0];
+    const IntLiteral* bound = resolve_to_int_literal(cmp.operands.nodes[1]);
+    if (!bound) {
+        // maybe the induction variable is on the right-hand side ?
+        iv = cmp.operands.nodes[1];
+        bound = resolve_to_int_literal(cmp.operands.nodes[0]);
+        switch (op) {
+            case lt_op: op = gt_op; break;
+            case lte_op: op = gte_op; break;
+            case gt_op: op = lt_op; break;
+            case gte_op: op = lte_op; break;
+            default: break;
+        }
+    }
+    if (!bound)
+        return false;
+
+    size_t iv_index;
+    for (iv_index = 0; iv_index < params.count; iv_index++)
+        if (params.nodes[iv_index] == iv)
+            break;
+    if (iv_index == params.count)
+        return false;
+    const IntLiteral* start = resolve_to_int_literal(payload.initial_args.nodes[iv_index]);
+    bool negative;
+    const IntLiteral* step = get_defining_step(info, info->merge_continue->payload.merge_continue.args.nodes[iv_index], iv, &negative);
+    if (!start || !step)
+        return false;
+
+    IntLiteral value = *start;
+    for (size_t k = 0; k < MAX_TRIP_COUNT; k++) {
+        if (evaluate_comparison(op, value, *bound) == exit_when) {
+            *trip_count = k + 1;
+            return true;
+        }
+        value.value = negative ? value.value - step->value : value.value + step->value;
+    }
+    return false;
+}
+
+/// Looks for an exit test with a constant trip count on the top level of the loop body. Nothing before it may continue,
+/// otherwise it could be skipped, but other constructs are fine, even if they break out of the loop.
+static bool find_trip_count(LoopBodyInfo* info, const Node* old_loop, size_t* trip_count) {
+    if (info->continues != 1)
+        return false;
+    const Node* terminator = get_abstraction_body(old_loop->payload.loop_instr.body);
+    while (terminator->tag == Let_TAG) {
+        const Node* instruction = get_let_instruction(terminator);
+        terminator = get_abstraction_body(get_let_tail(terminator));
+        if (!is_construct(instruction))
+            continue;
+        if (instruction->tag == If_TAG && find_trip_count_from_test(info, old_loop, instruction->payload.if_instr, trip_count))
+            return true;
+        LoopBodyInfo construct_info = {
+            .defs = new_dict(const Node*, const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+        };
+        scan_instruction(&construct_info, instruction);
+        destroy_dict(construct_info.defs);
+        if (construct_info.continues > 0)
+            return false;
+    }
+    return false;
+}
+
+static const Node* emit_copy(Context* ctx, UnrolledLoop* unrolled, size_t copy, Nodes args) {
+    Context copy_ctx = *ctx;
+    copy_ctx.rewriter.map = clone_dict(unrolled->base_map);
+    append_list(struct Dict*, unrolled->maps, copy_ctx.rewriter.map);
+    copy_ctx.unrolled = unrolled;
+    copy_ctx.copy = copy;
+    copy_ctx.folded_let = NULL;
+    copy_ctx.folded_ctx = NULL;
+    const Node* body = unrolled->old_loop->payload.loop_instr.body;
+    register_processed_list(&copy_ctx.rewriter, get_abstraction_params(body), args);
+    return rewrite_node(&copy_ctx.rewriter, get_abstraction_body(body));
+}
+
+static const Node* unroll_loop(Context* ctx, const Node* old_let) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    const Node* old_loop = get_let_instruction(old_let);
+    Loop payload = old_loop->payload.loop_instr;
+
+    LoopBodyInfo info = {
+        .defs = new_dict(const Node*, const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+    };
+    scan_case(&info, payload.body);
+    size_t trip_count = 0;
+    bool known_trip_count = !info.blocked && find_trip_count(&info, old_loop, &trip_count);
+    destroy_dict(info.defs);
+    if (info.blocked || info.continues == 0 || ctx->hint == 1)
+        return NULL;
+
+    size_t size = info.instructions + 1;
+    size_t budget = ctx->config->optimisations.unroll.full_unroll_budget;
+    bool full = known_trip_count && (ctx->hint == 0 || (ctx->hint < 0 && trip_count * size <= budget) || (ctx->hint > 1 && trip_count <= (size_t) ctx->hint));
+    size_t factor = ctx->hint > 1 ? (size_t) ctx->hint : ctx->config->optimisations.unroll.partial_unroll_factor;
+    if (!full && (info.continues != 1 || factor < 2 || (ctx->hint < 0 && factor * size > budget)))
+        return NULL;
+
+    UnrolledLoop unrolled = {
+        .old_loop = old_loop,
+        .count = full ? trip_count : factor,
+        .full = full,
+        .breaks_yield = full,
+        .base_map = ctx->rewriter.map,
+        .maps = new_list(struct Dict*),
+    };
+
+    Nodes yield_types = rewrite_nodes(&ctx->rewriter, payload.yield_types);
+    const Node* instruction;
+    if (full) {
+        debugv_print("opt_unroll: fully unrolling a loop with %zu iterations\n", trip_count);
+        Nodes initial_args = rewrite_nodes(&ctx->rewriter, payload.initial_args);
+        const Node* body = emit_copy(ctx, &unrolled, 0, initial_args);
+        if (!unrolled.failed) {
+            instruction = block(a, (Block) {
+                .yield_types = add_qualifiers(a, yield_types, false),
+                .inside = case_(a, empty(a), body),
+            });
+        } else {
+            // some breaks are nested: keep a loop around that never takes the back-edge, so they still have a target
+            unrolled.breaks_yield = false;
+            body = emit_copy(ctx, &unrolled, 0, initial_args);
+            instruction = loop_instr(a, (Loop) {
+                .yield_types = yield_types,
+                .initial_args = empty(a),
+                .body = case_(a, empty(a), body),
+            });
+        }
+    } else {
+        debugv_print("opt_unroll: unrolling a loop %zu times\n", factor);
+        Nodes params = recreate_variables(&ctx->rewriter, get_abstraction_params(payload.body));
+        const Node* body = emit_copy(ctx, &unrolled, 0, params);
+        instruction = loop_instr(a, (Loop) {
+            .yield_types = yield_types,
+            .initial_args = rewrite_nodes(&ctx->rewriter, payload.initial_args),
+            .body = case_(a, params, body),
+        });
+    }
+
+    for (size_t i = 0; i < entries_count_list(unrolled.maps); i++)
+        destroy_dict(read_list(struct Dict*, unrolled.maps)[i]);
+    destroy_list(unrolled.maps);
+
+    return let(a, instruction, rewrite_node(&ctx->rewriter, get_let_tail(old_let)));
+}
+
+/// Returns the innermost loop this block is the only entry of, if there is one.
+static const LTNode* get_innermost_loop(Context* ctx, const Node* header) {
+    const LTNode* loop = looptree_lookup(ctx->loop_tree, header)->parent;
+    if (!loop || loop == ctx->loop_tree->root || loop->type != LF_HEAD)
+        return NULL;
+    if (entries_count_list(loop->cf_nodes) != 1 || read_list(CFNode*, loop->cf_nodes)[0]->node != header)
+        return NULL;
+    for (size_t i = 0; i < entries_count_list(loop->lf_children); i++)
+        if (read_list(LTNode*, loop->lf_children)[i]->type != LF_LEAF)
+            return NULL;
+    return loop;
+}
+
+static size_t count_instructions(const Node* terminator) {
+    LoopBodyInfo info = {
+        .defs = new_dict(const Node*, const Node*, (HashFn) hash_node, (CmpFn) compare_node),
+    };
+    scan_terminator(&info, terminator);
+    destroy_dict(info.defs);
+    return info.instructions + 1;
+}
+
+static const Node* unroll_basic_block_loop(Context* ctx, const Node* header) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    if (!ctx->loop_tree || ctx->hint == 0 || ctx->hint == 1)
+        return NULL;
+    const LTNode* loop = get_innermost_loop(ctx, header);
+    if (!loop)
+        return NULL;
+
+    size_t leaves_count = entries_count_list(loop->lf_children);
+    LARRAY(const CFNode*, leaves, leaves_count);
+    size_t blocks_count = 0;
+    size_t size = 0;
+    for (size_t i = 0; i < leaves_count; i++) {
+        // keep them in reverse post-order, so the blocks are rewritten after those defining the values they use
+        const CFNode* leaf = read_list(CFNode*, read_list(LTNode*, loop->lf_children)[i]->cf_nodes)[0];
+        size_t j = i;
+        for (; j > 0 && leaves[j - 1]->rpo_index > leaf->rpo_index; j--)
+            leaves[j] = leaves[j - 1];
+        leaves[j] = leaf;
+    }
+    for (size_t i = 0; i < leaves_count; i++) {
+        if (leaves[i]->node->tag == BasicBlock_TAG) {
+            blocks_count++;
+            size += count_instructions(get_abstraction_body(leaves[i]->node));
+        }
+    }
+
+    size_t factor = ctx->hint > 1 ? (size_t) ctx->hint : ctx->config->optimisations.unroll.partial_unroll_factor;
+    if (factor < 2 || (ctx->hint < 0 && factor * size > ctx->config->optimisations.unroll.full_unroll_budget))
+        return NULL;
+    debugv_print("opt_unroll: unrolling the loop headed by %s %zu times\n", get_abstraction_name(header), factor);
+
+    // the exits are shared by all the copies, so they need to exist before we make them
+    for (size_t i = 0; i < leaves_count; i++) {
+        for (size_t j = 0; j < entries_count_list(leaves[i]->succ_edges); j++) {
+            CFEdge edge = read_list(CFEdge, leaves[i]->succ_edges)[j];
+            if (edge.dst->node->tag != BasicBlock_TAG)
+                continue;
+            if (looptree_lookup(ctx->loop_tree, edge.dst->node)->parent == loop)
+                continue;
+            rewrite_node(&ctx->rewriter, edge.dst->node);
+        }
+    }
+
+    // the blocks of a copy are all created up front, the back-edges of a copy jump to the header of the next one
+    LARRAY(struct Dict*, maps, factor);
+    LARRAY(Node*, headers, factor);
+    LARRAY(Node*, blocks, factor * blocks_count);
+    Node* fn = (Node*) rewrite_node(&ctx->rewriter, header->payload.basic_block.fn);
+    for (size_t k = 0; k < factor; k++) {
+        maps[k] = clone_dict(ctx->rewriter.map);
+        size_t b = 0;
+        for (size_t i = 0; i < leaves_count; i++) {
+            const Node* old = leaves[i]->node;
+            if (old->tag != BasicBlock_TAG)
+                continue;
+            Nodes params = recreate_variables(&ctx->rewriter, get_abstraction_params(old));
+            blocks[k * blocks_count + b] = basic_block(a, fn, params, get_abstraction_name(old));
+            if (old == header)
+                headers[k] = blocks[k * blocks_count + b];
+            b++;
+        }
+    }
+    for (size_t k = 0; k < factor; k++) {
+        Context copy_ctx = *ctx;
+        copy_ctx.rewriter.map = maps[k];
+        size_t b = 0;
+        for (size_t i = 0; i < leaves_count; i++) {
+            const Node* old = leaves[i]->node;
+            if (old->tag != BasicBlock_TAG)
+                continue;
+            Node* new = blocks[k * blocks_count + b++];
+            register_processed(&copy_ctx.rewriter, old, old == header ? headers[(k + 1) % factor] : new);
+            register_processed_list(&copy_ctx.rewriter, get_abstraction_params(old), get_abstraction_params(new));
+        }
+    }
+    for (size_t k = 0; k < factor; k++) {
+        Context copy_ctx = *ctx;
+        copy_ctx.rewriter.map = maps[k];
+        size_t b = 0;
+        for (size_t i = 0; i < leaves_count; i++) {
+            const Node* old = leaves[i]->node;
+            if (old->tag != BasicBlock_TAG)
+                continue;
+            blocks[k * blocks_count + b++]->payload.basic_block.body = rewrite_node(&copy_ctx.rewriter, get_abstraction_body(old));
+        }
+        destroy_dict(maps[k]);
+    }
+
+    register_processed(&ctx->rewriter, header, headers[0]);
+    return headers[0];
+}
+
+static const Node* process(Context* ctx, const Node* node) {
+    const Node* found = search_processed(&ctx->rewriter, node);
+    if (found) return found;
+
+    IrArena* a = ctx->rewriter.dst_arena;
+    switch (node->tag) {
+        case Function_TAG: {
+            Context fn_ctx = *ctx;
+            ctx = &fn_ctx;
+            ctx->hint = get_unroll_hint(node);
+            ctx->loop_tree = NULL;
+            ctx->unrolled = NULL;
+            ctx->nested = false;
+            ctx->folded_let = NULL;
+
+            Node* new = recreate_decl_header_identity(&ctx->rewriter, node);
+            if (get_abstraction_body(node)) {
+                ctx->scope = new_scope(node);
+                ctx->loop_tree = build_loop_tree(ctx->scope);
+                new->payload.fun.body = rewrite_node(&ctx->rewriter, get_abstraction_body(node));
+                destroy_loop_tree(ctx->loop_tree);
+                destroy_scope(ctx->scope);
+            }
+            return new;
+        }
+        case Constant_TAG:
+        case GlobalVariable_TAG:
+        case NominalType_TAG: {
+            Context not_a_fn_ctx = *ctx;
+            ctx = &not_a_fn_ctx;
+            ctx->loop_tree = NULL;
+            ctx->unrolled = NULL;
+            return recreate_node_identity(&ctx->rewriter, node);
+        }
+        case BasicBlock_TAG: {
+            const Node* unrolled = unroll_basic_block_loop(ctx, node);
+            if (unrolled)
+                return unrolled;
+            break;
+        }
+        case Let_TAG: {
+            const Node* old_instruction = get_let_instruction(node);
+            if (old_instruction->tag == Loop_TAG) {
+                const Node* unrolled = unroll_loop(ctx, node);
+                if (unrolled)
+                    return unrolled;
+            }
+            if (!ctx->unrolled || !is_construct(old_instruction))
+                break;
+            if (old_instruction->tag == If_TAG) {
+                If payload = old_instruction->payload.if_instr;
+                const Node* condition = rewrite_node(&ctx->rewriter, payload.condition);
+                if (condition->tag == True_TAG || condition->tag == False_TAG) {
+                    const Node* taken = condition->tag == True_TAG ? payload.if_true : payload.if_false;
+                    if (!taken)
+                        return rewrite_node(&ctx->rewriter, get_abstraction_body(get_let_tail(node)));
+                    Context folded_ctx = *ctx;
+                    folded_ctx.folded_let = node;
+                    folded_ctx.folded_ctx = ctx;
+                    return rewrite_node(&folded_ctx.rewriter, get_abstraction_body(taken));
+                }
+            }
+            Context nested_ctx = *ctx;
+            nested_ctx.nested = true;
+            nested_ctx.folded_let = NULL;
+            const Node* instruction = rewrite_node(&nested_ctx.rewriter, old_instruction);
+            return let(a, instruction, rewrite_node(&ctx->rewriter, get_let_tail(node)));
+        }
+        case Yield_TAG: {
+            if (!ctx->folded_let)
+                break;
+            Context* outer = ctx->folded_ctx;
+            const Node* tail = get_let_tail(ctx->folded_let);
+            register_processed_list(&outer->rewriter, get_abstraction_params(tail), rewrite_nodes(&ctx->rewriter, node->payload.yield.args));
+            return rewrite_node(&outer->rewriter, get_abstraction_body(tail));
+        }
+        case MergeContinue_TAG: {
+            UnrolledLoop* unrolled = ctx->unrolled;
+            if (!unrolled)
+                break;
+            Nodes args = rewrite_nodes(&ctx->rewriter, node->payload.merge_continue.args);
+            if (ctx->copy + 1 < unrolled->count)
+                return emit_copy(ctx, unrolled, ctx->copy + 1, args);
+            if (unrolled->full)
+                return unreachable(a);
+            return merge_continue(a, (MergeContinue) { .args = args });
+        }
+        case MergeBreak_TAG: {
+            UnrolledLoop* unrolled = ctx->unrolled;
+            if (!unrolled || !unrolled->breaks_yield)
+                break;
+            if (ctx->nested)
+                unrolled->failed = true;
+            return yield(a, (Yield) { .args = rewrite_nodes(&ctx->rewriter, node->payload.merge_break.args) });
+        }
+        default: break;
+    }
+
+    return recreate_node_identity(&ctx->rewriter, node);
+}
+
+Module* opt_unroll(const CompilerConfig* config, Module* src) {
+    ArenaConfig aconfig = get_arena_config(get_module_arena(src));
+    IrArena* a = new_ir_arena(aconfig);
+    Module* dst = new_module(a, get_module_name(src));
+    Context ctx = {
+        .rewriter = create_rewriter(src, dst, (RewriteNodeFn) process),
+        .config = config,
+        .hint = -1,
+    };
+    rewrite_module(&ctx.rewriter);
+    destroy_rewriter(&ctx.rewriter);
+    return dst;
+}
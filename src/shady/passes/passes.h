@@ -48,8 +48,6 @@ RewritePass normalize_builtins;
 RewritePass lower_callf;
 /// Emulates tailcalls, forks and joins using a god function
 RewritePass lower_tailcalls;
-/// Turns SIMT code back into SIMD (intended for debugging with the help of the C backend)
-RewritePass simt2d;
 
 /// @}
 
@@ -110,6 +108,14 @@ RewritePass opt_inline_jumps;
 /// In addition, also inlines function calls according to heuristics
 RewritePass opt_inline;
 RewritePass opt_mem2reg;
+/// Forwards stores to later loads and removes redundant or overwritten stores in thread-private memory
+RewritePass opt_load_store;
+/// Runs a divergence analysis and re-types values it proves uniform, even where the type system can't see it
+RewritePass opt_uniformity;
+/// Unrolls innermost loops, fully when they have a small constant trip count, otherwise by the configured (or annotated) factor
+RewritePass opt_unroll;
+/// Removes parameters that are constant at every call site or unused, and results nobody reads, and clones small functions for frequent constant arguments
+RewritePass opt_ipo;
 
 /// Try to identify reconvergence points throughout the program for unstructured control flow programs
 RewritePass reconvergence_heuristics;
@@ -3,15 +3,19 @@
 #include "log.h"
 #include "portability.h"
 #include "list.h"
+#include "dict.h"
 #include "util.h"
 
 #include "../rewrite.h"
 #include "../visit.h"
 #include "../type.h"
 #include "../ir_private.h"
+#include "../analysis/scope.h"
 #include "../transform/ir_gen_helpers.h"
+#include "../transform/memory_layout.h"
 
 #include <assert.h>
+#include <stdlib.h>
 
 typedef struct Context_ {
     Rewriter rewriter;
@@ -23,42 +27,239 @@ typedef struct Context_ {
 } Context;
 
 typedef struct {
-    Visitor visitor;
-    Context* context;
-    BodyBuilder* bb;
-    Node* nom_t;
-    struct List* members;
-} VContext;
-
-static void search_operand_for_alloca(VContext* vctx, const Node* node) {
-    IrArena* a = vctx->context->rewriter.dst_arena;
+    const Node* alloca;
+    const Node* ptr;
+    AddressSpace as;
+    const Type* element_type;
+    TypeMemLayout layout;
+    /// CFNodes (by rpo index) where the slot holds a value that might still be observed
+    bool* live;
+    size_t slot;
+} StackAllocation;
+
+typedef struct {
     AddressSpace as;
+    size_t size_in_bytes;
+    size_t alignment_in_bytes;
+    size_t offset_in_bytes;
+    bool* live;
+} StackSlot;
+
+KeyHash hash_node(Node**);
+bool compare_node(Node**, Node**);
+
+inline static size_t round_up(size_t a, size_t b) {
+    if (b == 0)
+        return a;
+    return (a + b - 1) / b * b;
+}
+
+static size_t maxof(size_t a, size_t b) {
+    if (a > b)
+        return a;
+    return b;
+}
+
+typedef struct {
+    Visitor visitor;
+    struct Dict* derived;
+    bool found;
+} UsesVisitor;
+
+static void search_for_derived_values(UsesVisitor* v, const Node* node) {
+    if (node->tag == Variable_TAG) {
+        if (find_key_dict(const Node*, v->derived, node))
+            v->found = true;
+        return;
+    }
+    visit_node_operands(&v->visitor, IGNORE_ABSTRACTIONS_MASK, node);
+}
+
+static bool uses_derived_values(struct Dict* derived, const Node* node) {
+    UsesVisitor v = {
+        .visitor = {
+            .visit_node_fn = (VisitNodeFn) search_for_derived_values,
+        },
+        .derived = derived,
+        .found = false,
+    };
+    search_for_derived_values(&v, node);
+    return v.found;
+}
+
+static void mark_reachable(Scope* scope, bool* set, CFNode* node, bool forward) {
+    if (set[node->rpo_index])
+        return;
+    set[node->rpo_index] = true;
+    struct List* edges = forward ? node->succ_edges : node->pred_edges;
+    for (size_t i = 0; i < entries_count_list(edges); i++) {
+        CFEdge edge = read_list(CFEdge, edges)[i];
+        mark_reachable(scope, set, forward ? edge.dst : edge.src, forward);
+    }
+}
+
+/// Computes the CFNodes where the memory behind an alloca might be live: the ones on a path from the allocation to a
+/// use of the pointer or of anything derived from it. Pointers that escape (stored, passed to calls, sent to other
+/// blocks...) are pessimistically live everywhere.
+static void compute_allocation_liveness(Scope* scope, CFNode* def, StackAllocation* alloc) {
+    struct Dict* derived = new_set(const Node*, (HashFn) hash_node, (CmpFn) compare_node);
+    insert_set_get_result(const Node*, derived, alloc->ptr);
+
+    bool* uses = calloc(scope->size, sizeof(bool));
+    bool escapes = false;
+    for (size_t i = def->rpo_index + 1; i < scope->size && !escapes; i++) {
+        CFNode* cfnode = scope->rpo[i];
+        const Node* terminator = get_abstraction_body(cfnode->node);
+        if (!terminator)
+            continue;
+        if (terminator->tag != Let_TAG) {
+            escapes |= uses_derived_values(derived, terminator);
+            continue;
+        }
 
-    if (node->tag == PrimOp_TAG) {
-        switch (node->payload.prim_op.op) {
+        const Node* instruction = get_let_instruction(terminator);
+        if (!uses_derived_values(derived, instruction))
+            continue;
+        uses[i] = true;
+        if (instruction->tag != PrimOp_TAG) {
+            escapes = true;
+            continue;
+        }
+
+        Nodes operands = instruction->payload.prim_op.operands;
+        switch (instruction->payload.prim_op.op) {
+            case load_op: break;
+            case store_op: escapes |= uses_derived_values(derived, operands.nodes[1]); break;
+            default: {
+                Nodes results = get_abstraction_params(get_let_tail(terminator));
+                for (size_t j = 0; j < results.count; j++)
+                    insert_set_get_result(const Node*, derived, results.nodes[j]);
+                break;
+            }
+        }
+    }
+    destroy_dict(derived);
+
+    alloc->live = calloc(scope->size, sizeof(bool));
+    if (escapes) {
+        for (size_t i = 0; i < scope->size; i++)
+            alloc->live[i] = true;
+        free(uses);
+        return;
+    }
+
+    bool* after_def = calloc(scope->size, sizeof(bool));
+    bool* before_use = calloc(scope->size, sizeof(bool));
+    mark_reachable(scope, after_def, def, true);
+    for (size_t i = 0; i < scope->size; i++) {
+        if (uses[i])
+            mark_reachable(scope, before_use, scope->rpo[i], false);
+    }
+    for (size_t i = 0; i < scope->size; i++)
+        alloc->live[i] = after_def[i] && before_use[i];
+    alloc->live[def->rpo_index] = true;
+    free(after_def);
+    free(before_use);
+    free(uses);
+}
+
+static bool interferes(size_t count, const bool* a, const bool* b) {
+    for (size_t i = 0; i < count; i++) {
+        if (a[i] && b[i])
+            return true;
+    }
+    return false;
+}
+
+/// Finds the allocas in a function and gives allocations whose lifetimes don't overlap the same frame offset
+static size_t layout_stack_frame(Context* ctx, const Node* old_fn, BodyBuilder* bb) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    Scope* scope = new_scope(old_fn);
+
+    struct List* allocs = new_list(StackAllocation);
+    for (size_t i = 0; i < scope->size; i++) {
+        const Node* terminator = get_abstraction_body(scope->rpo[i]->node);
+        if (!terminator || terminator->tag != Let_TAG)
+            continue;
+        const Node* instruction = get_let_instruction(terminator);
+        if (instruction->tag != PrimOp_TAG)
+            continue;
+        AddressSpace as;
+        switch (instruction->payload.prim_op.op) {
             case alloca_op: as = AsPrivatePhysical; break;
             case alloca_subgroup_op: as = AsSubgroupPhysical; break;
-            default: goto not_alloca;
+            default: continue;
         }
 
-        const Type* element_type = rewrite_node(&vctx->context->rewriter, node->payload.prim_op.type_arguments.nodes[0]);
+        const Type* element_type = rewrite_node(&ctx->rewriter, first(instruction->payload.prim_op.type_arguments));
         assert(is_data_type(element_type));
-        const Node* slot_offset = gen_primop_e(vctx->bb, offset_of_op, singleton(type_decl_ref_helper(a, vctx->nom_t)), singleton(int32_literal(a, entries_count_list(vctx->members))));
-        append_list(const Type*, vctx->members, element_type);
+        StackAllocation alloc = {
+            .alloca = instruction,
+            .ptr = first(get_abstraction_params(get_let_tail(terminator))),
+            .as = as,
+            .element_type = element_type,
+            .layout = get_mem_layout(a, element_type),
+        };
+        compute_allocation_liveness(scope, scope->rpo[i], &alloc);
+        append_list(StackAllocation, allocs, alloc);
+    }
 
-        const Node* slot = first(bind_instruction_named(vctx->bb, prim_op(a, (PrimOp) {
+    // greedy first-fit colouring, in program order
+    size_t allocs_count = entries_count_list(allocs);
+    StackAllocation* allocs_arr = read_list(StackAllocation, allocs);
+    struct List* slots = new_list(StackSlot);
+    for (size_t i = 0; i < allocs_count; i++) {
+        StackAllocation* alloc = &allocs_arr[i];
+        StackSlot* slots_arr = read_list(StackSlot, slots);
+        size_t j;
+        for (j = 0; j < entries_count_list(slots); j++) {
+            if (slots_arr[j].as == alloc->as && !interferes(scope->size, slots_arr[j].live, alloc->live))
+                break;
+        }
+        if (j == entries_count_list(slots)) {
+            StackSlot slot = {
+                .as = alloc->as,
+                .live = calloc(scope->size, sizeof(bool)),
+            };
+            append_list(StackSlot, slots, slot);
+            slots_arr = read_list(StackSlot, slots);
+        }
+        StackSlot* slot = &slots_arr[j];
+        for (size_t k = 0; k < scope->size; k++)
+            slot->live[k] |= alloc->live[k];
+        slot->size_in_bytes = maxof(slot->size_in_bytes, alloc->layout.size_in_bytes);
+        slot->alignment_in_bytes = maxof(slot->alignment_in_bytes, alloc->layout.alignment_in_bytes);
+        alloc->slot = j;
+    }
+
+    size_t frame_size = 0;
+    StackSlot* slots_arr = read_list(StackSlot, slots);
+    for (size_t j = 0; j < entries_count_list(slots); j++) {
+        frame_size = round_up(frame_size, slots_arr[j].alignment_in_bytes);
+        slots_arr[j].offset_in_bytes = frame_size;
+        frame_size += slots_arr[j].size_in_bytes;
+        free(slots_arr[j].live);
+    }
+    if (allocs_count > 0)
+        debugv_print("setup_stack_frames: %s uses %d bytes for %d allocas in %d slots\n", get_abstraction_name(old_fn), (int) frame_size, (int) allocs_count, (int) entries_count_list(slots));
+
+    for (size_t i = 0; i < allocs_count; i++) {
+        StackAllocation* alloc = &allocs_arr[i];
+        const Node* slot = first(bind_instruction_named(bb, prim_op(a, (PrimOp) {
             .op = lea_op,
-            .operands = mk_nodes(a, vctx->context->entry_base_stack_ptr, slot_offset) }), (String []) {format_string_arena(a->arena, "stack_slot_%d", entries_count_list(vctx->members)) }));
+            .operands = mk_nodes(a, ctx->entry_base_stack_ptr, size_t_literal(a, slots_arr[alloc->slot].offset_in_bytes)) }), (String []) {format_string_arena(a->arena, "stack_slot_%d", (int) i + 1) }));
 
-        const Node* ptr_t = ptr_type(a, (PtrType) { .pointed_type = element_type, .address_space = as });
-        slot = gen_reinterpret_cast(vctx->bb, ptr_t, slot);
+        const Node* ptr_t = ptr_type(a, (PtrType) { .pointed_type = alloc->element_type, .address_space = alloc->as });
+        slot = gen_reinterpret_cast(bb, ptr_t, slot);
 
-        register_processed(&vctx->context->rewriter, node, quote_helper(a, singleton(slot)));
-        return;
+        register_processed(&ctx->rewriter, alloc->alloca, quote_helper(a, singleton(slot)));
+        free(alloc->live);
     }
 
-    not_alloca:
-    visit_node_operands(&vctx->visitor, IGNORE_ABSTRACTIONS_MASK, node);
+    destroy_list(slots);
+    destroy_list(allocs);
+    destroy_scope(scope);
+    return frame_size;
 }
 
 static const Node* process(Context* ctx, const Node* node) {
@@ -66,7 +267,6 @@ static const Node* process(Context* ctx, const Node* node) {
     if (found) return found;
 
     IrArena* a = ctx->rewriter.dst_arena;
-    Module* m = ctx->rewriter.dst_module;
     switch (node->tag) {
         case Function_TAG: {
             Node* fun = recreate_decl_header_identity(&ctx->rewriter, node);
@@ -75,32 +275,15 @@ static const Node* process(Context* ctx, const Node* node) {
 
             BodyBuilder* bb = begin_body(a);
             if (!ctx2.disable_lowering) {
-                Node* nom_t = nominal_type(m, empty(a), format_string_arena(a->arena, "%s_stack_frame", get_abstraction_name(node)));
                 ctx2.entry_stack_offset = first(bind_instruction_named(bb, prim_op(a, (PrimOp) { .op = get_stack_pointer_op } ), (String []) {format_string_arena(a->arena, "saved_stack_ptr_entering_%s", get_abstraction_name(fun)) }));
                 ctx2.entry_base_stack_ptr = gen_primop_ce(bb, get_stack_base_op, 0, NULL);
-                VContext vctx = {
-                    .visitor = {
-                        .visit_node_fn = (VisitNodeFn) search_operand_for_alloca,
-                    },
-                    .context = &ctx2,
-                    .bb = bb,
-                    .nom_t = nom_t,
-                    .members = new_list(const Node*),
-                };
-                if (node->payload.fun.body) {
-                    search_operand_for_alloca(&vctx, node->payload.fun.body);
-                    visit_function_rpo(&vctx.visitor, node);
-                }
-                vctx.nom_t->payload.nom_type.body = record_type(a, (RecordType) {
-                    .members = nodes(a, entries_count_list(vctx.members), read_list(const Node*, vctx.members)),
-                    .names = strings(a, 0, NULL),
-                    .special = 0
-                });
-                destroy_list(vctx.members);
-
-                const Node* frame_size = gen_primop_e(bb, size_of_op, singleton(type_decl_ref_helper(a, nom_t)), empty(a));
-                frame_size = convert_int_extend_according_to_src_t(bb, get_unqualified_type(ctx2.entry_stack_offset->type), frame_size);
-                const Node* updated_stack_ptr = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, ctx2.entry_stack_offset, frame_size));
+                size_t frame_size = 0;
+                if (node->payload.fun.body)
+                    frame_size = layout_stack_frame(&ctx2, node, bb);
+
+                // keep the stack pointer aligned to the words backing private memory so accesses can use them whole
+                frame_size = round_up(frame_size, int_size_in_bytes(a->config.memory.word_size) * get_private_memory_words_per_backing_word(ctx->config, a));
+                const Node* updated_stack_ptr = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, ctx2.entry_stack_offset, uint32_literal(a, frame_size)));
                 gen_primop(bb, set_stack_pointer_op, empty(a), singleton(updated_stack_ptr));
             }
             if (node->payload.fun.body)
@@ -0,0 +1,585 @@
+#include "ir_private.h"
+#include "visit.h"
+
+#include "log.h"
+#include "dict.h"
+#include "growy.h"
+#include "list.h"
+#include "portability.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Binary module format (.shdb)
+//
+// Everything is made of 32-bit words in host byte order, a file written on a machine with the other endianness is
+// rejected by the magic number. The layout is:
+//
+//  - a header: magic, version, flags, string count, size of the string table in bytes, record count
+//  - the string table: every distinct string once, as its length followed by its bytes, a NUL terminator and padding
+//    to the next word. Strings can therefore be used straight from the (possibly memory-mapped) file.
+//  - the node records, in an order where every node comes after its operands. A record is a word holding its kind
+//    and node tag, followed by the fields of the node in the order of the grammar. Node operands are referenced by
+//    index (starting at 1, 0 means NULL), strings by index into the string table (same convention).
+//  - the declarations of the module, as a count and node indices, so they can be put back in their original order.
+//
+// Declarations and basic blocks can be part of cycles: they are written as a header record first, which gets an
+// index like any node, and get a body record once the nodes their body needs have been written, just like the
+// rewriter recreates them.
+
+#define SHDB_MAGIC 0x42444853 // 'SHDB'
+#define SHDB_VERSION 1
+
+typedef enum {
+    ShdbNameBound = 0x1,
+    ShdbTyped = 0x2,
+} ShdbFlags;
+
+typedef enum {
+    /// Creates a new node
+    ShdbNodeRecord,
+    /// Fills in the body of a declaration or basic block created earlier
+    ShdbBodyRecord,
+} ShdbRecordKind;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t strings_count;
+    uint32_t strings_size;
+    uint32_t records_count;
+} ShdbHeader;
+
+KeyHash hash_node(Node**);
+bool compare_node(Node**, Node**);
+KeyHash hash_string(const char** string);
+bool compare_string(const char** a, const char** b);
+
+typedef struct {
+    Visitor visitor;
+    Growy* records;
+    Growy* strings;
+    /// maps nodes to their index in the records
+    struct Dict* nodes_map;
+    /// maps strings to their index in the string table, by contents
+    struct Dict* strings_map;
+    uint32_t nodes_count;
+    uint32_t records_count;
+    uint32_t strings_count;
+} Serializer;
+
+static void serialize_word(Serializer* s, uint32_t word) {
+    growy_append_object(s->records, word);
+}
+
+static void append_padded(Growy* g, const void* data, size_t size) {
+    growy_append_bytes(g, size, data);
+    uint32_t zero = 0;
+    if (size % 4 != 0)
+        growy_append_bytes(g, 4 - size % 4, (const char*) &zero);
+}
+
+static void serialize_pod(Serializer* s, const void* data, size_t size) {
+    append_padded(s->records, data, size);
+}
+
+static uint32_t serialize_node(Serializer* s, const Node* node);
+
+static void serialize_ref(Serializer* s, const Node* node) {
+    if (!node) {
+        serialize_word(s, 0);
+        return;
+    }
+    uint32_t* found = find_value_dict(const Node*, uint32_t, s->nodes_map, node);
+    assert(found && "operands are written before the nodes using them");
+    serialize_word(s, *found);
+}
+
+static void serialize_refs(Serializer* s, Nodes nodes) {
+    serialize_word(s, nodes.count);
+    for (size_t i = 0; i < nodes.count; i++)
+        serialize_ref(s, nodes.nodes[i]);
+}
+
+static void serialize_string(Serializer* s, String str) {
+    if (!str) {
+        serialize_word(s, 0);
+        return;
+    }
+    uint32_t* found = find_value_dict(String, uint32_t, s->strings_map, str);
+    if (found) {
+        serialize_word(s, *found);
+        return;
+    }
+    uint32_t len = strlen(str);
+    growy_append_object(s->strings, len);
+    append_padded(s->strings, str, len + 1);
+    uint32_t index = ++s->strings_count;
+    insert_dict(String, uint32_t, s->strings_map, str, index);
+    serialize_word(s, index);
+}
+
+static void serialize_strings(Serializer* s, Strings strings) {
+    serialize_word(s, strings.count);
+    for (size_t i = 0; i < strings.count; i++)
+        serialize_string(s, strings.strings[i]);
+}
+
+static void serialize_record_header(Serializer* s, ShdbRecordKind kind, NodeTag tag) {
+    serialize_word(s, kind << 16 | tag);
+    s->records_count++;
+}
+
+static uint32_t register_serialized(Serializer* s, const Node* node) {
+    uint32_t index = ++s->nodes_count;
+    insert_dict(const Node*, uint32_t, s->nodes_map, node, index);
+    return index;
+}
+
+static void serialize_nodes(Serializer* s, Nodes nodes) {
+    for (size_t i = 0; i < nodes.count; i++)
+        serialize_node(s, nodes.nodes[i]);
+}
+
+static void serialize_body(Serializer* s, const Node* node, const Node* body) {
+    serialize_node(s, body);
+    serialize_record_header(s, ShdbBodyRecord, node->tag);
+    serialize_ref(s, node);
+    serialize_ref(s, body);
+}
+
+static void serialize_op(Serializer* s, SHADY_UNUSED NodeClass class, SHADY_UNUSED String op_name, const Node* node) {
+    serialize_node(s, node);
+}
+
+typedef struct {
+    IrArena* arena;
+    Module* mod;
+    const uint32_t* words;
+    size_t words_count;
+    size_t cursor;
+    /// points into the string table of the input, and then to the interned copies once they're needed
+    const char** strings;
+    uint32_t* strings_lengths;
+    bool* strings_interned;
+    uint32_t strings_count;
+    const Node** nodes;
+    uint32_t nodes_count;
+    bool failed;
+} Deserializer;
+
+static uint32_t deserialize_word(Deserializer* d) {
+    if (d->cursor >= d->words_count) {
+        d->failed = true;
+        return 0;
+    }
+    return d->words[d->cursor++];
+}
+
+static void deserialize_pod(Deserializer* d, void* data, size_t size) {
+    size_t words = (size + 3) / 4;
+    if (d->cursor + words > d->words_count) {
+        d->failed = true;
+        return;
+    }
+    memcpy(data, &d->words[d->cursor], size);
+    d->cursor += words;
+}
+
+static const Node* deserialize_ref(Deserializer* d) {
+    uint32_t index = deserialize_word(d);
+    if (index > d->nodes_count) {
+        d->failed = true;
+        return NULL;
+    }
+    return index == 0 ? NULL : d->nodes[index - 1];
+}
+
+static Nodes deserialize_refs(Deserializer* d) {
+    uint32_t count = deserialize_word(d);
+    if (count > d->words_count - d->cursor) {
+        d->failed = true;
+        return empty(d->arena);
+    }
+    const Node** arr = malloc(count * sizeof(const Node*));
+    for (size_t i = 0; i < count; i++) {
+        arr[i] = deserialize_ref(d);
+        if (!arr[i])
+            d->failed = true;
+    }
+    Nodes result = d->failed ? empty(d->arena) : nodes(d->arena, count, arr);
+    free(arr);
+    return result;
+}
+
+static String deserialize_string(Deserializer* d) {
+    uint32_t index = deserialize_word(d);
+    if (index > d->strings_count) {
+        d->failed = true;
+        return NULL;
+    }
+    if (index == 0)
+        return NULL;
+    if (!d->strings_interned[index - 1]) {
+        d->strings[index - 1] = string_sized(d->arena, d->strings_lengths[index - 1], d->strings[index - 1]);
+        d->strings_interned[index - 1] = true;
+    }
+    return d->strings[index - 1];
+}
+
+static Strings deserialize_strings(Deserializer* d) {
+    uint32_t count = deserialize_word(d);
+    if (count > d->words_count - d->cursor) {
+        d->failed = true;
+        return strings(d->arena, 0, NULL);
+    }
+    String* arr = malloc(count * sizeof(String));
+    for (size_t i = 0; i < count; i++)
+        arr[i] = deserialize_string(d);
+    Strings result = strings(d->arena, count, arr);
+    free(arr);
+    return result;
+}
+
+#pragma GCC diagnostic error "-Wswitch"
+
+#include "serialize_generated.c"
+
+static uint32_t serialize_node(Serializer* s, const Node* node) {
+    if (!node)
+        return 0;
+    uint32_t* found = find_value_dict(const Node*, uint32_t, s->nodes_map, node);
+    if (found)
+        return *found;
+
+    if (can_be_default_serialized(node->tag)) {
+        visit_node_operands(&s->visitor, 0, node);
+        serialize_record_header(s, ShdbNodeRecord, node->tag);
+        serialize_payload_generated(s, node);
+        return register_serialized(s, node);
+    }
+
+    uint32_t index;
+    switch (node->tag) {
+        case Variable_TAG: {
+            serialize_node(s, node->payload.var.type);
+            serialize_record_header(s, ShdbNodeRecord, node->tag);
+            serialize_ref(s, node->payload.var.type);
+            serialize_string(s, node->payload.var.name);
+            return register_serialized(s, node);
+        }
+        case Let_TAG:
+        case LetMut_TAG: {
+            serialize_node(s, get_let_instruction(node));
+            serialize_node(s, get_let_tail(node));
+            serialize_record_header(s, ShdbNodeRecord, node->tag);
+            serialize_ref(s, get_let_instruction(node));
+            serialize_ref(s, get_let_tail(node));
+            return register_serialized(s, node);
+        }
+        case Case_TAG: {
+            serialize_nodes(s, node->payload.case_.params);
+            serialize_node(s, node->payload.case_.body);
+            serialize_record_header(s, ShdbNodeRecord, node->tag);
+            serialize_refs(s, node->payload.case_.params);
+            serialize_ref(s, node->payload.case_.body);
+            return register_serialized(s, node);
+        }
+        case BasicBlock_TAG: {
+            serialize_nodes(s, node->payload.basic_block.params);
+            // writing the function writes its body, which may well contain this block
+            serialize_node(s, node->payload.basic_block.fn);
+            found = find_value_dict(const Node*, uint32_t, s->nodes_map, node);
+            if (found)
+                return *found;
+            serialize_record_header(s, ShdbNodeRecord, node->tag);
+            serialize_string(s, node->payload.basic_block.name);
+            serialize_refs(s, node->payload.basic_block.params);
+            serialize_ref(s, node->payload.basic_block.fn);
+            index = register_serialized(s, node);
+            serialize_body(s, node, node->payload.basic_block.body);
+            return index;
+        }
+        case Function_TAG: {
+            Function payload = node->payload.fun;
+            serialize_nodes(s, payload.annotations);
+            serialize_nodes(s, payload.params);
+            serialize_nodes(s, payload.return_types);
+            serialize_record_header(s, ShdbNodeRecord, node->tag);
+            serialize_string(s, payload.name);
+            serialize_refs(s, payload.annotations);
+            serialize_refs(s, payload.params);
+            serialize_refs(s, payload.return_types);
+            index = register_serialized(s, node);
+            serialize_body(s, node, payload.body);
+            return index;
+        }
+        case Constant_TAG: {
+            Constant payload = node->payload.constant;
+            serialize_nodes(s, payload.annotations);
+            serialize_node(s, payload.type_hint);
+            serialize_record_header(s, ShdbNodeRecord, node->tag);
+            serialize_string(s, payload.name);
+            serialize_refs(s, payload.annotations);
+            serialize_ref(s, payload.type_hint);
+            index = register_serialized(s, node);
+            serialize_body(s, node, payload.instruction);
+            return index;
+        }
+        case GlobalVariable_TAG: {
+            GlobalVariable payload = node->payload.global_variable;
+            serialize_nodes(s, payload.annotations);
+            serialize_node(s, payload.type);
+            serialize_record_header(s, ShdbNodeRecord, node->tag);
+            serialize_string(s, payload.name);
+            serialize_refs(s, payload.annotations);
+            serialize_ref(s, payload.type);
+            serialize_pod(s, &payload.address_space, sizeof(payload.address_space));
+            index = register_serialized(s, node);
+            serialize_body(s, node, payload.init);
+            return index;
+        }
+        case NominalType_TAG: {
+            NominalType payload = node->payload.nom_type;
+            serialize_nodes(s, payload.annotations);
+            serialize_record_header(s, ShdbNodeRecord, node->tag);
+            serialize_string(s, payload.name);
+            serialize_refs(s, payload.annotations);
+            index = register_serialized(s, node);
+            serialize_body(s, node, payload.body);
+            return index;
+        }
+        default: error("unhandled node in serialize_node: %s", node_tags[node->tag]);
+    }
+}
+
+void serialize_module(Module* mod, size_t* size, char** output) {
+    IrArena* arena = get_module_arena(mod);
+    Serializer s = {
+        .visitor = {
+            .visit_op_fn = (VisitOpFn) serialize_op,
+        },
+        .records = new_growy(),
+        .strings = new_growy(),
+        .nodes_map = new_dict(const Node*, uint32_t, (HashFn) hash_node, (CmpFn) compare_node),
+        .strings_map = new_dict(String, uint32_t, (HashFn) hash_string, (CmpFn) compare_string),
+    };
+
+    Nodes decls = get_module_declarations(mod);
+    for (size_t i = 0; i < decls.count; i++)
+        serialize_node(&s, decls.nodes[i]);
+    serialize_refs(&s, decls);
+
+    ShdbHeader header = {
+        .magic = SHDB_MAGIC,
+        .version = SHDB_VERSION,
+        .flags = (arena->config.name_bound ? ShdbNameBound : 0) | (arena->config.check_types ? ShdbTyped : 0),
+        .strings_count = s.strings_count,
+        .strings_size = growy_size(s.strings),
+        .records_count = s.records_count,
+    };
+
+    *size = sizeof(header) + growy_size(s.strings) + growy_size(s.records);
+    *output = malloc(*size);
+    memcpy(*output, &header, sizeof(header));
+    memcpy(*output + sizeof(header), growy_data(s.strings), growy_size(s.strings));
+    memcpy(*output + sizeof(header) + growy_size(s.strings), growy_data(s.records), growy_size(s.records));
+
+    destroy_growy(s.records);
+    destroy_growy(s.strings);
+    destroy_dict(s.nodes_map);
+    destroy_dict(s.strings_map);
+}
+
+static bool are_unbound_params(Nodes params) {
+    for (size_t i = 0; i < params.count; i++) {
+        if (params.nodes[i]->tag != Variable_TAG || params.nodes[i]->payload.var.abs)
+            return false;
+    }
+    return true;
+}
+
+static const Node* deserialize_node_record(Deserializer* d, NodeTag tag) {
+    if (can_be_default_serialized(tag))
+        return deserialize_payload_generated(d, tag);
+
+    switch (tag) {
+        case Variable_TAG: {
+            const Type* type = deserialize_ref(d);
+            String name = deserialize_string(d);
+            return d->failed ? NULL : var(d->arena, type, name);
+        }
+        case Let_TAG:
+        case LetMut_TAG: {
+            const Node* instruction = deserialize_ref(d);
+            const Node* tail = deserialize_ref(d);
+            if (d->failed || !instruction || !tail || tail->tag != Case_TAG)
+                return NULL;
+            return tag == Let_TAG ? let(d->arena, instruction, tail) : let_mut(d->arena, instruction, tail);
+        }
+        case Case_TAG: {
+            Nodes params = deserialize_refs(d);
+            const Node* body = deserialize_ref(d);
+            if (d->failed || !are_unbound_params(params))
+                return NULL;
+            return case_(d->arena, params, body);
+        }
+        case BasicBlock_TAG: {
+            String name = deserialize_string(d);
+            Nodes params = deserialize_refs(d);
+            const Node* fn = deserialize_ref(d);
+            if (d->failed || !fn || fn->tag != Function_TAG || !are_unbound_params(params))
+                return NULL;
+            return basic_block(d->arena, (Node*) fn, params, name);
+        }
+        case Function_TAG: {
+            String name = deserialize_string(d);
+            Nodes annotations = deserialize_refs(d);
+            Nodes params = deserialize_refs(d);
+            Nodes return_types = deserialize_refs(d);
+            if (d->failed || !are_unbound_params(params))
+                return NULL;
+            return function(d->mod, params, name, annotations, return_types);
+        }
+        case Constant_TAG: {
+            String name = deserialize_string(d);
+            Nodes annotations = deserialize_refs(d);
+            const Type* type_hint = deserialize_ref(d);
+            return d->failed ? NULL : constant(d->mod, annotations, type_hint, name);
+        }
+        case GlobalVariable_TAG: {
+            String name = deserialize_string(d);
+            Nodes annotations = deserialize_refs(d);
+            const Type* type = deserialize_ref(d);
+            AddressSpace as;
+            deserialize_pod(d, &as, sizeof(as));
+            return d->failed ? NULL : global_var(d->mod, annotations, type, name, as);
+        }
+        case NominalType_TAG: {
+            String name = deserialize_string(d);
+            Nodes annotations = deserialize_refs(d);
+            return d->failed ? NULL : nominal_type(d->mod, annotations, name);
+        }
+        default: return NULL;
+    }
+}
+
+static bool deserialize_body_record(Deserializer* d, NodeTag tag) {
+    Node* node = (Node*) deserialize_ref(d);
+    const Node* body = deserialize_ref(d);
+    if (d->failed || !node || node->tag != tag)
+        return false;
+    switch (tag) {
+        case BasicBlock_TAG: node->payload.basic_block.body = body; return true;
+        case Function_TAG: node->payload.fun.body = body; return true;
+        case Constant_TAG: node->payload.constant.instruction = body; return true;
+        case GlobalVariable_TAG: node->payload.global_variable.init = body; return true;
+        case NominalType_TAG: node->payload.nom_type.body = body; return true;
+        default: return false;
+    }
+}
+
+bool deserialize_module(Module* mod, size_t size, const char* data) {
+    IrArena* arena = get_module_arena(mod);
+    ShdbHeader header;
+    if (size < sizeof(header) || ((size_t) data) % 4 != 0) {
+        error_print("Not a .shdb module: too short or misaligned\n");
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != SHDB_MAGIC || header.version != SHDB_VERSION) {
+        error_print("Not a .shdb module, or one with an unsupported version\n");
+        return false;
+    }
+    ShdbFlags flags = (arena->config.name_bound ? ShdbNameBound : 0) | (arena->config.check_types ? ShdbTyped : 0);
+    if (header.flags != flags) {
+        error_print("This .shdb module was written from an arena with different name_bound/check_types settings\n");
+        return false;
+    }
+    if (header.strings_size % 4 != 0 || header.strings_size > size - sizeof(header)) {
+        error_print("Corrupt .shdb module: bad string table\n");
+        return false;
+    }
+
+    Deserializer d = {
+        .arena = arena,
+        .mod = mod,
+        .words = (const uint32_t*) (data + sizeof(header)),
+        .words_count = header.strings_size / 4,
+    };
+
+    // every string and every record takes at least one word, larger counts can only come from a corrupt header
+    size_t records_words = (size - sizeof(header) - header.strings_size) / 4;
+    if (header.strings_count > d.words_count || header.records_count > records_words) {
+        error_print("Corrupt .shdb module: more strings or records than there are words\n");
+        return false;
+    }
+
+    // the string table is only indexed here, strings get interned when something refers to them
+    d.strings = calloc((size_t) header.strings_count + 1, sizeof(const char*));
+    d.strings_lengths = calloc((size_t) header.strings_count + 1, sizeof(uint32_t));
+    d.strings_interned = calloc((size_t) header.strings_count + 1, sizeof(bool));
+    for (; d.strings_count < header.strings_count; d.strings_count++) {
+        uint32_t len = deserialize_word(&d);
+        size_t words = ((size_t) len + 1 + 3) / 4;
+        if (d.failed || words > d.words_count - d.cursor || ((const char*) &d.words[d.cursor])[len] != '\0') {
+            d.failed = true;
+            break;
+        }
+        d.strings[d.strings_count] = (const char*) &d.words[d.cursor];
+        d.strings_lengths[d.strings_count] = len;
+        d.cursor += words;
+    }
+
+    size_t first_decl = entries_count_list(mod->decls);
+    d.words_count = (size - sizeof(header)) / 4;
+    d.nodes = calloc((size_t) header.records_count + 1, sizeof(const Node*));
+    for (size_t i = 0; i < header.records_count && !d.failed; i++) {
+        uint32_t record = deserialize_word(&d);
+        NodeTag tag = record & 0xFFFF;
+        switch ((ShdbRecordKind) (record >> 16)) {
+            case ShdbNodeRecord: {
+                const Node* node = deserialize_node_record(&d, tag);
+                if (!node)
+                    d.failed = true;
+                d.nodes[d.nodes_count++] = node;
+                break;
+            }
+            case ShdbBodyRecord: {
+                if (!deserialize_body_record(&d, tag))
+                    d.failed = true;
+                break;
+            }
+            default: d.failed = true;
+        }
+    }
+
+    // the declarations got added to the module in the order they were read, put them back in the original one.
+    // Global variables that were already in the module were merged with those instead, and stay where they are.
+    Nodes decls = deserialize_refs(&d);
+    const Node** module_decls = read_list(const Node*, mod->decls);
+    size_t module_decls_count = entries_count_list(mod->decls);
+    size_t next = first_decl;
+    for (size_t i = 0; i < decls.count && !d.failed; i++) {
+        size_t j = next;
+        while (j < module_decls_count && module_decls[j] != decls.nodes[i])
+            j++;
+        if (j == module_decls_count)
+            continue;
+        module_decls[j] = module_decls[next];
+        module_decls[next++] = decls.nodes[i];
+    }
+    if (next != module_decls_count)
+        d.failed = true;
+
+    if (d.failed)
+        error_print("Corrupt .shdb module: bad record after %zu words\n", d.cursor);
+
+    free(d.strings);
+    free(d.strings_lengths);
+    free(d.strings_interned);
+    free(d.nodes);
+    return !d.failed;
+}
@@ -128,6 +128,29 @@ uint64_t bytes_to_words_static(const IrArena* a, uint64_t bytes) {
     return bytes / word_width;
 }
 
+const Node* gen_align_up(BodyBuilder* bb, const Node* bytes, size_t alignment) {
+    IrArena* a = bytes->arena;
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    if (alignment == 1)
+        return bytes;
+    const Type* t = get_unqualified_type(bytes->type);
+    assert(t->tag == Int_TAG);
+    Int int_t = t->payload.int_type;
+    uint64_t width_mask = int_t.width == IntTy64 ? UINT64_MAX : (UINT64_C(1) << (int_size_in_bytes(int_t.width) * 8)) - 1;
+    const Node* bump = int_literal(a, (IntLiteral) { .width = int_t.width, .is_signed = int_t.is_signed, .value = alignment - 1 });
+    const Node* mask = int_literal(a, (IntLiteral) { .width = int_t.width, .is_signed = int_t.is_signed, .value = ~(uint64_t) (alignment - 1) & width_mask });
+    const Node* bumped = gen_primop_e(bb, add_op, empty(a), mk_nodes(a, bytes, bump));
+    return gen_primop_e(bb, and_op, empty(a), mk_nodes(a, bumped, mask));
+}
+
+size_t get_private_memory_words_per_backing_word(const CompilerConfig* config, const IrArena* a) {
+    size_t word_size = int_size_in_bytes(a->config.memory.word_size);
+    size_t backing_word_size = int_size_in_bytes(config->lower.emulated_private_memory_word_size);
+    if (backing_word_size <= word_size)
+        return 1;
+    return backing_word_size / word_size;
+}
+
 IntSizes float_to_int_width(FloatSizes width) {
     switch (width) {
         case FloatTy16: return IntTy16;
@@ -22,6 +22,10 @@ size_t get_record_field_offset_in_bytes(IrArena*, const Type*, size_t);
 const Node* size_t_literal(IrArena* a, uint64_t value);
 const Node* bytes_to_words(BodyBuilder* bb, const Node* bytes);
 uint64_t bytes_to_words_static(const IrArena*, uint64_t bytes);
+/// Rounds an amount of bytes up to a multiple of (power-of-two) alignment
+const Node* gen_align_up(BodyBuilder* bb, const Node* bytes, size_t alignment);
+/// How many addressable words fit in one of the words backing emulated private memory (see CompilerConfig.lower)
+size_t get_private_memory_words_per_backing_word(const CompilerConfig*, const IrArena*);
 IntSizes float_to_int_width(FloatSizes width);
 
 #endif
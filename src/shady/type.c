@@ -975,6 +975,30 @@ const Type* check_type_prim_op(IrArena* arena, PrimOp prim_op) {
                 .type = get_actual_mask_type(arena)
             });
         }
+        case subgroup_partition_op: {
+            assert(prim_op.type_arguments.count == 0);
+            assert(prim_op.operands.count == 1);
+            return qualified_type(arena, (QualifiedType) {
+                .is_uniform = false,
+                .type = get_actual_mask_type(arena)
+            });
+        }
+        case subgroup_shuffle_op: {
+            assert(prim_op.type_arguments.count == 0);
+            assert(prim_op.operands.count == 2);
+            const Type* lane_type = prim_op.operands.nodes[1]->type;
+            deconstruct_qualified_type(&lane_type);
+            assert(lane_type == uint32_type(arena));
+            return qualified_type(arena, (QualifiedType) {
+                .is_uniform = false,
+                .type = get_unqualified_type(prim_op.operands.nodes[0]->type)
+            });
+        }
+        case subgroup_barrier_op: {
+            assert(prim_op.type_arguments.count == 0);
+            assert(prim_op.operands.count == 0);
+            return empty_multiple_return_type(arena);
+        }
         case subgroup_elect_first_op: {
             assert(prim_op.type_arguments.count == 0);
             assert(prim_op.operands.count == 0);
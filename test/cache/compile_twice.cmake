@@ -0,0 +1,9 @@
+file(REMOVE_RECURSE ${DST}/cache)
+execute_process(COMMAND ${COMPILER} ${SRC} -o ${DST}/uncached.spv COMMAND_ERROR_IS_FATAL ANY COMMAND_ECHO STDOUT)
+execute_process(COMMAND ${COMPILER} ${SRC} --cache-dir ${DST}/cache -o ${DST}/cold.spv COMMAND_ERROR_IS_FATAL ANY COMMAND_ECHO STDOUT)
+execute_process(COMMAND ${COMPILER} ${SRC} --cache-dir ${DST}/cache -o ${DST}/warm.spv --log-level debug ERROR_VARIABLE LOG COMMAND_ERROR_IS_FATAL ANY COMMAND_ECHO STDOUT)
+if (NOT LOG MATCHES "Compilation cache hit")
+    message(FATAL_ERROR "the second compilation did not come from the cache")
+endif()
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${DST}/uncached.spv ${DST}/cold.spv COMMAND_ERROR_IS_FATAL ANY)
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${DST}/uncached.spv ${DST}/warm.spv COMMAND_ERROR_IS_FATAL ANY)
@@ -0,0 +1,30 @@
+# Dumps the occupancy report of SRC, and checks that it parses as JSON and agrees with itself
+execute_process(COMMAND ${COMPILER} ${SRC} --dump-occupancy ${DST}/occupancy.json -o ${DST}/occupancy.spv COMMAND_ERROR_IS_FATAL ANY)
+file(READ ${DST}/occupancy.json REPORT)
+
+# string(JSON) stops the script on anything that doesn't parse, or on a missing member
+string(JSON MODULE GET "${REPORT}" module)
+string(JSON FUNCTIONS_COUNT LENGTH "${REPORT}" functions)
+string(JSON DISPATCHERS_COUNT LENGTH "${REPORT}" dispatchers)
+string(JSON MAX_LIVE GET "${REPORT}" max_live_registers)
+if (NOT MODULE STREQUAL "my_module" OR FUNCTIONS_COUNT EQUAL 0 OR DISPATCHERS_COUNT EQUAL 0)
+    message(FATAL_ERROR "unexpected report:\n${REPORT}")
+endif ()
+
+set(ENTRY_POINTS "")
+set(HIGHEST_LIVE 0)
+math(EXPR LAST "${FUNCTIONS_COUNT} - 1")
+foreach(I RANGE ${LAST})
+    string(JSON NAME GET "${REPORT}" functions ${I} name)
+    string(JSON IS_ENTRY_POINT GET "${REPORT}" functions ${I} entry_point)
+    string(JSON LIVE GET "${REPORT}" functions ${I} max_live_registers)
+    if (IS_ENTRY_POINT)
+        list(APPEND ENTRY_POINTS ${NAME})
+    endif ()
+    if (LIVE GREATER HIGHEST_LIVE)
+        set(HIGHEST_LIVE ${LIVE})
+    endif ()
+endforeach()
+if (NOT ENTRY_POINTS STREQUAL "main" OR NOT MAX_LIVE EQUAL HIGHEST_LIVE)
+    message(FATAL_ERROR "expected main as the only entry point and ${HIGHEST_LIVE} live registers at most, got ${ENTRY_POINTS} and ${MAX_LIVE}")
+endif ()
@@ -0,0 +1,37 @@
+# Runs the main kernel of SRC on the CPU backend, once as scalar code and once with TARGS, and checks that both leave
+# the same values in the buffer. The exceptions are the subgroup reductions the kernel stores from index REDUCTIONS
+# on: each one is checked against the sum of the scalar results its subgroup had stored from index INPUTS on.
+function(run_kernel OUT)
+    execute_process(COMMAND ${RUNTIME_TEST} --device CPU --print-buffer ${SRC} ${ARGN} OUTPUT_VARIABLE OUTPUT RESULT_VARIABLE RESULT)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "runtime_test ${ARGN} failed:\n${OUTPUT}")
+    endif ()
+    string(REGEX MATCH "buffer:[-0-9 ]*" BUFFER "${OUTPUT}")
+    string(REPLACE "buffer: " "" BUFFER "${BUFFER}")
+    string(REPLACE " " ";" BUFFER "${BUFFER}")
+    set(${OUT} ${BUFFER} PARENT_SCOPE)
+endfunction()
+
+run_kernel(REFERENCE)
+run_kernel(RESULTS ${TARGS})
+
+list(LENGTH REFERENCE COUNT)
+math(EXPR LAST "${COUNT} - 1")
+math(EXPR REDUCTIONS_END "${REDUCTIONS} + ${REDUCTIONS_COUNT}")
+foreach (I RANGE ${LAST})
+    list(GET RESULTS ${I} GOT)
+    if (I GREATER_EQUAL REDUCTIONS AND I LESS REDUCTIONS_END)
+        math(EXPR FIRST "${INPUTS} + ${I} - ${REDUCTIONS} - (${I} - ${REDUCTIONS}) % ${SUBGROUP_SIZE}")
+        math(EXPR END "${FIRST} + ${SUBGROUP_SIZE} - 1")
+        set(WANTED 0)
+        foreach (J RANGE ${FIRST} ${END})
+            list(GET REFERENCE ${J} INPUT)
+            math(EXPR WANTED "${WANTED} + ${INPUT}")
+        endforeach ()
+    else ()
+        list(GET REFERENCE ${I} WANTED)
+    endif ()
+    if (NOT GOT EQUAL WANTED)
+        message(FATAL_ERROR "entry ${I}: expected ${WANTED}, got ${GOT}\nscalar: ${REFERENCE}\nresults: ${RESULTS}")
+    endif ()
+endforeach ()
@@ -0,0 +1,14 @@
+# Runs the main kernel of SRC on the CPU backend with runtime_test, and checks that the buffer starts with EXPECTED
+execute_process(COMMAND ${RUNTIME_TEST} --device CPU --print-buffer ${SRC} ${TARGS} OUTPUT_VARIABLE OUTPUT RESULT_VARIABLE RESULT)
+if (NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "runtime_test failed:\n${OUTPUT}")
+endif ()
+string(REGEX MATCH "buffer:[-0-9 ]*" BUFFER "${OUTPUT}")
+string(REPLACE "buffer: " "" BUFFER "${BUFFER}")
+string(REPLACE " " ";" BUFFER "${BUFFER}")
+string(REPLACE " " ";" EXPECTED "${EXPECTED}")
+list(LENGTH EXPECTED COUNT)
+list(SUBLIST BUFFER 0 ${COUNT} BUFFER)
+if (NOT BUFFER STREQUAL EXPECTED)
+    message(FATAL_ERROR "expected ${EXPECTED}\ngot ${BUFFER}")
+endif ()
@@ -0,0 +1,3 @@
+execute_process(COMMAND ${COMPILER} ${SRC} --dump-shdb ${DST}/module.shdb -o ${DST}/from_source.spv COMMAND_ERROR_IS_FATAL ANY COMMAND_ECHO STDOUT)
+execute_process(COMMAND ${COMPILER} ${DST}/module.shdb -o ${DST}/from_shdb.spv COMMAND_ERROR_IS_FATAL ANY COMMAND_ECHO STDOUT)
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${DST}/from_source.spv ${DST}/from_shdb.spv COMMAND_ERROR_IS_FATAL ANY)
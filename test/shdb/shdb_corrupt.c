@@ -0,0 +1,71 @@
+#include "shady/ir.h"
+#include "shady/driver.h"
+
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Reads back damaged copies of a module: every one of them has to be rejected, without reading or writing out of bounds
+
+// word offsets in the .shdb header, and of the length of the first string that follows it
+#define STRINGS_COUNT_WORD 3
+#define RECORDS_COUNT_WORD 5
+#define FIRST_STRING_WORD 6
+
+static IrArena* arena;
+static int failures;
+
+static void expect_rejected(const char* what, size_t size, const uint32_t* words) {
+    IrArena* copy_arena = new_ir_arena(get_arena_config(arena));
+    Module* copy = new_module(copy_arena, "copy");
+    if (deserialize_module(copy, size, (const char*) words)) {
+        error_print("A module with %s was accepted\n", what);
+        failures++;
+    }
+    destroy_ir_arena(copy_arena);
+}
+
+static void expect_rejected_with(const char* what, size_t size, const uint32_t* words, size_t word, uint32_t value) {
+    uint32_t* damaged = malloc(size);
+    memcpy(damaged, words, size);
+    damaged[word] = value;
+    expect_rejected(what, size, damaged);
+    free(damaged);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        error_print("usage: shdb_corrupt file.slim\n");
+        return -1;
+    }
+
+    arena = new_ir_arena(default_arena_config());
+    Module* mod = new_module(arena, "module");
+    if (driver_load_source_file_from_filename(argv[1], mod) != NoError)
+        return -1;
+    size_t size;
+    char* data;
+    serialize_module(mod, &size, &data);
+    const uint32_t* words = (const uint32_t*) data;
+
+    for (size_t truncated = 0; truncated < size; truncated += 4) {
+        // a fresh allocation of the exact size, so that reading past the end of it gets noticed by sanitizers
+        uint32_t* prefix = malloc(truncated + 4);
+        memcpy(prefix, words, truncated);
+        expect_rejected("a truncated file", truncated, prefix);
+        free(prefix);
+    }
+
+    expect_rejected_with("too many strings", size, words, STRINGS_COUNT_WORD, UINT32_MAX);
+    expect_rejected_with("too many records", size, words, RECORDS_COUNT_WORD, UINT32_MAX);
+    if (words[STRINGS_COUNT_WORD] > 0) {
+        expect_rejected_with("a string that overflows its length", size, words, FIRST_STRING_WORD, UINT32_MAX);
+        expect_rejected_with("a string that overflows its size in words", size, words, FIRST_STRING_WORD, UINT32_MAX - 3);
+    }
+
+    free(data);
+    destroy_ir_arena(arena);
+    return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,43 @@
+#include "shady/ir.h"
+#include "shady/driver.h"
+
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+// Writes the module out after every pass, reads it back into a fresh arena and writes it again: both must match
+static void after_pass(void* uptr, String pass_name, Module* mod) {
+    size_t size;
+    char* data;
+    serialize_module(mod, &size, &data);
+
+    IrArena* arena = new_ir_arena(get_arena_config(get_module_arena(mod)));
+    Module* copy = new_module(arena, get_module_name(mod));
+    if (!deserialize_module(copy, size, data)) {
+        error_print("Failed to read back the module written after %s\n", pass_name);
+        exit(-1);
+    }
+
+    size_t size2;
+    char* data2;
+    serialize_module(copy, &size2, &data2);
+    if (size != size2 || memcmp(data, data2, size) != 0) {
+        error_print("Reading back the module written after %s did not give the same module\n", pass_name);
+        dump_module(mod);
+        dump_module(copy);
+        exit(-1);
+    }
+
+    free(data);
+    free(data2);
+    destroy_ir_arena(arena);
+}
+
+static void hook(DriverConfig* args, int* pargc, char** argv) {
+    args->config.hooks.after_pass.fn = after_pass;
+}
+
+#define HOOK_STUFF hook(&args, &argc, argv);
+
+#include "../../src/driver/slim.c"
@@ -0,0 +1,7 @@
+file(MAKE_DIRECTORY ${DST})
+execute_process(COMMAND ${COMPILER} ${SRC} ${TARGS} -o ${DST}/serial.spv COMMAND_ERROR_IS_FATAL ANY COMMAND_ECHO STDOUT)
+execute_process(COMMAND ${COMPILER} ${SRC} ${TARGS} --spirv-emission-threads 4 -o ${DST}/parallel.spv --log-level debug ERROR_VARIABLE LOG COMMAND_ERROR_IS_FATAL ANY COMMAND_ECHO STDOUT)
+if (LOG MATCHES "emitting it again in place")
+    message(FATAL_ERROR "some functions could not be emitted in parallel")
+endif()
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${DST}/serial.spv ${DST}/parallel.spv COMMAND_ERROR_IS_FATAL ANY)